@@ -0,0 +1,215 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// What the benchmarks share: a user interface to load commands and plugins with, a
+// timer of repeated runs, a way to run a measurement in a process of its own, and
+// the JSON report every benchmark writes its results to.
+
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+import pdCalc_userInterface;
+
+namespace pdCalc {
+
+// Messages are written to stderr, so that they do not mix with the report, unless
+// the interface is quiet.
+class BenchInterface : public UserInterface
+{
+public:
+    explicit BenchInterface(bool quiet = false) : quiet_{quiet} { }
+
+    void postMessage(std::string_view m) override
+    {
+        if(!quiet_) std::fprintf(stderr, "%.*s\n", static_cast<int>( m.size() ), m.data());
+    }
+
+    void stackChanged() override { }
+
+private:
+    bool quiet_;
+};
+
+struct Timing
+{
+    double best;
+    double median;
+};
+
+inline Timing summarize(std::vector<double> t)
+{
+    std::ranges::sort(t);
+
+    return Timing{t.front(), t[t.size() / 2]};
+}
+
+// the best and median time of runs runs of f, in nanoseconds per operation, where
+// one run of f performs ops operations
+template<typename F>
+Timing timeRuns(int runs, long ops, F f)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<double> t;
+    for(int run = 0; run < runs; ++run)
+    {
+        auto start = Clock::now();
+        f();
+        t.push_back( std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops );
+    }
+
+    return summarize( std::move(t) );
+}
+
+// Returns f(), computed in a child process on POSIX systems, so that a measurement
+// such as the peak memory use or the time to load a library is not affected by
+// what ran before it. Elsewhere, or if the child cannot be started, f runs here.
+template<typename F>
+auto inChildProcess(F f)
+{
+    using Result = decltype( f() );
+    static_assert( std::is_trivially_copyable_v<Result> );
+
+#ifdef POSIX
+    int result[2];
+    if(pipe(result) == 0)
+    {
+        std::fflush(stdout);
+
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            close(result[0]);
+            const Result r = f();
+            if( write( result[1], &r, sizeof(r) ) != sizeof(r) ) _exit(1);
+            _exit(0);
+        }
+
+        close(result[1]);
+        Result r{};
+        const bool received = pid > 0 && read( result[0], &r, sizeof(r) ) == sizeof(r);
+        close(result[0]);
+        if(pid > 0) waitpid(pid, nullptr, 0);
+
+        if(received) return r;
+    }
+#endif
+
+    return f();
+}
+
+// Writes a benchmark's report to stdout as JSON: an object naming the benchmark and
+// pdCalc's version, then the fields and arrays of results added, in order. A field's
+// value and a result's members are given as std::format arguments, e.g.,
+//
+//     JsonReport report{"journalBench"};
+//     report.field("records", "{}", n);
+//     report.array("results");
+//     report.result("\"case\": \"{}\", \"seconds\": {:.4g}", name, seconds);
+//
+// The report is closed when it is destroyed.
+class JsonReport
+{
+public:
+    explicit JsonReport(std::string_view benchmark)
+    : inArray_{false}
+    , firstResult_{false}
+    {
+        std::printf( "{\n  \"benchmark\": \"%.*s\",\n  \"version\": \"%s\"",
+            static_cast<int>( benchmark.size() ), benchmark.data(), PDCALC_VERSION );
+    }
+
+    ~JsonReport()
+    {
+        closeArray();
+        std::printf("\n}\n");
+    }
+
+    template<typename... Args>
+    void field(std::string_view name, std::format_string<Args...> value, Args&&... args)
+    {
+        closeArray();
+        write( std::format( ",\n  \"{}\": {}", name, std::format( value, std::forward<Args>(args)... ) ) );
+
+        return;
+    }
+
+    // starts an array of results, ending the one before
+    void array(std::string_view name)
+    {
+        closeArray();
+        write( std::format(",\n  \"{}\": [\n", name) );
+        inArray_ = true;
+        firstResult_ = true;
+
+        return;
+    }
+
+    // adds an object with the given members to the array
+    template<typename... Args>
+    void result(std::format_string<Args...> members, Args&&... args)
+    {
+        write( std::format( "{}    {{{}}}", firstResult_ ? "" : ",\n",
+            std::format( members, std::forward<Args>(args)... ) ) );
+        firstResult_ = false;
+
+        return;
+    }
+
+private:
+    JsonReport(const JsonReport&) = delete;
+    JsonReport(JsonReport&&) = delete;
+    JsonReport& operator=(const JsonReport&) = delete;
+    JsonReport& operator=(JsonReport&&) = delete;
+
+    void write(const std::string& s)
+    {
+        std::fwrite( s.data(), 1, s.size(), stdout );
+
+        return;
+    }
+
+    void closeArray()
+    {
+        if(inArray_) std::printf("\n  ]");
+        inArray_ = false;
+
+        return;
+    }
+
+    bool inArray_;
+    bool firstResult_;
+};
+
+}
+
+#endif
@@ -0,0 +1,352 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Drives every undo/redo strategy of the CommandManager through a set of workloads
+// and reports, for each, throughput, median and p99 latency per history operation,
+// heap allocations per operation, and peak resident set size. The execute workload
+// also reports live heap bytes per history entry; the allocator adds its own
+// overhead (commonly 16 bytes) to each allocation. Results are written to stdout
+// as JSON so that runs can be compared across releases.
+//
+// Workloads:
+//     execute   - a long run of executed commands
+//     oscillate - repeated deep undo followed by redo of the same commands
+//     truncate  - short undo runs, each followed by an execute that discards the
+//                 redo branch
+//     mixed     - core commands alternating with plugin commands, executed, then
+//                 all undone and redone
+//
+// On POSIX systems, each strategy and workload runs in its own process so that its
+// peak resident set size can be measured; elsewhere, it is reported as -1.
+//
+// usage: historyBench [number of commands]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+#include <utility>
+#ifdef POSIX
+#include <sys/resource.h>
+#endif
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_stackinterface;
+
+using namespace pdCalc;
+using std::vector;
+using std::string;
+using std::pair;
+
+namespace {
+
+// every allocation is prefixed by a header recording its size, so the number of
+// live bytes can be tracked
+constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+
+std::atomic<long long> liveBytes{0};
+std::atomic<long long> allocations{0};
+
+using Clock = std::chrono::steady_clock;
+
+// stands in for a plugin command: it works through the plugin stack interface and,
+// like a plugin that does not implement the serialization hook, cannot be flattened
+class BenchPluginCommand : public PluginCommand
+{
+public:
+    BenchPluginCommand() = default;
+    explicit BenchPluginCommand(const BenchPluginCommand& rhs) : PluginCommand{rhs}, top_{rhs.top_} { }
+
+private:
+    const char* checkPluginPreconditions() const noexcept override
+    {
+        return StackSize() < 1 ? "Stack must have one element" : nullptr;
+    }
+
+    BenchPluginCommand* clonePluginImpl() const noexcept override { return new BenchPluginCommand{*this}; }
+    const char* helpMessageImpl() const noexcept override { return "Benchmark plugin command"; }
+
+    void executeImpl() noexcept override
+    {
+        top_ = StackPop(true);
+        StackPush(0.5 * top_, false);
+    }
+
+    void undoImpl() noexcept override
+    {
+        StackPop(true);
+        StackPush(top_, false);
+    }
+
+    double top_ = 0.0;
+};
+
+// a mix of core commands that leaves the stack size unchanged, so the memory
+// measured is that of the history alone
+CommandPtr makeCommand(size_t i)
+{
+    switch(i % 5)
+    {
+    case 0: return MakeCommandPtr<EnterNumber>(0.5);
+    case 1: return MakeCommandPtr<Add>();
+    case 2: return MakeCommandPtr<Sine>();
+    case 3: return MakeCommandPtr<Duplicate>();
+    default: return MakeCommandPtr<Subtract>();
+    }
+}
+
+CommandPtr makeMixedCommand(size_t i)
+{
+    return i % 2 == 0 ? makeCommand(i / 2) : MakeCommandPtr<BenchPluginCommand>();
+}
+
+struct Result
+{
+    size_t ops = 0;
+    double seconds = 0.0;
+    double p50Ns = 0.0;
+    double p99Ns = 0.0;
+    double allocationsPerOp = 0.0;
+    double bytesPerEntry = -1.0;
+    long peakRssKb = -1;
+};
+
+// Times history operations one at a time. Latencies are stored in a buffer that is
+// reserved up front, so recording them neither allocates nor skews the counts.
+class Sampler
+{
+public:
+    explicit Sampler(size_t ops)
+    {
+        latencies_.reserve(ops);
+        allocations_ = allocations.load();
+    }
+
+    template<typename F>
+    void time(F op)
+    {
+        auto start = Clock::now();
+        op();
+        latencies_.push_back( std::chrono::duration<double, std::nano>(Clock::now() - start).count() );
+    }
+
+    Result result()
+    {
+        Result r;
+        r.ops = latencies_.size();
+        r.allocationsPerOp = static_cast<double>(allocations.load() - allocations_) / r.ops;
+        for(auto l : latencies_) r.seconds += l * 1e-9;
+
+        std::sort( latencies_.begin(), latencies_.end() );
+        r.p50Ns = latencies_[r.ops / 2];
+        r.p99Ns = latencies_[std::min(r.ops - 1, r.ops * 99 / 100)];
+
+        return r;
+    }
+
+private:
+    vector<double> latencies_;
+    long long allocations_;
+};
+
+void prefill(CommandManager& cm, size_t n)
+{
+    for(auto i = 0u; i < n; ++i)
+        cm.executeCommand( makeCommand(i) );
+
+    return;
+}
+
+Result executeWorkload(CommandManager::UndoRedoStrategy st, size_t n)
+{
+    Sampler s{n};
+    const auto bytes = liveBytes.load();
+
+    CommandManager cm{st};
+    for(auto i = 0u; i < n; ++i)
+        s.time([&]{ cm.executeCommand( makeCommand(i) ); });
+
+    const double bytesPerEntry = static_cast<double>(liveBytes.load() - bytes) / n;
+
+    Result r = s.result();
+    r.bytesPerEntry = bytesPerEntry;
+
+    return r;
+}
+
+Result oscillateWorkload(CommandManager::UndoRedoStrategy st, size_t n)
+{
+    constexpr size_t Rounds = 4;
+
+    CommandManager cm{st};
+    prefill(cm, n);
+
+    const size_t depth = n / 2;
+    Sampler s{2 * depth * Rounds};
+    for(auto round = 0u; round < Rounds; ++round)
+    {
+        for(auto i = 0u; i < depth; ++i) s.time([&]{ cm.undo(); });
+        for(auto i = 0u; i < depth; ++i) s.time([&]{ cm.redo(); });
+    }
+
+    return s.result();
+}
+
+Result truncateWorkload(CommandManager::UndoRedoStrategy st, size_t n)
+{
+    constexpr size_t Depth = 16;
+
+    CommandManager cm{st};
+    prefill(cm, n);
+
+    // each branch undoes Depth commands and replaces them with the first one undone,
+    // so the history remains a prefix of the sequence makeCommand generates
+    const size_t branches = n / (2 * Depth);
+    Sampler s{branches * (Depth + 1)};
+    for(auto b = 0u; b < branches; ++b)
+    {
+        const size_t top = cm.getUndoSize();
+        for(auto i = 0u; i < Depth; ++i) s.time([&]{ cm.undo(); });
+        s.time([&]{ cm.executeCommand( makeCommand(top - Depth) ); });
+    }
+
+    return s.result();
+}
+
+Result mixedWorkload(CommandManager::UndoRedoStrategy st, size_t n)
+{
+    CommandManager cm{st};
+
+    Sampler s{3 * n};
+    for(auto i = 0u; i < n; ++i) s.time([&]{ cm.executeCommand( makeMixedCommand(i) ); });
+    for(auto i = 0u; i < n; ++i) s.time([&]{ cm.undo(); });
+    for(auto i = 0u; i < n; ++i) s.time([&]{ cm.redo(); });
+
+    return s.result();
+}
+
+using Workload = Result (*)(CommandManager::UndoRedoStrategy, size_t);
+
+Result run(Workload w, CommandManager::UndoRedoStrategy st, size_t n)
+{
+    Stack::Instance().clear();
+    Stack::Instance().push(1.0, true);
+
+    Result r = w(st, n);
+
+    Stack::Instance().clear();
+
+    return r;
+}
+
+void print(JsonReport& report, const char* strategy, const char* workload, const Result& r)
+{
+    report.result("\"strategy\": \"{}\", \"workload\": \"{}\", \"ops\": {}, \"opsPerSec\": {:.4g}, "
+        "\"p50Ns\": {:.1f}, \"p99Ns\": {:.1f}, \"allocationsPerOp\": {:.4f}, \"bytesPerEntry\": {:.1f}, "
+        "\"peakRssKb\": {}",
+        strategy, workload, r.ops, r.ops / r.seconds, r.p50Ns, r.p99Ns, r.allocationsPerOp,
+        r.bytesPerEntry, r.peakRssKb);
+
+    return;
+}
+
+// runs the workload in a child process, where its peak resident set size is its own
+Result runIsolated(Workload w, CommandManager::UndoRedoStrategy st, size_t n)
+{
+    return inChildProcess([&]
+    {
+        Result r = run(w, st, n);
+
+#ifdef POSIX
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        r.peakRssKb = usage.ru_maxrss;
+#endif
+
+        return r;
+    });
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    void* p = std::malloc(size + HeaderSize);
+    if(!p) throw std::bad_alloc{};
+
+    *static_cast<std::size_t*>(p) = size;
+    liveBytes += static_cast<long long>(size);
+    ++allocations;
+
+    return static_cast<std::byte*>(p) + HeaderSize;
+}
+
+void operator delete(void* p) noexcept
+{
+    if(!p) return;
+
+    void* base = static_cast<std::byte*>(p) - HeaderSize;
+    liveBytes -= static_cast<long long>( *static_cast<std::size_t*>(base) );
+    std::free(base);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t n = argc > 1 ? std::stoul(argv[1]) : 200000;
+
+    // new strategies only need to be added here to be benchmarked
+    const vector<pair<const char*, CommandManager::UndoRedoStrategy>> strategies{
+        {"StackStrategy", CommandManager::UndoRedoStrategy::StackStrategy},
+        {"ListStrategy", CommandManager::UndoRedoStrategy::ListStrategy},
+        {"ListStrategyVector", CommandManager::UndoRedoStrategy::ListStrategyVector},
+        {"SpillStrategy", CommandManager::UndoRedoStrategy::SpillStrategy},
+        {"FlatStrategy", CommandManager::UndoRedoStrategy::FlatStrategy}
+    };
+
+    const vector<pair<const char*, Workload>> workloads{
+        {"execute", executeWorkload},
+        {"oscillate", oscillateWorkload},
+        {"truncate", truncateWorkload},
+        {"mixed", mixedWorkload}
+    };
+
+    JsonReport report{"historyBench"};
+    report.field("commands", "{}", n);
+    report.array("results");
+
+    for(const auto& [workload, w] : workloads)
+    {
+        for(const auto& [strategy, st] : strategies)
+            print( report, strategy, workload, runIsolated(w, st, n) );
+    }
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures the cost of journaling a session and of recovering one. For each sync
+// policy, it reports the median and p99 latency of appending a record to the
+// journal. It then writes a large journal of a typical session and reports the
+// time to read it back alone and to replay it through a CommandInterpreter, which
+// is the time a --recover startup takes. Results are written to stdout as JSON.
+//
+// usage: journalBench [number of records]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <filesystem>
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_stack;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::vector;
+using std::string;
+using std::string_view;
+using std::pair;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// a session that enters numbers, applies operations to them, and occasionally undoes
+// and redoes them, leaving the stack size bounded
+void record(Journal& journal, size_t i)
+{
+    switch(i % 8)
+    {
+    case 0: journal.number(0.5 + static_cast<double>(i)); break;
+    case 1: journal.number(1.0 / static_cast<double>(i)); break;
+    case 2: journal.command("+"); break;
+    case 3: journal.command("sin"); break;
+    case 4: journal.undo(1); break;
+    case 5: journal.redo(1); break;
+    case 6: journal.command("dup"); break;
+    default: journal.command("*"); break;
+    }
+
+    return;
+}
+
+void appendLatency(JsonReport& report, const string& file, const char* name, Journal::SyncPolicy policy, size_t n)
+{
+    vector<double> latencies;
+    latencies.reserve(n);
+
+    auto start = Clock::now();
+    {
+        Journal journal{file, Journal::Mode::Create, policy};
+        for(auto i = 0u; i < n; ++i)
+        {
+            auto t = Clock::now();
+            record(journal, i);
+            latencies.push_back( std::chrono::duration<double, std::nano>(Clock::now() - t).count() );
+        }
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::sort( latencies.begin(), latencies.end() );
+    report.result("\"case\": \"append\", \"policy\": \"{}\", \"records\": {}, \"seconds\": {:.4g}, "
+        "\"p50Ns\": {:.1f}, \"p99Ns\": {:.1f}",
+        name, n, seconds, latencies[n / 2], latencies[std::min(n - 1, n * 99 / 100)]);
+
+    return;
+}
+
+void recovery(JsonReport& report, const string& file, size_t n)
+{
+    {
+        Journal journal{file, Journal::Mode::Create, Journal::SyncPolicy::None};
+        for(auto i = 0u; i < n; ++i)
+            record(journal, i);
+    }
+    const auto bytes = std::filesystem::file_size(file);
+
+    auto start = Clock::now();
+    Journal::Recover(file, [](const string&){ }, [](std::span<const std::byte>){ });
+    const double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    BenchInterface ui{true};
+    RegisterCoreCommands(ui);
+    Stack::Instance().clear();
+
+    start = Clock::now();
+    {
+        CommandInterpreter ci{ui};
+        StackChangeBatch batch;
+        Journal::Recover(file, [&ci](const string& c){ ci.commandEntered(c); },
+            [&ci](std::span<const std::byte> s){ ci.loadSession(s); });
+    }
+    const double replaySeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Stack::Instance().clear();
+
+    report.result("\"case\": \"recover\", \"records\": {}, \"bytes\": {}, \"readSeconds\": {:.4g}, "
+        "\"replaySeconds\": {:.4g}, \"recordsPerSec\": {:.4g}",
+        n, static_cast<uintmax_t>(bytes), readSeconds, replaySeconds, n / replaySeconds);
+
+    return;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t n = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    const string file = ( std::filesystem::temp_directory_path() / "pdCalcJournalBench.pdj" ).string();
+
+    const vector<pair<const char*, Journal::SyncPolicy>> policies{
+        {"None", Journal::SyncPolicy::None},
+        {"Periodic", Journal::SyncPolicy::Periodic},
+        {"Always", Journal::SyncPolicy::Always}
+    };
+
+    JsonReport report{"journalBench"};
+    report.field("records", "{}", n);
+    report.array("results");
+
+    // every append under Always waits for the disk, so it is measured on fewer records
+    for(const auto& [name, policy] : policies)
+        appendLatency( report, file, name, policy, policy == Journal::SyncPolicy::Always ? std::max<size_t>(n / 1000, 100) : n );
+
+    recovery(report, file, n);
+
+    std::filesystem::remove(file);
+
+    return 0;
+}
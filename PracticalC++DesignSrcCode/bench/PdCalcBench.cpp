@@ -0,0 +1,422 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmarks of the backend and utility modules. Each case is timed as the
+// best of several runs and reported in nanoseconds per operation, so that runs can
+// be compared across commits. The groups are:
+//
+//     tokenizer - GreedyTokenizer and LazyTokenizer, per token
+//     isNumber  - CommandInterpreter::IsNumber, for numbers and for command names
+//     stack     - Stack push and pop, with and without a change event, and
+//                 getElements
+//     publisher - Publisher::raise to 1 to 16 observers
+//     factory   - CommandFactory::allocateCommand of a core command, and of a name
+//                 that is not registered
+//     strategy  - each CommandManager strategy's execute, and undo followed by redo
+//     pluginAbi - the C interface plugins use to reach the stack, and a plugin's
+//                 function and kernel called through the pointers it exports
+//     numbers   - bulk work on a large stack, per element: adding it up, copying it
+//                 out and back, and applying a kernel to it
+//
+// The results name the build's number type (PDCALC_NUMBER), so that builds of each
+// type can be compared.
+//
+// Results are written to stdout as JSON; failures, such as a plugin that cannot be
+// loaded, are written to stderr, and the cases affected are left out.
+//
+// usage: pdCalcBench [group] [plugin library]
+
+#include <algorithm>
+#include <any>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "BenchSupport.h"
+
+import pdCalc_utilities;
+import pdCalc_commandDispatcher;
+import pdCalc_pluginManagement;
+import pdCalc_plugin;
+import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_stackinterface;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+using std::vector;
+using std::pair;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int Runs = 5;
+
+// results are added to sink so that the work producing them is not optimized away
+volatile double sink = 0;
+
+// set by main for the duration of the groups
+JsonReport* report = nullptr;
+
+// reports the best time per operation of the runs of f, which performs ops operations
+template<typename F>
+void bench(const char* group, const string& name, long ops, F f)
+{
+    report->result("\"group\": \"{}\", \"case\": \"{}\", \"ops\": {}, \"ns_per_op\": {:.2f}",
+        group, name, ops, timeRuns(Runs, ops, f).best);
+
+    return;
+}
+
+class BenchPublisher : public Publisher
+{
+public:
+    BenchPublisher() { registerEvent("event"); }
+    void fire() const { raise("event"); }
+};
+
+class BenchObserver : public Observer
+{
+public:
+    explicit BenchObserver(string_view name) : Observer{name} { }
+
+private:
+    void notifyImpl(const std::any&) override { sink = sink + 1; }
+};
+
+void benchTokenizer()
+{
+    constexpr long Tokens = 100'000;
+
+    string input;
+    for(long i = 0; i < Tokens / 10; ++i)
+        input += "1 2.5 + Sin dup * 3E2 swap - drop\n";
+
+    bench("tokenizer", "greedy", Tokens, [&]
+    {
+        std::istringstream is{input};
+        GreedyTokenizer t{is};
+        for(const auto& s : t) sink = sink + s.size();
+    });
+
+    bench("tokenizer", "lazy", Tokens, [&]
+    {
+        std::istringstream is{input};
+        LazyTokenizer t{is};
+        for(const auto& s : t) sink = sink + s.size();
+    });
+
+    return;
+}
+
+void benchIsNumber()
+{
+    constexpr long Calls = 100'000;
+
+    for(auto [name, tokens] : {pair{"numbers", vector<string>{"3.14159", "-2e10", "42", "0.5"}},
+        pair{"commands", vector<string>{"sin", "+", "dup", "arctan"}}})
+    {
+        bench("isNumber", name, Calls, [&]
+        {
+            Number d = 0;
+            for(long i = 0; i < Calls; ++i)
+                sink = sink + CommandInterpreter::IsNumber(tokens[i % tokens.size()], d);
+        });
+    }
+
+    return;
+}
+
+void benchStack()
+{
+    constexpr long Ops = 1'000'000;
+
+    auto& s = Stack::Instance();
+    s.clear();
+
+    bench("stack", "push+pop", Ops, [&]
+    {
+        for(long i = 0; i < Ops; ++i)
+        {
+            s.push(0.5, true);
+            sink = sink + s.pop(true);
+        }
+    });
+
+    // without observers, the events only cost raising them
+    bench("stack", "push+pop with events", Ops, [&]
+    {
+        for(long i = 0; i < Ops; ++i)
+        {
+            s.push(0.5);
+            sink = sink + s.pop();
+        }
+    });
+
+    for(int i = 0; i < 16; ++i) s.push(i, true);
+
+    bench("stack", "getElements(16)", Ops, [&]
+    {
+        for(long i = 0; i < Ops; ++i)
+            sink = sink + s.getElements(16).back();
+    });
+
+    bench("stack", "getElements(16) reusing a vector", Ops, [&]
+    {
+        vector<Number> v;
+        for(long i = 0; i < Ops; ++i)
+        {
+            // getElements appends
+            v.clear();
+            s.getElements(16, v);
+            sink = sink + v.back();
+        }
+    });
+
+    s.clear();
+
+    return;
+}
+
+void benchPublisher()
+{
+    constexpr long Raises = 1'000'000;
+
+    for(int n : {1, 2, 4, 8, 16})
+    {
+        BenchPublisher p;
+        for(int i = 0; i < n; ++i)
+            p.attach( "event", std::make_unique<BenchObserver>("observer" + std::to_string(i)) );
+
+        bench("publisher", "raise to " + std::to_string(n), Raises, [&]
+        {
+            for(long i = 0; i < Raises; ++i) p.fire();
+        });
+    }
+
+    return;
+}
+
+void benchFactory()
+{
+    constexpr long Allocations = 1'000'000;
+
+    auto& f = CommandFactory::Instance();
+    f.registerCoreCommands();
+
+    for(auto name : {"+", "unknown"})
+    {
+        bench("factory", name, Allocations, [&]
+        {
+            const string s{name};
+            for(long i = 0; i < Allocations; ++i)
+                sink = sink + static_cast<bool>( f.allocateCommand(s) );
+        });
+    }
+
+    f.clearAllCommands();
+
+    return;
+}
+
+void benchStrategy()
+{
+    constexpr long Commands = 100'000;
+
+    const vector<pair<const char*, CommandManager::UndoRedoStrategy>> strategies{
+        {"StackStrategy", CommandManager::UndoRedoStrategy::StackStrategy},
+        {"ListStrategy", CommandManager::UndoRedoStrategy::ListStrategy},
+        {"ListStrategyVector", CommandManager::UndoRedoStrategy::ListStrategyVector},
+        {"SpillStrategy", CommandManager::UndoRedoStrategy::SpillStrategy},
+        {"FlatStrategy", CommandManager::UndoRedoStrategy::FlatStrategy}
+    };
+
+    // sine leaves the size of the stack unchanged, so any number can be executed
+    Stack::Instance().clear();
+    Stack::Instance().push(0.5, true);
+
+    for(const auto& [name, st] : strategies)
+    {
+        // each run executes, then undoes, then redoes, its own history
+        std::unique_ptr<CommandManager> cm;
+        bench("strategy", string{name} + " execute", Commands, [&]
+        {
+            cm = std::make_unique<CommandManager>(st);
+            for(long i = 0; i < Commands; ++i) cm->executeCommand( MakeCommandPtr<Sine>() );
+        });
+
+        bench("strategy", string{name} + " undo+redo", Commands, [&]
+        {
+            for(long i = 0; i < Commands; ++i) cm->undo();
+            for(long i = 0; i < Commands; ++i) cm->redo();
+        });
+    }
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+void benchPluginAbi(const string& library)
+{
+    constexpr long Calls = 1'000'000;
+
+    bench("pluginAbi", "StackPush+StackPop", Calls, [&]
+    {
+        for(long i = 0; i < Calls; ++i)
+        {
+            StackPush(0.5, true);
+            sink = sink + StackPop(true);
+        }
+    });
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcBench.pdp" ).string();
+    std::ofstream{pluginFile} << fs::absolute(library).string() << '\n';
+
+    BenchInterface ui;
+    PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile);
+    fs::remove(pluginFile);
+
+    if( loader.getPlugins().size() != 1 )
+    {
+        std::fprintf(stderr, "Cannot load %s\n", library.c_str());
+        return;
+    }
+
+    const Plugin& p = *loader.getPlugins()[0];
+    if( auto f = p.getFunctions(); f && f->nUnary > 0 )
+    {
+        bench("pluginAbi", std::format("function {}", f->unaryNames[0]), Calls, [&]
+        {
+            for(long i = 0; i < Calls; ++i) sink = sink + f->unaryFunctions[0](0.5);
+        });
+    }
+
+    if( auto k = p.getKernels(); k && k->nKernels > 0 && k->arities[0] == 1 )
+    {
+        // per element, over the elements of a large stack
+        constexpr long Elements = 4096;
+        vector<double> in(Elements, 0.5);
+        vector<double> out(Elements);
+        const double* args[] = {in.data()};
+
+        bench("pluginAbi", std::format("kernel {} per element", k->kernelNames[0]), Calls, [&]
+        {
+            for(long i = 0; i < Calls / Elements; ++i) k->kernels[0](args, out.data(), Elements);
+            sink = sink + out[0];
+        });
+    }
+
+    return;
+}
+
+void squareKernel(const double* in[], double* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = in[0][i] * in[0][i];
+
+    return;
+}
+
+void benchNumbers()
+{
+    constexpr long Elements = 1'000'000;
+
+    // the history keeps every addend for undo, and checkpoints of the stack, so
+    // fewer are added up than the other cases use
+    constexpr long Addends = 100'000;
+
+    auto& s = Stack::Instance();
+    auto fill = [&](long n)
+    {
+        vector<Number> v(n);
+        for(long i = 0; i < n; ++i) v[i] = 1 + 1.0 / (i + 1);
+        s.restore(v, true);
+    };
+
+    bench("numbers", "add up through FlatStrategy", Addends - 1, [&]
+    {
+        fill(Addends);
+        CommandManager cm{CommandManager::UndoRedoStrategy::FlatStrategy};
+        for(long i = 1; i < Addends; ++i) cm.executeCommand( MakeCommandPtr<Add>() );
+        sink = sink + s.pop(true);
+    });
+
+    fill(Elements);
+    bench("numbers", "contents+restore", Elements, [&]
+    {
+        auto v = s.contents();
+        s.restore(v, true);
+        sink = sink + v.back();
+    });
+
+    // kernels compute in double, so other builds also convert the stack
+    KernelCommand square{"square", squareKernel, 1, nullptr};
+    bench("numbers", "kernel", Elements, [&]
+    {
+        square.execute();
+        sink = sink + s.size();
+    });
+
+    s.clear();
+
+    return;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string group = argc > 1 ? argv[1] : "";
+    const string library = argc > 2 ? argv[2] : PLUGIN_LIBRARY;
+
+    JsonReport json{"pdCalcBench"};
+    json.field("number", "\"{}\"", Numeric::Name);
+    json.array("results");
+    report = &json;
+
+    const vector<pair<const char*, std::function<void()>>> groups{
+        {"tokenizer", benchTokenizer},
+        {"isNumber", benchIsNumber},
+        {"stack", benchStack},
+        {"publisher", benchPublisher},
+        {"factory", benchFactory},
+        {"strategy", benchStrategy},
+        {"pluginAbi", [&]{ benchPluginAbi(library); }},
+        {"numbers", benchNumbers}
+    };
+
+    for(const auto& [name, g] : groups)
+    {
+        if( group.empty() || group == name ) g();
+    }
+
+    report = nullptr;
+
+    return 0;
+}
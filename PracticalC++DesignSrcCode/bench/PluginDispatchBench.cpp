@@ -0,0 +1,142 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures the per-call cost of a plugin operation by the two paths a plugin can
+// offer it: as a plugin command, which is cloned, checked, and deleted in the
+// plugin, or as a plain function, which pdCalc wraps in its own command. Each call
+// is what the interpreter does for a command entered: the command is cloned from
+// the factory and executed through the CommandManager. It is then undone, so that
+// the stack stays the same, and deleted when the next call truncates the redo
+// history. Both paths are timed for an operation without a precondition (sinh) and
+// one with (ln); the best of several runs is reported. Results are written to
+// stdout as JSON.
+//
+// usage: pluginDispatchBench [plugin library] [calls per run]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_pluginManagement;
+import pdCalc_plugin;
+import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int Runs = 5;
+
+// the plugin's command named name, as it would be registered without the fast path
+const Command* pluginCommand(const Plugin& p, const string& name)
+{
+    const auto& descriptor = p.getPluginDescriptor();
+    for(int i = 0; i < descriptor.nCommands; ++i)
+    {
+        if(name == descriptor.commandNames[i]) return descriptor.commands[i];
+    }
+
+    return nullptr;
+}
+
+// the best time per call, in nanoseconds, of the command registered as name
+double time(const string& name, double operand, long calls)
+{
+    const auto t = timeRuns(Runs, calls, [&]
+    {
+        CommandManager manager;
+        Stack::Instance().clear();
+        Stack::Instance().push(operand);
+
+        for(long i = 0; i < calls; ++i)
+        {
+            manager.executeCommand( CommandFactory::Instance().allocateCommand(name) );
+            manager.undo();
+        }
+    });
+
+    Stack::Instance().clear();
+
+    return t.best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string library = argc > 1 ? argv[1] : PLUGIN_LIBRARY;
+    const long calls = argc > 2 ? std::atol(argv[2]) : 1'000'000;
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginDispatchBench.pdp" ).string();
+    std::ofstream{pluginFile} << fs::absolute(library).string() << '\n';
+
+    BenchInterface ui;
+    PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile);
+    fs::remove(pluginFile);
+
+    if( loader.getPlugins().size() != 1 )
+    {
+        std::fprintf(stderr, "Cannot load %s\n", library.c_str());
+        return 1;
+    }
+
+    const Plugin& plugin = *loader.getPlugins()[0];
+    if( !plugin.getFunctions() )
+    {
+        std::fprintf(stderr, "%s exports no functions\n", library.c_str());
+        return 1;
+    }
+
+    JsonReport report{"pluginDispatchBench"};
+    report.field("calls", "{}", calls);
+    report.array("results");
+
+    for(auto [name, operand] : {std::pair{"sinh", 0.5}, std::pair{"ln", 2.0}})
+    {
+        auto command = pluginCommand(plugin, name);
+        auto function = loader.makeCommand(0, name);
+        if(!command || !function) continue;
+
+        auto& factory = CommandFactory::Instance();
+        factory.registerCommand( "command", MakeCommandPtr( command->clone() ) );
+        factory.registerCommand( "function", std::move(function) );
+
+        const double commandNs = time("command", operand, calls);
+        const double functionNs = time("function", operand, calls);
+
+        factory.clearAllCommands();
+
+        report.result("\"operation\": \"{}\", \"command_ns\": {:.1f}, \"function_ns\": {:.1f}, \"speedup\": {:.2f}",
+            name, commandNs, functionNs, commandNs / functionNs);
+    }
+
+    return 0;
+}
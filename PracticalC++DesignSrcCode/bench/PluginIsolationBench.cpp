@@ -0,0 +1,147 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures what running a plugin in a helper process costs. Per call, the plugin's
+// commands are timed as the interpreter runs them, cloned from the factory and
+// executed and undone through the CommandManager, once loaded into the benchmark and
+// once isolated in a helper. Throughput is then timed for runs of isolated commands
+// given to the helper in one request, for several run lengths, as calls per second.
+// The best of several runs is reported. Results are written to stdout as JSON.
+//
+// usage: pluginIsolationBench [plugin library] [calls per run]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_pluginManagement;
+import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int Runs = 5;
+
+// the best time per call of the command registered as name
+double time(const string& name, long calls)
+{
+    return timeRuns(Runs, calls, [&]
+    {
+        CommandManager manager;
+        Stack::Instance().clear();
+        Stack::Instance().push(0.5);
+
+        for(long i = 0; i < calls; ++i)
+        {
+            manager.executeCommand( CommandFactory::Instance().allocateCommand(name) );
+            manager.undo();
+        }
+    }).best;
+}
+
+// the best time per call of runs of length commands alternating sinh and arcsinh,
+// which leave the stack as it was, given to host in one request each
+double time(PluginHost& host, size_t length, long calls)
+{
+    vector<size_t> commands(length);
+    for(size_t i = 0; i < length; ++i)
+        commands[i] = host.index(i % 2 == 0 ? "sinh" : "arcsinh");
+
+    const long requests = std::max<long>(1, calls / static_cast<long>(length));
+
+    return timeRuns(Runs, requests * static_cast<long>(length), [&]
+    {
+        vector<Number> stack{0.5};
+        string error;
+        for(long i = 0; i < requests; ++i)
+        {
+            host.run(commands, stack, error);
+            stack.back() = 0.5;
+        }
+    }).best;
+}
+
+PluginLoader::Isolation isolations[] = { PluginLoader::Isolation::InProcess, PluginLoader::Isolation::Process };
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string library = argc > 1 ? argv[1] : PLUGIN_LIBRARY;
+    const long calls = argc > 2 ? std::atol(argv[2]) : 100'000;
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginIsolationBench.pdp" ).string();
+    std::ofstream{pluginFile} << fs::absolute(library).string() << '\n';
+
+    BenchInterface ui;
+    PluginLoader loaders[2];
+    for(int i = 0; i < 2; ++i)
+        loaders[i].loadPlugins(ui, pluginFile, PluginLoader::Activation::Eager, isolations[i]);
+    fs::remove(pluginFile);
+
+    if( loaders[0].getPluginManifest().size() != 1 || loaders[1].getPluginManifest().size() != 1 )
+    {
+        std::fprintf(stderr, "Cannot load %s\n", library.c_str());
+        return 1;
+    }
+
+    JsonReport report{"pluginIsolationBench"};
+    report.field("calls", "{}", calls);
+    report.array("latency");
+
+    for(const char* name : {"sinh", "ln"})
+    {
+        auto& factory = CommandFactory::Instance();
+        factory.registerCommand( "inProcess", loaders[0].makeCommand(0, name) );
+        factory.registerCommand( "isolated", loaders[1].makeCommand(0, name) );
+
+        const double inProcessNs = time("inProcess", calls);
+        const double isolatedNs = time("isolated", calls);
+
+        factory.clearAllCommands();
+
+        report.result("\"operation\": \"{}\", \"in_process_ns\": {:.1f}, \"isolated_ns\": {:.1f}, \"slowdown\": {:.1f}",
+            name, inProcessNs, isolatedNs, isolatedNs / inProcessNs);
+    }
+
+    report.array("throughput");
+    for(size_t length : {1, 8, 64, 512})
+    {
+        const double ns = time(*loaders[1].getHost(0), length, calls);
+
+        report.result("\"run_length\": {}, \"ns_per_call\": {:.1f}, \"calls_per_second\": {:.0f}",
+            length, ns, 1e9 / ns);
+    }
+
+    return 0;
+}
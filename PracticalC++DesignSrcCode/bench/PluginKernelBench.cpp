@@ -0,0 +1,141 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures the plugin's kernels, which evaluate a function over the whole stack,
+// for each instruction set it has vectorized kernels for, as far as the CPU supports
+// them, and for its scalar kernels. Each kernel is applied to a stack of elements
+// within its function's domain, small enough to stay in cache, and the best time
+// per element of several runs is reported with its speedup over the scalar kernel.
+// Results are written to stdout as JSON.
+//
+// usage: pluginKernelBench [plugin library] [elements] [repetitions]
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BenchSupport.h"
+
+import pdCalc_pluginManagement;
+import pdCalc_plugin;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int Runs = 5;
+
+void setSimd(const char* isa)
+{
+#ifdef _WIN32
+    _putenv_s("PDCALC_SIMD", isa);
+#else
+    setenv("PDCALC_SIMD", isa, 1);
+#endif
+
+    return;
+}
+
+// the best time per element, in nanoseconds, of kernel applied to x
+double time(Plugin::Kernel kernel, const vector<double>& x, long repetitions)
+{
+    vector<double> out( x.size() );
+    const double* in[] = {x.data()};
+
+    return timeRuns(Runs, repetitions * static_cast<long>( x.size() ), [&]
+    {
+        for(long i = 0; i < repetitions; ++i)
+            kernel(in, out.data(), x.size());
+    }).best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string library = argc > 1 ? argv[1] : PLUGIN_LIBRARY;
+    const size_t elements = argc > 2 ? std::atol(argv[2]) : 4096;
+    const long repetitions = argc > 3 ? std::atol(argv[3]) : 2000;
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginKernelBench.pdp" ).string();
+    std::ofstream{pluginFile} << fs::absolute(library).string() << '\n';
+
+    // arguments spread over (-2, 2), shifted into (1, 5) for arccosh and ln and
+    // shrunk into (-1, 1) for arctanh
+    vector<double> x(elements);
+    for(size_t i = 0; i < elements; ++i)
+        x[i] = -2.0 + 4.0 * (i + 0.5) / elements;
+
+    auto argumentsOf = [&](const string& kernel)
+    {
+        auto a = x;
+        for(auto& d : a)
+        {
+            if(kernel == "arccosh" || kernel == "ln") d += 3.0;
+            else if(kernel == "arctanh") d *= 0.49;
+        }
+
+        return a;
+    };
+
+    BenchInterface ui;
+    std::map<string, double> scalarNs;
+
+    JsonReport report{"pluginKernelBench"};
+    report.field("elements", "{}", elements);
+    report.array("results");
+
+    for(const char* isa : {"none", "baseline", "avx2", "avx512"})
+    {
+        setSimd(isa);
+
+        PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile);
+        if( loader.getPlugins().size() != 1 || !loader.getPlugins()[0]->getKernels() )
+        {
+            std::fprintf(stderr, "Cannot load kernels from %s\n", library.c_str());
+            return 1;
+        }
+
+        const auto& kernels = *loader.getPlugins()[0]->getKernels();
+        for(int i = 0; i < kernels.nKernels; ++i)
+        {
+            const string name{kernels.kernelNames[i]};
+            const double ns = time( kernels.kernels[i], argumentsOf(name), repetitions );
+            if( scalarNs.find(name) == scalarNs.end() ) scalarNs[name] = ns;
+
+            report.result("\"isa\": \"{}\", \"kernel\": \"{}\", \"ns_per_element\": {:.2f}, \"speedup\": {:.2f}",
+                isa, name, ns, scalarNs[name] / ns);
+        }
+    }
+
+    fs::remove(pluginFile);
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures the plugin share of pdCalc's startup: loading the plugins listed in a
+// plugin file and registering their commands, as setupPlugins does before the first
+// prompt. The plugin file lists 1, 10, and 50 copies of a plugin library, and each
+// count is timed three ways:
+//     eager - every library is loaded
+//     cold  - lazy activation without a manifest, which loads every library and
+//             writes the manifest
+//     warm  - lazy activation with a current manifest, which loads no library
+// Each case runs in its own process on POSIX systems, so no case finds libraries
+// already loaded by another. Results are written to stdout as JSON.
+//
+// usage: pluginStartupBench [plugin library]
+
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_pluginManagement;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+using std::vector;
+using std::pair;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// copies of one library are distinct files, so each is loaded separately
+string makePluginFile(const fs::path& dir, const string& library, int n)
+{
+    vector<string> names;
+    for(int i = 0; i < n; ++i)
+    {
+        auto copy = dir / std::format("plugin{}{}", i, fs::path{library}.extension().string());
+        if( !fs::exists(copy) ) fs::copy_file(library, copy);
+        names.push_back( copy.string() );
+    }
+
+    auto pluginFile = ( dir / std::format("plugins{}.pdp", n) ).string();
+    std::ofstream ofs{pluginFile};
+    for(const auto& name : names)
+        ofs << name << '\n';
+
+    return pluginFile;
+}
+
+double startup(const string& pluginFile, PluginLoader::Activation activation)
+{
+    BenchInterface ui;
+    auto start = Clock::now();
+
+    PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile, activation);
+
+    // every copy provides the same names, so each copy's commands are suffixed
+    const auto& plugins = loader.getPluginManifest();
+    for(size_t p = 0; p < plugins.size(); ++p)
+    {
+        for(const auto& c : plugins[p].commands)
+            CommandFactory::Instance().registerCommand( std::format("{}{}", c.name, p), loader.makeCommand(p, c.name) );
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    CommandFactory::Instance().clearAllCommands();
+
+    return seconds;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string library = argc > 1 ? argv[1] : PLUGIN_LIBRARY;
+
+    auto dir = fs::temp_directory_path() / "pdCalcPluginStartupBench";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    JsonReport report{"pluginStartupBench"};
+    report.array("results");
+
+    for(int n : {1, 10, 50})
+    {
+        auto pluginFile = makePluginFile(dir, library, n);
+        fs::remove( PluginLoader::ManifestName(pluginFile) );
+
+        const vector<pair<const char*, PluginLoader::Activation>> modes{
+            {"eager", PluginLoader::Activation::Eager},
+            {"cold", PluginLoader::Activation::Lazy},
+            {"warm", PluginLoader::Activation::Lazy}
+        };
+
+        for(const auto& [mode, activation] : modes)
+        {
+            const double seconds = inChildProcess([&]{ return startup(pluginFile, activation); });
+            report.result("\"plugins\": {}, \"mode\": \"{}\", \"ms\": {:.3f}", n, mode, seconds * 1e3);
+        }
+    }
+
+    fs::remove_all(dir);
+
+    return 0;
+}
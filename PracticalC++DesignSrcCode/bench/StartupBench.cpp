@@ -0,0 +1,198 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures pdCalc's time to first prompt. In process, registering the core commands
+// and listing every command's help, as the help command does, are timed per call.
+// On POSIX systems, pdCalc is then started in an empty directory, so that no plugins
+// are loaded, and timed until the command line interface prints its startup
+// message (--cli) and until a one line batch file has run and pdCalc has exited
+// (--batch). The best and median of the runs are reported. Results are written to
+// stdout as JSON.
+//
+// usage: startupBench [pdCalc executable] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifdef POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int Calls = 10000;
+
+void print(JsonReport& report, const char* name, const char* unit, Timing t)
+{
+    report.result("\"case\": \"{}\", \"best_{}\": {:.3f}, \"median_{}\": {:.3f}",
+        name, unit, t.best, unit, t.median);
+
+    return;
+}
+
+// nanoseconds per call of f, for each of runs runs of Calls calls
+template<typename F>
+Timing perCall(int runs, F f)
+{
+    return timeRuns(runs, Calls, [&]
+    {
+        for(int i = 0; i < Calls; ++i) f();
+    });
+}
+
+#ifdef POSIX
+
+// Starts pdCalc in dir with args, its input and output on pipes, and returns the
+// milliseconds until its output contains until (or it exits, if until is empty).
+// Then, input is written, and pdCalc is waited for.
+double timeProcess(const string& pdCalc, const fs::path& dir, vector<string> args, string_view until,
+    string_view input)
+{
+    int in[2];
+    int out[2];
+    if(pipe(in) != 0 || pipe(out) != 0) std::exit(1);
+
+    auto start = Clock::now();
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        if( chdir( dir.c_str() ) != 0 ) _exit(1);
+
+        vector<char*> argv{ const_cast<char*>( pdCalc.c_str() ) };
+        for(auto& a : args) argv.push_back( a.data() );
+        argv.push_back(nullptr);
+
+        execv( pdCalc.c_str(), argv.data() );
+        _exit(1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+
+    string output;
+    char buf[4096];
+    double ms = -1;
+    for(ssize_t n; ms < 0 && (n = read(out[0], buf, sizeof(buf))) > 0; )
+    {
+        output.append(buf, n);
+        if( !until.empty() && output.find(until) != string::npos )
+            ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    if( !input.empty() && write( in[1], input.data(), input.size() ) < 0 ) std::exit(1);
+    close(in[1]);
+
+    // drain the rest, so that pdCalc is not blocked writing
+    while(read(out[0], buf, sizeof(buf)) > 0) { }
+    close(out[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(ms < 0) ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    if( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+    {
+        std::fprintf(stderr, "%s did not run\n", pdCalc.c_str());
+        std::exit(1);
+    }
+
+    return ms;
+}
+
+template<typename F>
+Timing processRuns(int runs, F f)
+{
+    vector<double> t;
+    for(int run = 0; run < runs; ++run)
+        t.push_back( f() );
+
+    return summarize(t);
+}
+
+#endif
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string pdCalc = fs::absolute(argc > 1 ? argv[1] : PDCALC_EXECUTABLE).string();
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 20;
+
+    JsonReport report{"startupBench"};
+    report.array("results");
+
+    BenchInterface ui;
+    auto& cf = CommandFactory::Instance();
+
+    print(report, "register core commands", "ns", perCall(runs, [&]
+    {
+        cf.clearAllCommands();
+        RegisterCoreCommands(ui);
+    }));
+
+    size_t length = 0;
+    print(report, "help", "ns", perCall(runs, [&]
+    {
+        for(const auto& name : cf.getAllCommandNames())
+            length += cf.helpMessage(name).size();
+    }));
+
+    cf.clearAllCommands();
+
+#ifdef POSIX
+    auto dir = fs::temp_directory_path() / "pdCalcStartupBench";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    std::ofstream{dir / "batch.txt"} << "1 2 +\n";
+
+    print(report, "--cli", "ms", processRuns(runs, [&]
+        { return timeProcess(pdCalc, dir, {"--cli"}, "'exit' to end program", "exit\n"); }));
+
+    print(report, "--batch", "ms", processRuns(runs, [&]
+        { return timeProcess(pdCalc, dir, {"--batch", "batch.txt"}, {}, {}); }));
+
+    fs::remove_all(dir);
+#endif
+
+    return length > 0 ? 0 : 1;
+}
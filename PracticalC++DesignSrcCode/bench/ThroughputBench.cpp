@@ -0,0 +1,168 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures pdCalc's throughput on the workloads made by workloadGenerator. Each
+// workload is run by pdCalc --batch, in a directory holding the stored procedures the
+// workloads call and a plugin file listing the hyperbolicLn plugin, and the best and
+// median tokens per second of the runs, the peak resident set size, and the bytes of
+// output are reported. Without workloads given, those checked in next to the
+// hypotenuse procedure are run. Results are written to stdout as JSON, naming the
+// number type pdCalc was built with (PDCALC_NUMBER), so that the float, double, and
+// long double builds can be compared by running each build's benchmark. POSIX only.
+//
+// usage: throughputBench [pdCalc executable] [runs] [workload...]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifdef POSIX
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "BenchSupport.h"
+
+using std::string;
+using std::vector;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// the stored procedures the workloads call
+constexpr const char* Procedures[] = {"hypotenuse", "norm3"};
+
+long countTokens(const fs::path& workload)
+{
+    std::ifstream ifs{workload};
+    long n = 0;
+    for(string token; ifs >> token; ) ++n;
+
+    return n;
+}
+
+#ifdef POSIX
+
+struct Run
+{
+    double seconds;
+    long peakKb;
+};
+
+// runs pdCalc --batch on workload in dir, writing its output to out
+Run runBatch(const string& pdCalc, const fs::path& dir, const fs::path& workload, const fs::path& out)
+{
+    auto start = Clock::now();
+
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        if( chdir( dir.c_str() ) != 0 ) _exit(1);
+
+        execl( pdCalc.c_str(), pdCalc.c_str(), "--batch", workload.c_str(), out.c_str(), static_cast<char*>(nullptr) );
+        _exit(1);
+    }
+
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if( !WIFEXITED(status) || WEXITSTATUS(status) != 0 )
+    {
+        std::fprintf(stderr, "%s did not run %s\n", pdCalc.c_str(), workload.c_str());
+        std::exit(1);
+    }
+
+    // ru_maxrss is in kilobytes on Linux, and in bytes on macOS
+#ifdef __APPLE__
+    return Run{seconds, usage.ru_maxrss / 1024};
+#else
+    return Run{seconds, usage.ru_maxrss};
+#endif
+}
+
+#endif
+
+}
+
+int main(int argc, char* argv[])
+{
+    const string pdCalc = fs::absolute(argc > 1 ? argv[1] : PDCALC_EXECUTABLE).string();
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+    vector<fs::path> workloads;
+    for(int i = 3; i < argc; ++i)
+        workloads.push_back( fs::absolute(argv[i]) );
+
+    if( workloads.empty() )
+    {
+        for(const auto& entry : fs::directory_iterator{WORKLOAD_DIR})
+        {
+            if( entry.path().filename().string().starts_with("workload.") )
+                workloads.push_back( entry.path() );
+        }
+        std::ranges::sort(workloads);
+    }
+
+    pdCalc::JsonReport report{"throughputBench"};
+    report.field("number", "\"{}\"", NUMBER_TYPE);
+    report.array("results");
+
+#ifdef POSIX
+    auto dir = fs::temp_directory_path() / "pdCalcThroughputBench";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    std::ofstream{dir / "plugins.pdp"} << PLUGIN_LIBRARY << '\n';
+    for(auto procedure : Procedures)
+        fs::copy_file(fs::path{WORKLOAD_DIR} / procedure, dir / procedure);
+
+    for(const auto& workload : workloads)
+    {
+        const long tokens = countTokens(workload);
+        const auto out = dir / "output.txt";
+
+        vector<double> seconds;
+        long peakKb = 0;
+        for(int run = 0; run < runs; ++run)
+        {
+            auto r = runBatch(pdCalc, dir, workload, out);
+            seconds.push_back(r.seconds);
+            peakKb = std::max(peakKb, r.peakKb);
+        }
+        const auto t = pdCalc::summarize(seconds);
+
+        report.result("\"workload\": \"{}\", \"tokens\": {}, \"best_tokens_per_s\": {:.0f}, "
+            "\"median_tokens_per_s\": {:.0f}, \"peak_rss_kb\": {}, \"output_bytes\": {}",
+            workload.filename().string(), tokens, tokens / t.best, tokens / t.median, peakKb,
+            static_cast<uintmax_t>( fs::file_size(out) ));
+    }
+
+    fs::remove_all(dir);
+#endif
+
+    return 0;
+}
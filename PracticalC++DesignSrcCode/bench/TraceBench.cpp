@@ -0,0 +1,112 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Measures what tracing costs. Lines of core commands, which leave the stack as
+// they found it, are fed through the command line interface, whose output is
+// discarded, so that every token passes through the whole pipeline: tokenizing,
+// raising CommandEntered, interpreting, executing, and rendering the stack. The
+// time per token is the best of several runs, alternately untraced and traced.
+// Results are written to stdout as JSON.
+//
+// usage: traceBench [lines per run]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include "BenchSupport.h"
+
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+import pdCalc_utilities;
+import pdCalc_stack;
+
+using namespace pdCalc;
+using std::string;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int Runs = 15;
+
+const char* Line = "1 2 + 3 * dup drop 4 swap - sin cos neg drop\n";
+constexpr int TokensPerLine = 14;
+
+}
+
+int main(int argc, char* argv[])
+{
+    const int lines = argc > 1 ? std::max(1, std::atoi(argv[1])) : 5000;
+
+    string input;
+    for(int i = 0; i < lines; ++i)
+        input += Line;
+
+    // output to a stream without a buffer is discarded, after the stack is rendered
+    std::istringstream in;
+    std::ostream out{nullptr};
+    Cli cli{in, out};
+    CommandInterpreter ci{cli};
+
+    RegisterCoreCommands(cli);
+    cli.attach( UserInterface::CommandEntered(), std::make_unique<CommandIssuedObserver>(ci) );
+    Stack::Instance().attach( Stack::StackChanged(), std::make_unique<StackUpdatedObserver>(cli) );
+
+    auto run = [&]
+    {
+        in.clear();
+        in.str(input);
+
+        auto start = Clock::now();
+        cli.execute(true);
+
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (lines * TokensPerLine);
+    };
+
+    double untraced = 0;
+    double traced = 0;
+    for(int r = 0; r < Runs; ++r)
+    {
+        const double u = run();
+
+        // the rings are the default size, as with --trace, so long runs overwrite events
+        Trace::Start();
+        const double t = run();
+        Trace::Stop();
+
+        untraced = r == 0 ? u : std::min(untraced, u);
+        traced = r == 0 ? t : std::min(traced, t);
+    }
+
+    const auto events = Trace::Events().size() + Trace::Dropped();
+
+    JsonReport report{"traceBench"};
+    report.field("tokens", "{}", lines * TokensPerLine);
+    report.field("events_per_token", "{:.1f}", static_cast<double>(events) / (lines * TokensPerLine));
+    report.array("results");
+    report.result("\"case\": \"untraced\", \"ns_per_token\": {:.1f}", untraced);
+    report.result("\"case\": \"traced\", \"ns_per_token\": {:.1f}", traced);
+    report.field("overhead_percent", "{:.1f}", 100.0 * (traced - untraced) / untraced);
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Generates RPN scripts for pdCalc's batch interface with a controlled mix of
+// tokens, for throughputBench. Scripts are reproducible: the random numbers come
+// from a generator implemented here (SplitMix64) rather than from <random>, whose
+// distributions differ between standard libraries, so a seed gives the same
+// script on every platform and build.
+//
+// Each token is chosen in turn, while the depth of the stack the script leaves is
+// tracked: below the minimum depth, a number is entered; at the maximum, an
+// operation that shortens the stack is. Otherwise, with the given probabilities, the
+// token is an error (an unknown command), an undo or a redo, a stored procedure, a
+// plugin command, or a number, and failing those, an operation drawn from the
+// weighted mix (an operation the stack is too short for is replaced by a number).
+// The stored procedures are hypotenuse and norm3 (which calls hypotenuse twice), run
+// from the directory pdCalc is started in; the plugin commands are those of the
+// hyperbolicLn plugin.
+//
+// The presets are the workloads checked in next to the hypotenuse procedure
+// (test/backendTest/workload.<preset>); options given after a preset override it:
+//
+//     arith  - arithmetic on a shallow stack
+//     mixed  - every kind of token, as a session might have
+//     deep   - a deep stack
+//     errors - many errors, undos, and redos
+//
+// usage: workloadGenerator [--preset name] [--tokens n] [--seed s] [--literals p]
+//            [--ops name=weight,...] [--depth min:max] [--errors p] [--undo p]
+//            [--procs p] [--plugins p] [--line tokens]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace {
+
+struct Op
+{
+    string name;
+    double weight;
+};
+
+struct Options
+{
+    long tokens = 10000;
+    uint64_t seed = 1;
+    double literals = 0.45;
+    vector<Op> ops{ {"+", 4}, {"-", 3}, {"*", 3}, {"/", 1}, {"sin", 1}, {"cos", 1}, {"neg", 1},
+        {"dup", 1}, {"swap", 1}, {"drop", 1} };
+    long minDepth = 1;
+    long maxDepth = 8;
+    double errors = 0;
+    double undo = 0;
+    double procs = 0;
+    double plugins = 0;
+    int line = 16;
+};
+
+// the stack needed by a command, and the change it makes to the stack's depth
+struct Effect
+{
+    long needs;
+    long delta;
+};
+
+Effect effect(string_view name)
+{
+    for(auto binary : {"+", "-", "*", "/", "pow", "root"})
+        if(name == binary) return {2, -1};
+    if(name == "dup") return {1, 1};
+    if(name == "drop") return {1, -1};
+    if(name == "swap") return {2, 0};
+    if(name == "hypotenuse") return {2, -1};
+    if(name == "norm3") return {3, -2};
+
+    // the unary core and plugin commands
+    return {1, 0};
+}
+
+class SplitMix64
+{
+public:
+    explicit SplitMix64(uint64_t seed) : state_{seed} { }
+
+    uint64_t next()
+    {
+        uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    // uniform in [0, 1)
+    double uniform() { return static_cast<double>(next() >> 11) * 0x1p-53; }
+
+    // uniform in [0, n)
+    uint64_t below(uint64_t n) { return next() % n; }
+
+private:
+    uint64_t state_;
+};
+
+class Generator
+{
+public:
+    explicit Generator(const Options& o) : o_{o}, random_{o.seed}
+    {
+        for(const auto& op : o_.ops) totalWeight_ += op.weight;
+    }
+
+    string token()
+    {
+        if(depth_ < o_.minDepth) return number();
+        if(depth_ >= o_.maxDepth) return command( depth_ >= 2 ? "+" : "drop" );
+
+        if( random_.uniform() < o_.errors )
+        {
+            static constexpr const char* Errors[] = {"sinn", "swapp", "1.2.3", "nosuchcommand"};
+            return Errors[ random_.below(4) ];
+        }
+
+        if( random_.uniform() < o_.undo )
+        {
+            if( !redo_.empty() && random_.uniform() < 0.5 )
+            {
+                depth_ += redo_.back();
+                history_.push_back( redo_.back() );
+                redo_.pop_back();
+                return "redo";
+            }
+
+            if( !history_.empty() )
+            {
+                depth_ -= history_.back();
+                redo_.push_back( history_.back() );
+                history_.pop_back();
+                return "undo";
+            }
+        }
+
+        if( random_.uniform() < o_.procs )
+        {
+            const string_view proc = random_.below(2) == 0 ? "hypotenuse" : "norm3";
+            if( depth_ >= effect(proc).needs ) return command( std::format("proc:{}", proc), effect(proc) );
+        }
+
+        if( random_.uniform() < o_.plugins )
+        {
+            static constexpr const char* Plugin[] = {"sinh", "cosh", "tanh", "arcsinh"};
+            return command( Plugin[ random_.below(4) ] );
+        }
+
+        if( random_.uniform() < o_.literals || o_.ops.empty() ) return number();
+
+        double w = random_.uniform() * totalWeight_;
+        for(const auto& op : o_.ops)
+        {
+            if( (w -= op.weight) < 0 || &op == &o_.ops.back() )
+                return depth_ >= effect(op.name).needs ? command(op.name) : number();
+        }
+
+        return number();
+    }
+
+private:
+    // numbers of up to three decimal places in [0.001, 100)
+    string number()
+    {
+        record(1);
+        return std::format( "{}.{:03}", random_.below(100), 1 + random_.below(999) );
+    }
+
+    string command(const string& name, Effect e)
+    {
+        record(e.delta);
+        return name;
+    }
+
+    string command(const string& name)
+    {
+        return command( name, effect(name) );
+    }
+
+    // a new command discards the commands that could be redone
+    void record(long delta)
+    {
+        depth_ += delta;
+        history_.push_back(delta);
+        redo_.clear();
+
+        return;
+    }
+
+    const Options& o_;
+    SplitMix64 random_;
+    double totalWeight_ = 0;
+
+    long depth_ = 0;
+
+    // the changes in depth made by the commands that can be undone, and redone
+    vector<long> history_;
+    vector<long> redo_;
+};
+
+void usage()
+{
+    std::fprintf(stderr, "usage: workloadGenerator [--preset arith|mixed|deep|errors] [--tokens n] [--seed s]\n"
+        "           [--literals p] [--ops name=weight,...] [--depth min:max] [--errors p] [--undo p]\n"
+        "           [--procs p] [--plugins p] [--line tokens]\n");
+    std::exit(1);
+}
+
+bool preset(string_view name, Options& o)
+{
+    if(name == "arith")
+    {
+        o.seed = 1;
+    }
+    else if(name == "mixed")
+    {
+        o.seed = 2;
+        o.literals = 0.4;
+        o.minDepth = 2;
+        o.maxDepth = 16;
+        o.errors = 0.01;
+        o.undo = 0.05;
+        o.procs = 0.02;
+        o.plugins = 0.05;
+    }
+    else if(name == "deep")
+    {
+        o.seed = 3;
+        o.literals = 0.55;
+        o.minDepth = 32;
+        o.maxDepth = 256;
+    }
+    else if(name == "errors")
+    {
+        o.seed = 4;
+        o.errors = 0.2;
+        o.undo = 0.2;
+    }
+    else
+        return false;
+
+    return true;
+}
+
+vector<Op> parseOps(const string& s)
+{
+    vector<Op> ops;
+    for(size_t first = 0; first < s.size(); )
+    {
+        auto comma = s.find(',', first);
+        if(comma == string::npos) comma = s.size();
+
+        auto item = s.substr(first, comma - first);
+        auto equals = item.find('=');
+        ops.push_back( equals == string::npos ? Op{item, 1} : Op{item.substr(0, equals), std::atof( item.c_str() + equals + 1 )} );
+        first = comma + 1;
+    }
+
+    return ops;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    Options o;
+    for(int i = 1; i < argc; ++i)
+    {
+        const string_view arg{argv[i]};
+        if(i + 1 == argc) usage();
+        const string value{argv[++i]};
+
+        if(arg == "--preset") { if( !preset(value, o) ) usage(); }
+        else if(arg == "--tokens") o.tokens = std::atol( value.c_str() );
+        else if(arg == "--seed") o.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if(arg == "--literals") o.literals = std::atof( value.c_str() );
+        else if(arg == "--ops") o.ops = parseOps(value);
+        else if(arg == "--depth")
+        {
+            auto colon = value.find(':');
+            if(colon == string::npos) usage();
+            o.minDepth = std::atol( value.c_str() );
+            o.maxDepth = std::atol( value.c_str() + colon + 1 );
+        }
+        else if(arg == "--errors") o.errors = std::atof( value.c_str() );
+        else if(arg == "--undo") o.undo = std::atof( value.c_str() );
+        else if(arg == "--procs") o.procs = std::atof( value.c_str() );
+        else if(arg == "--plugins") o.plugins = std::atof( value.c_str() );
+        else if(arg == "--line") o.line = std::max( 1, std::atoi( value.c_str() ) );
+        else usage();
+    }
+
+    if(o.minDepth < 0 || o.maxDepth <= o.minDepth) usage();
+
+    Generator g{o};
+    string script;
+    for(long i = 0; i < o.tokens; ++i)
+    {
+        script += g.token();
+        script += (i + 1) % o.line == 0 || i + 1 == o.tokens ? '\n' : ' ';
+    }
+
+    std::fwrite(script.data(), 1, script.size(), stdout);
+
+    return 0;
+}
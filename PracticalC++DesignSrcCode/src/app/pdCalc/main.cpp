@@ -23,11 +23,16 @@
 #include <fstream>
 #include <memory>
 #include <vector>
-#include <set>
+#include <map>
+#include <chrono>
 #include <sstream>
 #include <algorithm>
 #include <ranges>
 #include <format>
+#include <filesystem>
+#include <charconv>
+#include <cstddef>
+#include <span>
 #include "src/ui/MainWindow.h"
 
 import pdCalc_utilities;
@@ -38,7 +43,7 @@ import pdCalc_plugin;
 import pdCalc_command;
 import pdCalc_userInterface;
 
-using std::set;
+using std::map;
 using std::vector;
 using std::cin;
 using std::cout;
@@ -110,6 +115,53 @@ BatchIo::~BatchIo()
     if(hasOutFile_) delete out_;
 }
 
+// A directory holding a capture's procedures, under the names they were run by, and
+// a plugin file listing its plugins, which is made the current directory while it
+// exists. Procedures run by absolute paths (or from outside their directory) are left
+// where they are.
+class ReplayDirectory
+{
+public:
+    explicit ReplayDirectory(const Capture::Recording& recording);
+    ~ReplayDirectory();
+
+    const std::filesystem::path& path() const { return path_; }
+
+private:
+    std::filesystem::path previous_;
+    std::filesystem::path path_;
+};
+
+ReplayDirectory::ReplayDirectory(const Capture::Recording& recording)
+: previous_{std::filesystem::current_path()}
+, path_{std::filesystem::temp_directory_path()
+    / std::format("pdCalcReplay{}", std::chrono::steady_clock::now().time_since_epoch().count())}
+{
+    std::filesystem::create_directories(path_);
+
+    std::ofstream pluginFile{path_ / "plugins.pdp"};
+    for(const auto& library : recording.plugins)
+        pluginFile << library << '\n';
+
+    for(const auto& p : recording.procedures)
+    {
+        std::filesystem::path name{p.name};
+        if( name.is_absolute() || ranges::find(name, "..") != name.end() ) continue;
+
+        std::filesystem::create_directories( (path_ / name).parent_path() );
+        std::ofstream{path_ / name, std::ios::binary} << p.contents;
+    }
+
+    std::filesystem::current_path(path_);
+}
+
+ReplayDirectory::~ReplayDirectory()
+{
+    std::error_code ec;
+    std::filesystem::current_path(previous_, ec);
+    std::filesystem::remove_all(path_, ec);
+}
+
 void usage()
 {
     cout << "\n"
@@ -120,11 +172,123 @@ void usage()
          << "\t--gui, -g: graphical user interface\n"
          << "\t--cli, -c: command line interface\n"
          << "\t--batch <in> [out], -b <in> [out]: batch interface (out optional)\n"
+         << "\t--journal <file>, -j <file>: journal the session to file for crash recovery\n"
+         << "\t--recover <file>, -r <file>: recover the session journaled to file and continue it\n"
+         << "\t--sync <none|periodic|always>: how often the journal is synced to disk (default periodic)\n"
+         << "\t--session <file>, -s <file>: load the session saved in file, snapshot it there periodically, and save it on exit\n"
+         << "\t--watch-plugins, -w: reload plugins whose libraries are replaced while running\n"
+         << "\t--isolate-plugins, -i: run each plugin in a helper process\n"
+         << "\t--trace <file>: write a Chrome trace of each command's stages to file on exit\n"
+         << "\t--capture <file>: capture the session's commands, plugins, and procedures to file\n"
+         << "\t--replay <capture> [out]: replay a capture and report each command's latency (out optional)\n"
+         << "\t--paced: replay at the pace of the capture instead of as fast as possible\n"
+         << "\t--replay-report <file>: also write the replay's latency report to file\n"
+         << "\t--replay-baseline <report>: compare the replay's latencies with a report from another build\n"
+         << "\t--memory-limit <bytes>: trim the oldest undo entries once the history holds more than bytes\n"
+#ifdef PDCALC_STATS
+         << "\t--stats-file <file>: write command latencies and counters to file as JSON on exit\n"
+#endif
          << endl;
        
     exit(0);
 }
 
+struct Options
+{
+    enum class Interface { Gui, Cli, Batch, Replay };
+
+    Interface ui = Interface::Gui;
+    string batchIn;
+    string batchOut;
+    string journal;
+    bool recover = false;
+    Journal::SyncPolicy sync = Journal::SyncPolicy::Periodic;
+    string session;
+    bool watchPlugins = false;
+    bool isolatePlugins = false;
+    string statsFile;
+    string trace;
+    string capture;
+    string replayIn;
+    string replayOut;
+    bool paced = false;
+    string replayReport;
+    string replayBaseline;
+    size_t memoryLimit = 0;
+};
+
+Options parseOptions(int argc, char* argv[])
+{
+    Options opts;
+    bool uiSet = false;
+
+    auto setUi = [&](Options::Interface ui)
+    {
+        if(uiSet) usage();
+        opts.ui = ui;
+        uiSet = true;
+    };
+
+    for(int i = 1; i < argc; ++i)
+    {
+        string arg{argv[i]};
+        bool hasValue = i + 1 < argc;
+
+        if(arg == "--gui" || arg == "-g") setUi(Options::Interface::Gui);
+        else if(arg == "--cli" || arg == "-c") setUi(Options::Interface::Cli);
+        else if( (arg == "--batch" || arg == "-b") && hasValue )
+        {
+            setUi(Options::Interface::Batch);
+            opts.batchIn = argv[++i];
+            if(i + 1 < argc && argv[i + 1][0] != '-') opts.batchOut = argv[++i];
+        }
+        else if(arg == "--replay" && hasValue)
+        {
+            setUi(Options::Interface::Replay);
+            opts.replayIn = argv[++i];
+            if(i + 1 < argc && argv[i + 1][0] != '-') opts.replayOut = argv[++i];
+        }
+        else if( (arg == "--journal" || arg == "-j" || arg == "--recover" || arg == "-r") && hasValue )
+        {
+            if( !opts.journal.empty() ) usage();
+            opts.journal = argv[++i];
+            opts.recover = arg == "--recover" || arg == "-r";
+        }
+        else if( (arg == "--session" || arg == "-s") && hasValue )
+        {
+            if( !opts.session.empty() ) usage();
+            opts.session = argv[++i];
+        }
+        else if(arg == "--watch-plugins" || arg == "-w") opts.watchPlugins = true;
+        else if(arg == "--isolate-plugins" || arg == "-i") opts.isolatePlugins = true;
+        else if(arg == "--trace" && hasValue) opts.trace = argv[++i];
+        else if(arg == "--capture" && hasValue) opts.capture = argv[++i];
+        else if(arg == "--paced") opts.paced = true;
+        else if(arg == "--replay-report" && hasValue) opts.replayReport = argv[++i];
+        else if(arg == "--replay-baseline" && hasValue) opts.replayBaseline = argv[++i];
+        else if(arg == "--memory-limit" && hasValue)
+        {
+            string bytes{argv[++i]};
+            auto [p, ec] = std::from_chars( bytes.data(), bytes.data() + bytes.size(), opts.memoryLimit );
+            if( bytes.empty() || ec != std::errc{} || p != bytes.data() + bytes.size() ) usage();
+        }
+#ifdef PDCALC_STATS
+        else if(arg == "--stats-file" && hasValue) opts.statsFile = argv[++i];
+#endif
+        else if(arg == "--sync" && hasValue)
+        {
+            string policy{argv[++i]};
+            if(policy == "none") opts.sync = Journal::SyncPolicy::None;
+            else if(policy == "periodic") opts.sync = Journal::SyncPolicy::Periodic;
+            else if(policy == "always") opts.sync = Journal::SyncPolicy::Always;
+            else usage();
+        }
+        else usage();
+    }
+
+    return opts;
+}
+
 void setupUi(UserInterface& ui, CommandInterpreter& ci)
 {
     RegisterCoreCommands(ui);
@@ -134,7 +298,7 @@ void setupUi(UserInterface& ui, CommandInterpreter& ci)
     Stack::Instance().attach(Stack::StackChanged(), make_unique<StackUpdatedObserver>( ui ) );
 }
 
-void registerCommand(UserInterface& ui, const string& label, CommandPtr c)
+bool registerCommand(UserInterface& ui, const string& label, CommandPtr c)
 {
     try
     {
@@ -143,57 +307,183 @@ void registerCommand(UserInterface& ui, const string& label, CommandPtr c)
     catch(Exception& e)
     {
         ui.postMessage( e.what() );
+        return false;
     }
 
-    return;
+    return true;
 }
 
-set<string> setupPlugins(UserInterface& ui, PluginLoader& loader)
+// Recovers the journaled session if asked to, and then journals the session. Without
+// a successful recovery, journaling is not started so that the journal is not lost.
+// A new journal starts from the session file loaded, if any, which it records so
+// that recovery does not start from a later snapshot of the file.
+unique_ptr<Journal> setupJournal(UserInterface& ui, CommandInterpreter& ci, const Options& opts, bool session)
 {
-    // for now, I don't want to allow the plugin file to be a command
-    // line option, so I simply code the name of the searched plugin file
-    auto pluginFile = "plugins.pdp";
-    loader.loadPlugins(ui, pluginFile);
-    auto plugins = loader.getPlugins();
+    if( opts.journal.empty() ) return nullptr;
 
-    set<string> injectedCommands;
-    for(auto p : plugins)
+    bool recovered = false;
+    try
     {
-        if(auto apiVersion = p->apiVersion(); apiVersion.major != 1 || apiVersion.minor != 0)
+        if(opts.recover)
         {
-            ui.postMessage("Plugin API version is incompatible. Need v. 1.0.");
-            continue;
+            // the ui only needs to see the recovered stack
+            StackChangeBatch batch;
+            Journal::Recover(opts.journal, [&ci](const string& c){ ci.commandEntered(c); },
+                [&ci](std::span<const std::byte> s){ ci.loadSession(s); });
+            recovered = true;
         }
 
-        auto descriptor = p->getPluginDescriptor();
-        for( auto i : views::iota(0, descriptor.nCommands) )
-        {
-            registerCommand(ui, descriptor.commandNames[i], MakeCommandPtr(descriptor.commands[i]->clone()) );
-            injectedCommands.insert(descriptor.commandNames[i]);
-        }
+        auto journal = make_unique<Journal>(opts.journal,
+            opts.recover ? Journal::Mode::Append : Journal::Mode::Create, opts.sync);
+        ci.setJournal( journal.get() );
+
+        if( !opts.recover && session && std::filesystem::exists(opts.session) )
+            ci.commandEntered("load-session");
+
+        return journal;
+    }
+    catch(Exception& e)
+    {
+        ui.postMessage( e.what() );
+    }
+
+    // without a recovery, the session starts from its file, which was not loaded
+    if( opts.recover && !recovered && session && std::filesystem::exists(opts.session) )
+        ci.commandEntered("load-session");
+
+    return nullptr;
+}
+
+// Captures the commands the user interface issues, with the plugins loaded, if asked to.
+unique_ptr<Capture> setupCapture(UserInterface& ui, const PluginLoader& loader, const Options& opts)
+{
+    if( opts.capture.empty() ) return nullptr;
+
+    try
+    {
+        vector<string> plugins;
+        for(const auto& e : loader.getPluginManifest())
+            plugins.push_back(e.library);
+
+        auto capture = make_unique<Capture>(opts.capture, plugins);
+        ui.attach( UserInterface::CommandEntered(), make_unique<CommandCapturedObserver>(*capture) );
+
+        return capture;
+    }
+    catch(Exception& e)
+    {
+        ui.postMessage( e.what() );
+    }
+
+    return nullptr;
+}
+
+// Adds the plugins to the mem command's breakdown and sets the soft limit on the
+// history's memory, if given.
+void setupMemory(CommandInterpreter& ci, const PluginLoader& loader, const Options& opts)
+{
+    ci.addFootprint("plugins", [&loader]{ return static_cast<size_t>( loader.footprint() ); });
+    ci.addFootprint("retired plugins", [&loader]{ return static_cast<size_t>( loader.retainedBytes() ); });
+
+    if(opts.memoryLimit > 0) ci.setMemoryLimit(opts.memoryLimit);
+
+    return;
+}
+
+// Loads the session file, if given, and keeps the session in it. If the session cannot
+// be loaded, it is not kept so that the file is not overwritten.
+bool setupSession(UserInterface& ui, CommandInterpreter& ci, const Options& opts)
+{
+    if( opts.session.empty() ) return false;
+
+    try
+    {
+        // a recovered journal starts from the session it recorded, not the file's
+        ci.setSession(opts.session, CommandInterpreter::DefaultSnapshotInterval, !opts.recover);
+        return true;
+    }
+    catch(Exception& e)
+    {
+        ui.postMessage( e.what() );
+    }
+
+    return false;
+}
+
+bool compatible(UserInterface& ui, const PluginManifest::Entry& plugin)
+{
+    if(auto apiVersion = plugin.apiVersion; apiVersion.major != 1 || apiVersion.minor < 0 || apiVersion.minor > 3)
+    {
+        ui.postMessage("Plugin API version is incompatible. Need v. 1.0 to 1.3.");
+        return false;
+    }
+
+    return true;
+}
+
+// registers the commands and functions of plugin p, and a map: command for each of
+// its kernels; a function and a command of the same name are registered once
+void registerPluginCommands(UserInterface& ui, PluginLoader& loader, size_t p, map<string, size_t>& injectedCommands)
+{
+    const auto& plugin = loader.getPluginManifest()[p];
+
+    vector<string> names;
+    for(const auto& f : plugin.functions) names.push_back(f.name);
+    for(const auto& c : plugin.commands)
+        if( ranges::find(names, c.name) == names.end() ) names.push_back(c.name);
+    for(const auto& k : plugin.kernels) names.push_back( PluginLoader::KernelCommandName(k.name) );
+
+    for(const auto& name : names)
+    {
+        if( registerCommand(ui, name, loader.makeCommand(p, name)) )
+            injectedCommands.emplace(name, p);
+    }
+
+    return;
+}
+
+// returns the plugin commands registered, each with the index of its plugin
+map<string, size_t> setupPlugins(UserInterface& ui, PluginLoader& loader, const Options& opts)
+{
+    // for now, I don't want to allow the plugin file to be a command
+    // line option, so I simply code the name of the searched plugin file;
+    // without one, every library in the plugin directory is loaded
+    string pluginFile = "plugins.pdp";
+    if( !std::filesystem::exists(pluginFile) && std::filesystem::is_directory("plugins") )
+        pluginFile = "plugins";
+
+    // plugins described by the cached manifest are only loaded once their commands
+    // are first used, unless each is isolated in a helper process
+    loader.loadPlugins(ui, pluginFile, PluginLoader::Activation::Lazy,
+        opts.isolatePlugins ? PluginLoader::Isolation::Process : PluginLoader::Isolation::InProcess);
+    const auto& plugins = loader.getPluginManifest();
+
+    map<string, size_t> injectedCommands;
+    for( auto p : views::iota(size_t{0}, plugins.size()) )
+    {
+        if( !compatible(ui, plugins[p]) ) continue;
+
+        registerPluginCommands(ui, loader, p, injectedCommands);
 
         // if gui, setup buttons
         if( auto gui = dynamic_cast<pdCalc::MainWindow*>(&ui) )
         {
-            auto allCommands = CommandFactory::Instance().getAllCommandNames();
-            if(auto buttonDescriptor = p->getPluginButtonDescriptor() )
+            const auto& allCommands = CommandFactory::Instance().getAllCommandNames();
+            for(const auto& b : plugins[p].buttons)
             {
-                for( auto i : views::iota(0, buttonDescriptor->nButtons) )
+                if( !allCommands.contains(b.primaryCmd) )
                 {
-                    if( auto b = *buttonDescriptor; !allCommands.contains(b.primaryCmd[i]) )
-                    {
-                        auto t = std::format("{} {}", "Error adding button", b.dispPrimaryCmd[i]);
-                        ui.postMessage(t);
-                    }
-                    else if( !allCommands.contains(b.shftCmd[i]) )
-                    {
-                        auto t = std::format("{} {}", "Error adding button ", b.dispShftCmd[i]);
-                        ui.postMessage(t);
-                    }
-                    else
-                    {
-                        gui->addCommandButton(b.dispPrimaryCmd[i], b.primaryCmd[i], b.dispShftCmd[i], b.shftCmd[i]);
-                    }
+                    auto t = std::format("{} {}", "Error adding button", b.dispPrimaryCmd);
+                    ui.postMessage(t);
+                }
+                else if( !allCommands.contains(b.shftCmd) )
+                {
+                    auto t = std::format("{} {}", "Error adding button ", b.dispShftCmd);
+                    ui.postMessage(t);
+                }
+                else
+                {
+                    gui->addCommandButton(b.dispPrimaryCmd, b.primaryCmd, b.dispShftCmd, b.shftCmd);
                 }
             }
         }
@@ -202,7 +492,70 @@ set<string> setupPlugins(UserInterface& ui, PluginLoader& loader)
     return injectedCommands;
 }
 
-void runGui(int argc, char* argv[])
+// Replaces the plugins whose libraries changed with their new versions. This runs
+// between commands, so no plugin command is executing. The old version's registered
+// commands are replaced, and its commands in the history are upgraded to the new
+// version where their state can be serialized; the old version stays loaded while
+// any history entry may still use it.
+void reloadPlugins(UserInterface& ui, PluginLoader& loader, CommandInterpreter& ci,
+    map<string, size_t>& injectedCommands, const vector<string>& libraries)
+{
+    const auto& plugins = loader.getPluginManifest();
+    for(const auto& library : libraries)
+    {
+        auto i = ranges::find_if(plugins, [&](const auto& e){ return e.library == library; });
+        if( i == plugins.end() ) continue;
+        const size_t p = i - plugins.begin();
+        if( !compatible(ui, *i) ) continue;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if( !loader.reload(p) ) continue;
+
+        std::erase_if(injectedCommands, [p](const auto& c)
+        {
+            if(c.second != p) return false;
+            CommandFactory::Instance().deregisterCommand(c.first);
+            return true;
+        });
+
+        registerPluginCommands(ui, loader, p, injectedCommands);
+
+        ci.rebindHistory([&](const Command& c){ return loader.upgrade(p, c); });
+        loader.releaseRetired([&](const auto& f){ ci.visitHistory(f); });
+
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+        ui.postMessage( std::format("Reloaded plugin {} in {:.2f} ms; retaining {} old version(s), {} bytes",
+            library, latency.count(), loader.retainedVersions(), loader.retainedBytes()) );
+    }
+
+    return;
+}
+
+// Watches the plugins' libraries and reloads those that change before the next
+// command. Old versions that were retained are released once the history no longer
+// uses them; this is checked at most once a second, since it visits the history.
+void watchPlugins(UserInterface& ui, PluginLoader& loader, CommandInterpreter& ci,
+    map<string, size_t>& injectedCommands, PluginWatcher& watcher)
+{
+    for(const auto& e : loader.getPluginManifest())
+        watcher.watch(e.library);
+
+    ci.setBeforeCommand([&, lastRelease = std::chrono::steady_clock::now()]() mutable
+    {
+        if( auto changed = watcher.changed(); !changed.empty() )
+            reloadPlugins(ui, loader, ci, injectedCommands, changed);
+        else if( loader.retainedVersions() > 0 && std::chrono::steady_clock::now() - lastRelease >= std::chrono::seconds{1} )
+        {
+            loader.releaseRetired([&](const auto& f){ ci.visitHistory(f); });
+            lastRelease = std::chrono::steady_clock::now();
+        }
+    });
+
+    return;
+}
+
+void runGui(int argc, char* argv[], const Options& opts)
 try
 {
     QApplication app{argc, argv};
@@ -215,13 +568,23 @@ try
     CommandInterpreter ci{gui};
 
     setupUi(gui, ci);
-    set<string> injectedCommands{setupPlugins(gui, loader)};
+    map<string, size_t> injectedCommands{setupPlugins(gui, loader, opts)};
+    setupMemory(ci, loader, opts);
+    bool session = setupSession(gui, ci, opts);
+    auto journal = setupJournal(gui, ci, opts, session);
+    auto capture = setupCapture(gui, loader, opts);
+
+    PluginWatcher watcher;
+    if(opts.watchPlugins) watchPlugins(gui, loader, ci, injectedCommands, watcher);
 
     gui.execute();
 
     app.exec();
 
-    ranges::for_each(injectedCommands, [](auto i){CommandFactory::Instance().deregisterCommand(i);});
+    // the session is saved while plugin commands are still registered
+    if(session) ci.commandEntered("save-session");
+
+    ranges::for_each(views::keys(injectedCommands), [](auto i){CommandFactory::Instance().deregisterCommand(i);});
 
     return;
 }
@@ -231,9 +594,9 @@ catch(Exception& e)
          << e.what() << endl;
 }
 
-void runBatch(const string& in, const string& out)
+void runBatch(const Options& opts)
 {
-    BatchIo io{in, out};
+    BatchIo io{opts.batchIn, opts.batchOut};
 
     pdCalc::Cli cli{io.in(), io.out()};
 
@@ -243,16 +606,26 @@ void runBatch(const string& in, const string& out)
     CommandInterpreter ci{cli};
 
     setupUi(cli, ci);
-    set<string> injectedCommands{setupPlugins(cli, loader)};
+    map<string, size_t> injectedCommands{setupPlugins(cli, loader, opts)};
+    setupMemory(ci, loader, opts);
+    bool session = setupSession(cli, ci, opts);
+    auto journal = setupJournal(cli, ci, opts, session);
+    auto capture = setupCapture(cli, loader, opts);
+
+    PluginWatcher watcher;
+    if(opts.watchPlugins) watchPlugins(cli, loader, ci, injectedCommands, watcher);
 
     cli.execute(true, true);
 
-    ranges::for_each(injectedCommands, [](auto i){CommandFactory::Instance().deregisterCommand(i);});
+    // the session is saved while plugin commands are still registered
+    if(session) ci.commandEntered("save-session");
+
+    ranges::for_each(views::keys(injectedCommands), [](auto i){CommandFactory::Instance().deregisterCommand(i);});
 
     return;
 }
 
-void runCli()
+void runCli(const Options& opts)
 try
 {
     pdCalc::Cli cli{cin, cout};
@@ -263,11 +636,21 @@ try
     CommandInterpreter ci{cli};
 
     setupUi(cli, ci);
-    set<string> injectedCommands{setupPlugins(cli, loader)};
+    map<string, size_t> injectedCommands{setupPlugins(cli, loader, opts)};
+    setupMemory(ci, loader, opts);
+    bool session = setupSession(cli, ci, opts);
+    auto journal = setupJournal(cli, ci, opts, session);
+    auto capture = setupCapture(cli, loader, opts);
+
+    PluginWatcher watcher;
+    if(opts.watchPlugins) watchPlugins(cli, loader, ci, injectedCommands, watcher);
 
     cli.execute();
 
-    ranges::for_each(injectedCommands, [](auto i){CommandFactory::Instance().deregisterCommand(i);});
+    // the session is saved while plugin commands are still registered
+    if(session) ci.commandEntered("save-session");
+
+    ranges::for_each(views::keys(injectedCommands), [](auto i){CommandFactory::Instance().deregisterCommand(i);});
 
     return;
 }  
@@ -280,27 +663,87 @@ catch(...)
 {
     cerr << "pdCalc terminated with an unknown error." << endl;
 }
+
+// Replays a capture, with its plugins and procedures, and reports each command's
+// latency. The replay's output goes to the out file, if given, or is discarded.
+void runReplay(const Options& opts)
+try
+{
+    const auto recording = Capture::Read(opts.replayIn);
+
+    // files named on the command line are relative to where pdCalc was started
+    const auto out = opts.replayOut.empty() ? string{} : std::filesystem::absolute(opts.replayOut).string();
+    const auto report = opts.replayReport.empty() ? string{} : std::filesystem::absolute(opts.replayReport).string();
+    const auto baseline = opts.replayBaseline.empty() ? Replay::Report{} : Replay::Read(opts.replayBaseline);
+
+    ReplayDirectory dir{recording};
+    std::ofstream ofs{ out.empty() ? dir.path() / "output.txt" : std::filesystem::path{out} };
+    std::istringstream none;
+    pdCalc::Cli cli{none, ofs};
+
+    // PluginLoader must be before CommandInterpreter so that memory on Command stack
+    // is released before plugins are freed
+    PluginLoader loader;
+    CommandInterpreter ci{cli};
+
+    setupUi(cli, ci);
+    map<string, size_t> injectedCommands{setupPlugins(cli, loader, opts)};
+    setupMemory(ci, loader, opts);
+
+    Replay replay{ci};
+    auto latencies = replay.run(recording, opts.paced ? Replay::Pacing::Original : Replay::Pacing::Fast);
+
+    Replay::Write(cout, latencies, opts.replayBaseline.empty() ? nullptr : &baseline);
+    if( !report.empty() )
+    {
+        std::ofstream reportFile{report};
+        Replay::Write(reportFile, latencies);
+        if(!reportFile)
+            cerr << "Unable to write the replay report to " << report << endl;
+    }
+
+    ranges::for_each(views::keys(injectedCommands), [](auto i){CommandFactory::Instance().deregisterCommand(i);});
+
+    return;
+}
+catch(Exception& e)
+{
+    cerr << "pdCalc terminated with the following message:\n"
+         << e.what() << endl;
+}
+catch(std::filesystem::filesystem_error& e)
+{
+    cerr << "Unable to replay the capture:\n"
+         << e.what() << endl;
+}
   
 }
 
 int main(int argc, char* argv[])
 {
-    if(argc == 1) runGui(argc, argv); // default
-    else if(argc == 2)
+    Options opts = parseOptions(argc, argv);
+
+    if( !opts.trace.empty() ) Trace::Start();
+
+    switch(opts.ui)
     {
-        string arg(argv[1]);
-        if(arg == "--gui" || arg == "-g") runGui(argc, argv);
-        else if(arg == "--cli" || arg == "-c") runCli();
-        else usage();
+    case Options::Interface::Gui: runGui(argc, argv, opts); break;
+    case Options::Interface::Cli: runCli(opts); break;
+    case Options::Interface::Batch: runBatch(opts); break;
+    case Options::Interface::Replay: runReplay(opts); break;
     }
-    else if(argc == 3 || argc == 4)
+
+    if( !opts.trace.empty() )
     {
-        string cmd(argv[1]);
-        string file(argv[2]);
-        if(cmd == "--batch" || cmd == "-b") runBatch(file, (argc == 4 ? argv[3] : "") );
-        else usage();
+        Trace::Stop();
+        if( !Trace::Write(opts.trace) )
+            cerr << "Unable to write trace to " << opts.trace << endl;
     }
-    else usage();
+
+#ifdef PDCALC_STATS
+    if( !opts.statsFile.empty() && !Stats::Instance().writeJson(opts.statsFile) )
+        cerr << "Unable to write statistics to " << opts.statsFile << endl;
+#endif
 
     return 0;
 }
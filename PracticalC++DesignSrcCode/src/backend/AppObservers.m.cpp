@@ -23,6 +23,7 @@ module;
 export module pdCalc_commandDispatcher:AppObservers;
 
 import :CommandInterpreter;
+import :Capture;
 import pdCalc_utilities;
 
 using std::string;
@@ -41,6 +42,18 @@ private:
     CommandInterpreter& ci_;
 };
 
+// records each command the user interface issues in a capture
+export class CommandCapturedObserver : public Observer
+{
+public:
+    explicit CommandCapturedObserver(Capture& capture);
+
+private:
+    void notifyImpl(const any&) override;
+
+    Capture& capture_;
+};
+
 export class StackUpdatedObserver : public Observer
 {
 public:
@@ -72,6 +85,25 @@ void CommandIssuedObserver::notifyImpl(const any& data)
     return;
 }
 
+CommandCapturedObserver::CommandCapturedObserver(Capture& capture)
+: Observer{"CommandCaptured"}
+, capture_{capture}
+{ }
+
+void CommandCapturedObserver::notifyImpl(const any& data)
+{
+    try
+    {
+        capture_.token( any_cast<string>(data) );
+    }
+    catch(const std::bad_any_cast&)
+    {
+        throw Exception("Could not convert CommandCaptured data to a string");
+    }
+
+    return;
+}
+
 StackUpdatedObserver::StackUpdatedObserver(UserInterface& ui)
 : Observer{"StackUpdated"}
 , ui_{ui}
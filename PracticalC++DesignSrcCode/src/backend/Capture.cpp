@@ -0,0 +1,334 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+#include <iterator>
+#include <filesystem>
+#include <format>
+#include <chrono>
+#include <thread>
+module pdCalc_commandDispatcher:Capture;
+
+import pdCalc_utilities;
+import :StoredProcedure;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace pdCalc {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr char CaptureMagic[4] = {'P', 'D', 'C', 'C'};
+constexpr uint32_t CaptureVersion = 1;
+
+// records are written once this many bytes are waiting, even within a flush interval
+constexpr size_t BufferSize = 1 << 16;
+
+// the name of the procedure a token runs, or an empty string
+string_view procedureName(string_view token)
+{
+    return token.starts_with("proc:") ? token.substr(5) : string_view{};
+}
+
+class Reader
+{
+public:
+    explicit Reader(const vector<char>& data) : data_{data}, pos_{0} { }
+
+    bool atEnd() const { return pos_ == data_.size(); }
+
+    bool byte(uint8_t& b)
+    {
+        if( atEnd() ) return false;
+        b = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+
+    bool varint(uint64_t& v)
+    {
+        v = 0;
+        for(int shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t b;
+            if( !byte(b) ) return false;
+            v |= static_cast<uint64_t>(b & 0x7f) << shift;
+            if( (b & 0x80) == 0 ) return true;
+        }
+
+        return false;
+    }
+
+    bool text(string& s)
+    {
+        uint64_t size;
+        if( !varint(size) || data_.size() - pos_ < size ) return false;
+        s.assign(data_.data() + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+private:
+    const vector<char>& data_;
+    size_t pos_;
+};
+
+}
+
+Capture::Capture(const string& filename, const vector<string>& plugins)
+: file_{nullptr}
+, last_{Clock::now()}
+, flushed_{last_}
+{
+    file_ = std::fopen(filename.c_str(), "wb");
+    if(!file_)
+        throw Exception{ std::format("Could not open capture {}", filename) };
+
+    std::fwrite(CaptureMagic, 1, sizeof(CaptureMagic), file_);
+    std::fwrite(&CaptureVersion, sizeof(CaptureVersion), 1, file_);
+
+    // libraries without a directory are found along the search path, as they were
+    for(const auto& library : plugins)
+    {
+        record(Kind::Plugin);
+        text( library.find_first_of("/\\") == string::npos ? library : std::filesystem::absolute(library).string() );
+    }
+
+    flush();
+}
+
+Capture::~Capture()
+{
+    flush();
+    std::fclose(file_);
+}
+
+void Capture::token(string_view t)
+{
+    if( auto name = procedureName(t); !name.empty() ) procedure( string{name} );
+
+    const auto now = Clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - last_).count();
+    last_ = now;
+
+    auto [i, inserted] = tokens_.try_emplace( string{t}, tokens_.size() );
+    record(inserted ? Kind::Token : Kind::Repeat, elapsed);
+    if(inserted) text(t);
+    else varint(i->second);
+
+    if(buffer_.size() >= BufferSize || now - flushed_ >= FlushInterval) flush();
+
+    return;
+}
+
+void Capture::procedure(const string& name)
+{
+    if( !procedures_.insert(name).second ) return;
+
+    // the procedures it runs, as its interpreter will read them, follow it
+    for(const auto& p : ProcedureSource::Read(name))
+    {
+        if( p.name != name && !procedures_.insert(p.name).second ) continue;
+
+        record(Kind::Procedure);
+        text(p.name);
+        text(p.contents);
+    }
+
+    return;
+}
+
+void Capture::record(Kind kind, uint64_t elapsed)
+{
+    varint( elapsed << 2 | static_cast<uint64_t>(kind) );
+    return;
+}
+
+void Capture::varint(uint64_t v)
+{
+    for(; v >= 0x80; v >>= 7)
+        buffer_.push_back( static_cast<std::byte>( (v & 0x7f) | 0x80 ) );
+    buffer_.push_back( static_cast<std::byte>(v) );
+
+    return;
+}
+
+void Capture::text(string_view s)
+{
+    varint( s.size() );
+    const auto* p = reinterpret_cast<const std::byte*>( s.data() );
+    buffer_.insert(buffer_.end(), p, p + s.size());
+
+    return;
+}
+
+void Capture::flush()
+{
+    if( !buffer_.empty() )
+    {
+        std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+        buffer_.clear();
+    }
+    std::fflush(file_);
+    flushed_ = Clock::now();
+
+    return;
+}
+
+Capture::Recording Capture::Read(const string& filename)
+{
+    std::ifstream ifs{filename, std::ios::binary};
+    if(!ifs)
+        throw Exception{ std::format("Could not open capture {}", filename) };
+
+    const vector<char> data{ std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{} };
+
+    uint32_t version = 0;
+    if(data.size() >= sizeof(CaptureMagic) + sizeof(version))
+        std::memcpy(&version, data.data() + sizeof(CaptureMagic), sizeof(version));
+    if( data.size() < sizeof(CaptureMagic) + sizeof(version) || std::memcmp(data.data(), CaptureMagic, sizeof(CaptureMagic)) != 0
+        || version != CaptureVersion )
+        throw Exception{ std::format("{} is not a capture", filename) };
+
+    const vector<char> records{ data.begin() + sizeof(CaptureMagic) + sizeof(version), data.end() };
+    Reader r{records};
+    Recording recording;
+
+    // the distinct tokens, by index, as indices into recording.tokens
+    vector<size_t> distinct;
+    std::chrono::microseconds time{0};
+
+    for(uint64_t header; r.varint(header); )
+    {
+        const auto kind = static_cast<Kind>(header & 3);
+        const std::chrono::microseconds elapsed( header >> 2 );
+        uint64_t index;
+        string s;
+        string contents;
+
+        if( kind == Kind::Plugin && r.text(s) )
+            recording.plugins.push_back( std::move(s) );
+        else if( kind == Kind::Procedure && r.text(s) && r.text(contents) )
+            recording.procedures.push_back( Procedure{std::move(s), std::move(contents)} );
+        else if( kind == Kind::Token && r.text(s) )
+        {
+            time += elapsed;
+            distinct.push_back( recording.tokens.size() );
+            recording.tokens.push_back( Token{time, std::move(s)} );
+        }
+        else if( kind == Kind::Repeat && r.varint(index) && index < distinct.size() )
+        {
+            time += elapsed;
+            recording.tokens.push_back( Token{time, recording.tokens[ distinct[index] ].text} );
+        }
+        else
+            break;
+    }
+
+    return recording;
+}
+
+Replay::Replay(CommandInterpreter& ci)
+: ci_{ci}
+{ }
+
+Replay::Report Replay::run(const Capture::Recording& recording, Pacing pacing)
+{
+    std::map<string, vector<double>> latencies;
+
+    const auto start = Clock::now();
+    for(const auto& token : recording.tokens)
+    {
+        if(pacing == Pacing::Original) std::this_thread::sleep_until(start + token.time);
+
+        const auto begin = Clock::now();
+        ci_.commandEntered(token.text);
+        const auto end = Clock::now();
+
+        Number d;
+        const string name = CommandInterpreter::IsNumber(token.text, d) ? "number" : token.text.substr( 0, token.text.find(':') );
+        latencies[name].push_back( std::chrono::duration<double, std::micro>(end - begin).count() );
+    }
+
+    Report report;
+    for(auto& [name, l] : latencies)
+    {
+        std::ranges::sort(l);
+        double total = 0;
+        for(auto t : l) total += t;
+
+        report[name] = Summary{l.size(), total / l.size(), l[l.size() / 2], l[ std::min(l.size() - 1, l.size() * 99 / 100) ]};
+    }
+
+    return report;
+}
+
+void Replay::Write(std::ostream& os, const Report& report, const Report* baseline)
+{
+    os << "# command\tcount\tmean_us\tp50_us\tp99_us" << (baseline ? "\tbaseline_p50_us\tchange" : "") << '\n';
+    for(const auto& [name, s] : report)
+    {
+        os << std::format("{}\t{}\t{:.3f}\t{:.3f}\t{:.3f}", name, s.count, s.meanUs, s.p50Us, s.p99Us);
+        if(baseline)
+        {
+            if( auto b = baseline->find(name); b != baseline->end() && b->second.p50Us > 0 )
+                os << std::format("\t{:.3f}\t{:+.1f}%", b->second.p50Us, (s.p50Us / b->second.p50Us - 1) * 100);
+            else
+                os << "\t-\t-";
+        }
+        os << '\n';
+    }
+
+    return;
+}
+
+Replay::Report Replay::Read(const string& filename)
+{
+    Report report;
+
+    std::ifstream ifs{filename};
+    for(string line; std::getline(ifs, line); )
+    {
+        if( line.empty() || line[0] == '#' ) continue;
+
+        std::istringstream iss{line};
+        string name;
+        Summary s;
+        if( !(iss >> name >> s.count >> s.meanUs >> s.p50Us >> s.p99Us) ) return Report{};
+        report[name] = s;
+    }
+
+    return report;
+}
+
+}
@@ -0,0 +1,155 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <chrono>
+#include <iosfwd>
+export module pdCalc_commandDispatcher:Capture;
+
+import :CommandInterpreter;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+export namespace pdCalc {
+
+// A capture of a session, for reproducing performance problems from the field: every
+// token the user interface delivers, with the time it arrived, together with the
+// plugin libraries loaded and the stored procedures the tokens run. A capture is a
+// binary file of records, each a varint holding its kind (in the low two bits) and,
+// for tokens, the microseconds since the last token, followed by its fields:
+//
+//     Plugin     library
+//     Procedure  name | contents
+//     Token      text
+//     Repeat     index of an earlier token
+//
+// Other numbers are varints too, and strings a varint length followed by their bytes.
+// Each distinct token's text is written once; its later occurrences repeat its index,
+// in the order the distinct tokens first appeared. Procedures are recorded the first
+// time a token (or a captured procedure) runs them. Records are buffered, and written
+// at least every flush interval, so a crash loses at most the last interval.
+class Capture
+{
+public:
+    struct Procedure
+    {
+        string name;
+        string contents;
+    };
+
+    struct Token
+    {
+        // since the capture started
+        std::chrono::microseconds time;
+        string text;
+    };
+
+    struct Recording
+    {
+        vector<string> plugins;
+        vector<Procedure> procedures;
+        vector<Token> tokens;
+    };
+
+    static constexpr std::chrono::milliseconds FlushInterval{100};
+
+    // Starts a capture in filename of a session with the given plugin libraries, which
+    // are recorded with absolute paths. Throws if the file cannot be opened.
+    Capture(const string& filename, const vector<string>& plugins);
+
+    // writes every buffered record
+    ~Capture();
+
+    // records a token delivered by the user interface, and the procedures it runs
+    void token(string_view text);
+
+    // Reads the capture in filename. A capture cut short by a crash ends at its last
+    // complete record. Throws if the file cannot be read or is not a capture.
+    static Recording Read(const string& filename);
+
+private:
+    enum class Kind : uint8_t { Plugin, Procedure, Token, Repeat };
+
+    Capture(const Capture&) = delete;
+    Capture(Capture&&) = delete;
+    Capture& operator=(const Capture&) = delete;
+    Capture& operator=(Capture&&) = delete;
+
+    // records the procedure in name, and those it runs, if not yet recorded
+    void procedure(const string& name);
+
+    void record(Kind kind, uint64_t elapsed = 0);
+    void varint(uint64_t v);
+    void text(string_view s);
+    void flush();
+
+    std::FILE* file_;
+    vector<std::byte> buffer_;
+    std::chrono::steady_clock::time_point last_;
+    std::chrono::steady_clock::time_point flushed_;
+    std::unordered_map<string, uint64_t> tokens_;
+    std::set<string> procedures_;
+};
+
+// Replays a capture through a command interpreter, as fast as possible or at the pace
+// it was captured, and measures each token's latency. Latencies are reported per
+// command: numbers as "number", and commands with an argument (e.g., proc:file or
+// undo:2) by the name before the colon.
+class Replay
+{
+public:
+    enum class Pacing { Fast, Original };
+
+    struct Summary
+    {
+        size_t count;
+        double meanUs;
+        double p50Us;
+        double p99Us;
+    };
+
+    using Report = std::map<string, Summary>;
+
+    explicit Replay(CommandInterpreter& ci);
+
+    // feeds the recording's tokens to the interpreter, and returns their latencies
+    Report run(const Capture::Recording& recording, Pacing pacing);
+
+    // Writes report as text, a line per command, with the change from each command's
+    // latencies in baseline, a report of another build, if given.
+    static void Write(std::ostream& os, const Report& report, const Report* baseline = nullptr);
+
+    // reads a report written by Write; a missing or malformed report is empty
+    static Report Read(const string& filename);
+
+private:
+    CommandInterpreter& ci_;
+};
+
+}
@@ -18,6 +18,12 @@
 module;
 
 #include <string_view>
+#include <vector>
+#include <span>
+#include <string>
+#include <format>
+#include <algorithm>
+#include <concepts>
 
 module pdCalc_command;
 
@@ -25,18 +31,48 @@ import pdCalc_stack;
 import pdCalc_utilities;
 
 using std::string_view;
+using std::vector;
+using std::span;
 
 namespace pdCalc {
 
+namespace {
+
+// Kernels compute in double, so the elements of other builds are converted through
+// buffer; elements of the same type are passed as they are.
+template<typename To, typename From>
+span<const To> convertedElements(span<const From> elements, vector<To>& buffer)
+{
+    if constexpr( std::same_as<To, From> )
+        return elements;
+    else
+    {
+        buffer.assign( elements.begin(), elements.end() );
+        return buffer;
+    }
+}
+
+}
+
 void Command::execute()
 {
-    checkPreconditionsImpl();
+    Allocations::Scope scope{Allocations::Stage::Execute};
+
+    {
+        Trace::Span span{"Command::checkPreconditionsImpl"};
+        checkPreconditionsImpl();
+    }
+
+    Trace::Span span{"Command::executeImpl"};
+    PerfCounters::Sample sample;
     executeImpl();
     return;
 }
 
 void Command::undo()
 {
+    Trace::Span span{"Command::undoImpl"};
+    Allocations::Scope scope{Allocations::Stage::Execute};
     undoImpl();
     return;
 }
@@ -51,6 +87,37 @@ const char* Command::helpMessage() const
     return helpMessageImpl();
 }
 
+bool Command::serialize(vector<Number>& operands) const
+{
+    return serializeImpl(operands);
+}
+
+void Command::deserialize(span<const Number> operands)
+{
+    deserializeImpl(operands);
+    return;
+}
+
+bool Command::deserializable(span<const Number> operands) const
+{
+    return deserializableImpl(operands);
+}
+
+bool Command::replayable() const
+{
+    return replayableImpl();
+}
+
+const Command& Command::target() const
+{
+    return targetImpl();
+}
+
+size_t Command::footprint() const
+{
+    return footprintImpl();
+}
+
 void Command::deallocate()
 {
     delete this;
@@ -61,6 +128,36 @@ void Command::checkPreconditionsImpl() const
     return;
 }
 
+bool Command::serializeImpl(vector<Number>&) const
+{
+    return false;
+}
+
+void Command::deserializeImpl(span<const Number>) noexcept
+{
+    return;
+}
+
+bool Command::deserializableImpl(span<const Number>) const noexcept
+{
+    return false;
+}
+
+bool Command::replayableImpl() const noexcept
+{
+    return true;
+}
+
+const Command& Command::targetImpl() const noexcept
+{
+    return *this;
+}
+
+size_t Command::footprintImpl() const
+{
+    return sizeof(Command);
+}
+
 BinaryCommand::BinaryCommand(const BinaryCommand& rhs)
 : Command(rhs)
 , top_{rhs.top_}
@@ -93,6 +190,32 @@ void BinaryCommand::undoImpl() noexcept
     return;
 }
 
+bool BinaryCommand::serializeImpl(vector<Number>& operands) const
+{
+    operands.push_back(top_);
+    operands.push_back(next_);
+
+    return true;
+}
+
+void BinaryCommand::deserializeImpl(span<const Number> operands) noexcept
+{
+    top_ = operands[0];
+    next_ = operands[1];
+
+    return;
+}
+
+bool BinaryCommand::deserializableImpl(span<const Number> operands) const noexcept
+{
+    return operands.size() == 2;
+}
+
+size_t BinaryCommand::footprintImpl() const
+{
+    return sizeof(BinaryCommand);
+}
+
 UnaryCommand::UnaryCommand(const UnaryCommand& rhs)
 : Command(rhs)
 , top_(rhs.top_)
@@ -123,6 +246,30 @@ void UnaryCommand::undoImpl() noexcept
     return;
 }
 
+bool UnaryCommand::serializeImpl(vector<Number>& operands) const
+{
+    operands.push_back(top_);
+
+    return true;
+}
+
+void UnaryCommand::deserializeImpl(span<const Number> operands) noexcept
+{
+    top_ = operands[0];
+
+    return;
+}
+
+bool UnaryCommand::deserializableImpl(span<const Number> operands) const noexcept
+{
+    return operands.size() == 1;
+}
+
+size_t UnaryCommand::footprintImpl() const
+{
+    return sizeof(UnaryCommand);
+}
+
 void PluginCommand::checkPreconditionsImpl() const
 {
     if( const char* p = checkPluginPreconditions() )
@@ -139,6 +286,43 @@ PluginCommand *PluginCommand::cloneImpl() const
         throw Exception("Problem cloning a plugin command");
 }
 
+int PluginCommand::serializePluginState(double*) const noexcept
+{
+    return -1;
+}
+
+void PluginCommand::deserializePluginState(const double*, int) noexcept
+{
+    return;
+}
+
+bool PluginCommand::serializeImpl(vector<Number>& operands) const
+{
+    double buf[MaxSerializedOperands];
+    int n = serializePluginState(buf);
+    if(n < 0 || n > MaxSerializedOperands) return false;
+
+    operands.insert(operands.end(), buf, buf + n);
+
+    return true;
+}
+
+void PluginCommand::deserializeImpl(span<const Number> operands) noexcept
+{
+    double buf[MaxSerializedOperands];
+    const auto n = std::min<size_t>(operands.size(), MaxSerializedOperands);
+    std::copy_n(operands.begin(), n, buf);
+    deserializePluginState( buf, static_cast<int>(n) );
+
+    return;
+}
+
+// the plugin is passed the count with its state, so it checks the count itself
+bool PluginCommand::deserializableImpl(span<const Number> operands) const noexcept
+{
+    return operands.size() <= MaxSerializedOperands;
+}
+
 BinaryCommandAlternative::BinaryCommandAlternative(string_view help, std::function<BinaryCommandAlternative::BinaryCommandOp> f)
 : helpMsg_{help}
 , command_{f}
@@ -188,5 +372,218 @@ void BinaryCommandAlternative::undoImpl() noexcept
     return;
 }
 
+bool BinaryCommandAlternative::serializeImpl(vector<Number>& operands) const
+{
+    operands.push_back(top_);
+    operands.push_back(next_);
+
+    return true;
+}
+
+void BinaryCommandAlternative::deserializeImpl(span<const Number> operands) noexcept
+{
+    top_ = operands[0];
+    next_ = operands[1];
+
+    return;
+}
+
+bool BinaryCommandAlternative::deserializableImpl(span<const Number> operands) const noexcept
+{
+    return operands.size() == 2;
+}
+
+size_t BinaryCommandAlternative::footprintImpl() const
+{
+    return sizeof(BinaryCommandAlternative) + helpMsg_.capacity();
+}
+
+KernelCommand::KernelCommand(string_view help, Kernel kernel, int arity, Domain domain)
+: helpMsg_{help}
+, kernel_{kernel}
+, arity_{arity}
+, domain_{domain}
+{ }
+
+KernelCommand::KernelCommand(const KernelCommand& rhs)
+: Command{rhs}
+, helpMsg_{rhs.helpMsg_}
+, kernel_{rhs.kernel_}
+, arity_{rhs.arity_}
+, domain_{rhs.domain_}
+, stack_{rhs.stack_}
+{ }
+
+void KernelCommand::checkPreconditionsImpl() const
+{
+    const auto n = Stack::Instance().size();
+    if( arity_ < 1 || n == 0 || n % arity_ != 0 )
+        throw Exception{ std::format("Stack must have a nonzero multiple of {} elements", arity_) };
+
+    if(!domain_) return;
+
+    for( auto element : Stack::Instance().contents() )
+    {
+        if( auto message = domain_( static_cast<double>(element) ) )
+            throw Exception{message};
+    }
+
+    return;
+}
+
+const char* KernelCommand::helpMessageImpl() const noexcept
+{
+    return helpMsg_.c_str();
+}
+
+KernelCommand* KernelCommand::cloneImpl() const
+{
+    return new KernelCommand{*this};
+}
+
+void KernelCommand::executeImpl() noexcept
+{
+    stack_ = Stack::Instance().contents();
+
+    vector<double> converted;
+    auto elements = convertedElements<double>( span<const Number>{stack_}, converted );
+
+    const size_t n = elements.size() / arity_;
+    vector<const double*> in(arity_);
+    for(int i = 0; i < arity_; ++i)
+        in[i] = elements.data() + i * n;
+
+    vector<double> out(n);
+    kernel_(in.data(), out.data(), n);
+
+    vector<Number> results;
+    Stack::Instance().restore( convertedElements<Number>( span<const double>{out}, results ) );
+
+    return;
+}
+
+void KernelCommand::undoImpl() noexcept
+{
+    Stack::Instance().restore(stack_);
+
+    return;
+}
+
+bool KernelCommand::serializeImpl(vector<Number>& operands) const
+{
+    operands.insert( operands.end(), stack_.begin(), stack_.end() );
+
+    return true;
+}
+
+void KernelCommand::deserializeImpl(span<const Number> operands) noexcept
+{
+    stack_.assign( operands.begin(), operands.end() );
+
+    return;
+}
+
+// the undo state is a whole stack, of any size
+bool KernelCommand::deserializableImpl(span<const Number>) const noexcept
+{
+    return true;
+}
+
+size_t KernelCommand::footprintImpl() const
+{
+    return sizeof(KernelCommand) + helpMsg_.capacity() + stack_.capacity() * sizeof(Number);
+}
+
+UnaryFunctionCommand::UnaryFunctionCommand(string_view help, Function f, Precondition p)
+: helpMsg_{help}
+, function_{f}
+, precondition_{p}
+{ }
+
+UnaryFunctionCommand::UnaryFunctionCommand(const UnaryFunctionCommand& rhs)
+: UnaryCommand{rhs}
+, helpMsg_{rhs.helpMsg_}
+, function_{rhs.function_}
+, precondition_{rhs.precondition_}
+{ }
+
+void UnaryFunctionCommand::checkPreconditionsImpl() const
+{
+    UnaryCommand::checkPreconditionsImpl();
+
+    if(!precondition_) return;
+
+    if( auto message = precondition_( Stack::Instance().getElements(1)[0] ) )
+        throw Exception{message};
+
+    return;
+}
+
+const char* UnaryFunctionCommand::helpMessageImpl() const noexcept
+{
+    return helpMsg_.c_str();
+}
+
+UnaryFunctionCommand* UnaryFunctionCommand::cloneImpl() const
+{
+    return new UnaryFunctionCommand{*this};
+}
+
+size_t UnaryFunctionCommand::footprintImpl() const
+{
+    return sizeof(UnaryFunctionCommand) + helpMsg_.capacity();
+}
+
+Number UnaryFunctionCommand::unaryOperation(Number top) const noexcept
+{
+    return static_cast<Number>( function_(top) );
+}
+
+BinaryFunctionCommand::BinaryFunctionCommand(string_view help, Function f, Precondition p)
+: helpMsg_{help}
+, function_{f}
+, precondition_{p}
+{ }
+
+BinaryFunctionCommand::BinaryFunctionCommand(const BinaryFunctionCommand& rhs)
+: BinaryCommand{rhs}
+, helpMsg_{rhs.helpMsg_}
+, function_{rhs.function_}
+, precondition_{rhs.precondition_}
+{ }
+
+void BinaryFunctionCommand::checkPreconditionsImpl() const
+{
+    BinaryCommand::checkPreconditionsImpl();
+
+    if(!precondition_) return;
+
+    // the elements are returned top first
+    auto v = Stack::Instance().getElements(2);
+    if( auto message = precondition_(v[1], v[0]) )
+        throw Exception{message};
+
+    return;
+}
+
+const char* BinaryFunctionCommand::helpMessageImpl() const noexcept
+{
+    return helpMsg_.c_str();
+}
+
+BinaryFunctionCommand* BinaryFunctionCommand::cloneImpl() const
+{
+    return new BinaryFunctionCommand{*this};
+}
+
+size_t BinaryFunctionCommand::footprintImpl() const
+{
+    return sizeof(BinaryFunctionCommand) + helpMsg_.capacity();
+}
+
+Number BinaryFunctionCommand::binaryOperation(Number next, Number top) const noexcept
+{
+    return static_cast<Number>( function_(next, top) );
+}
 
 }
@@ -21,11 +21,17 @@ module;
 #include <memory>
 #include <functional>
 #include <concepts>
+#include <vector>
+#include <span>
 export module pdCalc_command;
 
+import pdCalc_number;
+
 using std::string_view;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using std::span;
 
 export namespace pdCalc {
 
@@ -46,6 +52,33 @@ public:
     // supplies a short help message for the command
     const char* helpMessage() const;
 
+    // Serialization of the state a command needs to undo itself, used by histories
+    // that do not keep every command in memory. serialize appends the state to
+    // operands and returns true, or returns false if the command cannot be
+    // serialized and must therefore stay resident. deserialize restores state
+    // written by serialize into a clone of a command of the same type.
+    bool serialize(vector<Number>& operands) const;
+    void deserialize(span<const Number> operands);
+
+    // Whether serialize could have written operands for a command of this type,
+    // e.g., as many values as its state holds. Operands read from a file must pass
+    // before they are given to deserialize, which does not check them.
+    bool deserializable(span<const Number> operands) const;
+
+    // A command is replayable if its entire effect is on the stack. A history may
+    // then restore a snapshot of the stack in place of undoing or redoing it.
+    bool replayable() const;
+
+    // A command that only stands in for another (e.g., a stub for a plugin command
+    // whose library is not loaded yet) returns the command it stands for, once known,
+    // so that clones of that command can be identified. Others return themselves.
+    const Command& target() const;
+
+    // The approximate number of bytes the command retains, counting itself and what
+    // it holds for undo (e.g., a copy of the stack), so that histories can account
+    // for their memory. The commands of plugins count only as a bare Command.
+    size_t footprint() const;
+
     // Deletes commands. This should only be overridden in plugins. By default,
     // simply deletes command. In plugins, delete must happen in the plugin.
     virtual void deallocate();
@@ -66,6 +99,20 @@ private:
     // all commands should have a short help
     virtual const char* helpMessageImpl() const noexcept = 0;
 
+    // by default, commands are not serializable
+    virtual bool serializeImpl(vector<Number>& operands) const;
+    virtual void deserializeImpl(span<const Number> operands) noexcept;
+    virtual bool deserializableImpl(span<const Number> operands) const noexcept;
+
+    // by default, a command's only state is the stack
+    virtual bool replayableImpl() const noexcept;
+
+    // by default, a command stands for itself
+    virtual const Command& targetImpl() const noexcept;
+
+    // by default, a command holds nothing beyond itself
+    virtual size_t footprintImpl() const;
+
     Command(Command&&) = delete;
     Command& operator=(const Command&) = delete;
     Command& operator=(Command&&) = delete;
@@ -102,10 +149,17 @@ private:
     // drops the result and returns the original two numbers to the stack
     void undoImpl() noexcept final override;
 
-    virtual double binaryOperation(double next, double top) const noexcept = 0;
+    // the undo state is the two original numbers
+    bool serializeImpl(vector<Number>& operands) const final override;
+    void deserializeImpl(span<const Number> operands) noexcept final override;
+    bool deserializableImpl(span<const Number> operands) const noexcept final override;
+
+    size_t footprintImpl() const override;
+
+    virtual Number binaryOperation(Number next, Number top) const noexcept = 0;
 
-    double top_;
-    double next_;
+    Number top_;
+    Number next_;
 };
 
 // Base class for unary operations: take one element from the stack and return
@@ -137,9 +191,16 @@ private:
     // drops the result and returns the original number to the stack
     void undoImpl() noexcept final override;
 
-    virtual double unaryOperation(double top) const noexcept = 0;
+    // the undo state is the original number
+    bool serializeImpl(vector<Number>& operands) const final override;
+    void deserializeImpl(span<const Number> operands) noexcept final override;
+    bool deserializableImpl(span<const Number> operands) const noexcept final override;
 
-    double top_;
+    size_t footprintImpl() const override;
+
+    virtual Number unaryOperation(Number top) const noexcept = 0;
+
+    Number top_;
 };
 
 class PluginCommand : public Command
@@ -147,18 +208,33 @@ class PluginCommand : public Command
 public:
     virtual ~PluginCommand() = default;
 
+    // the maximum number of values a plugin command may serialize
+    static constexpr int MaxSerializedOperands = 8;
+
 private:
     virtual const char* checkPluginPreconditions() const noexcept = 0;
     virtual PluginCommand* clonePluginImpl() const noexcept = 0;
 
+    // Serialization hook for plugins. It uses raw arrays so that no standard library
+    // types cross the plugin boundary. serializePluginState writes at most
+    // MaxSerializedOperands values and returns how many it wrote, or -1 if the command
+    // cannot be serialized. The default returns -1, so plugin commands that do not
+    // implement the hook are simply kept in memory by spilling histories.
+    virtual int serializePluginState(double* operands) const noexcept;
+    virtual void deserializePluginState(const double* operands, int n) noexcept;
+
     void checkPreconditionsImpl() const override final;
     PluginCommand* cloneImpl() const override final;
+
+    bool serializeImpl(vector<Number>& operands) const override final;
+    void deserializeImpl(span<const Number> operands) noexcept override final;
+    bool deserializableImpl(span<const Number> operands) const noexcept override final;
 };
 
 // This shows an entirely different design using function and lambdas.
 class BinaryCommandAlternative final : public Command
 {
-    using BinaryCommandOp = double(double, double);
+    using BinaryCommandOp = Number(Number, Number);
 public:
     BinaryCommandAlternative(string_view help, std::function<BinaryCommandOp> f);
     ~BinaryCommandAlternative() = default;
@@ -184,12 +260,128 @@ private:
 
     BinaryCommandAlternative* cloneImpl() const override;
 
-    double top_;
-    double next_;
+    bool serializeImpl(vector<Number>& operands) const override;
+    void deserializeImpl(span<const Number> operands) noexcept override;
+    bool deserializableImpl(span<const Number> operands) const noexcept override;
+    size_t footprintImpl() const override;
+
+    Number top_;
+    Number next_;
     string helpMsg_;
     std::function<BinaryCommandOp> command_;
 };
 
+// Applies an element-wise kernel, e.g., one exported by a plugin, to the whole stack
+// at once instead of one element per command. A kernel of arity k reads the stack as
+// k equal parts, bottom part first, and the stack is replaced by the results: a
+// unary kernel maps every element x to f(x), and a binary kernel combines the bottom
+// half with the top half. Undo restores the stack, which is also the undo state.
+class KernelCommand final : public Command
+{
+public:
+    // computes out[i] from in[0][i], ..., in[arity - 1][i] for i < n
+    using Kernel = void (*)(const double* in[], double* out, size_t n);
+
+    // the optional domain is checked for every element of the stack and returns a
+    // message if the kernel does not accept it, or else nullptr
+    using Domain = const char* (*)(double element);
+
+    KernelCommand(string_view help, Kernel kernel, int arity, Domain domain);
+    ~KernelCommand() = default;
+
+    Kernel kernel() const { return kernel_; }
+    int arity() const { return arity_; }
+
+private:
+    KernelCommand(KernelCommand&&) = delete;
+    KernelCommand& operator=(const KernelCommand&) = delete;
+    KernelCommand& operator=(KernelCommand&&) = delete;
+
+    KernelCommand(const KernelCommand&);
+
+    // throws an exception unless the stack splits into arity nonempty parts, each of
+    // whose elements is in the domain
+    void checkPreconditionsImpl() const override;
+
+    const char* helpMessageImpl() const noexcept override;
+    void executeImpl() noexcept override;
+    void undoImpl() noexcept override;
+    KernelCommand* cloneImpl() const override;
+
+    bool serializeImpl(vector<Number>& operands) const override;
+    void deserializeImpl(span<const Number> operands) noexcept override;
+    bool deserializableImpl(span<const Number> operands) const noexcept override;
+    size_t footprintImpl() const override;
+
+    string helpMsg_;
+    Kernel kernel_;
+    int arity_;
+    Domain domain_;
+    vector<Number> stack_;
+};
+
+// Unary and binary operations given as plain functions, e.g., by plugins, so that
+// pdCalc clones, executes, and deletes them itself. The optional precondition is
+// checked after the stack size and returns a message if the function does not
+// accept its operands, or else nullptr.
+class UnaryFunctionCommand final : public UnaryCommand
+{
+public:
+    using Function = double (*)(double top);
+    using Precondition = const char* (*)(double top);
+
+    UnaryFunctionCommand(string_view help, Function f, Precondition p);
+    ~UnaryFunctionCommand() = default;
+
+    Function function() const { return function_; }
+
+private:
+    UnaryFunctionCommand(UnaryFunctionCommand&&) = delete;
+    UnaryFunctionCommand& operator=(const UnaryFunctionCommand&) = delete;
+    UnaryFunctionCommand& operator=(UnaryFunctionCommand&&) = delete;
+
+    UnaryFunctionCommand(const UnaryFunctionCommand&);
+
+    void checkPreconditionsImpl() const override;
+    const char* helpMessageImpl() const noexcept override;
+    UnaryFunctionCommand* cloneImpl() const override;
+    size_t footprintImpl() const override;
+    Number unaryOperation(Number top) const noexcept override;
+
+    string helpMsg_;
+    Function function_;
+    Precondition precondition_;
+};
+
+class BinaryFunctionCommand final : public BinaryCommand
+{
+public:
+    using Function = double (*)(double next, double top);
+    using Precondition = const char* (*)(double next, double top);
+
+    BinaryFunctionCommand(string_view help, Function f, Precondition p);
+    ~BinaryFunctionCommand() = default;
+
+    Function function() const { return function_; }
+
+private:
+    BinaryFunctionCommand(BinaryFunctionCommand&&) = delete;
+    BinaryFunctionCommand& operator=(const BinaryFunctionCommand&) = delete;
+    BinaryFunctionCommand& operator=(BinaryFunctionCommand&&) = delete;
+
+    BinaryFunctionCommand(const BinaryFunctionCommand&);
+
+    void checkPreconditionsImpl() const override;
+    const char* helpMessageImpl() const noexcept override;
+    BinaryFunctionCommand* cloneImpl() const override;
+    size_t footprintImpl() const override;
+    Number binaryOperation(Number next, Number top) const noexcept override;
+
+    string helpMsg_;
+    Function function_;
+    Precondition precondition_;
+};
+
 inline void CommandDeleter(Command* p)
 {
     if(p) p->deallocate();
@@ -198,10 +390,11 @@ inline void CommandDeleter(Command* p)
 
 using CommandPtr = unique_ptr<Command, decltype(&CommandDeleter)>;
 
+// the arguments are converted as in a call, e.g., a double to a float Number
 template<typename T, typename... Args>
 auto MakeCommandPtr(Args&&... args) requires std::derived_from<T, Command>
 {
-    return CommandPtr{new T{std::forward<Args>(args)...}, &CommandDeleter};
+    return CommandPtr{new T(std::forward<Args>(args)...), &CommandDeleter};
 }
 
 inline auto MakeCommandPtr(Command* p)
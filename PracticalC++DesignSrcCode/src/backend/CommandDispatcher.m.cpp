@@ -23,9 +23,12 @@ export module pdCalc_commandDispatcher;
 export import :CommandInterpreter;
 export import :AppObservers;
 export import :CommandFactory;
+export import :Journal;
+export import :Capture;
 
 #ifdef ENABLE_TESTING_INTERFACE
 export import :CoreCommands;
 export import :CommandManager;
 export import :StoredProcedure;
+export import :Session;
 #endif
@@ -19,11 +19,16 @@ module;
 #include <memory>
 #include <string>
 #include <set>
+#include <map>
 #include <format>
 #include <unordered_map>
-#include <format>
+#include <vector>
+#include <array>
 #include <algorithm>
 #include <ranges>
+#include <typeinfo>
+#include <typeindex>
+#include <string_view>
 export module pdCalc_commandDispatcher:CommandFactory;
 
 import pdCalc_utilities;
@@ -32,11 +37,69 @@ import pdCalc_command;
 import :CoreCommands;
 
 using std::string;
+using std::string_view;
 using std::unordered_map;
 using std::set;
 
 namespace pdCalc {
 
+// A core command: its name, the number of stack elements it needs, its help
+// message, and a function making it. The core commands are described at compile
+// time, so registering them only marks them as available.
+export struct CoreCommand
+{
+    string_view name;
+    int arity;
+    string_view help;
+    Command* (*make)();
+    const std::type_info* type;
+};
+
+template<typename T>
+constexpr CoreCommand makeCoreCommand(string_view name, int arity)
+{
+    return CoreCommand{name, arity, T::Help, []() -> Command* { return new T{}; }, &typeid(T)};
+}
+
+constexpr const char* MultiplyHelp = "Replace first two elements on the stack with their product";
+
+// all the core commands, whether registered or not, sorted by name so that they
+// are found by binary search
+export constexpr std::array CoreCommandTable = {
+    CoreCommand{"*", 2, MultiplyHelp,
+        []() -> Command* { return new BinaryCommandAlternative{MultiplyHelp, [](Number d, Number f){ return d * f; }}; },
+        &typeid(BinaryCommandAlternative)},
+    makeCoreCommand<Add>("+", 2),
+    makeCoreCommand<Subtract>("-", 2),
+    makeCoreCommand<Divide>("/", 2),
+    makeCoreCommand<Arccosine>("arccos", 1),
+    makeCoreCommand<Arcsine>("arcsin", 1),
+    makeCoreCommand<Arctangent>("arctan", 1),
+    makeCoreCommand<ClearStack>("clear", 0),
+    makeCoreCommand<Cosine>("cos", 1),
+    makeCoreCommand<DropTopOfStack>("drop", 1),
+    makeCoreCommand<Duplicate>("dup", 1),
+    makeCoreCommand<Negate>("neg", 1),
+    makeCoreCommand<Power>("pow", 2),
+    makeCoreCommand<Root>("root", 2),
+    makeCoreCommand<Sine>("sin", 1),
+    makeCoreCommand<SwapTopOfStack>("swap", 2),
+    makeCoreCommand<Tangent>("tan", 1)
+};
+
+static_assert( std::ranges::is_sorted(CoreCommandTable, {}, &CoreCommand::name) );
+static_assert( std::ranges::adjacent_find(CoreCommandTable, {}, &CoreCommand::name) == CoreCommandTable.end() );
+
+// the index of the core command name, or -1
+constexpr int coreIndex(string_view name)
+{
+    auto i = std::ranges::lower_bound(CoreCommandTable, name, {}, &CoreCommand::name);
+
+    return i != CoreCommandTable.end() && i->name == name ? static_cast<int>( i - CoreCommandTable.begin() ) : -1;
+}
+
+static_assert( coreIndex("*") == 0 && coreIndex("tan") == std::ssize(CoreCommandTable) - 1 && coreIndex("exp") == -1 );
+
 export class CommandFactory
 {
 public:
@@ -46,29 +109,50 @@ public:
     // same name already exists...deregister first to replace a command
     void registerCommand(const string& name, CommandPtr c);
 
+    // registers the core commands that are not already, returning the names of
+    // those that could not be because another command of that name is registered
+    std::vector<string> registerCoreCommands();
+
     // deregister a command: returns the pointer to a command and subsequently
     // removes it from the internal database of commands...returns a nullptr
     // if the command does not exist
     CommandPtr deregisterCommand(const string& name);
 
     // returns the number of commands currently registered
-    size_t getNumberCommands() const { return factory_.size(); }
+    size_t getNumberCommands() const { return factory_.size() + std::ranges::count(core_, true); }
 
     // returns a pointer to a command without deregistering the command...returns
     // a nullptr if the command does not exist
     CommandPtr allocateCommand(const string& name) const;
 
     // returns true if the command is present, false otherwise
-    bool hasKey(const string& s) const { return factory_.contains(s); }
+    bool hasKey(const string& s) const { return registeredCore(s) != -1 || factory_.contains(s); }
+
+    // returns true if s names a registered core command
+    bool isCoreCommand(string_view s) const { return registeredCore(s) != -1; }
 
-    // returns a set of all the commands
-    std::set<string> getAllCommandNames() const;
+    // returns a set of all the commands, which is only rebuilt after commands are
+    // registered or deregistered
+    const std::set<string>& getAllCommandNames() const;
+
+    // Returns the name of the registered command of which c is a copy, or an empty
+    // string if there is none. Commands are matched by type and help message,
+    // since BinaryCommandAlternative uses one type for several commands, and a
+    // registered command is matched through the command it stands for. The names
+    // found are cached, since histories ask for the name of every command they
+    // execute, undo, or redo when collecting statistics, until the registered
+    // commands change.
+    string commandName(const Command& c) const;
 
     // prints help for command
     string helpMessage(const string& command) const;
 
+    // the approximate number of bytes retained by the registered commands and their
+    // names; core commands are made when allocated and retain nothing
+    size_t footprint() const;
+
     // clears all commands; mainly needed for testing
-    void clearAllCommands(){ factory_.clear(); }
+    void clearAllCommands();
 
 private:
     CommandFactory() = default;
@@ -79,22 +163,83 @@ private:
     CommandFactory& operator=(CommandFactory&) = delete;
     CommandFactory& operator=(CommandFactory&&) = delete;
 
+    // the index of the core command name if it is registered, or -1
+    int registeredCore(string_view name) const;
+
 private:
     using Factory = unordered_map<string, CommandPtr>;
     Factory factory_;
+
+    // which core commands are registered
+    std::array<bool, CoreCommandTable.size()> core_{};
+
+    mutable set<string> names_;
+    mutable bool namesCurrent_{false};
+
+    // the names found by commandName, by type and help message
+    mutable unordered_map<std::type_index, std::map<string, string, std::less<>>> commandNames_;
 };
 
-set<string> CommandFactory::getAllCommandNames() const
+int CommandFactory::registeredCore(string_view name) const
 {
-    set<string> tmp;
+    int i = coreIndex(name);
 
-    std::ranges::for_each(factory_ | std::views::keys, [&tmp](const auto& k){tmp.insert(k);});
+    return i != -1 && core_[i] ? i : -1;
+}
 
-    return tmp;
+const set<string>& CommandFactory::getAllCommandNames() const
+{
+    if(!namesCurrent_)
+    {
+        names_.clear();
+        std::ranges::for_each(factory_ | std::views::keys, [this](const auto& k){names_.insert(k);});
+        for(size_t i = 0; i < core_.size(); ++i)
+            if(core_[i]) names_.emplace(CoreCommandTable[i].name);
+
+        namesCurrent_ = true;
+    }
+
+    return names_;
+}
+
+string CommandFactory::commandName(const Command& c) const
+{
+    std::string_view help{ c.helpMessage() };
+
+    auto& byHelp = commandNames_[typeid(c)];
+    if( auto i = byHelp.find(help); i != byHelp.end() )
+        return i->second;
+
+    string name;
+    for(size_t i = 0; i < core_.size() && name.empty(); ++i)
+    {
+        const auto& e = CoreCommandTable[i];
+        if(core_[i] && typeid(c) == *e.type && help == e.help)
+            name = e.name;
+    }
+
+    if( name.empty() )
+    {
+        auto i = std::ranges::find_if(factory_, [&](const auto& entry)
+        {
+            const auto& t = entry.second->target();
+            return typeid(t) == typeid(c) && help == t.helpMessage();
+        });
+        if( i != factory_.end() ) name = i->first;
+    }
+
+    // a command not found is not cached, since a registered command may come to
+    // stand for it (e.g., once a plugin is loaded)
+    if( !name.empty() ) byHelp.emplace(help, name);
+
+    return name;
 }
 
 string CommandFactory::helpMessage(const string& command) const
 {
+    if( int i = registeredCore(command); i != -1 )
+        return std::format("{}: {}", command, CoreCommandTable[i].help);
+
     auto it = factory_.find(command);
 
     return std::format("{}: {}", command,
@@ -111,12 +256,40 @@ void CommandFactory::registerCommand(const string& name, CommandPtr c)
     else
         factory_.emplace( name, std::move(c) );
 
+    namesCurrent_ = false;
+    commandNames_.clear();
+
     return;
 }
 
+std::vector<string> CommandFactory::registerCoreCommands()
+{
+    std::vector<string> conflicts;
+    for(size_t i = 0; i < core_.size(); ++i)
+    {
+        string name{CoreCommandTable[i].name};
+        if( core_[i] ) continue;
+        else if( factory_.contains(name) ) conflicts.push_back(name);
+        else core_[i] = true;
+    }
+
+    namesCurrent_ = false;
+    commandNames_.clear();
+
+    return conflicts;
+}
+
 CommandPtr CommandFactory::deregisterCommand(const string& name)
 {
-    if( hasKey(name) )
+    namesCurrent_ = false;
+    commandNames_.clear();
+
+    if( int i = registeredCore(name); i != -1 )
+    {
+        core_[i] = false;
+        return MakeCommandPtr( CoreCommandTable[i].make() );
+    }
+    else if( hasKey(name) )
     {
         auto i = factory_.find(name);
         auto tmp = MakeCommandPtr( i->second.release() );
@@ -128,7 +301,12 @@ CommandPtr CommandFactory::deregisterCommand(const string& name)
 
 CommandPtr CommandFactory::allocateCommand(const string &name) const
 {
-    if( hasKey(name) )
+    Trace::Span span{"CommandFactory::allocateCommand", name};
+    Allocations::Scope scope{Allocations::Stage::Clone};
+
+    if( int i = registeredCore(name); i != -1 )
+        return MakeCommandPtr( CoreCommandTable[i].make() );
+    else if( hasKey(name) )
     {
         const auto& command = factory_.find(name)->second;
         return MakeCommandPtr( command->clone() );
@@ -136,6 +314,24 @@ CommandPtr CommandFactory::allocateCommand(const string &name) const
     else return MakeCommandPtr(nullptr);
 }
 
+size_t CommandFactory::footprint() const
+{
+    size_t bytes = sizeof(CommandFactory);
+    for(const auto& [name, c] : factory_)
+        bytes += sizeof(Factory::value_type) + name.capacity() + c->footprint();
+
+    return bytes;
+}
+
+void CommandFactory::clearAllCommands()
+{
+    factory_.clear();
+    core_.fill(false);
+    namesCurrent_ = false;
+    commandNames_.clear();
+
+    return;
+}
 
 CommandFactory& CommandFactory::Instance()
 {
@@ -145,34 +341,8 @@ CommandFactory& CommandFactory::Instance()
 
 export void RegisterCoreCommands(UserInterface& ui)
 {
-    auto& cr = CommandFactory::Instance();
-    try
-    {
-        cr.registerCommand( "swap", MakeCommandPtr<SwapTopOfStack>() );
-        cr.registerCommand( "drop", MakeCommandPtr<DropTopOfStack>() );
-        cr.registerCommand( "clear", MakeCommandPtr<ClearStack>() );
-        cr.registerCommand( "+", MakeCommandPtr<Add>() );
-        cr.registerCommand( "-", MakeCommandPtr<Subtract>() );
-        cr.registerCommand("*",
-            MakeCommandPtr<BinaryCommandAlternative>("Replace first two elements on the stack with their product",
-            [](double d, double f){ return d * f; })
-        );
-        cr.registerCommand( "/", MakeCommandPtr<Divide>() );
-        cr.registerCommand( "pow", MakeCommandPtr<Power>() );
-        cr.registerCommand( "root", MakeCommandPtr<Root>() );
-        cr.registerCommand( "sin", MakeCommandPtr<Sine>() );
-        cr.registerCommand( "cos", MakeCommandPtr<Cosine>() );
-        cr.registerCommand( "tan", MakeCommandPtr<Tangent>() );
-        cr.registerCommand( "arcsin", MakeCommandPtr<Arcsine>() );
-        cr.registerCommand( "arccos", MakeCommandPtr<Arccosine>() );
-        cr.registerCommand( "arctan", MakeCommandPtr<Arctangent>() );
-        cr.registerCommand( "neg", MakeCommandPtr<Negate>() );
-        cr.registerCommand( "dup", MakeCommandPtr<Duplicate>() );
-    }
-    catch(Exception& e)
-    {
-        ui.postMessage( e.what() );
-    }
+    for(const auto& name : CommandFactory::Instance().registerCoreCommands())
+        ui.postMessage( std::format("Command {} already registered", name) );
 
     return;
 }
@@ -16,6 +16,7 @@
 // You should have received a copy of the GNU General Public License
 // along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
 module;
+#include <cstddef>
 #include <format>
 #include <regex>
 #include <cassert>
@@ -25,84 +26,255 @@ module;
 #include <string_view>
 #include <string>
 #include <iterator>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include <span>
+#include <utility>
 module pdCalc_commandDispatcher:CommandInterpreter;
 
 import pdCalc_command;
+import pdCalc_stack;
 import pdCalc_utilities;
 import :CommandManager;
 import :CoreCommands;
 import :StoredProcedure;
 import :CommandFactory;
+import :Session;
 
 using std::string;
 using std::unique_ptr;
 using std::set;
 using std::string_view;
+using std::make_unique;
+
+// instrumentation for the stats command, which is compiled out without PDCALC_STATS
+#ifdef PDCALC_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
 
 namespace pdCalc {
 
+namespace {
+
+// the contents of a session file, read into memory that is aligned for Session::Load
+std::vector<std::byte> readSession(const string& filename)
+{
+    std::ifstream ifs{filename, std::ios::binary | std::ios::ate};
+    if(!ifs)
+        throw Exception{ std::format("Could not open session {}", filename) };
+
+    std::vector<std::byte> contents( static_cast<size_t>( ifs.tellg() ) );
+    ifs.seekg(0);
+    if( !ifs.read( reinterpret_cast<char*>( contents.data() ), contents.size() ) )
+        throw Exception{ std::format("Could not open session {}", filename) };
+
+    return contents;
+}
+
+}
+
 class CommandInterpreter::CommandInterpreterImpl
 {
 public:
     explicit CommandInterpreterImpl(UserInterface& ui);
 
     void executeCommand(const string& command);
-
+    void setJournal(Journal* journal) { journal_ = journal; }
+    void loadSession(std::span<const std::byte> contents);
+    void setSession(const string& filename, std::chrono::seconds interval, bool load);
+    void setBeforeCommand(std::function<void()> f) { beforeCommand_ = std::move(f); }
+    void addFootprint(const string& name, std::function<size_t()> f) { footprints_.emplace_back(name, std::move(f)); }
+    CommandManager& manager() { return manager_; }
 
 private:
-    bool isNum(const string&, double& d);
-    void handleCommand(CommandPtr command);
+    bool isCount(string_view, size_t& n);
+    bool handleCommand(CommandPtr command);
+    void handleJump(string_view command);
+    void handleSession(string_view command);
+    void handleProfile(const string& command, const string& filename);
+    void snapshot();
     void printHelp() const;
+    void printMemory();
+
+    template<typename F>
+    void journal(F record);
+    void journalMove(size_t from);
+    void journalProcedure(const string& command, const string& filename);
 
     CommandManager manager_;
     UserInterface& ui_;
+    Journal* journal_;
+
+    using Clock = std::chrono::steady_clock;
+    unique_ptr<Session> session_;
+    std::chrono::seconds snapshotInterval_;
+    Clock::time_point lastSnapshot_;
+
+    std::function<void()> beforeCommand_;
+
+    // set by profile for the command that follows it
+    bool profileNext_;
+
+    // the lines added to the mem command's breakdown
+    std::vector<std::pair<string, std::function<size_t()>>> footprints_;
 };
 
 CommandInterpreter::CommandInterpreterImpl::CommandInterpreterImpl(UserInterface& ui)
 : ui_(ui)
+, journal_{nullptr}
+, snapshotInterval_{0}
+, profileNext_{false}
 { }
 
 void CommandInterpreter::CommandInterpreterImpl::executeCommand(const string& command)
 {
     string_view sv{command};
 
+    Trace::Span span{"CommandInterpreter::executeCommand", sv};
+
+    if(beforeCommand_) beforeCommand_();
+
+    // the time to interpret a command is recorded under its name, which the
+    // branches below change for commands with arguments
+    STATS( Stats::Instance().count(Stats::Counter::Tokens); )
+    STATS( Stats::Timer timer{Stats::Operation::Interpret, sv}; )
+
+    // declared after the timer, so that the timer records the command's allocations
+    // outside any stage
+    Allocations::Scope scope{Allocations::Stage::Interpret};
+
+    // profile only applies to the command right after it
+    const bool profile = std::exchange(profileNext_, false);
+    if( profile && !sv.starts_with("proc:") && command != "profile" )
+        ui_.postMessage("Command profile must be followed by proc:<file>");
+
     // entry of a number simply goes onto the the stack
-    if(double d; isNum(command, d) )
+    if(Number d; IsNumber(command, d) )
+    {
+        STATS( timer.name("number"); )
         manager_.executeCommand(MakeCommandPtr<EnterNumber>(d));
+        journal([d](Journal& j){ j.number(d); });
+    }
     else if(command == "undo")
+    {
+        const auto from = manager_.getUndoSize();
         manager_.undo();
+        journalMove(from);
+    }
     else if(command == "redo")
+    {
+        const auto from = manager_.getUndoSize();
         manager_.redo();
+        journalMove(from);
+    }
     else if(command == "help")
         printHelp();
+    else if(command == "mem")
+        printMemory();
+    else if(command == "profile")
+        profileNext_ = true;
+#ifdef PDCALC_STATS
+    else if(command == "stats")
+        ui_.postMessage( Stats::Instance().report() );
+#endif
+#ifdef PDCALC_PERF_COUNTERS
+    else if(command == "perfstats")
+    {
+        // reports why the counters are unavailable if no command has opened them
+        PerfCounters::Instance().open();
+        ui_.postMessage( PerfCounters::Instance().report() );
+    }
+#endif
+    else if( sv.starts_with("undo:") || sv.starts_with("redo:") || sv.starts_with("goto:") )
+    {
+        STATS( timer.name( sv.starts_with("undo:") ? "undo:n" : sv.starts_with("redo:") ? "redo:n" : "goto:k" ); )
+        handleJump(sv);
+    }
+    else if( sv.starts_with("save-session") || sv.starts_with("load-session") )
+    {
+        STATS( timer.name( sv.substr(0, 12) ); )
+        handleSession(sv);
+    }
     else if( command.size() > 6 && sv.starts_with("proc:") )
     {
+        STATS( timer.name("proc"); )
         string filename{sv.substr(5, command.size() - 5)};
-        handleCommand( MakeCommandPtr<StoredProcedure>(ui_, filename) );
+        if(profile)
+            handleProfile(command, filename);
+        else if( handleCommand( MakeCommandPtr<StoredProcedure>(ui_, filename) ) )
+            journalProcedure(command, filename);
     }
     else
     {
         if( auto c = CommandFactory::Instance().allocateCommand(command) )
         {
-            handleCommand( std::move(c) );
+            if( handleCommand( std::move(c) ) )
+                journal([&](Journal& j){ j.command(command); });
         }
         else
         {
+            STATS( timer.name({}); )
+            STATS( Stats::Instance().count(Stats::Counter::ParseFailures); )
             auto t = std::format("Command {} is not a known command", command);
             ui_.postMessage(t);
         }
     }
 
+    STATS( Stats::Instance().undoDepth( manager_.getUndoSize() ); )
+
+    // snapshots are taken between commands, when the history is consistent
+    if( session_ && snapshotInterval_.count() > 0 && Clock::now() - lastSnapshot_ >= snapshotInterval_ )
+        snapshot();
+
     return;
 }
 
-void CommandInterpreter::CommandInterpreterImpl::handleCommand(CommandPtr c)
+bool CommandInterpreter::CommandInterpreterImpl::handleCommand(CommandPtr c)
 {
     try
     {
         manager_.executeCommand( std::move(c) );
     }
     catch(Exception& e)
+    {
+        STATS( Stats::Instance().count(Stats::Counter::PreconditionFailures); )
+        ui_.postMessage( e.what() );
+        return false;
+    }
+
+    return true;
+}
+
+void CommandInterpreter::CommandInterpreterImpl::handleJump(string_view command)
+{
+    size_t n;
+    if( !isCount(command.substr(5), n) )
+    {
+        STATS( Stats::Instance().count(Stats::Counter::ParseFailures); )
+        ui_.postMessage( std::format("Command {} needs a nonnegative integer count", command) );
+        return;
+    }
+
+    const auto from = manager_.getUndoSize();
+
+    try
+    {
+        if( command.starts_with("undo:") )
+            manager_.undo(n);
+        else if( command.starts_with("redo:") )
+            manager_.redo(n);
+        else
+            manager_.jumpTo(n);
+
+        journalMove(from);
+    }
+    catch(Exception& e)
     {
         ui_.postMessage( e.what() );
     }
@@ -110,14 +282,185 @@ void CommandInterpreter::CommandInterpreterImpl::handleCommand(CommandPtr c)
     return;
 }
 
+// handles save-session[:file] and load-session[:file]; without a file, the session
+// set by setSession is meant
+void CommandInterpreter::CommandInterpreterImpl::handleSession(string_view command)
+{
+    constexpr size_t NameLength = 12;
+    if( command.size() > NameLength && command[NameLength] != ':' )
+    {
+        STATS( Stats::Instance().count(Stats::Counter::ParseFailures); )
+        ui_.postMessage( std::format("Command {} is not a known command", command) );
+        return;
+    }
+
+    string filename{ command.size() > NameLength + 1 ? command.substr(NameLength + 1) : string_view{} };
+    if( filename.empty() && !session_ )
+    {
+        ui_.postMessage( std::format("Command {} needs a file: no session is set", command) );
+        return;
+    }
+
+    try
+    {
+        if( command.starts_with("save-session") )
+        {
+            if( !filename.empty() )
+                Session::Save(filename, manager_);
+            else
+            {
+                // an explicit save must not be skipped for a snapshot in progress
+                session_->wait();
+                snapshot();
+            }
+        }
+        else
+        {
+            if( filename.empty() ) filename = session_->filename();
+
+            // the journal records the contents loaded, since the file may be
+            // overwritten (e.g., by a snapshot) before the journal is recovered
+            if(journal_)
+            {
+                const auto contents = readSession(filename);
+                Session::Load(contents, filename, manager_);
+                journal([&](Journal& j){ j.session(contents); });
+            }
+            else
+                Session::Load(filename, manager_);
+        }
+    }
+    catch(Exception& e)
+    {
+        ui_.postMessage( e.what() );
+    }
+
+    return;
+}
+
+void CommandInterpreter::CommandInterpreterImpl::loadSession(std::span<const std::byte> contents)
+{
+    try
+    {
+        Session::Load(contents, "The journaled session", manager_);
+        journal([&](Journal& j){ j.session(contents); });
+    }
+    catch(Exception& e)
+    {
+        ui_.postMessage( e.what() );
+    }
+
+    return;
+}
+
+// executes the procedure as proc: does, and then reports the time of each of its tokens
+void CommandInterpreter::CommandInterpreterImpl::handleProfile(const string& command, const string& filename)
+{
+    ProcedureProfile profile;
+    bool executed = false;
+    profile.step(command, [&]{ executed = handleCommand( MakeCommandPtr<StoredProcedure>(ui_, filename) ); });
+    if(!executed) return;
+
+    journalProcedure(command, filename);
+    ui_.postMessage( profile.report() );
+
+    return;
+}
+
+void CommandInterpreter::CommandInterpreterImpl::snapshot()
+{
+    try
+    {
+        if( session_->snapshot(manager_) ) lastSnapshot_ = Clock::now();
+    }
+    catch(Exception& e)
+    {
+        ui_.postMessage( e.what() );
+        lastSnapshot_ = Clock::now();
+    }
+
+    return;
+}
+
+void CommandInterpreter::CommandInterpreterImpl::setSession(const string& filename, std::chrono::seconds interval, bool load)
+{
+    if( load && std::filesystem::exists(filename) )
+        Session::Load(filename, manager_);
+
+    session_ = make_unique<Session>(filename);
+    snapshotInterval_ = interval;
+    lastSnapshot_ = Clock::now();
+
+    return;
+}
+
+// records an operation that changed the history, if journaling
+template<typename F>
+void CommandInterpreter::CommandInterpreterImpl::journal(F record)
+{
+    if(!journal_) return;
+
+    try
+    {
+        record(*journal_);
+    }
+    catch(Exception& e)
+    {
+        ui_.postMessage( e.what() );
+    }
+
+    return;
+}
+
+// Records a move through the history from position from as the steps it took. A
+// memory limit trims the oldest entries, which shifts positions, so a recovery that
+// trims differently (e.g., without the limit) only reaches the same stack by moving
+// the same number of steps. A command that did not move is not recorded, since it
+// might move through a history trimmed less.
+void CommandInterpreter::CommandInterpreterImpl::journalMove(size_t from)
+{
+    const auto to = manager_.getUndoSize();
+    if(to < from)
+        journal([n = from - to](Journal& j){ j.undo(n); });
+    else if(to > from)
+        journal([n = to - from](Journal& j){ j.redo(n); });
+
+    return;
+}
+
+// Records the command proc:filename after the procedures it ran, which recovery runs
+// in place of their files, as it does for sessions, since the files may have been
+// edited by then.
+void CommandInterpreter::CommandInterpreterImpl::journalProcedure(const string& command, const string& filename)
+{
+    journal([&](Journal& j)
+    {
+        j.procedures( ProcedureSource::Read(filename) );
+        j.command(command);
+    });
+
+    return;
+}
+
 void CommandInterpreter::CommandInterpreterImpl::printHelp() const
 {
     string help = "\n"
                   "undo: undo last operation\n"
-                  "redo: redo last operation\n";
+                  "redo: redo last operation\n"
+                  "undo:n: undo last n operations\n"
+                  "redo:n: redo next n operations\n"
+                  "goto:k: move to step k of the history\n"
+                  "save-session[:file]: save the stack and history to file (default: the session file)\n"
+                  "load-session[:file]: load the stack and history from file (default: the session file)\n"
+                  "mem: print the approximate memory held by the stack, history, commands, and plugins\n"
+                  "profile proc:<file>: run a stored procedure and report the time of each of its tokens\n";
+    STATS( help += "stats: print the latencies of commands and counts of tokens and failures\n"; )
+#ifdef PDCALC_PERF_COUNTERS
+    help += "perfstats: print the instructions per cycle and miss rates of commands\n";
+#endif
 
-    set<string> allCommands = CommandFactory::Instance().getAllCommandNames();
-    for(auto i : allCommands)
+    const auto& allCommands = CommandFactory::Instance().getAllCommandNames();
+    for(const auto& i : allCommands)
     {
         help += CommandFactory::Instance().helpMessage(i) + "\n";
     }
@@ -127,23 +470,65 @@ void CommandInterpreter::CommandInterpreterImpl::printHelp() const
     return;
 }
 
-// uses a C++11 regular expression to check if this is a valid double number
+void CommandInterpreter::CommandInterpreterImpl::printMemory()
+{
+    const auto& stack = Stack::Instance();
+    const auto& factory = CommandFactory::Instance();
+
+    const auto stackBytes = stack.footprint();
+    const auto historyBytes = manager_.footprint();
+    const auto commandBytes = factory.footprint();
+    auto total = stackBytes + historyBytes + commandBytes;
+
+    string report = std::format("\nstack: {} elements, {} bytes\n", stack.size(), stackBytes);
+    report += std::format("history: {} undo, {} redo, {} bytes (checkpoints: {} bytes)\n",
+        manager_.getUndoSize(), manager_.getRedoSize(), historyBytes, manager_.checkpointFootprint());
+    report += std::format("commands: {} registered, {} bytes\n", factory.getNumberCommands(), commandBytes);
+
+    for(const auto& [name, f] : footprints_)
+    {
+        const auto bytes = f();
+        report += std::format("{}: {} bytes\n", name, bytes);
+        total += bytes;
+    }
+
+    report += std::format("total: {} bytes\n", total);
+    if( auto limit = manager_.getMemoryLimit() )
+        report += std::format("history limit: {} bytes\n", limit);
+
+    ui_.postMessage(report);
+
+    return;
+}
+
+// uses a C++11 regular expression to check if this is a valid number
 // if so, converts it into one and returns it
-bool CommandInterpreter::CommandInterpreterImpl::isNum(const string& s, double& d)
+bool CommandInterpreter::IsNumber(const string& s, Number& d)
 {
+     Trace::Span span{"CommandInterpreter::IsNumber"};
+     Allocations::Scope scope{Allocations::Stage::ParseNumber};
+
      if(s == "+" || s == "-") return false;
 
-     std::regex dpRegex("((\\+|-)?[[:digit:]]*)(\\.(([[:digit:]]+)?))?((e|E)((\\+|-)?)[[:digit:]]+)?");
+     // compiling the expression costs far more than matching it, so it is compiled once
+     static const std::regex dpRegex("((\\+|-)?[[:digit:]]*)(\\.(([[:digit:]]+)?))?((e|E)((\\+|-)?)[[:digit:]]+)?");
      bool isNumber{ std::regex_match(s, dpRegex) };
 
      if(isNumber)
      {
-         d = std::stod(s);
+         d = Numeric::Parse(s);
      }
 
      return isNumber;
 }
 
+bool CommandInterpreter::CommandInterpreterImpl::isCount(string_view s, size_t& n)
+{
+    auto [p, ec] = std::from_chars( s.data(), s.data() + s.size(), n );
+
+    return !s.empty() && ec == std::errc{} && p == s.data() + s.size();
+}
+
 void CommandInterpreter::commandEntered(const string& command)
 {
     pimpl_->executeCommand(command);
@@ -151,6 +536,67 @@ void CommandInterpreter::commandEntered(const string& command)
     return;
 }
 
+void CommandInterpreter::setJournal(Journal* journal)
+{
+    pimpl_->setJournal(journal);
+
+    return;
+}
+
+void CommandInterpreter::loadSession(std::span<const std::byte> contents)
+{
+    pimpl_->loadSession(contents);
+
+    return;
+}
+
+void CommandInterpreter::setSession(const string& filename, std::chrono::seconds interval, bool load)
+{
+    pimpl_->setSession(filename, interval, load);
+
+    return;
+}
+
+void CommandInterpreter::setBeforeCommand(std::function<void()> f)
+{
+    pimpl_->setBeforeCommand( std::move(f) );
+
+    return;
+}
+
+void CommandInterpreter::visitHistory(const std::function<void(const Command&)>& f)
+{
+    pimpl_->manager().visitHistory(f);
+
+    return;
+}
+
+void CommandInterpreter::rebindHistory(const std::function<CommandPtr(const Command&)>& f)
+{
+    pimpl_->manager().rebindHistory(f);
+
+    return;
+}
+
+size_t CommandInterpreter::footprint()
+{
+    return pimpl_->manager().footprint();
+}
+
+void CommandInterpreter::setMemoryLimit(size_t bytes)
+{
+    pimpl_->manager().setMemoryLimit(bytes);
+
+    return;
+}
+
+void CommandInterpreter::addFootprint(const string& name, std::function<size_t()> f)
+{
+    pimpl_->addFootprint( name, std::move(f) );
+
+    return;
+}
+
 CommandInterpreter::CommandInterpreter(UserInterface& ui)
 : pimpl_{ std::make_unique<CommandInterpreterImpl>(ui) }
 {
@@ -16,12 +16,18 @@
 // You should have received a copy of the GNU General Public License
 // along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
 module;
+#include <cstddef>
+#include <span>
 #include <string>
 #include <memory>
+#include <chrono>
+#include <functional>
 export module pdCalc_commandDispatcher:CommandInterpreter;
 
 import pdCalc_utilities;
 import pdCalc_userInterface;
+import pdCalc_command;
+import :Journal;
 
 using std::string;
 
@@ -37,6 +43,47 @@ public:
 
     void commandEntered(const string& command);
 
+    // returns true, and sets d, if s is a number, which the interpreter enters onto
+    // the stack
+    static bool IsNumber(const string& s, Number& d);
+
+    // Records every operation that changes the history in journal, which the
+    // interpreter does not own. A nullptr stops journaling. A session loaded while
+    // journaling is recorded by its contents, so that the journal can be recovered
+    // after the session's file has changed.
+    void setJournal(Journal* journal);
+
+    // loads a session, as load-session does, from the contents of its file, e.g., as
+    // Journal::Recover passes them
+    void loadSession(std::span<const std::byte> contents);
+
+    // Keeps the session in filename: loads the session saved there, if there is one
+    // and load is true, and then snapshots the session to it in the background every
+    // interval (never if interval is zero) and on save-session. Throws, keeping no
+    // session, if the saved session cannot be loaded. A session being recovered from
+    // a journal is not loaded, since the journal records the session it started from.
+    void setSession(const string& filename, std::chrono::seconds interval = DefaultSnapshotInterval,
+        bool load = true);
+
+    static constexpr std::chrono::seconds DefaultSnapshotInterval{60};
+
+    // Calls f before each command is interpreted, when no command is executing, so
+    // that f may change what commands refer to (e.g., reload plugins). An empty f
+    // stops the calls.
+    void setBeforeCommand(std::function<void()> f);
+
+    // give access to the commands of the history, as CommandManager does
+    void visitHistory(const std::function<void(const Command&)>& f);
+    void rebindHistory(const std::function<CommandPtr(const Command&)>& f);
+
+    // the footprint of the history, and a soft limit on it, as CommandManager's
+    size_t footprint();
+    void setMemoryLimit(size_t bytes);
+
+    // Adds a line to the breakdown printed by the mem command for memory that the
+    // interpreter cannot see (e.g., the plugins'): f returns its bytes.
+    void addFootprint(const string& name, std::function<size_t()> f);
+
 private:
     CommandInterpreter(const CommandInterpreter&) = delete;
     CommandInterpreter(CommandInterpreter&&) = delete;
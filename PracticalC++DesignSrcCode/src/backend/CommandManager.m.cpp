@@ -20,16 +20,36 @@ module;
 #include <stack>
 #include <vector>
 #include <list>
+#include <deque>
+#include <map>
+#include <string>
+#include <string_view>
+#include <span>
 #include <memory>
+#include <cstdint>
+#include <typeindex>
+#include <typeinfo>
+#include <algorithm>
+#include <functional>
 export module pdCalc_commandDispatcher:CommandManager;
 
 import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_utilities;
+import :HistoryLog;
+import :CoreCommands;
+import :CommandFactory;
+import :StoredProcedure;
 
 using std::unique_ptr;
 using std::make_unique;
 using std::stack;
 using std::vector;
 using std::list;
+using std::deque;
+using std::map;
+using std::string;
+using std::span;
 
 namespace pdCalc {
 
@@ -39,10 +59,19 @@ export class CommandManager
     class UndoRedoStackStrategy;
     class UndoRedoListStrategyVector;
     class UndoRedoListStrategy;
+    class UndoRedoSpillStrategy;
+    class UndoRedoFlatStrategy;
+    class PrototypeTable;
+    class SpilledHistory;
 public:
-    enum class UndoRedoStrategy { ListStrategy, StackStrategy, ListStrategyVector };
+    enum class UndoRedoStrategy { ListStrategy, StackStrategy, ListStrategyVector, SpillStrategy, FlatStrategy };
 
-    explicit CommandManager(UndoRedoStrategy st = UndoRedoStrategy::StackStrategy);
+    // number of undo (and redo) entries the SpillStrategy keeps in memory
+    static constexpr size_t DefaultHotWindowSize = 4096;
+
+    // hotWindowSize is only used by the SpillStrategy
+    explicit CommandManager(UndoRedoStrategy st = UndoRedoStrategy::StackStrategy,
+        size_t hotWindowSize = DefaultHotWindowSize);
     ~CommandManager() = default;
 
     size_t getUndoSize() const;
@@ -60,13 +89,92 @@ public:
     // to the undo stack. It does nothing if the redo stack is empty.
     void redo();
 
+    // These functions move through several steps of the history at once: undo(n) and
+    // redo(n) move n steps (or as many as are available), and jumpTo(k) moves to the
+    // position where k commands are on the undo stack. Where possible, the move
+    // restores the nearest stack checkpoint and replays forward from it instead of
+    // stepping through every command. The stack raises a single change event.
+    void undo(size_t n);
+    void redo(size_t n);
+    void jumpTo(size_t k);
+
+    // The stack is snapshotted every k commands, where k is the stack size clamped to
+    // [MinCheckpointSpacing, MaxCheckpointSpacing]. Copying a stack of size k every k
+    // commands costs about one element per command, while the cap bounds the number
+    // of commands replayed by a jump for large stacks.
+    static constexpr size_t MinCheckpointSpacing = 32;
+    static constexpr size_t MaxCheckpointSpacing = 1024;
+
+    // Passes every command of the history to f, oldest first: the undo stack from its
+    // bottom, then the redo stack from its top. The history is left unchanged.
+    void visitHistory(const std::function<void(const Command&)>& f);
+
+    // Replaces the history with commands, ordered as visitHistory passes them, of
+    // which the last nRedo go on the redo stack. No command is executed: the stack
+    // must already be the one the undo stack leads to.
+    void restoreHistory(vector<CommandPtr> commands, size_t nRedo);
+
+    // Replaces, in place, every command of the history for which f returns a command
+    // with the command it returns, e.g., to move commands to a reloaded plugin. The
+    // replacement must carry the same undo state. The stack is unchanged.
+    void rebindHistory(const std::function<CommandPtr(const Command&)>& f);
+
+    // The approximate number of bytes the history retains: its commands, as each
+    // reports through Command::footprint, and its checkpoints, which are also
+    // reported alone.
+    size_t footprint();
+    size_t checkpointFootprint() const;
+
+    // A soft limit on the history's footprint, or 0 (the default) for none. Each
+    // executed command adds its footprint to a running estimate. Once the estimate
+    // exceeds the limit, the footprint is measured, and the oldest undo entries are
+    // dropped until it is within three quarters of the limit, so that the history
+    // is not measured again on every command. Only undo entries are dropped, so a
+    // long redo stack may keep the history over the limit.
+    void setMemoryLimit(size_t bytes);
+    size_t getMemoryLimit() const { return memoryLimit_; }
+
+    // Drops the n oldest entries of the undo stack (or all of them, if fewer), which
+    // can no longer be undone. Positions in the history are then counted from the
+    // oldest entry kept.
+    void trimHistory(size_t n);
+
 private:
     CommandManager(CommandManager&) = delete;
     CommandManager(CommandManager&& ) = delete;
     CommandManager& operator=(CommandManager&) = delete;
     CommandManager& operator=(CommandManager&&) = delete;
 
+    struct Checkpoint
+    {
+        size_t position;
+        vector<Number> stack;
+    };
+
+    bool checkpointDue(size_t position) const;
+    void truncateCheckpoints(size_t position);
+    const Checkpoint* usableCheckpoint(size_t target, size_t current) const;
+    static size_t Footprint(const Checkpoint& cp);
+
+    // measures the history and trims it if it is over three quarters of the limit
+    void enforceMemoryLimit();
+
+    std::unique_ptr<CommandManagerStrategy> makeStrategy() const;
+
+    // replaces c with f's command for it, if any; shared by the strategies' rebind
+    static void Rebind(CommandPtr& c, const std::function<CommandPtr(const Command&)>& f);
+
+    UndoRedoStrategy st_;
+    size_t hotWindowSize_;
     std::unique_ptr<CommandManagerStrategy> strategy_;
+
+    // checkpoints and barriers are ordered by position; a barrier marks the position
+    // just after a command that is not replayable, which no jump may restore across
+    vector<Checkpoint> checkpoints_;
+    vector<size_t> barriers_;
+
+    size_t memoryLimit_;
+    size_t footprintEstimate_;
 };
 
 class CommandManager::CommandManagerStrategy
@@ -77,20 +185,156 @@ public:
     virtual size_t getUndoSize() const = 0;
     virtual size_t getRedoSize() const = 0;
 
-    virtual void executeCommand(CommandPtr c) = 0;
+    // returns the footprint of the command once executed
+    size_t executeCommand(CommandPtr c);
     virtual void undo() = 0;
     virtual void redo() = 0;
+
+    // move n commands between the undo and redo stacks without undoing or executing
+    // them; used when the stack is restored from a checkpoint
+    virtual void moveToRedo(size_t n) = 0;
+    virtual void moveToUndo(size_t n) = 0;
+
+    // enters an already executed command onto the undo stack and clears the redo
+    // stack; executeCommand is execute followed by record
+    virtual void record(CommandPtr c) = 0;
+
+    // passes every command to f, oldest first, i.e., the undo stack from its bottom
+    // and then the redo stack from its top, leaving the history unchanged
+    virtual void visit(const std::function<void(const Command&)>& f) = 0;
+
+    // replaces each command for which f returns a command, keeping its position
+    virtual void rebind(const std::function<CommandPtr(const Command&)>& f) = 0;
+
+    // the approximate number of bytes retained for the commands; by default, each
+    // command's footprint and a pointer to it
+    virtual size_t footprint();
+
+    // drops the n oldest commands of the undo stack, or all of them if fewer
+    virtual void dropOldest(size_t n) = 0;
+
+protected:
+    // the strategies undo and redo commands through these, so that they are timed
+    // if statistics are collected
+    static void Undo(Command& c);
+    static void Redo(Command& c);
 };
 
+// instrumentation for the stats and perfstats commands, which is compiled out
+// without PDCALC_STATS and PDCALC_PERF_COUNTERS
+#ifdef PDCALC_STATS
+#define STATS(...) __VA_ARGS__
+#else
+#define STATS(...)
+#endif
+
+#ifdef PDCALC_PERF_COUNTERS
+#define PERF(...) __VA_ARGS__
+#else
+#define PERF(...)
+#endif
+
+#if defined(PDCALC_STATS) || defined(PDCALC_PERF_COUNTERS)
+
+namespace {
+
+// the name under which the latencies and counters of c are recorded
+string statsName(const Command& c)
+{
+    if( typeid(c) == typeid(EnterNumber) ) return "number";
+    if( typeid(c) == typeid(StoredProcedure) ) return "proc";
+
+    auto name = CommandFactory::Instance().commandName(c);
+
+    return name.empty() ? "other" : name;
+}
+
+// the kind of command under which the counters of c are also recorded
+[[maybe_unused]] std::string_view commandKind(const Command& c, const string& name)
+{
+    if( typeid(c) == typeid(EnterNumber) || CommandFactory::Instance().isCoreCommand(name) ) return "core";
+    if( typeid(c) == typeid(StoredProcedure) ) return "procedure";
+
+    return CommandFactory::Instance().hasKey(name) ? "plugin" : "other";
+}
+
+}
+
+#endif
+
+size_t CommandManager::CommandManagerStrategy::executeCommand(CommandPtr c)
+{
+#if defined(PDCALC_STATS) || defined(PDCALC_PERF_COUNTERS)
+    {
+        const string name = statsName(*c);
+        PERF( PerfCounters::Context context{name, commandKind(*c, name)}; )
+        STATS( Stats::Timer timer{Stats::Operation::Execute, name}; )
+        c->execute();
+    }
+#else
+    c->execute();
+#endif
+    const auto bytes = c->footprint();
+    record( std::move(c) );
+
+    return bytes;
+}
+
+size_t CommandManager::CommandManagerStrategy::footprint()
+{
+    size_t bytes = 0;
+    visit([&](const Command& c){ bytes += sizeof(CommandPtr) + c.footprint(); });
+
+    return bytes;
+}
+
+void CommandManager::CommandManagerStrategy::Undo(Command& c)
+{
+#ifdef PDCALC_STATS
+    const string name = statsName(c);
+    Stats::Timer timer{Stats::Operation::Undo, name};
+#endif
+    c.undo();
+
+    return;
+}
+
+void CommandManager::CommandManagerStrategy::Redo(Command& c)
+{
+#if defined(PDCALC_STATS) || defined(PDCALC_PERF_COUNTERS)
+    const string name = statsName(c);
+    PERF( PerfCounters::Context context{name, commandKind(c, name)}; )
+    STATS( Stats::Timer timer{Stats::Operation::Redo, name}; )
+#endif
+    c.execute();
+
+    return;
+}
+
+void CommandManager::Rebind(CommandPtr& c, const std::function<CommandPtr(const Command&)>& f)
+{
+    if(c)
+    {
+        if( auto r = f(*c) ) c = std::move(r);
+    }
+
+    return;
+}
+
 class CommandManager::UndoRedoStackStrategy : public CommandManager::CommandManagerStrategy
 {
 public:
     size_t getUndoSize() const override { return undoStack_.size(); }
     size_t getRedoSize() const override { return redoStack_.size(); }
 
-    void executeCommand(CommandPtr c) override;
     void undo() override;
     void redo() override;
+    void moveToRedo(size_t n) override;
+    void moveToUndo(size_t n) override;
+    void record(CommandPtr c) override;
+    void visit(const std::function<void(const Command&)>& f) override;
+    void rebind(const std::function<CommandPtr(const Command&)>& f) override;
+    void dropOldest(size_t n) override;
 
 private:
     void flushStack(stack<CommandPtr>& st);
@@ -99,10 +343,8 @@ private:
     stack<CommandPtr> redoStack_;
 };
 
-void CommandManager::UndoRedoStackStrategy::executeCommand(CommandPtr c)
+void CommandManager::UndoRedoStackStrategy::record(CommandPtr c)
 {
-    c->execute();
-
     undoStack_.push( std::move(c) );
     flushStack(redoStack_);
 
@@ -114,7 +356,7 @@ void CommandManager::UndoRedoStackStrategy::undo()
     if( getUndoSize() == 0 ) return;
 
     auto& c = undoStack_.top();
-    c->undo();
+    Undo(*c);
 
     redoStack_.push( std::move(c) );
     undoStack_.pop();
@@ -127,7 +369,7 @@ void CommandManager::UndoRedoStackStrategy::redo()
     if( getRedoSize() == 0 ) return;
 
     auto& c = redoStack_.top();
-    c->execute();
+    Redo(*c);
 
     undoStack_.push( std::move(c) );
     redoStack_.pop();
@@ -135,6 +377,99 @@ void CommandManager::UndoRedoStackStrategy::redo()
     return;
 }
 
+void CommandManager::UndoRedoStackStrategy::moveToRedo(size_t n)
+{
+    for(auto i = 0u; i < n && !undoStack_.empty(); ++i)
+    {
+        redoStack_.push( std::move(undoStack_.top()) );
+        undoStack_.pop();
+    }
+
+    return;
+}
+
+void CommandManager::UndoRedoStackStrategy::moveToUndo(size_t n)
+{
+    for(auto i = 0u; i < n && !redoStack_.empty(); ++i)
+    {
+        undoStack_.push( std::move(redoStack_.top()) );
+        redoStack_.pop();
+    }
+
+    return;
+}
+
+void CommandManager::UndoRedoStackStrategy::visit(const std::function<void(const Command&)>& f)
+{
+    // a stack can only be walked by popping it, so the commands are popped into a
+    // vector and pushed back afterward
+    vector<CommandPtr> commands;
+    while( !undoStack_.empty() )
+    {
+        commands.push_back( std::move(undoStack_.top()) );
+        undoStack_.pop();
+    }
+
+    for(auto i = commands.rbegin(); i != commands.rend(); ++i)
+    {
+        f(**i);
+        undoStack_.push( std::move(*i) );
+    }
+
+    commands.clear();
+    while( !redoStack_.empty() )
+    {
+        f(*redoStack_.top());
+        commands.push_back( std::move(redoStack_.top()) );
+        redoStack_.pop();
+    }
+
+    for(auto i = commands.rbegin(); i != commands.rend(); ++i)
+        redoStack_.push( std::move(*i) );
+
+    return;
+}
+
+void CommandManager::UndoRedoStackStrategy::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    // as in visit, each stack is walked by popping it
+    for(auto st : {&undoStack_, &redoStack_})
+    {
+        vector<CommandPtr> commands;
+        while( !st->empty() )
+        {
+            commands.push_back( std::move(st->top()) );
+            st->pop();
+        }
+
+        for(auto i = commands.rbegin(); i != commands.rend(); ++i)
+        {
+            Rebind(*i, f);
+            st->push( std::move(*i) );
+        }
+    }
+
+    return;
+}
+
+void CommandManager::UndoRedoStackStrategy::dropOldest(size_t n)
+{
+    // the oldest commands are at the bottom of the stack, so the newer ones are
+    // popped and pushed back over them
+    vector<CommandPtr> commands;
+    while( undoStack_.size() > n )
+    {
+        commands.push_back( std::move(undoStack_.top()) );
+        undoStack_.pop();
+    }
+
+    flushStack(undoStack_);
+    for(auto i = commands.rbegin(); i != commands.rend(); ++i)
+        undoStack_.push( std::move(*i) );
+
+    return;
+}
+
 void CommandManager::UndoRedoStackStrategy::flushStack(stack<CommandPtr>& st)
 {
     while( !st.empty() )
@@ -153,9 +488,14 @@ public:
     size_t getUndoSize() const override { return undoSize_;}
     size_t getRedoSize() const override { return redoSize_; }
 
-    void executeCommand(CommandPtr c) override;
     void undo() override;
     void redo() override;
+    void moveToRedo(size_t n) override;
+    void moveToUndo(size_t n) override;
+    void record(CommandPtr c) override;
+    void visit(const std::function<void(const Command&)>& f) override;
+    void rebind(const std::function<CommandPtr(const Command&)>& f) override;
+    void dropOldest(size_t n) override;
 
 private:
     void flush();
@@ -166,10 +506,8 @@ private:
     vector<CommandPtr> undoRedoList_;
 };
 
-void CommandManager::UndoRedoListStrategyVector::executeCommand(CommandPtr c)
+void CommandManager::UndoRedoListStrategyVector::record(CommandPtr c)
 {
-    c->execute();
-
     flush();
     undoRedoList_.emplace_back( std::move(c) );
     cur_ = undoRedoList_.size() - 1;
@@ -183,7 +521,7 @@ void CommandManager::UndoRedoListStrategyVector::undo()
 {
     if(getUndoSize() == 0) return;
 
-    undoRedoList_[cur_]->undo();
+    Undo( *undoRedoList_[cur_] );
     --cur_;
     --undoSize_;
     ++redoSize_;
@@ -196,13 +534,59 @@ void CommandManager::UndoRedoListStrategyVector::redo()
     if(getRedoSize() == 0) return;
 
     ++cur_;
-    undoRedoList_[cur_]->execute();
+    Redo( *undoRedoList_[cur_] );
     --redoSize_;
     ++undoSize_;
 
     return;
 }
 
+void CommandManager::UndoRedoListStrategyVector::moveToRedo(size_t n)
+{
+    n = std::min(n, undoSize_);
+    cur_ -= static_cast<int>(n);
+    undoSize_ -= n;
+    redoSize_ += n;
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategyVector::moveToUndo(size_t n)
+{
+    n = std::min(n, redoSize_);
+    cur_ += static_cast<int>(n);
+    redoSize_ -= n;
+    undoSize_ += n;
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategyVector::visit(const std::function<void(const Command&)>& f)
+{
+    for(const auto& c : undoRedoList_)
+        f(*c);
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategyVector::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    for(auto& c : undoRedoList_)
+        Rebind(c, f);
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategyVector::dropOldest(size_t n)
+{
+    n = std::min(n, undoSize_);
+    undoRedoList_.erase( undoRedoList_.begin(), undoRedoList_.begin() + n );
+    cur_ -= static_cast<int>(n);
+    undoSize_ -= n;
+
+    return;
+}
+
 void CommandManager::UndoRedoListStrategyVector::flush()
 {
     if(!undoRedoList_.empty()) undoRedoList_.erase(undoRedoList_.begin() + cur_ + 1, undoRedoList_.end());
@@ -218,9 +602,14 @@ public:
     size_t getUndoSize() const override { return undoSize_; }
     size_t getRedoSize() const override { return redoSize_; }
 
-    void executeCommand(CommandPtr c) override;
     void undo() override;
     void redo() override;
+    void moveToRedo(size_t n) override;
+    void moveToUndo(size_t n) override;
+    void record(CommandPtr c) override;
+    void visit(const std::function<void(const Command&)>& f) override;
+    void rebind(const std::function<CommandPtr(const Command&)>& f) override;
+    void dropOldest(size_t n) override;
 
 private:
     void flush();
@@ -241,10 +630,8 @@ CommandManager::UndoRedoListStrategy::UndoRedoListStrategy()
     cur_ = undoRedoList_.end();
 }
 
-void CommandManager::UndoRedoListStrategy::executeCommand(CommandPtr c)
+void CommandManager::UndoRedoListStrategy::record(CommandPtr c)
 {
-    c->execute();
-
     flush();
     undoRedoList_.emplace_back( std::move(c) );
     ++undoSize_;
@@ -261,7 +648,7 @@ void CommandManager::UndoRedoListStrategy::undo()
 
     --undoSize_;
     ++redoSize_;
-    (*cur_)->undo();
+    Undo( **cur_ );
     --cur_;
 
     return;
@@ -274,7 +661,60 @@ void CommandManager::UndoRedoListStrategy::redo()
     --redoSize_;
     ++undoSize_;
     ++cur_;
-    (*cur_)->execute();
+    Redo( **cur_ );
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategy::moveToRedo(size_t n)
+{
+    n = std::min(n, undoSize_);
+    std::advance(cur_, -static_cast<long>(n));
+    undoSize_ -= n;
+    redoSize_ += n;
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategy::moveToUndo(size_t n)
+{
+    n = std::min(n, redoSize_);
+    std::advance(cur_, n);
+    redoSize_ -= n;
+    undoSize_ += n;
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategy::visit(const std::function<void(const Command&)>& f)
+{
+    // skip the empty spot at the front
+    for(auto i = std::next( undoRedoList_.begin() ); i != undoRedoList_.end(); ++i)
+        f(**i);
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategy::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    // the empty spot at the front is skipped by Rebind
+    for(auto& c : undoRedoList_)
+        Rebind(c, f);
+
+    return;
+}
+
+void CommandManager::UndoRedoListStrategy::dropOldest(size_t n)
+{
+    n = std::min(n, undoSize_);
+    if(n == 0) return;
+
+    // with no undo entries left, the current position is the empty spot at the front
+    if(n == undoSize_) cur_ = undoRedoList_.begin();
+
+    auto first = std::next( undoRedoList_.begin() );
+    undoRedoList_.erase( first, std::next(first, n) );
+    undoSize_ -= n;
 
     return;
 }
@@ -291,50 +731,890 @@ void CommandManager::UndoRedoListStrategy::flush()
     return;
 }
 
-CommandManager::CommandManager(UndoRedoStrategy st)
+// Interns command types so that a serialized command can be rehydrated by cloning
+// a prototype of its type and restoring the serialized state into the clone. Types
+// are keyed by dynamic type and help message, since BinaryCommandAlternative uses
+// one type for several commands.
+class CommandManager::PrototypeTable
 {
-    switch(st)
-    {
-    case UndoRedoStrategy::ListStrategy:
-        strategy_ = make_unique<UndoRedoListStrategy>();
-        break;
+public:
+    // opcode reserved for records of commands that could not be serialized
+    static constexpr uint32_t Resident = 0;
 
-    case UndoRedoStrategy::StackStrategy:
-        strategy_ = make_unique<UndoRedoStackStrategy>();
-        break;
+    // returns the opcode for the type of c, adding a prototype if the type is new;
+    // returns Resident if no prototype can be made
+    uint32_t intern(const Command& c);
 
-    case UndoRedoStrategy::ListStrategyVector:
-        strategy_ = make_unique<UndoRedoListStrategyVector>();
-        break;
+    CommandPtr rehydrate(uint32_t opcode, span<const Number> operands) const;
+
+    // restores operands into the prototype itself and returns it, so a command can be
+    // undone or redone without allocating a new one
+    Command& load(uint32_t opcode, span<const Number> operands);
+
+    // replaces prototypes as the history's rebind does; records keep their opcodes
+    void rebind(const std::function<CommandPtr(const Command&)>& f);
+
+    // the footprint of the prototypes
+    size_t footprint() const;
+
+private:
+    // keyed by help message within each type; looked up without building a string
+    map<std::type_index, map<string, uint32_t, std::less<>>> opcodes_;
+    vector<CommandPtr> prototypes_;
+};
+
+uint32_t CommandManager::PrototypeTable::intern(const Command& c)
+{
+    auto& byHelp = opcodes_[typeid(c)];
+    std::string_view help{ c.helpMessage() };
+
+    if( auto i = byHelp.find(help); i != byHelp.end() )
+        return i->second;
+
+    auto p = MakeCommandPtr( c.clone() );
+    if(!p) return Resident;
+
+    prototypes_.push_back( std::move(p) );
+    uint32_t opcode = static_cast<uint32_t>( prototypes_.size() );
+    byHelp.emplace(help, opcode);
+
+    return opcode;
+}
+
+CommandPtr CommandManager::PrototypeTable::rehydrate(uint32_t opcode, span<const Number> operands) const
+{
+    auto c = MakeCommandPtr( prototypes_[opcode - 1]->clone() );
+    c->deserialize(operands);
+
+    return c;
+}
+
+Command& CommandManager::PrototypeTable::load(uint32_t opcode, span<const Number> operands)
+{
+    auto& c = *prototypes_[opcode - 1];
+    c.deserialize(operands);
+
+    return c;
+}
+
+void CommandManager::PrototypeTable::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    bool rebound = false;
+    for(auto& p : prototypes_)
+    {
+        if( auto r = f(*p) )
+        {
+            p = std::move(r);
+            rebound = true;
+        }
     }
+
+    // a replacement may be of another type (one from another library, say), and the
+    // keys of the replaced types must not outlive them
+    if(rebound)
+    {
+        opcodes_.clear();
+        for(uint32_t i = 0; i < prototypes_.size(); ++i)
+            opcodes_[typeid(*prototypes_[i])].emplace( prototypes_[i]->helpMessage(), i + 1 );
+    }
+
+    return;
 }
 
-size_t CommandManager::getUndoSize() const
+size_t CommandManager::PrototypeTable::footprint() const
 {
-    return strategy_->getUndoSize();
+    size_t bytes = prototypes_.capacity() * sizeof(CommandPtr);
+    for(const auto& p : prototypes_) bytes += p->footprint();
+
+    return bytes;
 }
 
-size_t CommandManager::getRedoSize() const
+// One side (undo or redo) of a spilled history. The entries nearest the current
+// position are kept in memory; once more than hotWindowSize entries accumulate,
+// the farthest entry is serialized into a HistoryLog. Because entries are spilled
+// farthest first, the tail of the log is always the nearest spilled entry, and
+// entries are rehydrated from the tail once the in-memory window runs dry.
+//
+// Commands that cannot be serialized (stored procedures and plugin commands that
+// do not implement the serialization hook) are kept resident: the log records a
+// placeholder, and the command itself waits in a side stack in the same order.
+class CommandManager::SpilledHistory
 {
-    return strategy_->getRedoSize();
+public:
+    SpilledHistory(PrototypeTable& prototypes, size_t hotWindowSize);
+
+    size_t size() const { return hot_.size() + log_.size(); }
+
+    // adds c as the entry nearest the current position
+    void push(CommandPtr c);
+
+    // removes and returns the entry nearest the current position
+    CommandPtr pop();
+
+    void clear();
+
+    // passes every entry to f, starting from the farthest from the current position
+    // if farthestFirst or else from the nearest
+    void visit(const std::function<void(const Command&)>& f, bool farthestFirst);
+
+    // rebinds the entries held in memory; spilled entries are rebound with prototypes
+    void rebind(const std::function<CommandPtr(const Command&)>& f);
+
+    // the footprint of the entries held in memory
+    size_t footprint() const;
+
+    // drops the n entries farthest from the current position, or all if fewer
+    void dropFarthest(size_t n);
+
+private:
+    void spill();
+
+    PrototypeTable& prototypes_;
+    size_t hotWindowSize_;
+    deque<CommandPtr> hot_;
+    HistoryLog log_;
+    vector<CommandPtr> resident_;
+    vector<Number> operands_;
+};
+
+CommandManager::SpilledHistory::SpilledHistory(PrototypeTable& prototypes, size_t hotWindowSize)
+: prototypes_{prototypes}
+, hotWindowSize_{hotWindowSize}
+{ }
+
+void CommandManager::SpilledHistory::push(CommandPtr c)
+{
+    hot_.push_back( std::move(c) );
+    if(hot_.size() > hotWindowSize_) spill();
+
+    return;
 }
 
-void CommandManager::executeCommand(CommandPtr c)
+CommandPtr CommandManager::SpilledHistory::pop()
+{
+    if( !hot_.empty() )
+    {
+        auto c = std::move( hot_.back() );
+        hot_.pop_back();
+        return c;
+    }
+
+    operands_.clear();
+    if( auto opcode = log_.pop(operands_); opcode != PrototypeTable::Resident )
+        return prototypes_.rehydrate(opcode, operands_);
+
+    auto c = std::move( resident_.back() );
+    resident_.pop_back();
+
+    return c;
+}
+
+void CommandManager::SpilledHistory::clear()
 {
-    strategy_->executeCommand( std::move(c) );
+    hot_.clear();
+    log_.clear();
+    resident_.clear();
+
     return;
 }
 
-void CommandManager::undo()
+// the log holds the farthest entries, and its Resident records appear in the same
+// order as the commands in resident_
+void CommandManager::SpilledHistory::visit(const std::function<void(const Command&)>& f, bool farthestFirst)
 {
-    strategy_->undo();
+    auto visitLog = [&]
+    {
+        size_t resident = farthestFirst ? 0 : resident_.size();
+        log_.visit([&](uint32_t opcode, span<const Number> operands)
+        {
+            if(opcode != PrototypeTable::Resident)
+                f( prototypes_.load(opcode, operands) );
+            else
+                f( *resident_[farthestFirst ? resident++ : --resident] );
+        }, !farthestFirst);
+    };
+
+    if(farthestFirst)
+    {
+        visitLog();
+        for(const auto& c : hot_) f(*c);
+    }
+    else
+    {
+        for(auto i = hot_.rbegin(); i != hot_.rend(); ++i) f(**i);
+        visitLog();
+    }
+
     return;
 }
 
-void CommandManager::redo()
+void CommandManager::SpilledHistory::rebind(const std::function<CommandPtr(const Command&)>& f)
 {
-    strategy_->redo();
+    for(auto& c : hot_) Rebind(c, f);
+    for(auto& c : resident_) Rebind(c, f);
+
+    return;
+}
+
+size_t CommandManager::SpilledHistory::footprint() const
+{
+    size_t bytes = operands_.capacity() * sizeof(Number) + log_.residentBytes();
+    for(const auto& c : hot_) bytes += sizeof(CommandPtr) + c->footprint();
+    for(const auto& c : resident_) bytes += sizeof(CommandPtr) + c->footprint();
+
+    return bytes;
+}
+
+// The farthest entries are at the head of the log, and then at the front of hot_.
+// Those dropped from the log are never rehydrated, and the records kept stay where
+// they are.
+void CommandManager::SpilledHistory::dropFarthest(size_t n)
+{
+    const auto spilled = std::min( n, log_.size() );
+    size_t resident = 0;
+    log_.dropHead(spilled, [&](uint32_t opcode){ if(opcode == PrototypeTable::Resident) ++resident; });
+    resident_.erase( resident_.begin(), resident_.begin() + resident );
+
+    n -= spilled;
+    hot_.erase( hot_.begin(), hot_.begin() + std::min( n, hot_.size() ) );
+
     return;
 }
 
+void CommandManager::SpilledHistory::spill()
+{
+    auto c = std::move( hot_.front() );
+    hot_.pop_front();
+
+    operands_.clear();
+    uint32_t opcode = c->serialize(operands_) ? prototypes_.intern(*c) : PrototypeTable::Resident;
+
+    if(opcode == PrototypeTable::Resident)
+    {
+        operands_.clear();
+        resident_.push_back( std::move(c) );
+    }
+
+    log_.push(opcode, operands_);
+
+    return;
+}
+
+// Keeps a bounded window of recent undo and redo entries in memory and spills older
+// entries to disk, trading rehydration cost on deep undo for bounded memory use.
+class CommandManager::UndoRedoSpillStrategy : public CommandManager::CommandManagerStrategy
+{
+public:
+    explicit UndoRedoSpillStrategy(size_t hotWindowSize);
+
+    size_t getUndoSize() const override { return undo_.size(); }
+    size_t getRedoSize() const override { return redo_.size(); }
+
+    void undo() override;
+    void redo() override;
+    void moveToRedo(size_t n) override;
+    void moveToUndo(size_t n) override;
+    void record(CommandPtr c) override;
+    void visit(const std::function<void(const Command&)>& f) override;
+    void rebind(const std::function<CommandPtr(const Command&)>& f) override;
+    size_t footprint() override;
+    void dropOldest(size_t n) override;
+
+private:
+    PrototypeTable prototypes_;
+    SpilledHistory undo_;
+    SpilledHistory redo_;
+};
+
+CommandManager::UndoRedoSpillStrategy::UndoRedoSpillStrategy(size_t hotWindowSize)
+: undo_{prototypes_, hotWindowSize}
+, redo_{prototypes_, hotWindowSize}
+{ }
+
+void CommandManager::UndoRedoSpillStrategy::record(CommandPtr c)
+{
+    undo_.push( std::move(c) );
+    redo_.clear();
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::undo()
+{
+    if( getUndoSize() == 0 ) return;
+
+    auto c = undo_.pop();
+    Undo(*c);
+
+    redo_.push( std::move(c) );
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::redo()
+{
+    if( getRedoSize() == 0 ) return;
+
+    auto c = redo_.pop();
+    try
+    {
+        Redo(*c);
+    }
+    catch(...)
+    {
+        redo_.push( std::move(c) );
+        throw;
+    }
+
+    undo_.push( std::move(c) );
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::moveToRedo(size_t n)
+{
+    for(auto i = 0u; i < n && undo_.size() > 0; ++i)
+        redo_.push( undo_.pop() );
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::moveToUndo(size_t n)
+{
+    for(auto i = 0u; i < n && redo_.size() > 0; ++i)
+        undo_.push( redo_.pop() );
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::visit(const std::function<void(const Command&)>& f)
+{
+    undo_.visit(f, true);
+    redo_.visit(f, false);
+
+    return;
+}
+
+void CommandManager::UndoRedoSpillStrategy::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    prototypes_.rebind(f);
+    undo_.rebind(f);
+    redo_.rebind(f);
+
+    return;
+}
+
+size_t CommandManager::UndoRedoSpillStrategy::footprint()
+{
+    return prototypes_.footprint() + undo_.footprint() + redo_.footprint();
+}
+
+void CommandManager::UndoRedoSpillStrategy::dropOldest(size_t n)
+{
+    undo_.dropFarthest(n);
+
+    return;
+}
+
+// Stores the history as a contiguous array of fixed-size records, with each core
+// command's undo state packed into a shared operand pool, instead of as one heap
+// object per command. A record is undone or redone by loading its state into the
+// single prototype kept for its type. Plugin commands and commands that cannot be
+// serialized (e.g., stored procedures) keep the polymorphic path: they are held as
+// objects, and their records index them.
+class CommandManager::UndoRedoFlatStrategy : public CommandManager::CommandManagerStrategy
+{
+public:
+    UndoRedoFlatStrategy() : cur_{0} { }
+
+    size_t getUndoSize() const override { return cur_; }
+    size_t getRedoSize() const override { return records_.size() - cur_; }
+
+    void undo() override;
+    void redo() override;
+    void moveToRedo(size_t n) override;
+    void moveToUndo(size_t n) override;
+    void record(CommandPtr c) override;
+    void visit(const std::function<void(const Command&)>& f) override;
+    void rebind(const std::function<CommandPtr(const Command&)>& f) override;
+    size_t footprint() override;
+    void dropOldest(size_t n) override;
+
+private:
+    // offset indexes operands_ for core commands and resident_ for Resident records
+    struct Record
+    {
+        uint32_t opcode;
+        uint32_t nOperands;
+        size_t offset;
+    };
+
+    Command& command(const Record& r);
+    void flush();
+
+    PrototypeTable prototypes_;
+    vector<Record> records_;
+    vector<Number> operands_;
+    vector<CommandPtr> resident_;
+    size_t cur_;
+};
+
+void CommandManager::UndoRedoFlatStrategy::record(CommandPtr c)
+{
+    flush();
+
+    Record r{PrototypeTable::Resident, 0, operands_.size()};
+    if( !dynamic_cast<PluginCommand*>( c.get() ) && c->serialize(operands_) )
+        r.opcode = prototypes_.intern(*c);
+
+    if(r.opcode == PrototypeTable::Resident)
+    {
+        operands_.resize(r.offset);
+        r.offset = resident_.size();
+        resident_.push_back( std::move(c) );
+    }
+    else
+        r.nOperands = static_cast<uint32_t>( operands_.size() - r.offset );
+
+    records_.push_back(r);
+    ++cur_;
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::undo()
+{
+    if( getUndoSize() == 0 ) return;
+
+    Undo( command( records_[cur_ - 1] ) );
+    --cur_;
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::redo()
+{
+    if( getRedoSize() == 0 ) return;
+
+    // redoing a command on the stack it was first executed on reproduces the same
+    // undo state, so the record never needs to be rewritten
+    Redo( command( records_[cur_] ) );
+    ++cur_;
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::moveToRedo(size_t n)
+{
+    cur_ -= std::min(n, getUndoSize());
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::moveToUndo(size_t n)
+{
+    cur_ += std::min(n, getRedoSize());
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::visit(const std::function<void(const Command&)>& f)
+{
+    for(const auto& r : records_)
+        f( command(r) );
+
+    return;
+}
+
+void CommandManager::UndoRedoFlatStrategy::rebind(const std::function<CommandPtr(const Command&)>& f)
+{
+    prototypes_.rebind(f);
+    for(auto& c : resident_)
+        Rebind(c, f);
+
+    return;
+}
+
+size_t CommandManager::UndoRedoFlatStrategy::footprint()
+{
+    size_t bytes = prototypes_.footprint() + records_.capacity() * sizeof(Record)
+        + operands_.capacity() * sizeof(Number) + resident_.capacity() * sizeof(CommandPtr);
+    for(const auto& c : resident_) bytes += c->footprint();
+
+    return bytes;
+}
+
+// as in flush, the first record kept of each kind marks where its storage now starts
+void CommandManager::UndoRedoFlatStrategy::dropOldest(size_t n)
+{
+    n = std::min(n, cur_);
+    if(n == 0) return;
+
+    size_t operandsStart = operands_.size();
+    size_t residentStart = resident_.size();
+    bool operandsFound = false;
+    bool residentFound = false;
+    for(auto i = n; i < records_.size() && !(operandsFound && residentFound); ++i)
+    {
+        const auto& r = records_[i];
+        if(r.opcode == PrototypeTable::Resident && !residentFound)
+        {
+            residentStart = r.offset;
+            residentFound = true;
+        }
+        else if(r.opcode != PrototypeTable::Resident && !operandsFound)
+        {
+            operandsStart = r.offset;
+            operandsFound = true;
+        }
+    }
+
+    operands_.erase( operands_.begin(), operands_.begin() + operandsStart );
+    resident_.erase( resident_.begin(), resident_.begin() + residentStart );
+    records_.erase( records_.begin(), records_.begin() + n );
+    for(auto& r : records_)
+        r.offset -= r.opcode == PrototypeTable::Resident ? residentStart : operandsStart;
+
+    // erasing keeps the capacity, which the footprint counts
+    operands_.shrink_to_fit();
+    resident_.shrink_to_fit();
+    records_.shrink_to_fit();
+
+    cur_ -= n;
+
+    return;
+}
+
+Command& CommandManager::UndoRedoFlatStrategy::command(const Record& r)
+{
+    if(r.opcode == PrototypeTable::Resident)
+        return *resident_[r.offset];
+
+    return prototypes_.load( r.opcode, span<const Number>{operands_}.subspan(r.offset, r.nOperands) );
+}
+
+// records, operands, and resident commands are all appended in history order, so the
+// first redo record of each kind marks where its storage is truncated
+void CommandManager::UndoRedoFlatStrategy::flush()
+{
+    bool operandsFound = false;
+    bool residentFound = false;
+    for(auto i = cur_; i < records_.size() && !(operandsFound && residentFound); ++i)
+    {
+        const auto& r = records_[i];
+        if(r.opcode == PrototypeTable::Resident && !residentFound)
+        {
+            resident_.erase(resident_.begin() + r.offset, resident_.end());
+            residentFound = true;
+        }
+        else if(r.opcode != PrototypeTable::Resident && !operandsFound)
+        {
+            operands_.resize(r.offset);
+            operandsFound = true;
+        }
+    }
+
+    records_.resize(cur_);
+
+    return;
+}
+
+CommandManager::CommandManager(UndoRedoStrategy st, size_t hotWindowSize)
+: st_{st}
+, hotWindowSize_{hotWindowSize}
+, strategy_{ makeStrategy() }
+, memoryLimit_{0}
+, footprintEstimate_{0}
+{ }
+
+std::unique_ptr<CommandManager::CommandManagerStrategy> CommandManager::makeStrategy() const
+{
+    switch(st_)
+    {
+    case UndoRedoStrategy::ListStrategy:
+        return make_unique<UndoRedoListStrategy>();
+
+    case UndoRedoStrategy::StackStrategy:
+        return make_unique<UndoRedoStackStrategy>();
+
+    case UndoRedoStrategy::ListStrategyVector:
+        return make_unique<UndoRedoListStrategyVector>();
+
+    case UndoRedoStrategy::SpillStrategy:
+        return make_unique<UndoRedoSpillStrategy>(hotWindowSize_);
+
+    case UndoRedoStrategy::FlatStrategy:
+        return make_unique<UndoRedoFlatStrategy>();
+    }
+
+    return nullptr;
+}
+
+size_t CommandManager::getUndoSize() const
+{
+    return strategy_->getUndoSize();
+}
+
+size_t CommandManager::getRedoSize() const
+{
+    return strategy_->getRedoSize();
+}
+
+void CommandManager::executeCommand(CommandPtr c)
+{
+    const auto position = getUndoSize();
+    const bool replayable = c->replayable();
+
+    vector<Number> snapshot;
+    const bool due = checkpointDue(position);
+    if(due) snapshot = Stack::Instance().contents();
+
+    auto bytes = strategy_->executeCommand( std::move(c) );
+
+    // the redo stack was just flushed, so later checkpoints belong to a dead branch
+    truncateCheckpoints(position);
+    if(due)
+    {
+        checkpoints_.push_back( Checkpoint{position, std::move(snapshot)} );
+        bytes += Footprint( checkpoints_.back() );
+    }
+
+    // checkpoint right after a barrier so that jumps beyond it remain cheap
+    if(!replayable)
+    {
+        barriers_.push_back(position + 1);
+        checkpoints_.push_back( Checkpoint{position + 1, Stack::Instance().contents()} );
+        bytes += Footprint( checkpoints_.back() );
+    }
+
+    // the estimate ignores what flushing the redo stack freed, which measuring the
+    // history corrects
+    if(memoryLimit_ > 0)
+    {
+        footprintEstimate_ += bytes;
+        if(footprintEstimate_ > memoryLimit_) enforceMemoryLimit();
+    }
+
+    return;
+}
+
+void CommandManager::undo()
+{
+    strategy_->undo();
+    return;
+}
+
+void CommandManager::redo()
+{
+    strategy_->redo();
+    return;
+}
+
+void CommandManager::undo(size_t n)
+{
+    const auto position = getUndoSize();
+    jumpTo( position - std::min(n, position) );
+
+    return;
+}
+
+void CommandManager::redo(size_t n)
+{
+    jumpTo( getUndoSize() + std::min(n, getRedoSize()) );
+
+    return;
+}
+
+void CommandManager::jumpTo(size_t k)
+{
+    const auto current = getUndoSize();
+    const auto target = std::min(k, current + getRedoSize());
+    if(target == current) return;
+
+    StackChangeBatch batch;
+
+    const auto direct = target > current ? target - current : current - target;
+    const auto cp = usableCheckpoint(target, current);
+
+    if(cp && target - cp->position < direct)
+    {
+        Stack::Instance().restore(cp->stack);
+
+        if(cp->position < current)
+            strategy_->moveToRedo(current - cp->position);
+        else
+            strategy_->moveToUndo(cp->position - current);
+
+        for(auto i = cp->position; i < target; ++i)
+            strategy_->redo();
+    }
+    else if(target < current)
+    {
+        for(auto i = target; i < current; ++i)
+            strategy_->undo();
+    }
+    else
+    {
+        for(auto i = current; i < target; ++i)
+            strategy_->redo();
+    }
+
+    return;
+}
+
+void CommandManager::visitHistory(const std::function<void(const Command&)>& f)
+{
+    strategy_->visit(f);
+
+    return;
+}
+
+void CommandManager::restoreHistory(vector<CommandPtr> commands, size_t nRedo)
+{
+    nRedo = std::min( nRedo, commands.size() );
+    const auto position = commands.size() - nRedo;
+
+    strategy_ = makeStrategy();
+    checkpoints_.clear();
+    barriers_.clear();
+
+    for(size_t i = 0; i < commands.size(); ++i)
+    {
+        if( !commands[i]->replayable() ) barriers_.push_back(i + 1);
+        strategy_->record( std::move(commands[i]) );
+    }
+    strategy_->moveToRedo(nRedo);
+
+    // the stack is only known at the current position; jumps away from it step
+    // through the commands until checkpoints are taken again
+    checkpoints_.push_back( Checkpoint{position, Stack::Instance().contents()} );
+
+    if(memoryLimit_ > 0) enforceMemoryLimit();
+
+    return;
+}
+
+void CommandManager::rebindHistory(const std::function<CommandPtr(const Command&)>& f)
+{
+    strategy_->rebind(f);
+
+    return;
+}
+
+size_t CommandManager::footprint()
+{
+    return strategy_->footprint() + checkpointFootprint();
+}
+
+size_t CommandManager::checkpointFootprint() const
+{
+    size_t bytes = barriers_.capacity() * sizeof(size_t) + checkpoints_.capacity() * sizeof(Checkpoint);
+    for(const auto& cp : checkpoints_) bytes += cp.stack.capacity() * sizeof(Number);
+
+    return bytes;
+}
+
+size_t CommandManager::Footprint(const Checkpoint& cp)
+{
+    return sizeof(Checkpoint) + cp.stack.capacity() * sizeof(Number);
+}
+
+void CommandManager::setMemoryLimit(size_t bytes)
+{
+    memoryLimit_ = bytes;
+    if(memoryLimit_ > 0) enforceMemoryLimit();
+
+    return;
+}
+
+void CommandManager::trimHistory(size_t n)
+{
+    n = std::min( n, getUndoSize() );
+    if(n == 0) return;
+
+    strategy_->dropOldest(n);
+
+    // the checkpoints and barriers kept move with the entries; a barrier at the new
+    // oldest position can no longer be crossed, so it is dropped too
+    std::erase_if(checkpoints_, [n](const Checkpoint& cp){ return cp.position < n; });
+    for(auto& cp : checkpoints_) cp.position -= n;
+
+    std::erase_if(barriers_, [n](size_t b){ return b <= n; });
+    for(auto& b : barriers_) b -= n;
+
+    return;
+}
+
+// Entries are dropped oldest first, together with the checkpoints taken before them,
+// until their footprints add up to the excess over three quarters of the limit.
+void CommandManager::enforceMemoryLimit()
+{
+    footprintEstimate_ = footprint();
+
+    const auto target = memoryLimit_ - memoryLimit_ / 4;
+    if(footprintEstimate_ <= target) return;
+
+    const auto excess = footprintEstimate_ - target;
+    const auto undoSize = getUndoSize();
+    size_t freed = 0;
+    size_t n = 0;
+    auto cp = checkpoints_.begin();
+    strategy_->visit([&](const Command& c)
+    {
+        if(freed >= excess || n == undoSize) return;
+
+        for(; cp != checkpoints_.end() && cp->position <= n; ++cp)
+            freed += Footprint(*cp);
+
+        freed += sizeof(CommandPtr) + c.footprint();
+        ++n;
+    });
+
+    trimHistory(n);
+    footprintEstimate_ = footprint();
+
+    return;
+}
+
+bool CommandManager::checkpointDue(size_t position) const
+{
+    auto i = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), position,
+        [](size_t p, const Checkpoint& cp){ return p < cp.position; });
+
+    if( i == checkpoints_.begin() ) return true;
+
+    const auto spacing = std::clamp(Stack::Instance().size(), MinCheckpointSpacing, MaxCheckpointSpacing);
+
+    return position - std::prev(i)->position >= spacing;
+}
+
+void CommandManager::truncateCheckpoints(size_t position)
+{
+    auto i = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), position,
+        [](size_t p, const Checkpoint& cp){ return p < cp.position; });
+    checkpoints_.erase( i, checkpoints_.end() );
+
+    barriers_.erase( std::upper_bound(barriers_.begin(), barriers_.end(), position), barriers_.end() );
+
+    return;
+}
+
+// Returns the latest checkpoint at or before target from which the jump from current
+// to target can be replayed, or nullptr if there is none. A checkpoint is unusable if
+// a barrier lies among the commands the jump would skip or replay, i.e., those after
+// the earlier of the checkpoint and current, up to the later of target and current.
+const CommandManager::Checkpoint* CommandManager::usableCheckpoint(size_t target, size_t current) const
+{
+    auto i = std::upper_bound(checkpoints_.begin(), checkpoints_.end(), target,
+        [](size_t p, const Checkpoint& cp){ return p < cp.position; });
+    if( i == checkpoints_.begin() ) return nullptr;
+
+    const Checkpoint& cp = *std::prev(i);
+
+    auto b = std::upper_bound( barriers_.begin(), barriers_.end(), std::min(cp.position, current) );
+    if( b != barriers_.end() && *b <= std::max(target, current) ) return nullptr;
+
+    return &cp;
+}
+
 }
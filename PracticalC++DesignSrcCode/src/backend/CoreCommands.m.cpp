@@ -17,11 +17,11 @@
 // along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
 module;
 #include <string>
-#include <stack>
 #include <cassert>
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <span>
 
 export module pdCalc_commandDispatcher:CoreCommands;
 
@@ -31,17 +31,23 @@ import pdCalc_utilities;
 
 using std::vector;
 using std::string;
+using std::span;
 
 #define CLONE(X) X* cloneImpl() const override { return new X{*this}; }
-#define HELP(X) const char* helpMessageImpl() const noexcept override { return X; }
+// HELP also makes the message available without an instance, as Help, for the
+// CommandFactory's table of core commands
+#define HELP(X) public: static constexpr const char* Help = X; \
+    private: const char* helpMessageImpl() const noexcept override { return Help; }
+#define STATELESS bool serializeImpl(vector<Number>&) const override { return true; } \
+    bool deserializableImpl(span<const Number> operands) const noexcept override { return operands.empty(); }
 
 namespace {
 
 using namespace pdCalc;
 
-double eps = 1e-12; // arbitrary floating closeness
+Number eps = 1e-12; // arbitrary floating closeness
 
-bool topOfStackisBetween(double lb, double ub)
+bool topOfStackisBetween(Number lb, Number ub)
 {
     assert(lb <= ub);
 
@@ -55,14 +61,14 @@ bool topOfStackisBetween(double lb, double ub)
 // 1) If y == 0, x must be >= 0
 // 2) If y < 0, x must be integral
 // also works for nth rootOf(y) for x = 1/n
-bool passesPowerTest(double y, double x)
+bool passesPowerTest(Number y, Number x)
 {
     // check against true 0; otherwise it is invertible
     // although not well conditioned
     if(y == 0 && x < 0)
         return false;
 
-    if(double intPart; y < 0 && std::modf(x, &intPart) != 0.0 )
+    if(Number intPart; y < 0 && std::modf(x, &intPart) != 0.0 )
         return false;
 
     return true;
@@ -77,7 +83,7 @@ namespace pdCalc {
 export class EnterNumber : public Command
 {
 public:
-    explicit EnterNumber(double d)
+    explicit EnterNumber(Number d)
     : Command{}
     , number_{d}
     { }
@@ -106,10 +112,28 @@ private:
         Stack::Instance().pop();
     }
 
+    bool serializeImpl(vector<Number>& operands) const override
+    {
+        operands.push_back(number_);
+        return true;
+    }
+
+    void deserializeImpl(span<const Number> operands) noexcept override
+    {
+        number_ = operands[0];
+    }
+
+    bool deserializableImpl(span<const Number> operands) const noexcept override
+    {
+        return operands.size() == 1;
+    }
+
+    size_t footprintImpl() const override { return sizeof(EnterNumber); }
+
     CLONE(EnterNumber)
     HELP("Adds a number to the stack")
 
-    double number_;
+    Number number_;
 };
 
 // swaps two numbers on the stack
@@ -151,6 +175,7 @@ private:
 
     CLONE(SwapTopOfStack)
     HELP("Swap the top two elements of the stack")
+    STATELESS
 };
 
 // drop the top of the stack
@@ -191,10 +216,28 @@ private:
         Stack::Instance().push(droppedNumber_);
     }
 
+    bool serializeImpl(vector<Number>& operands) const override
+    {
+        operands.push_back(droppedNumber_);
+        return true;
+    }
+
+    void deserializeImpl(span<const Number> operands) noexcept override
+    {
+        droppedNumber_ = operands[0];
+    }
+
+    bool deserializableImpl(span<const Number> operands) const noexcept override
+    {
+        return operands.size() == 1;
+    }
+
+    size_t footprintImpl() const override { return sizeof(DropTopOfStack); }
+
     CLONE(DropTopOfStack)
     HELP("Drop the top element from the stack")
 
-    double droppedNumber_;
+    Number droppedNumber_;
 };
 
 // clear the stack
@@ -216,38 +259,53 @@ private:
     ClearStack& operator=(const ClearStack&) = delete;
     ClearStack& operator=(ClearStack&&) = delete;
 
-    // clears the stack
+    // clears the stack, saving its contents in one bulk copy
     void executeImpl() noexcept override
     {
-        const auto n = Stack::Instance().size();
-        if(n == 0) return;
-        for(auto i = 0u; i < n - 1; ++i)
-        {
-            stack_.push( Stack::Instance().pop(true) );
-        }
+        if(Stack::Instance().size() == 0) return;
 
-        stack_.push( Stack::Instance().pop(false) );
+        stack_ = Stack::Instance().contents();
+        Stack::Instance().clear();
     }
 
-    // restores the stack
+    // restores the stack in one bulk copy
     void undoImpl() noexcept override
     {
-        const auto n = stack_.size();
-        if(n == 0) return;
-        for(auto i = 0u; i < n - 1; ++i)
-        {
-            Stack::Instance().push(stack_.top(), true);
-            stack_.pop();
-        }
+        if( stack_.empty() ) return;
+
+        Stack::Instance().restore(stack_);
+        stack_.clear();
+    }
+
+    // serializes the cleared elements from the bottom of the stack to the top
+    bool serializeImpl(vector<Number>& operands) const override
+    {
+        operands.insert(operands.end(), stack_.begin(), stack_.end());
+
+        return true;
+    }
+
+    void deserializeImpl(span<const Number> operands) noexcept override
+    {
+        stack_.assign(operands.begin(), operands.end());
+    }
+
+    // a stack of any size may have been cleared
+    bool deserializableImpl(span<const Number>) const noexcept override
+    {
+        return true;
+    }
 
-        Stack::Instance().push(stack_.top(), false);
-        stack_.pop();
+    // the cleared stack is held until the clear is undone
+    size_t footprintImpl() const override
+    {
+        return sizeof(ClearStack) + stack_.capacity() * sizeof(Number);
     }
 
     CLONE(ClearStack)
     HELP("Clear the stack")
 
-    std::stack<double> stack_;
+    vector<Number> stack_;
 };
 
 // adds two elements on the stack
@@ -267,7 +325,7 @@ private:
     Add& operator=(const Add&) = delete;
     Add& operator=(Add&&) = delete;
 
-    double binaryOperation(double next, double top) const noexcept override
+    Number binaryOperation(Number next, Number top) const noexcept override
     {
         return next + top;
     }
@@ -293,7 +351,7 @@ private:
     Subtract& operator=(const Subtract&) = delete;
     Subtract& operator=(Subtract&&) = delete;
 
-    double binaryOperation(double next, double top) const noexcept override
+    Number binaryOperation(Number next, Number top) const noexcept override
     {
         return next - top;
     }
@@ -303,7 +361,7 @@ private:
 };
 
 // class Multiply is missing. It is achieved through BinaryCommandAlterative.
-// See its creation in RegisterCoreCommands()
+// See its creation in the CommandFactory's table of core commands.
 
 // divides two elements on the stack
 // precondition: divisor cannot be zero
@@ -335,7 +393,7 @@ private:
         return;
     }
 
-    double binaryOperation(double next, double top) const noexcept override
+    Number binaryOperation(Number next, Number top) const noexcept override
     {
         return next / top;
     }
@@ -373,7 +431,7 @@ private:
             throw Exception{"Invalid result"};
     }
 
-    double binaryOperation(double next, double top) const noexcept override
+    Number binaryOperation(Number next, Number top) const noexcept override
     {
         return std::pow(next, top);
     }
@@ -412,7 +470,7 @@ private:
             throw Exception{"Invalid result"};
     }
 
-    double binaryOperation(double next, double top) const noexcept override
+    Number binaryOperation(Number next, Number top) const noexcept override
     {
         return std::pow(next, 1. / top);
     }
@@ -439,7 +497,7 @@ private:
     Sine& operator=(const Sine&) = delete;
     Sine& operator=(Sine&&) = delete;
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::sin(top);
     }
@@ -466,7 +524,7 @@ private:
     Cosine& operator=(const Cosine&) = delete;
     Cosine& operator=(Cosine&&) = delete;
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::cos(top);
     }
@@ -501,15 +559,15 @@ private:
         UnaryCommand::checkPreconditionsImpl();
 
         auto v = Stack::Instance().getElements(1);
-        double d{ v.back() + M_PI / 2. };
-        double r{ std::fabs(d) / std::fabs(M_PI) };
+        Number d = v.back() + M_PI / 2.;
+        Number r = std::fabs(d) / std::fabs(M_PI);
         int w{ static_cast<int>(std::floor(r + eps)) };
         r = r - w;
         if(r < eps && r > -eps)
             throw Exception{"Infinite result"};
     }
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::tan(top);
     }
@@ -547,7 +605,7 @@ private:
             throw Exception{"Invalid argument"};
     }
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::asin(top);
     }
@@ -585,7 +643,7 @@ private:
             throw Exception{"Invalid argument"};
     }
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::acos(top);
     }
@@ -611,7 +669,7 @@ private:
     Arctangent& operator=(const Arctangent&) = delete;
     Arctangent& operator=(Arctangent&&) = delete;
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return std::atan(top);
     }
@@ -638,7 +696,7 @@ public:
     Negate& operator=(const Negate&) = delete;
     Negate& operator=(Negate&&) = delete;
 
-    double unaryOperation(double top) const noexcept override
+    Number unaryOperation(Number top) const noexcept override
     {
         return -top;
     }
@@ -684,6 +742,7 @@ private:
 
     CLONE(Duplicate)
     HELP("Duplicates the top number on the stack")
+    STATELESS
 };
 
 }
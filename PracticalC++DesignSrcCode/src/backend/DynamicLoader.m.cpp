@@ -44,6 +44,10 @@ public:
     virtual class Plugin* allocatePlugin(const string& pluginName) = 0;
     virtual void deallocatePlugin(class Plugin*) = 0;
 
+    // returns true if address lies in the shared library this loader loaded, e.g.,
+    // the type_info of an object whose class the library defines
+    virtual bool owns(const void* address) const = 0;
+
     // Get the plugin allocation name for derived classes
     static string GetPluginAllocationName() { return "AllocPlugin"; }
     static string GetPluginDeallocationName() { return "DeallocPlugin"; }
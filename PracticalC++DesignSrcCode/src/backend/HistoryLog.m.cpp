@@ -0,0 +1,325 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+module;
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include <span>
+#include <string>
+#include <filesystem>
+#include <algorithm>
+#include <functional>
+#ifdef POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdlib>
+#endif
+export module pdCalc_commandDispatcher:HistoryLog;
+
+import pdCalc_utilities;
+
+using std::vector;
+using std::span;
+using std::string;
+
+namespace pdCalc {
+
+// An append-only binary log of command records. Records are appended at the tail
+// and read back from the tail, so the log behaves as a stack that lives on disk
+// instead of in memory. Each record is laid out as
+//
+//     uint32 opcode | uint32 nOperands | nOperands Numbers | uint32 record size
+//
+// where the trailing size allows the log to be walked backward from its tail.
+// Popping a record only moves the tail; the space is reused by the next push.
+// Likewise, dropping records from the head only moves the head, and the records
+// kept are moved down once the space before them is needed.
+//
+// On POSIX systems, the log is a memory-mapped, unlinked temporary file, created
+// on first use, so the kernel is free to write its pages back and evict them.
+// Elsewhere, the log falls back to an ordinary in-memory buffer.
+class HistoryLog
+{
+public:
+    HistoryLog();
+    ~HistoryLog();
+
+    // appends a record to the tail of the log
+    void push(uint32_t opcode, span<const Number> operands);
+
+    // removes the record at the tail of the log, returns its opcode, and appends
+    // its operands to operands. Precondition: the log is not empty.
+    uint32_t pop(vector<Number>& operands);
+
+    // passes the opcode and operands of every record to f, starting from the head of
+    // the log, or from its tail if fromTail, without removing any
+    void visit(const std::function<void(uint32_t, span<const Number>)>& f, bool fromTail) const;
+
+    // removes the n records at the head of the log, or all if fewer, passing the
+    // opcode of each to f
+    void dropHead(size_t n, const std::function<void(uint32_t)>& f);
+
+    size_t size() const { return nRecords_; }
+    bool empty() const { return nRecords_ == 0; }
+
+    // number of bytes of the log currently in use
+    size_t bytes() const { return tail_ - head_; }
+
+    // number of bytes the log holds in memory, which is none where it is a file
+#ifdef POSIX
+    size_t residentBytes() const { return 0; }
+#else
+    size_t residentBytes() const { return capacity_; }
+#endif
+
+    void clear();
+
+private:
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog(HistoryLog&&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+    HistoryLog& operator=(HistoryLog&&) = delete;
+
+    void reserve(size_t bytes);
+
+    // moves the records down to the start of the log
+    void compact();
+
+#ifdef POSIX
+    void open();
+#endif
+
+    std::byte* data_;
+    size_t capacity_;
+    size_t head_;
+    size_t tail_;
+    size_t nRecords_;
+
+#ifdef POSIX
+    int fd_;
+#else
+    vector<std::byte> buffer_;
+#endif
+};
+
+namespace {
+
+constexpr size_t InitialLogCapacity = 1 << 20;
+
+}
+
+#ifdef POSIX
+
+HistoryLog::HistoryLog()
+: data_{nullptr}
+, capacity_{0}
+, head_{0}
+, tail_{0}
+, nRecords_{0}
+, fd_{-1}
+{ }
+
+HistoryLog::~HistoryLog()
+{
+    if(data_) munmap(data_, capacity_);
+    if(fd_ >= 0) close(fd_);
+}
+
+void HistoryLog::open()
+{
+    string name = (std::filesystem::temp_directory_path() / "pdCalcHistoryXXXXXX").string();
+    fd_ = mkstemp( name.data() );
+    if(fd_ < 0)
+        throw Exception{"Could not create history log"};
+
+    // the log only lives as long as the open descriptor
+    unlink( name.c_str() );
+
+    return;
+}
+
+void HistoryLog::reserve(size_t bytes)
+{
+    if(bytes <= capacity_) return;
+
+    if(fd_ < 0) open();
+
+    size_t newCapacity = capacity_ == 0 ? InitialLogCapacity : capacity_;
+    while(newCapacity < bytes) newCapacity *= 2;
+
+    if( ftruncate(fd_, static_cast<off_t>(newCapacity)) != 0 )
+        throw Exception{"Could not grow history log"};
+
+    if(data_) munmap(data_, capacity_);
+    void* p = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(p == MAP_FAILED)
+    {
+        data_ = nullptr;
+        capacity_ = 0;
+        throw Exception{"Could not map history log"};
+    }
+
+    data_ = static_cast<std::byte*>(p);
+    capacity_ = newCapacity;
+
+    return;
+}
+
+#else
+
+HistoryLog::HistoryLog()
+: data_{nullptr}
+, capacity_{0}
+, head_{0}
+, tail_{0}
+, nRecords_{0}
+{ }
+
+HistoryLog::~HistoryLog()
+{ }
+
+void HistoryLog::reserve(size_t bytes)
+{
+    if(bytes <= capacity_) return;
+
+    buffer_.resize( std::max({bytes, 2 * buffer_.size(), InitialLogCapacity}) );
+    data_ = buffer_.data();
+    capacity_ = buffer_.size();
+
+    return;
+}
+
+#endif
+
+void HistoryLog::push(uint32_t opcode, span<const Number> operands)
+{
+    const uint32_t n = static_cast<uint32_t>( operands.size() );
+    const uint32_t recordSize = 3 * sizeof(uint32_t) + n * sizeof(Number);
+
+    if(tail_ + recordSize > capacity_) compact();
+    reserve(tail_ + recordSize);
+
+    std::byte* p = data_ + tail_;
+    std::memcpy(p, &opcode, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    std::memcpy(p, &n, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    if(n > 0) std::memcpy(p, operands.data(), n * sizeof(Number));
+    p += n * sizeof(Number);
+    std::memcpy(p, &recordSize, sizeof(uint32_t));
+
+    tail_ += recordSize;
+    ++nRecords_;
+
+    return;
+}
+
+uint32_t HistoryLog::pop(vector<Number>& operands)
+{
+    uint32_t recordSize;
+    std::memcpy(&recordSize, data_ + tail_ - sizeof(uint32_t), sizeof(uint32_t));
+
+    const std::byte* p = data_ + tail_ - recordSize;
+    uint32_t opcode;
+    uint32_t n;
+    std::memcpy(&opcode, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    std::memcpy(&n, p, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+
+    const auto first = operands.size();
+    operands.resize(first + n);
+    if(n > 0) std::memcpy(operands.data() + first, p, n * sizeof(Number));
+
+    tail_ -= recordSize;
+    if(--nRecords_ == 0) head_ = tail_ = 0;
+
+    return opcode;
+}
+
+void HistoryLog::visit(const std::function<void(uint32_t, span<const Number>)>& f, bool fromTail) const
+{
+    // operands are not necessarily aligned in the log, so they are copied out
+    vector<Number> operands;
+    size_t pos = fromTail ? tail_ : head_;
+    for(auto i = 0u; i < nRecords_; ++i)
+    {
+        if(fromTail)
+        {
+            uint32_t recordSize;
+            std::memcpy(&recordSize, data_ + pos - sizeof(uint32_t), sizeof(uint32_t));
+            pos -= recordSize;
+        }
+
+        const std::byte* p = data_ + pos;
+        uint32_t opcode;
+        uint32_t n;
+        std::memcpy(&opcode, p, sizeof(uint32_t));
+        std::memcpy(&n, p + sizeof(uint32_t), sizeof(uint32_t));
+
+        operands.resize(n);
+        if(n > 0) std::memcpy(operands.data(), p + 2 * sizeof(uint32_t), n * sizeof(Number));
+        f(opcode, operands);
+
+        if(!fromTail) pos += 3 * sizeof(uint32_t) + n * sizeof(Number);
+    }
+
+    return;
+}
+
+void HistoryLog::dropHead(size_t n, const std::function<void(uint32_t)>& f)
+{
+    for(; n > 0 && nRecords_ > 0; --n)
+    {
+        uint32_t opcode;
+        uint32_t nOperands;
+        std::memcpy(&opcode, data_ + head_, sizeof(uint32_t));
+        std::memcpy(&nOperands, data_ + head_ + sizeof(uint32_t), sizeof(uint32_t));
+        f(opcode);
+
+        head_ += 3 * sizeof(uint32_t) + nOperands * sizeof(Number);
+        --nRecords_;
+    }
+
+    if(nRecords_ == 0) head_ = tail_ = 0;
+
+    return;
+}
+
+void HistoryLog::compact()
+{
+    if(head_ == 0) return;
+
+    std::memmove(data_, data_ + head_, tail_ - head_);
+    tail_ -= head_;
+    head_ = 0;
+
+    return;
+}
+
+void HistoryLog::clear()
+{
+    head_ = 0;
+    tail_ = 0;
+    nRecords_ = 0;
+
+    return;
+}
+
+}
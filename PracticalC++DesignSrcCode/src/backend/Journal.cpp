@@ -0,0 +1,427 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <limits>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#ifdef POSIX
+#include <unistd.h>
+#elif defined(WIN32)
+#include <io.h>
+#endif
+module pdCalc_commandDispatcher:Journal;
+
+import pdCalc_utilities;
+import :StoredProcedure;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace pdCalc {
+
+namespace {
+
+constexpr char Magic[4] = {'P', 'D', 'C', 'J'};
+constexpr uint32_t Version = 1;
+constexpr size_t HeaderSize = sizeof(Magic) + sizeof(Version);
+
+// size of the fixed fields around a record's payload: size, kind, and checksum
+constexpr size_t RecordOverhead = 2 * sizeof(uint32_t) + 1;
+
+// the writer is woken early once this many bytes are waiting
+constexpr size_t GroupSize = 1 << 16;
+
+// 32 bit FNV-1a
+uint32_t checksum(const std::byte* p, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < n; ++i)
+    {
+        h ^= static_cast<uint32_t>(p[i]);
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+// the shortest representation of the T at p that round trips, which reproduces the
+// number exactly
+template<typename T>
+string numberText(const char* p)
+{
+    T d;
+    std::memcpy(&d, p, sizeof(d));
+
+    return std::format("{}", d);
+}
+
+// The procedures in the payload of a Procedures record, each a name and its contents,
+// both a uint32 size followed by their bytes. Returns false if the payload is
+// malformed.
+bool readProcedures(const char* p, size_t size, vector<ProcedureSource::Procedure>& procedures)
+{
+    size_t pos = 0;
+    auto field = [&](string& s)
+    {
+        uint32_t n;
+        if(size - pos < sizeof(n)) return false;
+        std::memcpy(&n, p + pos, sizeof(n));
+        pos += sizeof(n);
+
+        if(size - pos < n) return false;
+        s.assign(p + pos, n);
+        pos += n;
+
+        return true;
+    };
+
+    while(pos < size)
+    {
+        ProcedureSource::Procedure procedure;
+        if( !field(procedure.name) || !field(procedure.contents) ) return false;
+        procedures.push_back( std::move(procedure) );
+    }
+
+    return true;
+}
+
+}
+
+Journal::Journal(const string& filename, Mode mode, SyncPolicy policy, std::chrono::milliseconds syncInterval)
+: file_{nullptr}
+, policy_{policy}
+, syncInterval_{syncInterval}
+, appended_{0}
+, requested_{0}
+, durable_{0}
+, stop_{false}
+, failed_{false}
+{
+    file_ = std::fopen( filename.c_str(), mode == Mode::Create ? "wb" : "ab" );
+    if(!file_)
+        throw Exception{ std::format("Could not open journal {}", filename) };
+
+    std::fseek(file_, 0, SEEK_END);
+    if(std::ftell(file_) == 0)
+    {
+        std::fwrite(Magic, 1, sizeof(Magic), file_);
+        std::fwrite(&Version, sizeof(Version), 1, file_);
+        std::fflush(file_);
+    }
+
+    writer_ = std::thread{ [this]{ write(); } };
+}
+
+Journal::~Journal()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        stop_ = true;
+    }
+    pending_.notify_one();
+
+    writer_.join();
+    std::fclose(file_);
+}
+
+void Journal::command(string_view name)
+{
+    append( Kind::Command, name.data(), static_cast<uint32_t>( name.size() ) );
+    return;
+}
+
+void Journal::number(Number d)
+{
+    append( Kind::Number, &d, sizeof(d) );
+    return;
+}
+
+void Journal::undo(size_t n)
+{
+    uint64_t v = n;
+    append( Kind::Undo, &v, sizeof(v) );
+    return;
+}
+
+void Journal::redo(size_t n)
+{
+    uint64_t v = n;
+    append( Kind::Redo, &v, sizeof(v) );
+    return;
+}
+
+void Journal::jumpTo(size_t k)
+{
+    uint64_t v = k;
+    append( Kind::Jump, &v, sizeof(v) );
+    return;
+}
+
+void Journal::session(std::span<const std::byte> contents)
+{
+    if( contents.size() > std::numeric_limits<uint32_t>::max() )
+        throw Exception{"The session is too large to journal"};
+
+    append( Kind::Session, contents.data(), static_cast<uint32_t>( contents.size() ) );
+    return;
+}
+
+void Journal::procedures(const vector<ProcedureSource::Procedure>& procedures)
+{
+    size_t size = 0;
+    for(const auto& p : procedures)
+        size += 2 * sizeof(uint32_t) + p.name.size() + p.contents.size();
+
+    if( size > std::numeric_limits<uint32_t>::max() )
+        throw Exception{"The procedures are too large to journal"};
+
+    vector<std::byte> payload(size);
+    std::byte* q = payload.data();
+    auto field = [&](const string& s)
+    {
+        const auto n = static_cast<uint32_t>( s.size() );
+        std::memcpy(q, &n, sizeof(n));
+        q += sizeof(n);
+        if(n > 0) std::memcpy(q, s.data(), n);
+        q += n;
+    };
+
+    for(const auto& p : procedures)
+    {
+        field(p.name);
+        field(p.contents);
+    }
+
+    append( Kind::Procedures, payload.data(), static_cast<uint32_t>(size) );
+    return;
+}
+
+void Journal::flush()
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    const auto target = appended_;
+    if(durable_ >= target) return;
+
+    requested_ = std::max(requested_, target);
+    pending_.notify_one();
+    written_.wait( lock, [&]{ return durable_ >= target || failed_; } );
+
+    return;
+}
+
+void Journal::append(Kind kind, const void* payload, uint32_t size)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    if(failed_)
+        throw Exception{"Could not write journal"};
+
+    const auto first = buffer_.size();
+    buffer_.resize(first + RecordOverhead + size);
+
+    std::byte* p = buffer_.data() + first;
+    std::memcpy(p, &size, sizeof(size));
+    p += sizeof(size);
+    std::byte* checked = p;
+    *p++ = static_cast<std::byte>(kind);
+    if(size > 0) std::memcpy(p, payload, size);
+    p += size;
+    const uint32_t sum = checksum(checked, size + 1);
+    std::memcpy(p, &sum, sizeof(sum));
+
+    const auto seq = ++appended_;
+
+    if(policy_ == SyncPolicy::Always)
+    {
+        requested_ = seq;
+        pending_.notify_one();
+        written_.wait( lock, [&]{ return durable_ >= seq || failed_; } );
+    }
+    else if(buffer_.size() >= GroupSize)
+        pending_.notify_one();
+
+    return;
+}
+
+// The writer thread. Each pass takes every record buffered so far as one group, and
+// writes (and syncs) the group outside the lock so that appends are not blocked.
+void Journal::write()
+{
+    vector<std::byte> group;
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    while(true)
+    {
+        pending_.wait_for( lock, syncInterval_,
+            [this]{ return stop_ || (!failed_ && (requested_ > durable_ || buffer_.size() >= GroupSize)); } );
+
+        if( !buffer_.empty() && !failed_ )
+        {
+            group.swap(buffer_);
+            const auto seq = appended_;
+
+            lock.unlock();
+            bool ok = std::fwrite(group.data(), 1, group.size(), file_) == group.size()
+                && std::fflush(file_) == 0;
+            if(ok && policy_ != SyncPolicy::None) sync();
+            group.clear();
+            lock.lock();
+
+            if(ok) durable_ = seq;
+            else failed_ = true;
+
+            written_.notify_all();
+        }
+
+        if(stop_ && (buffer_.empty() || failed_)) break;
+    }
+
+    return;
+}
+
+void Journal::sync()
+{
+#ifdef POSIX
+    fsync( fileno(file_) );
+#elif defined(WIN32)
+    _commit( _fileno(file_) );
+#endif
+
+    return;
+}
+
+size_t Journal::Recover(const string& filename, const std::function<void(const string&)>& f,
+    const std::function<void(std::span<const std::byte>)>& load)
+{
+    std::ifstream ifs{filename, std::ios::binary};
+    if(!ifs)
+        throw Exception{ std::format("Could not open journal {}", filename) };
+
+    vector<char> data{ std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{} };
+    ifs.close();
+
+    // a crash while the header was being written leaves a prefix of it
+    if(data.size() < HeaderSize)
+    {
+        if( data.empty() ) return 0;
+
+        if( std::memcmp(data.data(), Magic, std::min(data.size(), sizeof(Magic))) != 0 )
+            throw Exception{ std::format("{} is not a journal", filename) };
+
+        std::filesystem::resize_file(filename, 0);
+        return 0;
+    }
+
+    uint32_t version;
+    std::memcpy(&version, data.data() + sizeof(Magic), sizeof(version));
+    if( std::memcmp(data.data(), Magic, sizeof(Magic)) != 0 || version != Version )
+        throw Exception{ std::format("{} is not a journal", filename) };
+
+    size_t pos = HeaderSize;
+    size_t n = 0;
+
+    // the procedures recorded for the next command
+    vector<ProcedureSource::Procedure> procedures;
+    while(data.size() - pos >= RecordOverhead)
+    {
+        uint32_t size;
+        std::memcpy(&size, data.data() + pos, sizeof(size));
+        if(data.size() - pos - RecordOverhead < size) break;
+
+        const auto* checked = reinterpret_cast<const std::byte*>( data.data() + pos + sizeof(size) );
+        uint32_t sum;
+        std::memcpy(&sum, checked + 1 + size, sizeof(sum));
+        if( sum != checksum(checked, size + 1) ) break;
+
+        if( checked[0] > static_cast<std::byte>(Kind::Procedures) ) break;
+        auto kind = static_cast<Kind>(checked[0]);
+
+        const char* payload = reinterpret_cast<const char*>(checked + 1);
+        uint64_t count = 0;
+        string number;
+
+        // numbers are journaled as the build's Number, and builds of each number
+        // type replay the journals of the others
+        if(kind == Kind::Number && size == sizeof(Number))
+            number = numberText<Number>(payload);
+        else if(kind == Kind::Number && size == sizeof(double))
+            number = numberText<double>(payload);
+        else if(kind == Kind::Number && size == sizeof(float))
+            number = numberText<float>(payload);
+        else if(kind == Kind::Number && size == sizeof(long double))
+            number = numberText<long double>(payload);
+        else if(kind == Kind::Procedures && !readProcedures(payload, size, procedures))
+            break;
+        else if(kind == Kind::Undo || kind == Kind::Redo || kind == Kind::Jump)
+        {
+            if(size != sizeof(count)) break;
+            std::memcpy(&count, payload, sizeof(count));
+        }
+        else if(kind == Kind::Number)
+            break;
+
+        switch(kind)
+        {
+        case Kind::Command:
+        {
+            // a proc: command runs the procedures recorded before it
+            ProcedureSource source{ std::exchange(procedures, {}) };
+            f( string{payload, size} );
+            break;
+        }
+        case Kind::Number: f(number); break;
+        case Kind::Undo: f( count == 1 ? string{"undo"} : std::format("undo:{}", count) ); break;
+        case Kind::Redo: f( count == 1 ? string{"redo"} : std::format("redo:{}", count) ); break;
+        case Kind::Jump: f( std::format("goto:{}", count) ); break;
+        case Kind::Session:
+        {
+            // copied out of the record, where it is not aligned for a Number
+            const vector<std::byte> contents{checked + 1, checked + 1 + size};
+            load(contents);
+            break;
+        }
+        case Kind::Procedures: break;
+        }
+
+        pos += RecordOverhead + size;
+        if(kind != Kind::Procedures) ++n;
+    }
+
+    if(pos < data.size())
+        std::filesystem::resize_file(filename, pos);
+
+    return n;
+}
+
+}
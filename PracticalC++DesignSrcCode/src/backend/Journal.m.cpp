@@ -0,0 +1,142 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+export module pdCalc_commandDispatcher:Journal;
+
+import pdCalc_utilities;
+import :StoredProcedure;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+export namespace pdCalc {
+
+// A write-ahead journal of the history operations of a session, from which the
+// session can be recovered after a crash. The journal is a binary file of records,
+// each holding one operation:
+//
+//     uint32 payload size | uint8 kind | payload | uint32 checksum of kind and payload
+//
+// Appending only copies a record into a buffer. A writer thread writes buffered
+// records to the file in groups, so one write (and one sync) covers every record
+// appended since the last. The sync policy decides how durable an append is:
+//
+//     None     - records are written at least every sync interval, and the
+//                operating system decides when they reach the disk
+//     Periodic - records are written and synced at least every sync interval
+//     Always   - an append returns only after its record has been synced
+//
+// Only Always puts the disk on the command's latency path.
+class Journal
+{
+public:
+    enum class Mode { Create, Append };
+    enum class SyncPolicy { None, Periodic, Always };
+
+    static constexpr std::chrono::milliseconds DefaultSyncInterval{100};
+
+    // Create starts a new, empty journal; Append continues an existing one (or starts a
+    // new one if the file does not exist). Throws if the file cannot be opened.
+    Journal(const string& filename, Mode mode, SyncPolicy policy = SyncPolicy::Periodic,
+        std::chrono::milliseconds syncInterval = DefaultSyncInterval);
+
+    // writes and syncs every appended record
+    ~Journal();
+
+    // records a command entered by name, e.g., "+" or "proc:file"; a stored procedure
+    // is recorded by name after its contents (see procedures)
+    void command(string_view name);
+    void number(Number d);
+    void undo(size_t n);
+    void redo(size_t n);
+
+    // records the contents of a session file loaded, which recovery loads in turn
+    // even if the file has since been overwritten (e.g., by a snapshot); throws if the
+    // session is too large for a record
+    void session(std::span<const std::byte> contents);
+
+    // records the contents of the stored procedures a proc: command ran, which
+    // recovery runs the next command with in place of their files (see
+    // ProcedureSource); throws if they are too large for a record
+    void procedures(const vector<ProcedureSource::Procedure>& procedures);
+
+    // Records a jump to position k of the history, which only replays correctly on a
+    // history trimmed as the journaled one was; the interpreter records its jumps as
+    // undo or redo steps instead.
+    void jumpTo(size_t k);
+
+    // returns once every record appended so far has been written and, unless the
+    // policy is None, synced
+    void flush();
+
+    // Passes each operation recorded in filename to f, in order, as the interpreter
+    // command that reproduces it, except that a session is passed to load as the
+    // contents of its file, and that a command is passed with the procedures recorded
+    // before it as the ProcedureSource alive. Replay stops at the first incomplete or
+    // corrupt record, where a crash during a write leaves the journal, and the file is
+    // truncated there so it can be appended to. Returns the number of operations
+    // replayed. Throws if the file cannot be read or is not a journal.
+    static size_t Recover(const string& filename, const std::function<void(const string&)>& f,
+        const std::function<void(std::span<const std::byte>)>& load);
+
+private:
+    enum class Kind : uint8_t { Command, Number, Undo, Redo, Jump, Session, Procedures };
+
+    Journal(const Journal&) = delete;
+    Journal(Journal&&) = delete;
+    Journal& operator=(const Journal&) = delete;
+    Journal& operator=(Journal&&) = delete;
+
+    void append(Kind kind, const void* payload, uint32_t size);
+    void write();
+    void sync();
+
+    std::FILE* file_;
+    SyncPolicy policy_;
+    std::chrono::milliseconds syncInterval_;
+
+    std::mutex mutex_;
+    std::condition_variable pending_;
+    std::condition_variable written_;
+    vector<std::byte> buffer_;
+
+    // appended records are numbered in order; requested is the highest number an
+    // append or flush is waiting for, and durable the highest written
+    uint64_t appended_;
+    uint64_t requested_;
+    uint64_t durable_;
+    bool stop_;
+    bool failed_;
+    std::thread writer_;
+};
+
+}
@@ -20,7 +20,12 @@
 // must provide a command with its name (for the command structure), which
 // automatically provides a CLI interface. Optionally, a plugin can provide
 // a GUI interface.
-
+//
+// Since API v. 1.1, a plugin can also export element-wise kernels, which pdCalc
+// applies to the whole stack at once (see KernelCommand). Since API v. 1.2, it can
+// export simple unary and binary operations as plain functions, which pdCalc turns
+// into its own commands, so that executing them needs no allocation in the plugin.
+// Since API v. 1.3, its kernels can declare the domain of their elements.
 export module pdCalc_plugin;
 
 import pdCalc_command;
@@ -63,6 +68,67 @@ public:
 
     virtual ApiVersion apiVersion() const = 0;
 
+    // API v. 1.1: pure element-wise kernels, each with its name and arity. Kernels
+    // perform no checks: a result outside a function's domain is a NaN. API v. 1.3
+    // adds each kernel's optional domain (see KernelCommand), which pdCalc checks
+    // for every element first; domains is only read from plugins of v. 1.3 or later.
+    using Kernel = KernelCommand::Kernel;
+
+    struct KernelDescriptor
+    {
+        int nKernels;
+        char** kernelNames;
+        int* arities;
+        Kernel* kernels;
+        KernelCommand::Domain* domains;
+    };
+
+    // The plugin's kernels, or nullptr if it exports none. This is only declared
+    // after apiVersion so that v. 1.0 plugins, whose virtual tables end with
+    // apiVersion, keep their layout; getKernels never calls it on them.
+    virtual const KernelDescriptor* getKernelDescriptor() const { return nullptr; }
+
+    const KernelDescriptor* getKernels() const
+    {
+        auto v = apiVersion();
+        return v.major == 1 && v.minor >= 1 ? getKernelDescriptor() : nullptr;
+    }
+
+    // the domain of kernel i of getKernels(), or nullptr
+    KernelCommand::Domain getKernelDomain(int i) const
+    {
+        auto v = apiVersion();
+        auto k = getKernels();
+        return k && v.minor >= 3 && k->domains ? k->domains[i] : nullptr;
+    }
+
+    // API v. 1.2: unary and binary functions, each with its name, help message, and
+    // optional precondition (see UnaryFunctionCommand and BinaryFunctionCommand). A
+    // function takes the place of a command of the same name.
+    struct FunctionDescriptor
+    {
+        int nUnary;
+        char** unaryNames;
+        char** unaryHelp;
+        UnaryFunctionCommand::Function* unaryFunctions;
+        UnaryFunctionCommand::Precondition* unaryPreconditions;
+
+        int nBinary;
+        char** binaryNames;
+        char** binaryHelp;
+        BinaryFunctionCommand::Function* binaryFunctions;
+        BinaryFunctionCommand::Precondition* binaryPreconditions;
+    };
+
+    // the plugin's functions, or nullptr; declared last for the reason given above
+    virtual const FunctionDescriptor* getFunctionDescriptor() const { return nullptr; }
+
+    const FunctionDescriptor* getFunctions() const
+    {
+        auto v = apiVersion();
+        return v.major == 1 && v.minor >= 2 ? getFunctionDescriptor() : nullptr;
+    }
+
 private:
     Plugin(const Plugin&) = delete;
     Plugin& operator=(const Plugin&) = delete;
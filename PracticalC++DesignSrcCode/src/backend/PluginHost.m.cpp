@@ -0,0 +1,749 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Runs a plugin in a helper process, so that a plugin that crashes cannot take
+// pdCalc down with it. The helper is a fork of pdCalc that loads the plugin library
+// itself; pdCalc never loads it. The two processes share a memory region holding
+// two ring buffers, one carrying requests to the helper and one carrying responses
+// back, and each message is its length followed by its bytes.
+//
+// A request runs a sequence of the plugin's commands on a stack. The helper keeps a
+// replica of the stack between requests, so a request only carries the elements
+// above those that pdCalc's stack still shares with the replica, and a response
+// only carries the elements the commands changed. A run of plugin commands thus
+// moves few operands per command, and a run given to a single request costs one
+// round trip.
+//
+// A helper that dies is restarted, and the request it was serving fails. Helpers are
+// only available on POSIX systems.
+module;
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#ifdef POSIX
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+export module pdCalc_pluginManagement:PluginHost;
+
+import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_utilities;
+import :PluginManifest;
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::span;
+
+namespace pdCalc {
+
+export class PluginHost
+{
+public:
+    // What the helper serves, made by a Setup that runs in the helper: the plugin's
+    // description, the names of the commands it provides, and the command for each
+    // name. If the plugin cannot be set up, error says why.
+    struct Service
+    {
+        PluginManifest::Entry description;
+        vector<string> names;
+        std::function<const Command*(const string&)> command;
+        string error;
+    };
+    using Setup = std::function<Service()>;
+
+    // starts a helper serving the plugin that setup sets up; throws an exception if
+    // the helper cannot be started or the plugin cannot be set up
+    PluginHost(const string& library, Setup setup);
+    ~PluginHost();
+
+    const string& library() const { return library_; }
+    const PluginManifest::Entry& description() const { return description_; }
+
+    // The names of the commands the helper runs, as named when it was first started.
+    // index returns the index of name, or names().size() if there is none.
+    const vector<string>& names() const { return names_; }
+    size_t index(const string& name) const;
+
+    // Runs the commands with the given indices, in order, on stack, which is replaced
+    // by the result, in one round trip. Returns the number of commands that ran; if
+    // that is fewer than given, error is why the next one failed, and stack is the
+    // result of those that ran. If the helper dies, it is restarted, and an exception
+    // is thrown with stack unchanged.
+    size_t run(span<const size_t> commands, vector<Number>& stack, string& error);
+
+    // Restarts the helper, e.g., to load a new version of the library. Commands keep
+    // their indices; a command the new version no longer provides fails to run.
+    void restart();
+
+    // the number of times the helper was restarted, and its process id
+    size_t restarts() const { return restarts_; }
+    int processId() const { return pid_; }
+
+private:
+    PluginHost(const PluginHost&) = delete;
+    PluginHost(PluginHost&&) = delete;
+    PluginHost& operator=(const PluginHost&) = delete;
+    PluginHost& operator=(PluginHost&&) = delete;
+
+    struct Channel;
+
+    void start();
+    void stop();
+
+    // waits for the helper's next response, returning false if it died instead
+    bool await();
+    [[noreturn]] void serve();
+
+    string library_;
+    Setup setup_;
+    PluginManifest::Entry description_;
+    vector<string> names_;
+    Channel* channel_;
+    int pid_;
+    size_t restarts_;
+
+    // the helper's copy of the stack, as of its last response
+    vector<Number> replica_;
+};
+
+// A command of a plugin running in a helper. The plugin runs while the command's
+// preconditions are checked, since that is where a failure, including the helper
+// dying, can be reported; executing the command only replaces the stack with the
+// result. A plugin command usually changes only the top of the stack, so the command
+// keeps the length of the part below that it left unchanged, and only the elements it
+// replaced and those it replaced them with.
+export class IsolatedPluginCommand final : public Command
+{
+public:
+    IsolatedPluginCommand(PluginHost& host, size_t index, string_view help);
+    ~IsolatedPluginCommand() = default;
+
+private:
+    IsolatedPluginCommand(IsolatedPluginCommand&&) = delete;
+    IsolatedPluginCommand& operator=(const IsolatedPluginCommand&) = delete;
+    IsolatedPluginCommand& operator=(IsolatedPluginCommand&&) = delete;
+
+    IsolatedPluginCommand(const IsolatedPluginCommand&);
+
+    void checkPreconditionsImpl() const override;
+    const char* helpMessageImpl() const noexcept override;
+    void executeImpl() noexcept override;
+    void undoImpl() noexcept override;
+    IsolatedPluginCommand* cloneImpl() const override;
+
+    bool serializeImpl(vector<Number>& operands) const override;
+    void deserializeImpl(span<const Number> operands) noexcept override;
+    bool deserializableImpl(span<const Number> operands) const noexcept override;
+
+    PluginHost& host_;
+    size_t index_;
+    string helpMsg_;
+
+    // set by the precondition check, which runs the plugin
+    mutable size_t kept_;
+    mutable vector<Number> replaced_;
+    mutable vector<Number> result_;
+};
+
+namespace {
+
+// messages are built and parsed field by field in the byte order of the machine,
+// which both processes share
+template<typename T>
+void putField(string& message, const T& value)
+{
+    message.append( reinterpret_cast<const char*>(&value), sizeof(T) );
+
+    return;
+}
+
+void putString(string& message, string_view s)
+{
+    putField( message, static_cast<uint32_t>(s.size()) );
+    message.append(s);
+
+    return;
+}
+
+void putNumbers(string& message, span<const Number> values)
+{
+    putField( message, static_cast<uint32_t>(values.size()) );
+    message.append( reinterpret_cast<const char*>(values.data()), values.size_bytes() );
+
+    return;
+}
+
+class MessageReader
+{
+public:
+    explicit MessageReader(const string& message) : message_{message}, position_{0} { }
+
+    template<typename T>
+    T field()
+    {
+        T value{};
+        if( position_ + sizeof(T) <= message_.size() )
+            std::memcpy(&value, message_.data() + position_, sizeof(T));
+        position_ += sizeof(T);
+
+        return value;
+    }
+
+    string text()
+    {
+        const auto n = field<uint32_t>();
+        string s = position_ + n <= message_.size() ? message_.substr(position_, n) : string{};
+        position_ += n;
+
+        return s;
+    }
+
+    vector<Number> numbers()
+    {
+        vector<Number> values( field<uint32_t>() );
+        for(auto& v : values) v = field<Number>();
+
+        return values;
+    }
+
+private:
+    const string& message_;
+    size_t position_;
+};
+
+// the length of the common prefix of two stacks, which are ordered bottom first
+size_t sharedElements(span<const Number> a, span<const Number> b)
+{
+    return std::ranges::mismatch(a, b).in1 - a.begin();
+}
+
+// replaces the elements of the stack above the first kept with elements
+void replaceAbove(size_t kept, span<const Number> elements)
+{
+    auto stack = Stack::Instance().contents();
+    stack.resize( std::min(kept, stack.size()) );
+    stack.insert( stack.end(), elements.begin(), elements.end() );
+    Stack::Instance().restore(stack);
+
+    return;
+}
+
+// whether a count survives a round trip through a Number, which for a float is not
+// so above 2^24
+bool representable(size_t n)
+{
+    return static_cast<size_t>( static_cast<Number>(n) ) == n;
+}
+
+// whether a serialized count is a whole number no greater than limit
+bool isCount(Number n, size_t limit)
+{
+    return n >= 0 && n <= static_cast<Number>(limit) && n == std::floor(n);
+}
+
+}
+
+#ifdef POSIX
+
+// A ring buffer in shared memory with one writer and one reader. head and tail count
+// the bytes ever written and read, and messages counts the messages not yet read.
+struct RingBuffer
+{
+    static constexpr size_t Capacity = size_t{1} << 20;
+
+    std::atomic<uint64_t> head;
+    std::atomic<uint64_t> tail;
+    sem_t messages;
+    char data[Capacity];
+
+    void reset()
+    {
+        head = 0;
+        tail = 0;
+        sem_init(&messages, 1, 0);
+
+        return;
+    }
+
+    // returns false if the message does not fit
+    bool put(const string& message)
+    {
+        const uint32_t n = static_cast<uint32_t>( message.size() );
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        if( sizeof(n) + n > Capacity - (h - tail.load(std::memory_order_acquire)) ) return false;
+
+        copyIn(h, reinterpret_cast<const char*>(&n), sizeof(n));
+        copyIn(h + sizeof(n), message.data(), n);
+        head.store(h + sizeof(n) + n, std::memory_order_release);
+        sem_post(&messages);
+
+        return true;
+    }
+
+    // reads the oldest message, which must be complete
+    string take()
+    {
+        const uint64_t t = tail.load(std::memory_order_relaxed);
+        uint32_t n;
+        copyOut(t, reinterpret_cast<char*>(&n), sizeof(n));
+        string message(n, '\0');
+        copyOut(t + sizeof(n), message.data(), n);
+        tail.store(t + sizeof(n) + n, std::memory_order_release);
+
+        return message;
+    }
+
+private:
+    void copyIn(uint64_t at, const char* from, size_t n)
+    {
+        const size_t i = at % Capacity;
+        const size_t first = std::min(n, Capacity - i);
+        std::memcpy(data + i, from, first);
+        std::memcpy(data, from + first, n - first);
+
+        return;
+    }
+
+    void copyOut(uint64_t at, char* to, size_t n) const
+    {
+        const size_t i = at % Capacity;
+        const size_t first = std::min(n, Capacity - i);
+        std::memcpy(to, data + i, first);
+        std::memcpy(to + first, data, n - first);
+
+        return;
+    }
+};
+
+struct PluginHost::Channel
+{
+    RingBuffer requests;
+    RingBuffer responses;
+};
+
+PluginHost::PluginHost(const string& library, Setup setup)
+: library_{library}
+, setup_{std::move(setup)}
+, channel_{nullptr}
+, pid_{-1}
+, restarts_{0}
+{
+    void* shared = mmap(nullptr, sizeof(Channel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED)
+        throw Exception{ std::format("Could not start a helper for plugin {}", library_) };
+
+    channel_ = new (shared) Channel;
+
+    try
+    {
+        start();
+    }
+    catch(...)
+    {
+        munmap(channel_, sizeof(Channel));
+        throw;
+    }
+}
+
+PluginHost::~PluginHost()
+{
+    stop();
+    munmap(channel_, sizeof(Channel));
+}
+
+void PluginHost::start()
+{
+    channel_->requests.reset();
+    channel_->responses.reset();
+    replica_.clear();
+
+    pid_ = fork();
+    if(pid_ < 0)
+        throw Exception{ std::format("Could not start a helper for plugin {}", library_) };
+    if(pid_ == 0)
+        serve();
+
+    // the helper first reports on setting up the plugin
+    if( !await() )
+        throw Exception{ std::format("The helper for plugin {} stopped while loading it", library_) };
+
+    auto hello = channel_->responses.take();
+    MessageReader r{hello};
+    if( auto error = r.text(); !error.empty() )
+    {
+        stop();
+        throw Exception{error};
+    }
+
+    std::istringstream iss{ r.text() };
+    PluginManifest manifest{iss};
+    if( manifest.size() != 1 )
+    {
+        stop();
+        throw Exception{ std::format("The helper for plugin {} could not describe it", library_) };
+    }
+
+    description_ = manifest.entries()[0];
+    description_.library = library_;
+
+    vector<string> names( r.field<uint32_t>() );
+    for(auto& n : names) n = r.text();
+    if( names_.empty() ) names_ = std::move(names);
+
+    return;
+}
+
+void PluginHost::stop()
+{
+    // the helper holds nothing that needs cleaning up
+    if(pid_ > 0)
+    {
+        kill(pid_, SIGKILL);
+        waitpid(pid_, nullptr, 0);
+    }
+
+    pid_ = -1;
+
+    return;
+}
+
+void PluginHost::restart()
+{
+    stop();
+    ++restarts_;
+    start();
+
+    return;
+}
+
+bool PluginHost::await()
+{
+    constexpr long PollNs = 100'000'000;
+
+    for(;;)
+    {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PollNs;
+        if(deadline.tv_nsec >= 1'000'000'000)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1'000'000'000;
+        }
+
+        if( sem_timedwait(&channel_->responses.messages, &deadline) == 0 ) return true;
+        if(errno == EINTR) continue;
+
+        if( waitpid(pid_, nullptr, WNOHANG) == pid_ )
+        {
+            pid_ = -1;
+            return false;
+        }
+    }
+}
+
+size_t PluginHost::run(span<const size_t> commands, vector<Number>& stack, string& error)
+{
+    // a helper that could not be restarted before is tried again
+    if(pid_ < 0) restart();
+
+    const auto keep = sharedElements(stack, replica_);
+
+    string request;
+    putField( request, static_cast<uint32_t>(keep) );
+    putNumbers( request, span<const Number>{stack}.subspan(keep) );
+    putField( request, static_cast<uint32_t>(commands.size()) );
+    for(auto c : commands) putField( request, static_cast<uint32_t>(c) );
+
+    if( !channel_->requests.put(request) )
+        throw Exception{ std::format("The stack is too large for plugin {}", library_) };
+
+    if( !await() )
+    {
+        restart();
+        throw Exception{ std::format("Plugin {} stopped unexpectedly and was restarted", library_) };
+    }
+
+    auto response = channel_->responses.take();
+    MessageReader r{response};
+    const auto ran = r.field<uint32_t>();
+    const auto unchanged = r.field<uint32_t>();
+    auto changed = r.numbers();
+    error = r.text();
+
+    stack.resize( std::min<size_t>(unchanged, stack.size()) );
+    stack.insert( stack.end(), changed.begin(), changed.end() );
+    replica_ = stack;
+
+    return ran;
+}
+
+void PluginHost::serve()
+{
+#ifdef __linux__
+    // a helper does not outlive pdCalc
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+
+    // the helper has no user interface, so it raises no change events
+    Stack::Instance().beginBatch();
+
+    auto service = setup_();
+
+    string hello;
+    putString(hello, service.error);
+    if( service.error.empty() )
+    {
+        // only what the plugin provides is described; the manifest's write time is
+        // not needed, but an unknown one would not be written
+        service.description.modified = 0;
+        std::ostringstream oss;
+        PluginManifest::Write(oss, {service.description});
+        putString(hello, oss.str());
+
+        putField( hello, static_cast<uint32_t>(service.names.size()) );
+        for(const auto& n : service.names) putString(hello, n);
+    }
+    channel_->responses.put(hello);
+    if( !service.error.empty() ) _exit(1);
+
+    // a restarted helper serves the commands by the names they had when first started
+    vector<const Command*> table;
+    for(const auto& n : names_.empty() ? service.names : names_)
+        table.push_back( service.command(n) );
+
+    for(;;)
+    {
+        while( sem_wait(&channel_->requests.messages) != 0 ) { }
+
+        auto request = channel_->requests.take();
+        MessageReader r{request};
+
+        auto stack = Stack::Instance().contents();
+        stack.resize( std::min<size_t>(r.field<uint32_t>(), stack.size()) );
+        auto operands = r.numbers();
+        stack.insert( stack.end(), operands.begin(), operands.end() );
+        Stack::Instance().restore(stack);
+
+        uint32_t ran = 0;
+        string error;
+        for( auto n = r.field<uint32_t>(); ran < n; ++ran )
+        {
+            const auto i = r.field<uint32_t>();
+            const Command* prototype = i < table.size() ? table[i] : nullptr;
+            if(!prototype)
+            {
+                error = std::format("Plugin {} no longer provides the command", library_);
+                break;
+            }
+
+            try
+            {
+                auto c = MakeCommandPtr( prototype->clone() );
+                if(!c) throw Exception{"Could not allocate the command"};
+                c->execute();
+            }
+            catch(Exception& e)
+            {
+                error = e.what();
+                break;
+            }
+        }
+
+        const auto result = Stack::Instance().contents();
+        const auto unchanged = sharedElements(result, stack);
+
+        string response;
+        putField(response, ran);
+        putField( response, static_cast<uint32_t>(unchanged) );
+        putNumbers( response, span<const Number>{result}.subspan(unchanged) );
+        putString(response, error);
+        if( !channel_->responses.put(response) )
+        {
+            // the result does not fit, so the helper starts over with an empty replica
+            _exit(1);
+        }
+    }
+}
+
+#else
+
+struct PluginHost::Channel { };
+
+PluginHost::PluginHost(const string& library, Setup setup)
+: library_{library}
+, setup_{std::move(setup)}
+, channel_{nullptr}
+, pid_{-1}
+, restarts_{0}
+{
+    throw Exception{ std::format("Plugin {} cannot be isolated on this platform", library_) };
+}
+
+PluginHost::~PluginHost()
+{ }
+
+void PluginHost::start()
+{ }
+
+void PluginHost::stop()
+{ }
+
+void PluginHost::restart()
+{ }
+
+bool PluginHost::await()
+{
+    return false;
+}
+
+size_t PluginHost::run(span<const size_t>, vector<Number>&, string&)
+{
+    return 0;
+}
+
+void PluginHost::serve()
+{
+    std::abort();
+}
+
+#endif
+
+size_t PluginHost::index(const string& name) const
+{
+    return std::ranges::find(names_, name) - names_.begin();
+}
+
+IsolatedPluginCommand::IsolatedPluginCommand(PluginHost& host, size_t index, string_view help)
+: host_{host}
+, index_{index}
+, helpMsg_{help}
+, kept_{0}
+{ }
+
+IsolatedPluginCommand::IsolatedPluginCommand(const IsolatedPluginCommand& rhs)
+: Command{rhs}
+, host_{rhs.host_}
+, index_{rhs.index_}
+, helpMsg_{rhs.helpMsg_}
+, kept_{rhs.kept_}
+, replaced_{rhs.replaced_}
+, result_{rhs.result_}
+{ }
+
+void IsolatedPluginCommand::checkPreconditionsImpl() const
+{
+    const auto before = Stack::Instance().contents();
+    auto after = before;
+
+    string error;
+    if( host_.run(span<const size_t>{&index_, 1}, after, error) == 0 )
+        throw Exception{error};
+
+    kept_ = sharedElements(before, after);
+    replaced_.assign( before.begin() + kept_, before.end() );
+    result_.assign( after.begin() + kept_, after.end() );
+
+    return;
+}
+
+const char* IsolatedPluginCommand::helpMessageImpl() const noexcept
+{
+    return helpMsg_.c_str();
+}
+
+void IsolatedPluginCommand::executeImpl() noexcept
+{
+    replaceAbove(kept_, result_);
+
+    return;
+}
+
+void IsolatedPluginCommand::undoImpl() noexcept
+{
+    replaceAbove(kept_, replaced_);
+
+    return;
+}
+
+IsolatedPluginCommand* IsolatedPluginCommand::cloneImpl() const
+{
+    return new IsolatedPluginCommand{*this};
+}
+
+// serializes the length of the unchanged part of the stack and the number of elements
+// replaced, then the elements replaced and those that replaced them, which an undo
+// and a redo after deserializing need; a count a Number cannot hold exactly is not
+// serialized
+bool IsolatedPluginCommand::serializeImpl(vector<Number>& operands) const
+{
+    if( !representable(kept_) || !representable( replaced_.size() ) ) return false;
+
+    operands.push_back( static_cast<Number>(kept_) );
+    operands.push_back( static_cast<Number>( replaced_.size() ) );
+    operands.insert( operands.end(), replaced_.begin(), replaced_.end() );
+    operands.insert( operands.end(), result_.begin(), result_.end() );
+
+    return true;
+}
+
+void IsolatedPluginCommand::deserializeImpl(span<const Number> operands) noexcept
+{
+    if( operands.size() < 2 ) return;
+
+    const auto n = std::min( static_cast<size_t>( std::max<Number>(operands[1], 0) ), operands.size() - 2 );
+    kept_ = static_cast<size_t>( std::max<Number>(operands[0], 0) );
+    replaced_.assign( operands.begin() + 2, operands.begin() + 2 + n );
+    result_.assign( operands.begin() + 2 + n, operands.end() );
+
+    return;
+}
+
+// the two counts that lead the operands must be whole, and the second must count no
+// more than the operands that follow
+bool IsolatedPluginCommand::deserializableImpl(span<const Number> operands) const noexcept
+{
+    if( operands.size() < 2 ) return false;
+
+    return isCount( operands[0], size_t{1} << std::numeric_limits<Number>::digits )
+        && isCount( operands[1], operands.size() - 2 );
+}
+
+}
@@ -24,13 +24,28 @@ module;
 #include <vector>
 #include <string>
 #include <format>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <list>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <typeinfo>
+#include <system_error>
 export module pdCalc_pluginManagement;
 
 import pdCalc_userInterface;
 import pdCalc_utilities;
 import pdCalc_plugin;
+import pdCalc_command;
 import :DynamicLoader;
 import :PlatformFactory;
+export import :PluginManifest;
+export import :PluginWatcher;
+export import :PluginHost;
 
 using std::vector;
 using std::string;
@@ -38,6 +53,7 @@ using std::ifstream;
 using std::unique_ptr;
 using std::format;
 namespace ranges = std::ranges;
+namespace fs = std::filesystem;
 
 namespace pdCalc {
 
@@ -46,6 +62,7 @@ export class PluginDeleter
 public:
     explicit PluginDeleter(DynamicLoader& d) : loader_{d} {}
     void operator()(pdCalc::Plugin* p) { loader_.deallocatePlugin(p); }
+    DynamicLoader& getLoader() const { return loader_; }
 
 private:
     DynamicLoader& loader_;
@@ -53,62 +70,747 @@ private:
 
 export class PluginLoader
 {
+    class LazyPluginCommand;
+
 public:
+    // Eager loads every listed plugin library. Lazy only loads libraries that the
+    // manifest cached next to the plugin file does not describe (and then updates
+    // the manifest); the others are loaded the first time one of their commands is
+    // used.
+    enum class Activation { Eager, Lazy };
+
+    // InProcess loads plugin libraries into pdCalc. Process runs each plugin in a
+    // helper process (see PluginHost), started when the plugin is loaded, so that a
+    // plugin that crashes only takes its helper down; activation is then ignored.
+    enum class Isolation { InProcess, Process };
+
     PluginLoader() = default;
     ~PluginLoader() = default;
 
-    void loadPlugins(UserInterface& ui, const string& pluginFileName);
+    // pluginFileName is either a file listing plugin libraries or a directory, in
+    // which case every library in the directory is a plugin. Libraries are loaded in
+    // parallel, but plugins are always ordered as listed or, for a directory, by name.
+    void loadPlugins(UserInterface& ui, const string& pluginFileName, Activation activation = Activation::Eager,
+        Isolation isolation = Isolation::InProcess);
+
+    // the plugins loaded into pdCalc so far
     const vector<const Plugin*> getPlugins() const;
 
+    // the helper running plugin i of the manifest, or nullptr if it is not isolated
+    PluginHost* getHost(size_t i) const { return hosts_[i].get(); }
+
+    // every listed plugin that was loaded or is described by the manifest, in order
+    const vector<PluginManifest::Entry>& getPluginManifest() const { return manifest_; }
+
+    // Returns the command that plugin i of the manifest provides under name: a clone
+    // of the command if the plugin is loaded, or else a stub whose clones are clones
+    // of the command, loading the plugin the first time. Returns a null command if
+    // the plugin does not provide name. A plugin's kernel k is provided as the
+    // KernelCommand named KernelCommandName(k), and its functions as
+    // UnaryFunctionCommands and BinaryFunctionCommands, in place of any commands of
+    // the same names. The commands of an isolated plugin are IsolatedPluginCommands.
+    CommandPtr makeCommand(size_t i, const string& name);
+
+    static string KernelCommandName(const string& kernel) { return "map:" + kernel; }
+
+    // Loads the current version of plugin i's library in place of the loaded one, if
+    // any, and returns true, or returns false (posting why) if it cannot be loaded,
+    // leaving plugin i as it was. Commands of the old version, wherever they are, must
+    // then be replaced: commands cloned from the loader, through upgrade, and the rest
+    // of the old version is retained until releaseRetired finds it unused. An isolated
+    // plugin's helper is simply restarted, and its commands need no replacing.
+    bool reload(size_t i);
+
+    // If c is a command of an old version of plugin i, returns the same command of the
+    // current version with c's state, serialized and restored; otherwise, or if c's
+    // state cannot be serialized, returns a null command.
+    CommandPtr upgrade(size_t i, const Command& c);
+
+    // Unloads every old version that no command passed to f by visitCommands still
+    // needs. A command needs an old version if its class is defined there or if it is
+    // a core command that cannot be serialized, since such a command (e.g., a stored
+    // procedure) may hold plugin commands.
+    using CommandVisitor = std::function<void(const Command&)>;
+    void releaseRetired(const std::function<void(const CommandVisitor&)>& visitCommands);
+
+    // the number of old versions retained and the total size of their libraries
+    size_t retainedVersions() const { return retired_.size(); }
+    uintmax_t retainedBytes() const;
+
+    // the number of libraries held open, not counting old versions
+    size_t openLibraries() const { return loaders_.size(); }
+
+    // the approximate number of bytes of the loaded plugins: the size of their
+    // libraries and the commands made for their functions and kernels
+    uintmax_t footprint() const;
+
+    // the name of the manifest cached for pluginFileName
+    static string ManifestName(const string& pluginFileName) { return pluginFileName + ".manifest"; }
+
+    // the extension of a plugin library on this platform
+#ifdef WIN32
+    static constexpr const char* LibraryExtension = ".dll";
+#elif defined(__APPLE__)
+    static constexpr const char* LibraryExtension = ".dylib";
+#else
+    static constexpr const char* LibraryExtension = ".so";
+#endif
+
 private:
     PluginLoader(const PluginLoader&) = delete;
     PluginLoader(PluginLoader&&) = delete;
     PluginLoader& operator=(const PluginLoader&) = delete;
     PluginLoader& operator=(PluginLoader&&) = delete;
 
-    void load(UserInterface& ui, const string&);
+    // the libraries listed in, or found in, pluginFileName
+    vector<string> listPlugins(UserInterface& ui, const string& pluginFileName) const;
+
+    const Plugin* load(UserInterface& ui, const string&);
+
+    // loads the library name, or returns nullptr
+    Plugin* open(const string& name);
+
+    // starts a helper for each library in names
+    void loadIsolated(UserInterface& ui, const vector<string>& names);
+
+    // the names of the commands plugin p provides, in the order makeCommand looks
+    // for them
+    static vector<string> CommandNames(const PluginManifest::Entry& p);
+
+    // takes ownership of p, loaded from name by the last of loaders_
+    void keep(Plugin* p, const string& name);
+
+    // loads every library in names concurrently and returns the plugins in order,
+    // with null for those that could not be loaded
+    vector<const Plugin*> loadAll(UserInterface& ui, const vector<string>& names);
+
+    // loads plugin i of the manifest if needed and returns its command name, or
+    // nullptr if either cannot be found
+    const Command* activate(size_t i, const string& name);
+
+    // the command of plugin p named name, or nullptr
+    static const Command* find(const Plugin& p, const string& name);
+
+    // the command pdCalc makes for the function or kernel of plugin p with the
+    // command name name, made the first time it is asked for, or nullptr
+    const Command* findHosted(const Plugin& p, const string& name);
+
+    // the command name of the function or kernel of plugin p at address origin, or ""
+    static string HostedName(const Plugin& p, const void* origin);
+
+    static string KernelHelp(const string& kernel, int arity);
+
+    // the address identifying the library c comes from: its function's or kernel's
+    // for the commands pdCalc makes for them, since their classes are pdCalc's, or
+    // else its type's
+    static const void* Origin(const Command& c);
+
+    // moves the loaded version of plugin i, which must be active, to retired_
+    void retire(size_t i);
 
+    UserInterface* ui_ = nullptr;
     vector<unique_ptr<DynamicLoader>> loaders_;
     vector<unique_ptr<Plugin, PluginDeleter>> plugins_;
+
+    // active_[i] is the loaded plugin described by manifest_[i], if any
+    vector<PluginManifest::Entry> manifest_;
+    vector<const Plugin*> active_;
+    vector<bool> failed_;
+
+    // hosts_[i] is the helper running plugin i, if it is isolated
+    vector<unique_ptr<PluginHost>> hosts_;
+
+    // An old version of a plugin, kept loaded while commands may still use it. The
+    // plugin is declared after its loader so that it is deallocated first.
+    struct Retired
+    {
+        size_t plugin;
+        uintmax_t bytes;
+        unique_ptr<DynamicLoader> loader;
+        unique_ptr<Plugin, PluginDeleter> instance;
+        bool used;
+    };
+
+    // a list because a plugin's deleter cannot be assigned
+    std::list<Retired> retired_;
+
+    // the size of each loaded plugin's library
+    std::map<const Plugin*, uintmax_t> bytes_;
+
+    // the commands made for plugins' functions and kernels, by plugin and name
+    std::map<std::pair<const Plugin*, string>, CommandPtr> hosted_;
 };
 
-void PluginLoader::loadPlugins(UserInterface& ui, const string& pluginFileName)
+// Stands in for a command of a plugin that is not loaded yet. Only the help message
+// is known until the stub is first cloned, which loads the plugin; every clone is
+// then a clone of the plugin's command, so the stub itself is never executed.
+class PluginLoader::LazyPluginCommand : public Command
 {
+public:
+    LazyPluginCommand(PluginLoader& loader, size_t plugin, const string& name, const string& help)
+    : loader_{loader}, plugin_{plugin}, name_{name}, help_{help}, target_{nullptr} { }
+
+private:
+    LazyPluginCommand(const LazyPluginCommand&) = delete;
+    LazyPluginCommand(LazyPluginCommand&&) = delete;
+    LazyPluginCommand& operator=(const LazyPluginCommand&) = delete;
+    LazyPluginCommand& operator=(LazyPluginCommand&&) = delete;
+
+    void executeImpl() noexcept override { }
+    void undoImpl() noexcept override { }
+
+    Command* cloneImpl() const override
+    {
+        if(!target_) target_ = loader_.activate(plugin_, name_);
+
+        return target_ ? target_->clone() : nullptr;
+    }
 
-    if( ifstream ifs{ pluginFileName.c_str() } )
+    const char* helpMessageImpl() const noexcept override
     {
-        ranges::for_each( vector<string>{ std::istream_iterator<string>(ifs), std::istream_iterator<string>() },
-            [&ui, this](auto n){load(ui, n);} );
+        return target_ ? target_->helpMessage() : help_.c_str();
+    }
+
+    const Command& targetImpl() const noexcept override
+    {
+        return target_ ? *target_ : *this;
+    }
+
+    PluginLoader& loader_;
+    size_t plugin_;
+    string name_;
+    string help_;
+    mutable const Command* target_;
+};
+
+void PluginLoader::loadPlugins(UserInterface& ui, const string& pluginFileName, Activation activation,
+    Isolation isolation)
+{
+    ui_ = &ui;
+
+    auto names = listPlugins(ui, pluginFileName);
+    if(isolation == Isolation::Process)
+    {
+        loadIsolated(ui, names);
+        return;
+    }
+
+    PluginManifest cached{ activation == Activation::Lazy ? ManifestName(pluginFileName) : string{} };
+    bool stale = false;
+
+    // the manifest only holds the entries that can be cached, so only those are
+    // compared with it
+    size_t cacheable = 0;
+
+    // libraries the manifest describes are not loaded, and the rest are loaded together
+    vector<string> toLoad;
+    for(const auto& n : names)
+    {
+        if( !cached.find(n) || activation == Activation::Eager )
+            toLoad.push_back(n);
+    }
+    auto loaded = loadAll(ui, toLoad);
+
+    auto p = loaded.begin();
+    for(const auto& n : names)
+    {
+        if( auto e = cached.find(n); e && activation == Activation::Lazy )
+        {
+            manifest_.push_back(*e);
+            active_.push_back(nullptr);
+            ++cacheable;
+        }
+        else if( auto plugin = *p++ )
+        {
+            manifest_.push_back( PluginManifest::Describe(n, *plugin) );
+            active_.push_back(plugin);
+            if( PluginManifest::Cacheable( manifest_.back() ) )
+            {
+                ++cacheable;
+                stale = true;
+            }
+        }
+    }
+    stale = stale || cached.size() != cacheable;
+
+    failed_.assign(manifest_.size(), false);
+    hosts_.resize( manifest_.size() );
+
+    if(activation == Activation::Lazy && stale && !names.empty())
+        PluginManifest::Write( ManifestName(pluginFileName), manifest_ );
+
+    return;
+}
+
+vector<string> PluginLoader::listPlugins(UserInterface& ui, const string& pluginFileName) const
+{
+    vector<string> names;
+
+    std::error_code ec;
+    if( fs::is_directory(pluginFileName, ec) )
+    {
+        for(const auto& entry : fs::directory_iterator{pluginFileName, ec})
+        {
+            if( entry.is_regular_file(ec) && entry.path().extension() == LibraryExtension )
+                names.push_back( entry.path().string() );
+        }
+
+        // directory order is arbitrary, but commands must be registered in the same
+        // order every time, so that which of two conflicting commands wins is fixed
+        ranges::sort(names);
+    }
+    else if( ifstream ifs{ pluginFileName.c_str() } )
+    {
+        names.assign( std::istream_iterator<string>(ifs), std::istream_iterator<string>() );
     }
     else
     {
         ui.postMessage("Could not open plugin file");
     }
 
-    return;
+    return names;
 }
 
 const vector<const Plugin*> PluginLoader::getPlugins() const
 {
     vector<const Plugin*> v;
     for(auto& i : plugins_)
-        v.push_back( i.get() );
+    {
+        if(i) v.push_back( i.get() );
+    }
 
     return v;
 }
 
-void PluginLoader::load(UserInterface& ui, const string& name)
+CommandPtr PluginLoader::makeCommand(size_t i, const string& name)
+{
+    string help;
+
+    const auto& functions = manifest_[i].functions;
+    const auto& commands = manifest_[i].commands;
+    const auto& kernels = manifest_[i].kernels;
+    if( auto f = ranges::find_if(functions, [&](const auto& f){ return f.name == name; }); f != functions.end() )
+        help = f->help;
+    else if( auto c = ranges::find_if(commands, [&](const auto& c){ return c.name == name; }); c != commands.end() )
+        help = c->help;
+    else if( auto k = ranges::find_if(kernels, [&](const auto& k){ return KernelCommandName(k.name) == name; }); k != kernels.end() )
+        help = KernelHelp(k->name, k->arity);
+    else
+        return MakeCommandPtr(nullptr);
+
+    if( auto host = hosts_[i].get() )
+        return MakeCommandPtr<IsolatedPluginCommand>(*host, host->index(name), help);
+
+    if( active_[i] )
+    {
+        auto command = activate(i, name);
+        return MakeCommandPtr( command ? command->clone() : nullptr );
+    }
+
+    return MakeCommandPtr<LazyPluginCommand>(*this, i, name, help);
+}
+
+const Command* PluginLoader::activate(size_t i, const string& name)
+{
+    if( !active_[i] && !failed_[i] )
+    {
+        // a library that no longer matches its manifest entry is not used
+        auto p = load(*ui_, manifest_[i].library);
+        if( p && (p->apiVersion().major != manifest_[i].apiVersion.major
+            || p->apiVersion().minor != manifest_[i].apiVersion.minor) )
+        {
+            ui_->postMessage( format("Plugin {} does not match its manifest", manifest_[i].library) );
+            p = nullptr;
+        }
+
+        active_[i] = p;
+        failed_[i] = !p;
+    }
+
+    if( !active_[i] ) return nullptr;
+
+    if( auto c = findHosted(*active_[i], name) ) return c;
+    if( auto c = find(*active_[i], name) ) return c;
+
+    ui_->postMessage( format("Plugin {} does not provide command {}", manifest_[i].library, name) );
+
+    return nullptr;
+}
+
+const Command* PluginLoader::find(const Plugin& p, const string& name)
+{
+    const auto& descriptor = p.getPluginDescriptor();
+    for(int j = 0; j < descriptor.nCommands; ++j)
+    {
+        if(name == descriptor.commandNames[j])
+            return descriptor.commands[j];
+    }
+
+    return nullptr;
+}
+
+const Command* PluginLoader::findHosted(const Plugin& p, const string& name)
+{
+    if( auto h = hosted_.find({&p, name}); h != hosted_.end() ) return h->second.get();
+
+    auto c = MakeCommandPtr(nullptr);
+    if( auto f = p.getFunctions() )
+    {
+        for(int j = 0; !c && j < f->nUnary; ++j)
+        {
+            if( name == f->unaryNames[j] )
+                c = MakeCommandPtr<UnaryFunctionCommand>( f->unaryHelp[j], f->unaryFunctions[j], f->unaryPreconditions[j] );
+        }
+
+        for(int j = 0; !c && j < f->nBinary; ++j)
+        {
+            if( name == f->binaryNames[j] )
+                c = MakeCommandPtr<BinaryFunctionCommand>( f->binaryHelp[j], f->binaryFunctions[j], f->binaryPreconditions[j] );
+        }
+    }
+
+    if( auto k = p.getKernels() )
+    {
+        for(int j = 0; !c && j < k->nKernels; ++j)
+        {
+            if( name == KernelCommandName(k->kernelNames[j]) )
+                c = MakeCommandPtr<KernelCommand>( KernelHelp(k->kernelNames[j], k->arities[j]), k->kernels[j], k->arities[j],
+                    p.getKernelDomain(j) );
+        }
+    }
+
+    if(!c) return nullptr;
+
+    return hosted_.emplace( std::pair{&p, name}, std::move(c) ).first->second.get();
+}
+
+string PluginLoader::HostedName(const Plugin& p, const void* origin)
+{
+    auto address = [](auto f){ return reinterpret_cast<const void*>(f); };
+
+    if( auto f = p.getFunctions() )
+    {
+        for(int j = 0; j < f->nUnary; ++j)
+            if( address(f->unaryFunctions[j]) == origin ) return f->unaryNames[j];
+
+        for(int j = 0; j < f->nBinary; ++j)
+            if( address(f->binaryFunctions[j]) == origin ) return f->binaryNames[j];
+    }
+
+    if( auto k = p.getKernels() )
+    {
+        for(int j = 0; j < k->nKernels; ++j)
+            if( address(k->kernels[j]) == origin ) return KernelCommandName(k->kernelNames[j]);
+    }
+
+    return "";
+}
+
+string PluginLoader::KernelHelp(const string& kernel, int arity)
+{
+    return arity == 1 ? format("Replace every element x of the stack with {}(x)", kernel)
+        : format("Split the stack into {} equal parts and combine them element by element with {}", arity, kernel);
+}
+
+const void* PluginLoader::Origin(const Command& c)
+{
+    if( auto k = dynamic_cast<const KernelCommand*>(&c) )
+        return reinterpret_cast<const void*>( k->kernel() );
+    if( auto u = dynamic_cast<const UnaryFunctionCommand*>(&c) )
+        return reinterpret_cast<const void*>( u->function() );
+    if( auto b = dynamic_cast<const BinaryFunctionCommand*>(&c) )
+        return reinterpret_cast<const void*>( b->function() );
+
+    return &typeid(c);
+}
+
+bool PluginLoader::reload(size_t i)
+{
+    const auto library = manifest_[i].library;
+
+    if( auto host = hosts_[i].get() )
+    {
+        try
+        {
+            host->restart();
+            manifest_[i] = host->description();
+        }
+        catch(Exception& e)
+        {
+            ui_->postMessage( e.what() );
+            return false;
+        }
+
+        return true;
+    }
+
+    // while the old version is loaded, the dynamic linker resolves the library's name
+    // to it, so the new version is loaded from a copy, which is removed once loaded
+    std::error_code ec;
+    auto copy = fs::temp_directory_path(ec) / format( "pdCalc-{}-{}",
+        std::chrono::steady_clock::now().time_since_epoch().count(), fs::path{library}.filename().string() );
+    if( !fs::copy_file(library, copy, ec) )
+    {
+        ui_->postMessage( format("Could not reload plugin {}", library) );
+        return false;
+    }
+
+    auto p = load(*ui_, copy.string());
+    fs::remove(copy, ec);
+    if(!p)
+    {
+        loaders_.pop_back();
+        return false;
+    }
+
+    if( p->apiVersion().major != manifest_[i].apiVersion.major || p->apiVersion().minor != manifest_[i].apiVersion.minor )
+    {
+        ui_->postMessage( format("Plugin {} changed its API version and was not reloaded", library) );
+        bytes_.erase(p);
+
+        // the plugin is deallocated by its loader, which load left last
+        plugins_.back().reset();
+        loaders_.pop_back();
+        return false;
+    }
+
+    if( active_[i] ) retire(i);
+
+    manifest_[i] = PluginManifest::Describe(library, *p);
+    active_[i] = p;
+    failed_[i] = false;
+
+    return true;
+}
+
+void PluginLoader::retire(size_t i)
+{
+    auto plugin = ranges::find_if(plugins_, [&](const auto& p){ return p.get() == active_[i]; });
+    auto& loader = plugin->get_deleter().getLoader();
+    auto l = ranges::find_if(loaders_, [&](const auto& l){ return l.get() == &loader; });
+
+    // plugins_ keeps an empty slot, since its deleters cannot be assigned either
+    retired_.push_back( Retired{i, bytes_[active_[i]], std::move(*l), std::move(*plugin), true} );
+    loaders_.erase(l);
+    bytes_.erase(active_[i]);
+    std::erase_if(hosted_, [&](const auto& h){ return h.first.first == active_[i]; });
+
+    return;
+}
+
+CommandPtr PluginLoader::upgrade(size_t i, const Command& c)
+{
+    if( !active_[i] ) return MakeCommandPtr(nullptr);
+
+    for(const auto& r : retired_)
+    {
+        if( r.plugin != i || !r.loader->owns( Origin(c) ) ) continue;
+
+        vector<Number> operands;
+        if( !c.serialize(operands) ) return MakeCommandPtr(nullptr);
+
+        auto u = MakeCommandPtr(nullptr);
+        if( auto name = HostedName(*r.instance, Origin(c)); !name.empty() )
+        {
+            // the new version's command of the same name must keep the same state
+            auto current = findHosted(*active_[i], name);
+            auto k = dynamic_cast<const KernelCommand*>(&c);
+            if( current && typeid(*current) == typeid(c)
+                && (!k || static_cast<const KernelCommand*>(current)->arity() == k->arity()) )
+                u = MakeCommandPtr( current->clone() );
+        }
+        else
+        {
+            // commands of one type are told apart by help message, as the factory does
+            const auto& descriptor = r.instance->getPluginDescriptor();
+            for(int j = 0; j < descriptor.nCommands; ++j)
+            {
+                const auto& old = *descriptor.commands[j];
+                if( typeid(old) != typeid(c) || std::strcmp(old.helpMessage(), c.helpMessage()) != 0 ) continue;
+
+                if( auto current = find(*active_[i], descriptor.commandNames[j]) )
+                    u = MakeCommandPtr( current->clone() );
+            }
+        }
+
+        if(u) u->deserialize(operands);
+
+        return u;
+    }
+
+    return MakeCommandPtr(nullptr);
+}
+
+void PluginLoader::releaseRetired(const std::function<void(const CommandVisitor&)>& visitCommands)
+{
+    if( retired_.empty() ) return;
+
+    for(auto& r : retired_) r.used = false;
+
+    bool all = false;
+    vector<Number> operands;
+    visitCommands([&](const Command& c)
+    {
+        if(all) return;
+
+        operands.clear();
+        if( !dynamic_cast<const PluginCommand*>(&c) && !c.serialize(operands) )
+            all = true;
+
+        for(auto& r : retired_)
+        {
+            if( r.loader->owns( Origin(c) ) ) r.used = true;
+        }
+    });
+
+    if(!all) std::erase_if(retired_, [](const auto& r){ return !r.used; });
+
+    return;
+}
+
+uintmax_t PluginLoader::retainedBytes() const
+{
+    uintmax_t bytes = 0;
+    for(const auto& r : retired_) bytes += r.bytes;
+
+    return bytes;
+}
+
+uintmax_t PluginLoader::footprint() const
+{
+    uintmax_t bytes = 0;
+    for(const auto& [p, b] : bytes_) bytes += b;
+    for(const auto& [key, c] : hosted_) bytes += key.second.capacity() + c->footprint();
+
+    return bytes;
+}
+
+const Plugin* PluginLoader::load(UserInterface& ui, const string& name)
+{
+    auto p = open(name);
+    if(!p) ui.postMessage( format("Error opening plugin: {}", name) );
+
+    return p;
+}
+
+Plugin* PluginLoader::open(const string& name)
 {
     loaders_.emplace_back( PlatformFactory::Instance().createDynamicLoader() );
 
     // may be null
-    if( auto p = loaders_.back()->allocatePlugin(name) )
-        plugins_.emplace_back( p, PluginDeleter( *loaders_.back() ) );
-    else
-        ui.postMessage( format("Error opening plugin: {}", name) );
+    auto p = loaders_.back()->allocatePlugin(name);
+    if(p) keep(p, name);
+
+    return p;
+}
+
+void PluginLoader::loadIsolated(UserInterface& ui, const vector<string>& names)
+{
+    for(const auto& name : names)
+    {
+        // runs in the helper, which has its own copy of the loader
+        auto setup = [this, name]
+        {
+            PluginHost::Service s;
+            if( auto p = open(name) )
+            {
+                s.description = PluginManifest::Describe(name, *p);
+                s.names = CommandNames(s.description);
+                s.command = [this, p](const string& n)
+                {
+                    auto c = findHosted(*p, n);
+                    return c ? c : find(*p, n);
+                };
+            }
+            else
+                s.error = format("Error opening plugin: {}", name);
+
+            return s;
+        };
+
+        try
+        {
+            auto host = std::make_unique<PluginHost>(name, setup);
+            manifest_.push_back( host->description() );
+            active_.push_back(nullptr);
+            failed_.push_back(false);
+            hosts_.push_back( std::move(host) );
+        }
+        catch(Exception& e)
+        {
+            ui.postMessage( e.what() );
+        }
+    }
 
     return;
 }
 
+vector<string> PluginLoader::CommandNames(const PluginManifest::Entry& p)
+{
+    vector<string> names;
+    for(const auto& f : p.functions) names.push_back(f.name);
+    for(const auto& c : p.commands) names.push_back(c.name);
+    for(const auto& k : p.kernels) names.push_back( KernelCommandName(k.name) );
+
+    return names;
+}
+
+vector<const Plugin*> PluginLoader::loadAll(UserInterface& ui, const vector<string>& names)
+{
+    if( names.size() < 2 )
+    {
+        vector<const Plugin*> v;
+        for(const auto& n : names) v.push_back( load(ui, n) );
+        return v;
+    }
+
+    // the platform factory is not thread safe, so every loader is made up front
+    vector<unique_ptr<DynamicLoader>> loaders;
+    for(size_t i = 0; i < names.size(); ++i)
+        loaders.emplace_back( PlatformFactory::Instance().createDynamicLoader() );
+
+    // opening a library (relocation and static initialization) dominates, so the
+    // workers share nothing but the index of the next library to open
+    vector<Plugin*> allocated(names.size(), nullptr);
+    std::atomic<size_t> next{0};
+    auto work = [&]
+    {
+        for(size_t i = next++; i < names.size(); i = next++)
+            allocated[i] = loaders[i]->allocatePlugin(names[i]);
+    };
+
+    const size_t nThreads = std::min<size_t>( std::max(std::thread::hardware_concurrency(), 1u), names.size() );
+    vector<std::jthread> workers;
+    for(size_t i = 1; i < nThreads; ++i)
+        workers.emplace_back(work);
+    work();
+    workers.clear();
+
+    // errors are posted, and plugins kept, in order on the calling thread
+    vector<const Plugin*> v;
+    for(size_t i = 0; i < names.size(); ++i)
+    {
+        loaders_.push_back( std::move(loaders[i]) );
+        if( auto p = allocated[i] )
+            keep(p, names[i]);
+        else
+            ui.postMessage( format("Error opening plugin: {}", names[i]) );
+
+        v.push_back( allocated[i] );
+    }
+
+    return v;
+}
+
+void PluginLoader::keep(Plugin* p, const string& name)
+{
+    plugins_.emplace_back( p, PluginDeleter( *loaders_.back() ) );
+
+    std::error_code ec;
+    const auto bytes = fs::file_size(name, ec);
+    bytes_[p] = ec ? 0 : bytes;
+
+    return;
 }
 
+}
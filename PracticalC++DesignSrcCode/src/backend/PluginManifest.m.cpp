@@ -0,0 +1,285 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// A cache of what each plugin library provides (its API version, command names and
+// help messages, buttons, kernels, and functions) so that plugins can be set up at
+// startup without loading their libraries. Each entry records the last write time
+// of its library and is only used while the library is unchanged.
+//
+// The manifest is a text file. After a version line, each library is a plugin line
+// followed by lines for what it provides, with tab separated fields:
+//
+//     plugin  library  modified  major  minor
+//     command  name  help
+//     button  dispPrimaryCmd  primaryCmd  dispShftCmd  shftCmd
+//     kernel  name  arity
+//     function  name  arity  help
+//
+// Libraries whose names or descriptions contain tabs or newlines are not cached.
+module;
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <filesystem>
+#include <algorithm>
+#include <system_error>
+#include <limits>
+export module pdCalc_pluginManagement:PluginManifest;
+
+import pdCalc_plugin;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace pdCalc {
+
+export class PluginManifest
+{
+public:
+    struct CommandInfo
+    {
+        string name;
+        string help;
+    };
+
+    struct ButtonInfo
+    {
+        string dispPrimaryCmd;
+        string primaryCmd;
+        string dispShftCmd;
+        string shftCmd;
+    };
+
+    struct KernelInfo
+    {
+        string name;
+        int arity;
+    };
+
+    struct FunctionInfo
+    {
+        string name;
+        int arity;
+        string help;
+    };
+
+    struct Entry
+    {
+        string library;
+        int64_t modified;
+        Plugin::ApiVersion apiVersion;
+        vector<CommandInfo> commands;
+        vector<ButtonInfo> buttons;
+        vector<KernelInfo> kernels;
+        vector<FunctionInfo> functions;
+    };
+
+    // reads the manifest in filename, or from is; a missing or malformed manifest is
+    // empty
+    explicit PluginManifest(const string& filename);
+    explicit PluginManifest(std::istream& is);
+
+    size_t size() const { return entries_.size(); }
+
+    // returns the entry for library if the library is unchanged since it was
+    // described, or nullptr
+    const Entry* find(const string& library) const;
+
+    // describes the plugin loaded from library
+    static Entry Describe(const string& library, const Plugin& p);
+
+    // Writes entries to filename or os, leaving out those that cannot be cached.
+    // Returns false if the file cannot be written; the manifest is only a cache, so
+    // callers may simply carry on.
+    static bool Write(const string& filename, const vector<Entry>& entries);
+    static bool Write(std::ostream& os, const vector<Entry>& entries);
+
+    const vector<Entry>& entries() const { return entries_; }
+
+    // the last write time of library, or Unknown if it is not a file that can be
+    // checked (e.g., a library found through the system's search path)
+    static int64_t Modified(const string& library);
+    static constexpr int64_t Unknown = std::numeric_limits<int64_t>::min();
+
+    // whether Write keeps e: its library's write time is known and none of its
+    // strings would break the manifest's lines
+    static bool Cacheable(const Entry& e);
+
+private:
+    vector<Entry> entries_;
+};
+
+namespace {
+
+constexpr string_view ManifestVersion = "pdCalc plugin manifest 3";
+
+vector<string> splitFields(const string& line)
+{
+    vector<string> fields;
+    size_t first = 0;
+    for(size_t tab; (tab = line.find('\t', first)) != string::npos; first = tab + 1)
+        fields.emplace_back( line.substr(first, tab - first) );
+    fields.emplace_back( line.substr(first) );
+
+    return fields;
+}
+
+}
+
+bool PluginManifest::Cacheable(const Entry& e)
+{
+    auto clean = [](const string& s){ return s.find_first_of("\t\n\r") == string::npos; };
+
+    return e.modified != Unknown && clean(e.library)
+        && std::ranges::all_of(e.commands, [&](const auto& c){ return clean(c.name) && clean(c.help); })
+        && std::ranges::all_of(e.buttons, [&](const auto& b)
+            { return clean(b.dispPrimaryCmd) && clean(b.primaryCmd) && clean(b.dispShftCmd) && clean(b.shftCmd); })
+        && std::ranges::all_of(e.kernels, [&](const auto& k){ return clean(k.name); })
+        && std::ranges::all_of(e.functions, [&](const auto& f){ return clean(f.name) && clean(f.help); });
+}
+
+PluginManifest::PluginManifest(const string& filename)
+{
+    if( std::ifstream ifs{filename} )
+        *this = PluginManifest{ifs};
+}
+
+PluginManifest::PluginManifest(std::istream& ifs)
+{
+    string line;
+    if( !std::getline(ifs, line) || line != ManifestVersion ) return;
+
+    try
+    {
+        while( std::getline(ifs, line) )
+        {
+            auto f = splitFields(line);
+            if(f[0] == "plugin" && f.size() == 5)
+                entries_.push_back( Entry{f[1], std::stoll(f[2]), {std::stoi(f[3]), std::stoi(f[4])}, {}, {}, {}, {}} );
+            else if(f[0] == "command" && f.size() == 3 && !entries_.empty())
+                entries_.back().commands.push_back( CommandInfo{f[1], f[2]} );
+            else if(f[0] == "button" && f.size() == 5 && !entries_.empty())
+                entries_.back().buttons.push_back( ButtonInfo{f[1], f[2], f[3], f[4]} );
+            else if(f[0] == "kernel" && f.size() == 3 && !entries_.empty())
+                entries_.back().kernels.push_back( KernelInfo{f[1], std::stoi(f[2])} );
+            else if(f[0] == "function" && f.size() == 4 && !entries_.empty())
+                entries_.back().functions.push_back( FunctionInfo{f[1], std::stoi(f[2]), f[3]} );
+            else
+            {
+                entries_.clear();
+                return;
+            }
+        }
+    }
+    catch(...)
+    {
+        // a malformed number
+        entries_.clear();
+    }
+}
+
+const PluginManifest::Entry* PluginManifest::find(const string& library) const
+{
+    auto i = std::ranges::find_if(entries_, [&](const Entry& e){ return e.library == library; });
+    if( i == entries_.end() ) return nullptr;
+
+    const auto modified = Modified(library);
+
+    return modified != Unknown && modified == i->modified ? &*i : nullptr;
+}
+
+PluginManifest::Entry PluginManifest::Describe(const string& library, const Plugin& p)
+{
+    Entry e{library, Modified(library), p.apiVersion(), {}, {}, {}, {}};
+
+    const auto& descriptor = p.getPluginDescriptor();
+    for(int i = 0; i < descriptor.nCommands; ++i)
+        e.commands.push_back( CommandInfo{descriptor.commandNames[i], descriptor.commands[i]->helpMessage()} );
+
+    if( auto b = p.getPluginButtonDescriptor() )
+    {
+        for(int i = 0; i < b->nButtons; ++i)
+            e.buttons.push_back( ButtonInfo{b->dispPrimaryCmd[i], b->primaryCmd[i], b->dispShftCmd[i], b->shftCmd[i]} );
+    }
+
+    if( auto k = p.getKernels() )
+    {
+        for(int i = 0; i < k->nKernels; ++i)
+            e.kernels.push_back( KernelInfo{k->kernelNames[i], k->arities[i]} );
+    }
+
+    if( auto f = p.getFunctions() )
+    {
+        for(int i = 0; i < f->nUnary; ++i)
+            e.functions.push_back( FunctionInfo{f->unaryNames[i], 1, f->unaryHelp[i]} );
+        for(int i = 0; i < f->nBinary; ++i)
+            e.functions.push_back( FunctionInfo{f->binaryNames[i], 2, f->binaryHelp[i]} );
+    }
+
+    return e;
+}
+
+bool PluginManifest::Write(const string& filename, const vector<Entry>& entries)
+{
+    std::ofstream ofs{filename};
+
+    return ofs && Write(ofs, entries);
+}
+
+bool PluginManifest::Write(std::ostream& ofs, const vector<Entry>& entries)
+{
+    ofs << ManifestVersion << '\n';
+    for(const auto& e : entries)
+    {
+        if( !Cacheable(e) ) continue;
+
+        ofs << "plugin\t" << e.library << '\t' << e.modified << '\t'
+            << e.apiVersion.major << '\t' << e.apiVersion.minor << '\n';
+        for(const auto& c : e.commands)
+            ofs << "command\t" << c.name << '\t' << c.help << '\n';
+        for(const auto& b : e.buttons)
+            ofs << "button\t" << b.dispPrimaryCmd << '\t' << b.primaryCmd << '\t'
+                << b.dispShftCmd << '\t' << b.shftCmd << '\n';
+        for(const auto& k : e.kernels)
+            ofs << "kernel\t" << k.name << '\t' << k.arity << '\n';
+        for(const auto& f : e.functions)
+            ofs << "function\t" << f.name << '\t' << f.arity << '\t' << f.help << '\n';
+    }
+
+    return static_cast<bool>(ofs);
+}
+
+int64_t PluginManifest::Modified(const string& library)
+{
+    // without a directory, the library is looked for along the search path
+    if( library.find_first_of("/\\") == string::npos ) return Unknown;
+
+    std::error_code ec;
+    if( !std::filesystem::is_regular_file(library, ec) ) return Unknown;
+
+    auto t = std::filesystem::last_write_time(library, ec);
+
+    return ec ? Unknown : static_cast<int64_t>( t.time_since_epoch().count() );
+}
+
+}
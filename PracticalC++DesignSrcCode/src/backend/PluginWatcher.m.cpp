@@ -0,0 +1,174 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+// Watches plugin libraries for replacement so that they can be reloaded while
+// pdCalc runs. On Linux, the directories holding the libraries are watched with
+// inotify, which reports a library once it has been written and closed or moved
+// into place. Elsewhere, the libraries' last write times are polled instead.
+//
+// A library should be replaced by moving the new version into place: overwriting a
+// library in place also changes the version that is loaded.
+module;
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <filesystem>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+export module pdCalc_pluginManagement:PluginWatcher;
+
+import :PluginManifest;
+
+using std::string;
+using std::vector;
+using std::map;
+using std::set;
+
+namespace fs = std::filesystem;
+
+namespace pdCalc {
+
+export class PluginWatcher
+{
+public:
+    PluginWatcher();
+    ~PluginWatcher();
+
+    // starts watching library, which must be named by a path with a directory
+    void watch(const string& library);
+
+    // Returns the watched libraries, named as they were given to watch, that changed
+    // since the last call, each once and in the order they were watched. Never
+    // blocks, so it can be called before every command.
+    vector<string> changed();
+
+private:
+    PluginWatcher(const PluginWatcher&) = delete;
+    PluginWatcher(PluginWatcher&&) = delete;
+    PluginWatcher& operator=(const PluginWatcher&) = delete;
+    PluginWatcher& operator=(PluginWatcher&&) = delete;
+
+    struct Library
+    {
+        string name;
+        string path;
+        int64_t modified;
+    };
+
+    vector<Library> libraries_;
+
+#ifdef __linux__
+    int fd_;
+    // the directory of each inotify watch
+    map<int, fs::path> directories_;
+#endif
+};
+
+#ifdef __linux__
+
+PluginWatcher::PluginWatcher()
+: fd_{ inotify_init1(IN_NONBLOCK | IN_CLOEXEC) }
+{ }
+
+PluginWatcher::~PluginWatcher()
+{
+    if(fd_ >= 0) close(fd_);
+}
+
+#else
+
+PluginWatcher::PluginWatcher() { }
+
+PluginWatcher::~PluginWatcher() { }
+
+#endif
+
+void PluginWatcher::watch(const string& library)
+{
+    auto path = fs::absolute(library).lexically_normal();
+    if( std::ranges::any_of(libraries_, [&](const auto& l){ return l.path == path.string(); }) ) return;
+
+    libraries_.push_back( Library{library, path.string(), PluginManifest::Modified(path.string())} );
+
+#ifdef __linux__
+    // the directory is watched, not the library, because replacing the library
+    // replaces the file a watch on the library would follow
+    if(fd_ >= 0)
+    {
+        auto directory = path.parent_path();
+        int wd = inotify_add_watch(fd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if(wd >= 0) directories_[wd] = directory;
+    }
+#endif
+
+    return;
+}
+
+vector<string> PluginWatcher::changed()
+{
+    set<string> changed;
+
+#ifdef __linux__
+    if(fd_ >= 0)
+    {
+        alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+        ssize_t n;
+        while( (n = read(fd_, buffer, sizeof(buffer))) > 0 )
+        {
+            for(char* p = buffer; p < buffer + n; )
+            {
+                const auto* event = reinterpret_cast<const inotify_event*>(p);
+                if( auto d = directories_.find(event->wd); d != directories_.end() && event->len > 0 )
+                    changed.insert( (d->second / event->name).string() );
+
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+    else
+#endif
+    {
+        for(const auto& l : libraries_)
+        {
+            if(PluginManifest::Modified(l.path) != l.modified)
+                changed.insert(l.path);
+        }
+    }
+
+    // a library that has been removed is not reported until it is replaced
+    vector<string> libraries;
+    for(auto& l : libraries_)
+    {
+        if( !changed.contains(l.path) ) continue;
+
+        if( auto m = PluginManifest::Modified(l.path); m != PluginManifest::Unknown )
+        {
+            l.modified = m;
+            libraries.push_back(l.name);
+        }
+    }
+
+    return libraries;
+}
+
+}
@@ -36,14 +36,17 @@ public:
 
     Plugin* allocatePlugin(const std::string& pluginName) override;
     void deallocatePlugin(Plugin* p) override;
+    bool owns(const void* address) const override;
 
 private:
     void* handle_;
+    void* base_;
 };
 
 PosixDynamicLoader::PosixDynamicLoader()
 : DynamicLoader{}
 , handle_{nullptr}
+, base_{nullptr}
 {
 }
 
@@ -62,6 +65,9 @@ Plugin* PosixDynamicLoader::allocatePlugin(const std::string& pluginName)
         auto alloc = dlsym(handle_, GetPluginAllocationName().c_str());
         if( PluginAllocator allocator{ reinterpret_cast<PluginAllocator>(alloc) } )
         {
+            // the library is identified by the address it was mapped at
+            if(Dl_info info; dladdr(alloc, &info)) base_ = info.dli_fbase;
+
             auto p = static_cast<Plugin*>((*allocator)());
             return p;
         }
@@ -88,4 +94,10 @@ void PosixDynamicLoader::deallocatePlugin(Plugin* p)
     return;
 }
 
+bool PosixDynamicLoader::owns(const void* address) const
+{
+    Dl_info info;
+    return base_ && dladdr(address, &info) && info.dli_fbase == base_;
+}
+
 }
@@ -0,0 +1,476 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <span>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <typeindex>
+#include <typeinfo>
+#ifdef POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+module pdCalc_commandDispatcher:Session;
+
+import pdCalc_utilities;
+import pdCalc_command;
+import pdCalc_stack;
+import :CommandManager;
+import :CommandFactory;
+import :CoreCommands;
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::span;
+
+namespace pdCalc {
+
+namespace {
+
+// The stack and operands are stored as they are in memory, so builds of each number
+// type have their own magic. Builds of double keep the original.
+constexpr char SessionMagic[4] = {'P', 'D', 'C',
+    sizeof(Number) == sizeof(double) ? 'S' : sizeof(Number) == sizeof(float) ? 'F' : 'L'};
+constexpr uint32_t SessionVersion = 1;
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t nStack;
+    uint64_t nOperands;
+    uint64_t nRecords;
+    uint64_t nRedo;
+    uint64_t nameBytes;
+};
+
+// the stack and the operands follow the header directly, so they are aligned for
+// reading in place
+static_assert(sizeof(Header) % sizeof(Number) == 0);
+
+struct Record
+{
+    uint32_t name;
+    uint32_t nOperands;
+};
+
+// name 0 is reserved for EnterNumber, the only command not entered by name; the
+// names section lists names 1, 2, ..., each as a uint32 length and its characters
+constexpr uint32_t EnterNumberName = 0;
+constexpr uint32_t Unsaved = UINT32_MAX;
+
+// A read-only view of a whole file. On POSIX systems, the file is memory-mapped, so
+// only the pages actually read are loaded; elsewhere, it is read into a buffer.
+class MappedFile
+{
+public:
+    explicit MappedFile(const string& filename);
+    ~MappedFile();
+
+    const std::byte* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::byte* data_;
+    size_t size_;
+
+#ifndef POSIX
+    vector<std::byte> buffer_;
+#endif
+};
+
+#ifdef POSIX
+
+MappedFile::MappedFile(const string& filename)
+: data_{nullptr}
+, size_{0}
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        if(fd >= 0) close(fd);
+        throw Exception{ std::format("Could not open session {}", filename) };
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if(size_ > 0)
+    {
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p != MAP_FAILED) data_ = static_cast<const std::byte*>(p);
+    }
+
+    // the mapping outlives the descriptor
+    close(fd);
+
+    if(size_ > 0 && !data_)
+        throw Exception{ std::format("Could not open session {}", filename) };
+}
+
+MappedFile::~MappedFile()
+{
+    if(data_) munmap(const_cast<std::byte*>(data_), size_);
+}
+
+#else
+
+MappedFile::MappedFile(const string& filename)
+: data_{nullptr}
+, size_{0}
+{
+    std::ifstream ifs{filename, std::ios::binary};
+    if(!ifs)
+        throw Exception{ std::format("Could not open session {}", filename) };
+
+    vector<char> data{ std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{} };
+    buffer_.resize( data.size() );
+    if( !data.empty() ) std::memcpy(buffer_.data(), data.data(), data.size());
+
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+MappedFile::~MappedFile()
+{ }
+
+#endif
+
+// Assigns the names of the commands in a history, looking each distinct command up
+// in the CommandFactory only once. Commands are keyed by type and help message, as
+// in the factory's own lookup.
+class NameTable
+{
+public:
+    // returns the name of c, or Unsaved if c was not entered by a registered name
+    uint32_t name(const Command& c);
+
+    const vector<string>& names() const { return names_; }
+
+private:
+    std::map<std::type_index, std::map<string, uint32_t, std::less<>>> ids_;
+    vector<string> names_;
+};
+
+uint32_t NameTable::name(const Command& c)
+{
+    if( dynamic_cast<const EnterNumber*>(&c) ) return EnterNumberName;
+
+    auto& byHelp = ids_[typeid(c)];
+    string_view help{ c.helpMessage() };
+    if( auto i = byHelp.find(help); i != byHelp.end() )
+        return i->second;
+
+    uint32_t id = Unsaved;
+    if( auto name = CommandFactory::Instance().commandName(c); !name.empty() )
+    {
+        names_.push_back( std::move(name) );
+        id = static_cast<uint32_t>( names_.size() );
+    }
+    byHelp.emplace(help, id);
+
+    return id;
+}
+
+void writeSection(std::FILE* fp, const void* p, size_t n, bool& ok)
+{
+    if(ok && n > 0) ok = std::fwrite(p, 1, n, fp) == n;
+
+    return;
+}
+
+}
+
+Session::Session(const string& filename)
+: filename_{filename}
+#ifdef POSIX
+, child_{-1}
+, failed_{false}
+#endif
+{ }
+
+Session::~Session()
+{
+#ifdef POSIX
+    reap(true);
+#endif
+}
+
+#ifdef POSIX
+
+bool Session::snapshot(CommandManager& manager)
+{
+    if( !reap(false) ) return false;
+
+    if(failed_)
+    {
+        failed_ = false;
+        throw Exception{ std::format("Could not save session {}", filename_) };
+    }
+
+    // the child sees the stack and history exactly as they are now, and the kernel
+    // only copies the pages the parent changes while the child is writing them
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int status = 0;
+        try
+        {
+            Save(filename_, manager);
+        }
+        catch(...)
+        {
+            status = 1;
+        }
+
+        _exit(status);
+    }
+
+    if(pid < 0)
+        Save(filename_, manager);
+    else
+        child_ = pid;
+
+    return true;
+}
+
+void Session::wait()
+{
+    reap(true);
+
+    if(failed_)
+    {
+        failed_ = false;
+        throw Exception{ std::format("Could not save session {}", filename_) };
+    }
+
+    return;
+}
+
+bool Session::reap(bool wait)
+{
+    if(child_ < 0) return true;
+
+    int status = 0;
+    pid_t r = waitpid(child_, &status, wait ? 0 : WNOHANG);
+    if(r == 0) return false;
+
+    child_ = -1;
+    failed_ = failed_ || r < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+    return true;
+}
+
+#else
+
+bool Session::snapshot(CommandManager& manager)
+{
+    Save(filename_, manager);
+
+    return true;
+}
+
+void Session::wait()
+{
+    return;
+}
+
+#endif
+
+void Session::Save(const string& filename, CommandManager& manager)
+{
+    NameTable names;
+    vector<Record> records;
+    vector<Number> operands;
+
+    const size_t nUndo = manager.getUndoSize();
+    size_t position = 0;
+    size_t nRedo = 0;
+    bool redoEnded = false;
+
+    manager.visitHistory([&](const Command& c)
+    {
+        const bool undo = position++ < nUndo;
+        if(redoEnded) return;
+
+        const auto first = operands.size();
+        if(auto name = names.name(c); name != Unsaved && c.serialize(operands))
+        {
+            records.push_back( Record{name, static_cast<uint32_t>(operands.size() - first)} );
+            if(!undo) ++nRedo;
+            return;
+        }
+
+        // the history cannot be undone past, or redone beyond, a command not saved
+        operands.resize(first);
+        if(undo)
+        {
+            records.clear();
+            operands.clear();
+        }
+        else redoEnded = true;
+    });
+
+    vector<std::byte> nameBytes;
+    for(const auto& name : names.names())
+    {
+        const auto first = nameBytes.size();
+        const uint32_t length = static_cast<uint32_t>( name.size() );
+        nameBytes.resize(first + sizeof(length) + length);
+        std::memcpy(nameBytes.data() + first, &length, sizeof(length));
+        std::memcpy(nameBytes.data() + first + sizeof(length), name.data(), length);
+    }
+
+    const auto stack = Stack::Instance().contents();
+
+    Header header;
+    std::memcpy(header.magic, SessionMagic, sizeof(SessionMagic));
+    header.version = SessionVersion;
+    header.nStack = stack.size();
+    header.nOperands = operands.size();
+    header.nRecords = records.size();
+    header.nRedo = nRedo;
+    header.nameBytes = nameBytes.size();
+
+    const string tmp = filename + ".tmp";
+    std::FILE* fp = std::fopen(tmp.c_str(), "wb");
+    if(!fp)
+        throw Exception{ std::format("Could not save session {}", filename) };
+
+    bool ok = true;
+    writeSection(fp, &header, sizeof(header), ok);
+    writeSection(fp, stack.data(), stack.size() * sizeof(Number), ok);
+    writeSection(fp, operands.data(), operands.size() * sizeof(Number), ok);
+    writeSection(fp, records.data(), records.size() * sizeof(Record), ok);
+    writeSection(fp, nameBytes.data(), nameBytes.size(), ok);
+    ok = std::fclose(fp) == 0 && ok;
+
+    std::error_code ec;
+    if(ok) std::filesystem::rename(tmp, filename, ec);
+
+    if(!ok || ec)
+    {
+        std::filesystem::remove(tmp, ec);
+        throw Exception{ std::format("Could not save session {}", filename) };
+    }
+
+    return;
+}
+
+void Session::Load(const string& filename, CommandManager& manager)
+{
+    MappedFile file{filename};
+    Load(span<const std::byte>{file.data(), file.size()}, filename, manager);
+
+    return;
+}
+
+void Session::Load(span<const std::byte> file, const string& filename, CommandManager& manager)
+{
+    const auto notASession = std::format("{} is not a session", filename);
+
+    Header header;
+    if( file.size() < sizeof(header) )
+        throw Exception{notASession};
+
+    std::memcpy(&header, file.data(), sizeof(header));
+    if( std::memcmp(header.magic, SessionMagic, sizeof(SessionMagic) - 1) != 0 || header.version != SessionVersion )
+        throw Exception{notASession};
+
+    if(header.magic[3] != SessionMagic[3])
+        throw Exception{ std::format("{} was saved by a build of pdCalc with a different number type", filename) };
+
+    // the sections must exactly fill the file; this also bounds the counts below
+    const uint64_t available = file.size() - sizeof(header);
+    if( header.nStack > available / sizeof(Number) || header.nOperands > available / sizeof(Number)
+        || header.nRecords > available / sizeof(Record) || header.nameBytes > available
+        || (header.nStack + header.nOperands) * sizeof(Number) + header.nRecords * sizeof(Record)
+            + header.nameBytes != available
+        || header.nRedo > header.nRecords )
+        throw Exception{notASession};
+
+    const std::byte* p = file.data() + sizeof(header);
+    span<const Number> stack{ reinterpret_cast<const Number*>(p), header.nStack };
+    p += header.nStack * sizeof(Number);
+    span<const Number> operands{ reinterpret_cast<const Number*>(p), header.nOperands };
+    p += header.nOperands * sizeof(Number);
+    const std::byte* records = p;
+    p += header.nRecords * sizeof(Record);
+
+    vector<string> names;
+    for(const std::byte* end = p + header.nameBytes; p != end; )
+    {
+        uint32_t length;
+        if( static_cast<size_t>(end - p) < sizeof(length) ) throw Exception{notASession};
+        std::memcpy(&length, p, sizeof(length));
+        p += sizeof(length);
+        if( static_cast<size_t>(end - p) < length ) throw Exception{notASession};
+        names.emplace_back( reinterpret_cast<const char*>(p), length );
+        p += length;
+    }
+
+    vector<CommandPtr> commands;
+    commands.reserve(header.nRecords);
+    size_t offset = 0;
+    for(size_t i = 0; i < header.nRecords; ++i)
+    {
+        Record r;
+        std::memcpy(&r, records + i * sizeof(Record), sizeof(Record));
+        if(r.name > names.size() || r.nOperands > operands.size() - offset)
+            throw Exception{notASession};
+
+        auto c = r.name == EnterNumberName ? MakeCommandPtr<EnterNumber>(0.0)
+            : CommandFactory::Instance().allocateCommand( names[r.name - 1] );
+        if(!c)
+            throw Exception{ std::format("Session {} uses unknown command {}", filename, names[r.name - 1]) };
+
+        const auto state = operands.subspan(offset, r.nOperands);
+        if( !c->deserializable(state) )
+            throw Exception{notASession};
+
+        c->deserialize(state);
+        offset += r.nOperands;
+        commands.push_back( std::move(c) );
+    }
+
+    Stack::Instance().restore(stack);
+    manager.restoreHistory(std::move(commands), header.nRedo);
+
+    return;
+}
+
+}
@@ -0,0 +1,105 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+module;
+#include <cstddef>
+#include <span>
+#include <string>
+#ifdef POSIX
+#include <sys/types.h>
+#endif
+export module pdCalc_commandDispatcher:Session;
+
+import :CommandManager;
+
+using std::string;
+
+export namespace pdCalc {
+
+// A saved session: the stack together with the undo/redo history of a
+// CommandManager. The session file is laid out so that it can be memory-mapped and
+// read in place:
+//
+//     header | stack | operands | records | names
+//
+// The stack is stored from bottom to top and is restored straight from the mapping.
+// Numbers are stored as the build's Number, so only builds of the same number type
+// load each other's sessions.
+// Each command of the history is a record naming the command and counting the
+// operands it serialized; the operands of all records are packed in order. Names are
+// those the commands are registered under in the CommandFactory, so a session can
+// only be loaded once the same commands (including plugin commands) are registered.
+//
+// Only commands that can be serialized can be saved. The undo stack is saved from
+// just after the newest command that cannot be, and the redo stack up to the first
+// command that cannot be, so a loaded session simply has a shorter history.
+class Session
+{
+public:
+    // snapshots are written to filename
+    explicit Session(const string& filename);
+
+    // waits for a snapshot still being written
+    ~Session();
+
+    const string& filename() const { return filename_; }
+
+    // Starts writing a snapshot of the stack and the history of manager to the
+    // session file and returns true, or returns false if the previous snapshot is
+    // still being written. On POSIX systems, the snapshot is written by a forked
+    // copy of the process, so the caller never waits for the file to be written;
+    // elsewhere, it is written before snapshot returns. Throws if the previous
+    // snapshot failed.
+    bool snapshot(CommandManager& manager);
+
+    // waits for a snapshot still being written; throws if it failed
+    void wait();
+
+    // Writes the stack and the history of manager to filename. The session is
+    // written to a temporary file that then replaces filename, so a failed save
+    // leaves the previous session intact. Throws if the file cannot be written.
+    static void Save(const string& filename, CommandManager& manager);
+
+    // Replaces the stack and the history of manager with the session saved in
+    // filename. Throws, changing nothing, if the file cannot be read, is not a
+    // session, or names a command that is not registered.
+    static void Load(const string& filename, CommandManager& manager);
+
+    // As Load, but from the contents of a session file already in memory (e.g., as a
+    // journal recorded them), which must be aligned for a Number, as any allocation
+    // is. Errors name the session filename.
+    static void Load(std::span<const std::byte> file, const string& filename, CommandManager& manager);
+
+private:
+    Session(const Session&) = delete;
+    Session(Session&&) = delete;
+    Session& operator=(const Session&) = delete;
+    Session& operator=(Session&&) = delete;
+
+    string filename_;
+
+#ifdef POSIX
+    // reaps the snapshot process, blocking if wait; returns false if it is still running
+    bool reap(bool wait);
+
+    pid_t child_;
+    bool failed_;
+#endif
+};
+
+}
@@ -20,12 +20,14 @@ module;
 #include <vector>
 #include <string>
 #include <deque>
+#include <span>
 
 export module pdCalc_stack;
 
 using std::string;
 using std::vector;
 using std::deque;
+using std::span;
 
 import pdCalc_utilities;
 
@@ -49,17 +51,31 @@ export class Stack : private Publisher
 {
 public:
     static Stack& Instance();
-    void push(double, bool suppressChangeEvent = false);
-    double pop(bool suppressChangeEvent = false);
+    void push(Number, bool suppressChangeEvent = false);
+    Number pop(bool suppressChangeEvent = false);
     void swapTop();
 
     // returns first min(n, stackSize) elements of the stack with the top of stack at position 0
-    vector<double> getElements(size_t n) const;
-    void getElements(size_t n, std::vector<double>&) const;
+    vector<Number> getElements(size_t n) const;
+    void getElements(size_t n, std::vector<Number>&) const;
+
+    // bulk copy and replacement of the whole stack, ordered from the bottom of the
+    // stack to the top; restore raises a single change event
+    vector<Number> contents() const;
+    void restore(span<const Number> elements, bool suppressChangeEvent = false);
+
+    // Change events raised between beginBatch() and the matching endBatch() are
+    // coalesced: the outermost endBatch() raises a single change event if any
+    // change occurred during the batch. Batches may be nested.
+    void beginBatch();
+    void endBatch();
 
     using Publisher::attach;
     using Publisher::detach;
 
+    // the approximate number of bytes the stack retains
+    size_t footprint() const;
+
     // these are just needed for testing
     size_t size() const { return stack_.size(); }
     void clear();
@@ -75,7 +91,25 @@ private:
     Stack& operator=(const Stack&) = delete;
     Stack& operator=(const Stack&&) = delete;
 
-    deque<double> stack_;
+    void raiseChanged();
+
+    deque<Number> stack_;
+    int batchDepth_;
+    bool batchChanged_;
+};
+
+// RAII helper to batch the stack's change events over a scope
+export class StackChangeBatch
+{
+public:
+    StackChangeBatch() { Stack::Instance().beginBatch(); }
+    ~StackChangeBatch() { Stack::Instance().endBatch(); }
+
+private:
+    StackChangeBatch(const StackChangeBatch&) = delete;
+    StackChangeBatch(StackChangeBatch&&) = delete;
+    StackChangeBatch& operator=(const StackChangeBatch&) = delete;
+    StackChangeBatch& operator=(StackChangeBatch&&) = delete;
 };
 
 string Stack::StackChanged()
@@ -104,15 +138,15 @@ const char* StackErrorData::message() const
 }
 
 
-void Stack::push(double d, bool suppressChangeEvent)
+void Stack::push(Number d, bool suppressChangeEvent)
 {
     stack_.push_back(d);
-    if(!suppressChangeEvent) raise(Stack::StackChanged(), nullptr);
+    if(!suppressChangeEvent) raiseChanged();
 
     return;
 }
 
-double Stack::pop(bool suppressChangeEvent)
+Number Stack::pop(bool suppressChangeEvent)
 {
     if( stack_.empty() )
     {
@@ -124,7 +158,7 @@ double Stack::pop(bool suppressChangeEvent)
     {
         auto val = stack_.back();
         stack_.pop_back();
-        if(!suppressChangeEvent) raise(Stack::StackChanged(), nullptr);
+        if(!suppressChangeEvent) raiseChanged();
         return val;
     }
 }
@@ -146,20 +180,20 @@ void Stack::swapTop()
         stack_.push_back(first);
         stack_.push_back(second);
 
-        raise(Stack::StackChanged(), nullptr);
+        raiseChanged();
     }
 
     return;
 }
 
-vector<double> Stack::getElements(size_t n) const
+vector<Number> Stack::getElements(size_t n) const
 {
-    vector<double> v;
+    vector<Number> v;
     getElements(n, v);
     return v;
 }
 
-void Stack::getElements(size_t n, vector<double>& v) const
+void Stack::getElements(size_t n, vector<Number>& v) const
 {
     // if n is > stack's size, just return size of stack
     if(n > stack_.size()) n = stack_.size();
@@ -169,11 +203,59 @@ void Stack::getElements(size_t n, vector<double>& v) const
     return;
 }
 
+vector<Number> Stack::contents() const
+{
+    return vector<Number>( stack_.begin(), stack_.end() );
+}
+
+size_t Stack::footprint() const
+{
+    return sizeof(Stack) + stack_.size() * sizeof(Number);
+}
+
+void Stack::restore(span<const Number> elements, bool suppressChangeEvent)
+{
+    stack_.assign( elements.begin(), elements.end() );
+    if(!suppressChangeEvent) raiseChanged();
+
+    return;
+}
+
 void Stack::clear()
 {
     stack_.clear();
 
-    raise(Stack::StackChanged(), nullptr);
+    raiseChanged();
+
+    return;
+}
+
+void Stack::beginBatch()
+{
+    ++batchDepth_;
+
+    return;
+}
+
+void Stack::endBatch()
+{
+    if(batchDepth_ == 0) return;
+
+    if(--batchDepth_ == 0 && batchChanged_)
+    {
+        batchChanged_ = false;
+        raise(Stack::StackChanged(), nullptr);
+    }
+
+    return;
+}
+
+void Stack::raiseChanged()
+{
+    if(batchDepth_ > 0)
+        batchChanged_ = true;
+    else
+        raise(Stack::StackChanged(), nullptr);
 
     return;
 }
@@ -185,6 +267,8 @@ Stack& Stack::Instance()
 }
 
 Stack::Stack()
+: batchDepth_{0}
+, batchChanged_{false}
 {
     registerEvent( StackChanged() );
     registerEvent( StackError() );
@@ -42,12 +42,12 @@ extern "C" size_t StackSize()
 
 extern "C" double StackFirstElement()
 {
-    vector<double> v = pdCalc::Stack::Instance().getElements(1);
+    auto v = pdCalc::Stack::Instance().getElements(1);
     return v[0];
 }
 
 extern "C" double StackSecondElement()
 {
-    vector<double> v = pdCalc::Stack::Instance().getElements(2);
+    auto v = pdCalc::Stack::Instance().getElements(2);
     return v[1];
 }
@@ -20,9 +20,17 @@ module;
 #include <ranges>
 #include <memory>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cstdio>
+#include <format>
+#include <vector>
+#include <chrono>
+#include <functional>
 module pdCalc_commandDispatcher:StoredProcedure;
 
 import pdCalc_utilities;
+import pdCalc_stack;
 import :CommandInterpreter;
 
 namespace ranges = std::ranges;
@@ -44,6 +52,14 @@ void StoredProcedure::checkPreconditionsImpl() const
     {
         try
         {
+            auto source = ProcedureSource::Active();
+            if( auto contents = source ? source->find(filename_) : nullptr )
+            {
+                source_.str(*contents);
+                tokenizer_ = std::make_unique<LazyTokenizer>(source_);
+                return;
+            }
+
             ifs_.open( filename_.c_str() );
             if(!ifs_)
                 throw Exception{"Could not open procedure"};
@@ -61,9 +77,18 @@ void StoredProcedure::checkPreconditionsImpl() const
 
 void StoredProcedure::executeImpl() noexcept
 {
+    // the procedure's commands are traced nested in this span
+    Trace::Span span{"StoredProcedure::executeImpl", filename_};
+    PerfCounters::Procedure procedure{filename_};
+
     if(first_)
     {
-        ranges::for_each(*tokenizer_, [this](auto c){ci_->commandEntered(c);});
+        // the profile is looked for once, so that unprofiled tokens pay nothing
+        if( auto profile = ProcedureProfile::Active() )
+            ranges::for_each(*tokenizer_, [&](auto c){ profile->step(c, [&]{ ci_->commandEntered(c); }); });
+        else
+            ranges::for_each(*tokenizer_, [this](auto c){ci_->commandEntered(c);});
+
         first_ = false;
     }
     else
@@ -93,5 +118,157 @@ const char* StoredProcedure::helpMessageImpl() const noexcept
     return "Executes a stored procedure from disk";
 }
 
+// the procedure's own command history must be undone and redone step by step
+bool StoredProcedure::replayableImpl() const noexcept
+{
+    return false;
+}
+
+// the procedure keeps its file open, with its buffer, and its own interpreter, whose
+// history holds every command of the procedure
+size_t StoredProcedure::footprintImpl() const
+{
+    return sizeof(StoredProcedure) + filename_.capacity() + (ifs_.is_open() ? BUFSIZ : 0)
+        + sizeof(CommandInterpreter) + ci_->footprint();
+}
+
+namespace {
+
+ProcedureSource* activeSource = nullptr;
+
+void readProcedure(const string& name, std::vector<ProcedureSource::Procedure>& procedures)
+{
+    if( ranges::any_of(procedures, [&](const auto& p){ return p.name == name; }) ) return;
+
+    string contents;
+    if( auto s = activeSource ? activeSource->find(name) : nullptr )
+        contents = *s;
+    else if( std::ifstream ifs{name, std::ios::binary} )
+        contents.assign( std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{} );
+    else
+        return;
+
+    procedures.push_back( ProcedureSource::Procedure{name, contents} );
+
+    // the procedures it runs, as its interpreter will read them
+    std::istringstream iss{contents};
+    for( const auto& t : GreedyTokenizer{iss} )
+    {
+        if( t.size() > 5 && t.starts_with("proc:") ) readProcedure(t.substr(5), procedures);
+    }
+
+    return;
+}
+
+}
+
+ProcedureSource::ProcedureSource(std::vector<Procedure> procedures)
+: procedures_{std::move(procedures)}
+, previous_{activeSource}
+{
+    activeSource = this;
+}
+
+ProcedureSource::~ProcedureSource()
+{
+    activeSource = previous_;
+}
+
+const string* ProcedureSource::find(const string& name) const
+{
+    auto p = ranges::find(procedures_, name, &Procedure::name);
+
+    return p != procedures_.end() ? &p->contents : nullptr;
+}
+
+ProcedureSource* ProcedureSource::Active()
+{
+    return activeSource;
+}
+
+std::vector<ProcedureSource::Procedure> ProcedureSource::Read(const string& name)
+{
+    std::vector<Procedure> procedures;
+    readProcedure(name, procedures);
+
+    return procedures;
+}
+
+namespace {
+
+ProcedureProfile* activeProfile = nullptr;
+
+}
+
+ProcedureProfile::ProcedureProfile()
+: current_{&root_}
+, previous_{activeProfile}
+{
+    activeProfile = this;
+}
+
+ProcedureProfile::~ProcedureProfile()
+{
+    activeProfile = previous_;
+}
+
+ProcedureProfile* ProcedureProfile::Active()
+{
+    return activeProfile;
+}
+
+void ProcedureProfile::step(const string& token, const std::function<void()>& f)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Node& n = current_->tokens[token];
+    Node* parent = current_;
+    current_ = &n;
+
+    const auto start = Clock::now();
+    f();
+    n.time += Clock::now() - start;
+
+    current_ = parent;
+
+    const auto depth = Stack::Instance().size();
+    ++n.calls;
+    n.minDepth = std::min(n.minDepth, depth);
+    n.maxDepth = std::max(n.maxDepth, depth);
+
+    return;
+}
+
+string ProcedureProfile::report() const
+{
+    std::chrono::nanoseconds total{0};
+    for(const auto& t : root_.tokens) total += t.second.time;
+
+    string out = std::format("\n{:>10} {:>6} {:>7} {:>9}  {}\n", "ms", "%", "calls", "depth", "token");
+    report(out, root_, total, 0);
+
+    return out;
 }
 
+void ProcedureProfile::report(string& out, const Node& n, std::chrono::nanoseconds total, int indent) const
+{
+    std::vector<std::pair<const string*, const Node*>> tokens;
+    for(const auto& [token, t] : n.tokens) tokens.emplace_back(&token, &t);
+    ranges::stable_sort(tokens, [](const auto& a, const auto& b){ return a.second->time > b.second->time; });
+
+    for(const auto& [token, t] : tokens)
+    {
+        const double ms = std::chrono::duration<double, std::milli>(t->time).count();
+        const double percent = total.count() > 0 ? 100.0 * t->time.count() / total.count() : 0.0;
+        const auto depth = t->minDepth == t->maxDepth ? std::format("{}", t->minDepth)
+            : std::format("{}-{}", t->minDepth, t->maxDepth);
+
+        out += std::format("{:>10.3f} {:>6.1f} {:>7} {:>9}  {}{}\n", ms, percent, t->calls, depth,
+            string(2 * indent, ' '), *token);
+        report(out, *t, total, indent + 1);
+    }
+
+    return;
+}
+
+}
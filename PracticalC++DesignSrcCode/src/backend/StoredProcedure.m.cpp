@@ -19,6 +19,12 @@ module;
 #include <string>
 #include <memory>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <limits>
+#include <functional>
 export module pdCalc_commandDispatcher:StoredProcedure;
 
 import pdCalc_command;
@@ -45,12 +51,95 @@ private:
     void undoImpl() noexcept override;
     Command* cloneImpl() const noexcept override;
     const char* helpMessageImpl() const noexcept override;
+    bool replayableImpl() const noexcept override;
+    size_t footprintImpl() const override;
 
     mutable std::unique_ptr<class LazyTokenizer> tokenizer_;
     std::unique_ptr<class CommandInterpreter> ci_;
     std::string filename_;
     mutable std::ifstream ifs_;
+    mutable std::istringstream source_;
     bool first_ = true;
 };
 
+// The contents of stored procedures, under the names they are run by, which the
+// procedures executed while it is alive read in place of their files, so that a
+// journal replays the procedures that ran rather than whatever their files hold by
+// then. A source made while another is alive takes over until it is destroyed.
+export class ProcedureSource
+{
+public:
+    struct Procedure
+    {
+        string name;
+        string contents;
+    };
+
+    explicit ProcedureSource(std::vector<Procedure> procedures);
+    ~ProcedureSource();
+
+    // the contents of the procedure name, or nullptr if the source does not hold it
+    const string* find(const string& name) const;
+
+    // the source alive, or nullptr
+    static ProcedureSource* Active();
+
+    // The procedure in name and the procedures it runs, in the order they are first
+    // run, as StoredProcedure reads them: from the source alive, or else from their
+    // files. Procedures that cannot be read are left out.
+    static std::vector<Procedure> Read(const string& name);
+
+private:
+    ProcedureSource(const ProcedureSource&) = delete;
+    ProcedureSource(ProcedureSource&&) = delete;
+    ProcedureSource& operator=(const ProcedureSource&) = delete;
+    ProcedureSource& operator=(ProcedureSource&&) = delete;
+
+    std::vector<Procedure> procedures_;
+    ProcedureSource* previous_;
+};
+
+// Times every token of the stored procedures executed while it is alive, for the
+// profile command. A token is recorded under the token that ran it, so the tokens of
+// a nested procedure are attributed to the proc: token of the procedure that ran it.
+// Without a profile, procedures run their tokens untimed. A profile made while
+// another is alive takes over until it is destroyed.
+export class ProcedureProfile
+{
+public:
+    ProcedureProfile();
+    ~ProcedureProfile();
+
+    // runs f, which interprets token, recording its time and the stack's depth after it
+    void step(const string& token, const std::function<void()>& f);
+
+    // A table of the tokens recorded, each procedure's indented below the token that
+    // ran it and sorted by cumulative time, with their calls and the stack's depths.
+    string report() const;
+
+    // the profile alive, or nullptr
+    static ProcedureProfile* Active();
+
+private:
+    ProcedureProfile(const ProcedureProfile&) = delete;
+    ProcedureProfile(ProcedureProfile&&) = delete;
+    ProcedureProfile& operator=(const ProcedureProfile&) = delete;
+    ProcedureProfile& operator=(ProcedureProfile&&) = delete;
+
+    struct Node
+    {
+        size_t calls = 0;
+        std::chrono::nanoseconds time{0};
+        size_t minDepth = std::numeric_limits<size_t>::max();
+        size_t maxDepth = 0;
+        std::map<string, Node> tokens;
+    };
+
+    void report(string& out, const Node& n, std::chrono::nanoseconds total, int indent) const;
+
+    Node root_;
+    Node* current_;
+    ProcedureProfile* previous_;
+};
+
 }
@@ -38,6 +38,7 @@ public:
 
     Plugin* allocatePlugin(const string& pluginName) override;
     void deallocatePlugin(Plugin* p) override;
+    bool owns(const void* address) const override;
 
 private:
     HINSTANCE handle_;
@@ -89,4 +90,11 @@ void WindowsDynamicLoader::deallocatePlugin(Plugin* p)
     return;
 }
 
+bool WindowsDynamicLoader::owns(const void* address) const
+{
+    HMODULE module;
+    return handle_ && GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        static_cast<LPCTSTR>(address), &module) && module == handle_;
+}
+
 }
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <memory>
 #include <ranges>
+#include "VectorKernels.h"
 
 import pdCalc_plugin;
 import pdCalc_command;
@@ -37,6 +38,46 @@ using std::vector;
 using std::string;
 using std::unique_ptr;
 
+namespace {
+
+// The functions are shared by the commands and the functions exported for them,
+// which apply them to the top of the stack, and the kernels, which apply them to
+// every element of the stack. Likewise, the domains are shared by the commands,
+// functions, and kernels.
+double sinhOf(double x) { return std::sinh(x); }
+double coshOf(double x) { return std::cosh(x); }
+double tanhOf(double x) { return std::tanh(x); }
+double arcsinhOf(double x) { return std::log( x + std::sqrt(x * x + 1.0) ); }
+double arccoshOf(double x) { return std::log( x + std::sqrt(x * x - 1.0) ); }
+double arctanhOf(double x) { return 0.5 * std::log( (1.0 + x) / (1.0 - x) ); }
+double expOf(double x) { return std::exp(x); }
+double lnOf(double x) { return std::log(x); }
+
+const char* arccoshDomain(double x) { return x < 1.0 ? "Imaginary result" : nullptr; }
+const char* arctanhDomain(double x) { return std::fabs(x) >= 1.0 ? "Imaginary result" : nullptr; }
+
+const char* lnDomain(double x)
+{
+    if(x == 0.0)
+        return "Infinite result";
+    else if(x < 0.0)
+        return "Imaginary result";
+    else
+        return nullptr;
+}
+
+template<double (*F)(double)>
+void unaryKernel(const double* in[], double* out, size_t n)
+{
+    const double* x = in[0];
+    for(size_t i = 0; i < n; ++i)
+        out[i] = F(x[i]);
+
+    return;
+}
+
+}
+
 class HyperbolicLnPluginCommand : public pdCalc::PluginCommand
 {
 public:
@@ -57,6 +98,10 @@ private:
     HyperbolicLnPluginCommand* clonePluginImpl() const noexcept override;
     virtual HyperbolicLnPluginCommand* doClone() const = 0;
 
+    // the undo state is the original number
+    int serializePluginState(double* operands) const noexcept override;
+    void deserializePluginState(const double* operands, int n) noexcept override;
+
     virtual double unaryOperation(double top) const = 0;
 
     double top_;
@@ -113,6 +158,20 @@ HyperbolicLnPluginCommand* HyperbolicLnPluginCommand::clonePluginImpl() const no
     return p;
 }
 
+int HyperbolicLnPluginCommand::serializePluginState(double* operands) const noexcept
+{
+    operands[0] = top_;
+
+    return 1;
+}
+
+void HyperbolicLnPluginCommand::deserializePluginState(const double* operands, int n) noexcept
+{
+    if(n == 1) top_ = operands[0];
+
+    return;
+}
+
 // takes the hyperbolic sine of a number on the stack
 // precondition: at least one number on the stack
 class Sinh : public HyperbolicLnPluginCommand
@@ -140,7 +199,7 @@ Sinh::Sinh(const Sinh& rhs)
 
 double Sinh::unaryOperation(double top) const
 {
-    return std::sinh(top);
+    return sinhOf(top);
 }
 
 Sinh* Sinh::doClone() const
@@ -180,7 +239,7 @@ Cosh::Cosh(const Cosh& rhs)
 
 double Cosh::unaryOperation(double top) const
 {
-    return std::cosh(top);
+    return coshOf(top);
 }
 
 Cosh* Cosh::doClone() const
@@ -220,7 +279,7 @@ Tanh::Tanh(const Tanh& rhs)
 
 double Tanh::unaryOperation(double top) const
 {
-    return std::tanh(top);
+    return tanhOf(top);
 }
 
 Tanh* Tanh::doClone() const
@@ -260,7 +319,7 @@ Arcsinh::Arcsinh(const Arcsinh& rhs)
 
 double Arcsinh::unaryOperation(double top) const
 {
-    return std::log( top + std::sqrt(top * top + 1.0)  );
+    return arcsinhOf(top);
 }
 
 Arcsinh* Arcsinh::doClone() const
@@ -303,15 +362,12 @@ const char* Arccosh::checkPluginPreconditions() const noexcept
 {
     if( const char* r = HyperbolicLnPluginCommand::checkPluginPreconditions() ) return r;
 
-    if(StackFirstElement() < 1.0)
-        return "Imaginary result";
-
-    return nullptr;
+    return arccoshDomain( StackFirstElement() );
 }
 
 double Arccosh::unaryOperation(double top) const
 {
-    return std::log( top + std::sqrt(top * top - 1.0)  );
+    return arccoshOf(top);
 }
 
 Arccosh* Arccosh::doClone() const
@@ -355,15 +411,12 @@ const char* Arctanh::checkPluginPreconditions() const noexcept
 {
     if( const char* r = HyperbolicLnPluginCommand::checkPluginPreconditions() ) return r;
 
-    if(std::fabs( StackFirstElement() ) >= 1.0)
-        return "Imaginary result";
-
-    return nullptr;
+    return arctanhDomain( StackFirstElement() );
 }
 
 double Arctanh::unaryOperation(double top) const
 {
-    return 0.5 * std::log( (1.0 + top) / (1.0 - top) );
+    return arctanhOf(top);
 }
 
 Arctanh* Arctanh::doClone() const
@@ -403,7 +456,7 @@ Exp::Exp(const Exp& rhs)
 
 double Exp::unaryOperation(double top) const
 {
-    return std::exp(top);
+    return expOf(top);
 }
 
 Exp* Exp::doClone() const
@@ -447,17 +500,12 @@ const char* NaturalLog::checkPluginPreconditions() const noexcept
 {
     if( const char* r = HyperbolicLnPluginCommand::checkPluginPreconditions() ) return r;
 
-    if(auto v = StackFirstElement(); v == 0.0)
-        return "Infinite result";
-    else if(v < 0.0)
-         return "Imaginary result";
-    else
-        return nullptr;
+    return lnDomain( StackFirstElement() );
 }
 
 double NaturalLog::unaryOperation(double top) const
 {
-    return std::log(top);
+    return lnOf(top);
 }
 
 NaturalLog* NaturalLog::doClone() const
@@ -470,7 +518,7 @@ const char* NaturalLog::helpMessageImpl() const noexcept
     return "Replace the first element, x, on the stack with ln(x)";
 }
 
-// The double buffering of the PluginDescriptor and PluginButtonDescriptor is to maintain exception safety by
+// The double buffering of the PluginDescriptor, PluginButtonDescriptor, KernelDescriptor, and FunctionDescriptor is to maintain exception safety by
 // keeping all memory allocation in RAII containers. Without regard to exception safety, this can be made
 // much simpler without buffering.
 class HyperbolicLnPlugin : public pdCalc::Plugin
@@ -482,10 +530,14 @@ public:
 private:
     const PluginDescriptor& getPluginDescriptor() const override { return pd_; }
     const PluginButtonDescriptor* getPluginButtonDescriptor() const override { return &pb_; }
-    pdCalc::Plugin::ApiVersion apiVersion() const override { return {1, 0}; }
+    const KernelDescriptor* getKernelDescriptor() const override { return &kd_; }
+    const FunctionDescriptor* getFunctionDescriptor() const override { return &fd_; }
+    pdCalc::Plugin::ApiVersion apiVersion() const override { return {1, 3}; }
 
     void createPluginDescriptor();
     void createPluginButtonDescriptor();
+    void createKernelDescriptor();
+    void createFunctionDescriptor();
 
     pdCalc::Plugin::PluginDescriptor pd_;
     vector<pdCalc::Command*> rawCommands_;
@@ -502,6 +554,19 @@ private:
     vector<char*> rawP_;
     vector<char*> rawDispS_;
     vector<char*> rawS_;
+
+    KernelDescriptor kd_;
+    vector<string> kernelNames_;
+    vector<char*> rawKernelNames_;
+    vector<int> arities_;
+    vector<Kernel> kernels_;
+    vector<pdCalc::KernelCommand::Domain> domains_;
+
+    FunctionDescriptor fd_;
+    vector<string> functionHelp_;
+    vector<char*> rawFunctionHelp_;
+    vector<pdCalc::UnaryFunctionCommand::Function> functions_;
+    vector<pdCalc::UnaryFunctionCommand::Precondition> preconditions_;
 };
 
 void HyperbolicLnPlugin::createPluginDescriptor()
@@ -600,10 +665,75 @@ void HyperbolicLnPlugin::createPluginButtonDescriptor()
     return;
 }
 
+void HyperbolicLnPlugin::createKernelDescriptor()
+{
+    // the kernels share the names of the commands they generalize
+    kernelNames_ = {"sinh", "cosh", "tanh", "arcsinh", "arccosh", "arctanh", "exp", "ln"};
+
+    // the widest vectorized kernels the CPU supports, if any are built
+    if( auto v = selectVectorKernels() )
+        kernels_ = {v->sinh, v->cosh, v->tanh, v->arcsinh, v->arccosh, v->arctanh, v->exp, v->ln};
+    else
+    {
+        kernels_ = {unaryKernel<sinhOf>, unaryKernel<coshOf>, unaryKernel<tanhOf>, unaryKernel<arcsinhOf>,
+            unaryKernel<arccoshOf>, unaryKernel<arctanhOf>, unaryKernel<expOf>, unaryKernel<lnOf>};
+    }
+    domains_ = {nullptr, nullptr, nullptr, nullptr, arccoshDomain, arctanhDomain, nullptr, lnDomain};
+
+    const int n = static_cast<int>( kernels_.size() );
+    kd_.nKernels = n;
+    arities_.assign(n, 1);
+    rawKernelNames_.resize(n);
+
+    for( auto i : views::iota(0, n) )
+        rawKernelNames_[i] = &kernelNames_[i][0];
+
+    kd_.kernelNames = &rawKernelNames_[0];
+    kd_.arities = &arities_[0];
+    kd_.kernels = &kernels_[0];
+    kd_.domains = &domains_[0];
+
+    return;
+}
+
+void HyperbolicLnPlugin::createFunctionDescriptor()
+{
+    // each function is exported in place of the command of the same name, so it
+    // shares the command's name and help message
+    functions_ = {sinhOf, coshOf, tanhOf, arcsinhOf, arccoshOf, arctanhOf, expOf, lnOf};
+    preconditions_ = {nullptr, nullptr, nullptr, nullptr, arccoshDomain, arctanhDomain, nullptr, lnDomain};
+
+    const int n = static_cast<int>( functions_.size() );
+    fd_.nUnary = n;
+    functionHelp_.reserve(n);
+    rawFunctionHelp_.resize(n);
+
+    for( auto i : views::iota(0, n) )
+    {
+        functionHelp_.emplace_back( commands_[i]->helpMessage() );
+        rawFunctionHelp_[i] = &functionHelp_[i][0];
+    }
+
+    fd_.unaryNames = &rawNames_[0];
+    fd_.unaryHelp = &rawFunctionHelp_[0];
+    fd_.unaryFunctions = &functions_[0];
+    fd_.unaryPreconditions = &preconditions_[0];
+
+    fd_.nBinary = 0;
+    fd_.binaryNames = nullptr;
+    fd_.binaryHelp = nullptr;
+    fd_.binaryFunctions = nullptr;
+    fd_.binaryPreconditions = nullptr;
+
+    return;
+}
+
 HyperbolicLnPlugin::HyperbolicLnPlugin()
 {
     createPluginDescriptor();
     createPluginButtonDescriptor();
+    createKernelDescriptor();
+    createFunctionDescriptor();
 }
 
 extern "C" void* AllocPlugin()
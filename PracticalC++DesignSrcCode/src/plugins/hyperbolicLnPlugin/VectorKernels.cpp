@@ -0,0 +1,60 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// The baseline kernels, built for the instruction set the plugin is compiled for,
+// and the choice among the kernels built. The baseline kernels are only two doubles
+// wide, which on x86-64 is slower than the scalar functions, so they are only used
+// when asked for.
+#include <cstdlib>
+#include <string_view>
+#include "VectorKernels.h"
+#if defined(__GNUC__)
+#include "VectorMath.h"
+#endif
+
+const VectorKernels* baselineVectorKernels()
+{
+#if defined(__GNUC__)
+    static const VectorKernels kernels = VectorMath<2>::Kernels("baseline");
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
+
+const VectorKernels* selectVectorKernels()
+{
+    enum { None, Baseline, Avx2, Avx512 } limit = Avx512;
+    if( const char* simd = std::getenv("PDCALC_SIMD") )
+    {
+        const std::string_view s{simd};
+        if(s == "none") limit = None;
+        else if(s == "baseline") limit = Baseline;
+        else if(s == "avx2") limit = Avx2;
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if( limit >= Avx512 && __builtin_cpu_supports("avx512f") && avx512VectorKernels() )
+        return avx512VectorKernels();
+    if( limit >= Avx2 && __builtin_cpu_supports("avx2") && avx2VectorKernels() )
+        return avx2VectorKernels();
+#endif
+
+    return limit == Baseline ? baselineVectorKernels() : nullptr;
+}
@@ -0,0 +1,72 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Vectorized versions of the hyperbolicLn plugin's kernels, which pdCalc uses to
+// evaluate the plugin's functions over the whole stack. Each instruction set's
+// kernels are built in their own file, compiled for that instruction set, and the
+// widest the CPU supports are chosen when the plugin is loaded. Without a vectorizing
+// compiler (GCC or Clang), none are built, and without AVX2, the plugin's scalar
+// kernels are used.
+//
+// exp and ln are computed from polynomials after reducing their arguments, and the
+// hyperbolic functions from them. arcsinh, arccosh, and arctanh use the same formulas
+// as the scalar functions, so they only differ from them where ln does. The
+// largest errors measured against the scalar functions, in units in the last place,
+// are:
+//
+//     exp, ln, arcsinh, arccosh, arctanh   1
+//     cosh                                 2
+//     sinh                                 3
+//     tanh                                 4
+//
+// Results that over- or underflow, and the infinities and NaNs of the scalar
+// functions, are the same.
+#ifndef VECTOR_KERNELS_H
+#define VECTOR_KERNELS_H
+
+#include <cstddef>
+
+struct VectorKernels
+{
+    // the same as pdCalc's Plugin::Kernel
+    using Kernel = void (*)(const double* in[], double* out, size_t n);
+
+    const char* isa;
+    int width;
+
+    Kernel sinh;
+    Kernel cosh;
+    Kernel tanh;
+    Kernel arcsinh;
+    Kernel arccosh;
+    Kernel arctanh;
+    Kernel exp;
+    Kernel ln;
+};
+
+// the kernels for each instruction set, or nullptr where they are not built
+const VectorKernels* baselineVectorKernels();
+const VectorKernels* avx2VectorKernels();
+const VectorKernels* avx512VectorKernels();
+
+// The widest kernels the CPU supports, or nullptr for the scalar kernels. The
+// environment variable PDCALC_SIMD may name a narrower instruction set (avx2, or
+// baseline, which is otherwise never chosen), or none.
+const VectorKernels* selectVectorKernels();
+
+#endif
@@ -0,0 +1,33 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// The AVX2 kernels, built where this file is compiled for AVX2.
+#include "VectorKernels.h"
+#if defined(__GNUC__) && defined(__AVX2__)
+#include "VectorMath.h"
+#endif
+
+const VectorKernels* avx2VectorKernels()
+{
+#if defined(__GNUC__) && defined(__AVX2__)
+    static const VectorKernels kernels = VectorMath<4>::Kernels("avx2");
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
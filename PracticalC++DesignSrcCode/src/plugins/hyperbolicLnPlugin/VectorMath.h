@@ -0,0 +1,324 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// The vectorized kernels, written once with GCC's vector extensions for vectors of W
+// doubles. Each file including this one builds them for the instruction set it is
+// compiled for, so everything here has internal linkage.
+//
+// exp reduces x to r = x - k ln(2), with |r| <= ln(2)/2, and computes e^r - 1 from
+// its Taylor series, which is within 0.1 ulp by its 13th term; e^x is then 2^k e^r
+// and e^x - 1 is 2^k (e^r - 1) + 2^k - 1. ln splits x into 2^k m, with m in
+// [sqrt(2)/2, sqrt(2)), and computes ln(m) as in fdlibm. The hyperbolic functions
+// are computed from e^|x| - 1, or e^|x| / 2 where that is large, so that none
+// cancels.
+#ifndef VECTOR_MATH_H
+#define VECTOR_MATH_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "VectorKernels.h"
+
+namespace {
+
+// vectors of W doubles, their masks, and their bits, declared for each W since GCC
+// does not apply vector_size to a dependent size until instantiation
+template<int W> struct Lanes;
+
+template<> struct Lanes<2>
+{
+    typedef double V __attribute__((vector_size(16)));
+    typedef int64_t M __attribute__((vector_size(16)));
+    typedef uint64_t U __attribute__((vector_size(16)));
+};
+
+template<> struct Lanes<4>
+{
+    typedef double V __attribute__((vector_size(32)));
+    typedef int64_t M __attribute__((vector_size(32)));
+    typedef uint64_t U __attribute__((vector_size(32)));
+};
+
+template<> struct Lanes<8>
+{
+    typedef double V __attribute__((vector_size(64)));
+    typedef int64_t M __attribute__((vector_size(64)));
+    typedef uint64_t U __attribute__((vector_size(64)));
+};
+
+template<int W>
+class VectorMath
+{
+public:
+    static VectorKernels Kernels(const char* isa)
+    {
+        return VectorKernels{isa, W, apply<sinh>, apply<cosh>, apply<tanh>, apply<arcsinh>,
+            apply<arccosh>, apply<arctanh>, apply<exp>, apply<ln>};
+    }
+
+private:
+    using V = typename Lanes<W>::V;
+    using M = typename Lanes<W>::M;
+    using U = typename Lanes<W>::U;
+
+    static constexpr double Log2e = 0x1.71547652b82fep0;
+    static constexpr double Ln2Hi = 0x1.62e42feep-1;
+    static constexpr double Ln2Lo = 0x1.a39ef35793c76p-33;
+    static constexpr double Shifter = 0x1.8p52;
+    static constexpr uint64_t ShifterBits = 0x4338000000000000;
+    static constexpr uint64_t SignBit = 0x8000000000000000;
+    static constexpr double Infinity = std::numeric_limits<double>::infinity();
+
+    // applies f to each element of in[0], the last few padded to a whole vector
+    template<V (*F)(V)>
+    static void apply(const double* in[], double* out, size_t n)
+    {
+        const double* x = in[0];
+        size_t i = 0;
+        for(; i + W <= n; i += W)
+        {
+            V v;
+            std::memcpy(&v, x + i, sizeof(v));
+            v = F(v);
+            std::memcpy(out + i, &v, sizeof(v));
+        }
+
+        if(i < n)
+        {
+            V v = splat(1.0);
+            std::memcpy(&v, x + i, (n - i) * sizeof(double));
+            v = F(v);
+            std::memcpy(out + i, &v, (n - i) * sizeof(double));
+        }
+
+        return;
+    }
+
+    static V splat(double d)
+    {
+        return V{} + d;
+    }
+
+    static V select(M mask, V a, V b)
+    {
+        return (V)( (mask & (M)a) | (~mask & (M)b) );
+    }
+
+    static V abs(V x)
+    {
+        return (V)( (U)x & ~SignBit );
+    }
+
+    // |magnitude| with the sign of x
+    static V withSign(V magnitude, V x)
+    {
+        return (V)( ((U)magnitude & ~SignBit) | ((U)x & SignBit) );
+    }
+
+    // x limited to [lo, hi], except NaNs
+    static V clamp(V x, double lo, double hi)
+    {
+        x = select( (M)(x < lo), splat(lo), x );
+        return select( (M)(x > hi), splat(hi), x );
+    }
+
+    // y rounded to an integer, as a double and in k, for |y| < 2^51
+    static V round(V y, U& k)
+    {
+        const V t = y + Shifter;
+        k = (U)t - ShifterBits;
+
+        return t - Shifter;
+    }
+
+    // 2^k, for k in [-1022, 1024]
+    static V pow2(U k)
+    {
+        return (V)( (k + 1023) << 52 );
+    }
+
+    // p 2^k, for k in [-1080, 1026], in two steps so that neither factor overflows
+    static V scale(V p, V kd, U k)
+    {
+        U k1;
+        round(kd * 0.5, k1);
+
+        return p * pow2(k1) * pow2(k - k1);
+    }
+
+    static V sqrt(V x)
+    {
+#if defined(__AVX512F__)
+        // the masked form, since GCC warns that the unmasked one's source is undefined
+        if constexpr(W == 8) return (V)_mm512_mask_sqrt_pd( (__m512d)x, 0xff, (__m512d)x );
+#endif
+#if defined(__AVX__)
+        if constexpr(W == 4) return (V)_mm256_sqrt_pd( (__m256d)x );
+#endif
+#if defined(__SSE2__)
+        if constexpr(W == 2) return (V)_mm_sqrt_pd( (__m128d)x );
+#endif
+        V r;
+        for(int i = 0; i < W; ++i) r[i] = std::sqrt(x[i]);
+
+        return r;
+    }
+
+    // e^r - 1 for x = r + k ln(2), returning k as a double and in k
+    static V expm1Reduced(V x, V& kd, U& k)
+    {
+        static constexpr double Taylor[] = {1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+            1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800.0};
+
+        kd = round(x * Log2e, k);
+        const V r = (x - kd * Ln2Hi) - kd * Ln2Lo;
+
+        V q = splat(Taylor[11]);
+        for(int i = 10; i >= 0; --i) q = q * r + Taylor[i];
+
+        return r + (r * r) * q;
+    }
+
+    static V exp(V x)
+    {
+        V kd;
+        U k;
+        const V em1 = expm1Reduced( clamp(x, -746.0, 710.0), kd, k );
+
+        return scale(1.0 + em1, kd, k);
+    }
+
+    // e^x / 2, which does not overflow before sinh(x) and cosh(x) do
+    static V halfExp(V x)
+    {
+        V kd;
+        U k;
+        const V em1 = expm1Reduced( clamp(x, -746.0, 711.0), kd, k );
+
+        return scale(1.0 + em1, kd - 1.0, k - 1);
+    }
+
+    // e^x - 1 for x = r + k ln(2), for k <= 53, given e^r - 1
+    static V expm1Small(V em1, U k)
+    {
+        const V p = pow2(k);
+
+        return p * em1 + (p - 1.0);
+    }
+
+    static V expm1(V x)
+    {
+        V kd;
+        U k;
+        const V em1 = expm1Reduced( clamp(x, -40.0, 710.0), kd, k );
+
+        // beyond 2^53, subtracting 1 no longer changes e^x
+        return select( (M)(kd > 53.0), scale(1.0 + em1, kd, k), expm1Small(em1, k) );
+    }
+
+    static V ln(V x)
+    {
+        static constexpr double Lg[] = {6.666666666666735130e-01, 3.999999999940941908e-01, 2.857142874366239149e-01,
+            2.222219843214978396e-01, 1.818357216161805012e-01, 1.531383769920937332e-01, 1.479819860511658591e-01};
+
+        // subnormals are first made normal
+        const M subnormal = (M)(x < 0x1p-1022);
+        const V y = select( subnormal, x * 0x1p54, x );
+
+        const U bits = (U)y;
+        const U e = ( (bits >> 52) & 0x7ff ) - 1023;
+        V m = (V)( (bits & 0x000fffffffffffff) | 0x3ff0000000000000 );
+        V kd = (V)(e + ShifterBits) - Shifter;
+        kd = select( subnormal, kd - 54.0, kd );
+
+        const M high = (M)(m > 0x1.6a09e667f3bcdp0);
+        m = select( high, m * 0.5, m );
+        kd = select( high, kd + 1.0, kd );
+
+        const V f = m - 1.0;
+        const V hfsq = 0.5 * f * f;
+        const V s = f / (2.0 + f);
+        const V z = s * s;
+        const V w = z * z;
+        const V t1 = w * (Lg[1] + w * (Lg[3] + w * Lg[5]));
+        const V t2 = z * (Lg[0] + w * (Lg[2] + w * (Lg[4] + w * Lg[6])));
+        const V R = t2 + t1;
+        V r = kd * Ln2Hi - ( (hfsq - (s * (hfsq + R) + kd * Ln2Lo)) - f );
+
+        r = select( (M)(x == Infinity), splat(Infinity), r );
+        r = select( (M)(x == 0.0), splat(-Infinity), r );
+        r = select( (M)(x < 0.0), splat( std::numeric_limits<double>::quiet_NaN() ), r );
+
+        return select( (M)(x != x), x, r );
+    }
+
+    static V sinh(V x)
+    {
+        V kd;
+        U k;
+        const V a = abs(x);
+        const V em1 = expm1Reduced( clamp(a, 0.0, 711.0), kd, k );
+
+        const V e = expm1Small(em1, k);
+        const V s = 0.5 * ( e + e / (e + 1.0) );
+
+        // beyond 22, e^-|x| no longer changes the result, which is e^|x| / 2
+        const V h = scale(1.0 + em1, kd - 1.0, k - 1);
+
+        return withSign( select( (M)(a > 22.0), h, s ), x );
+    }
+
+    static V cosh(V x)
+    {
+        const V h = halfExp( abs(x) );
+
+        return h + 0.25 / h;
+    }
+
+    static V tanh(V x)
+    {
+        const V a = abs(x);
+        const V e = expm1(a + a);
+        const V t = e / (e + 2.0);
+
+        return withSign( select( (M)(a > 22.0), splat(1.0), t ), x );
+    }
+
+    static V arcsinh(V x)
+    {
+        return ln( x + sqrt(x * x + 1.0) );
+    }
+
+    static V arccosh(V x)
+    {
+        return ln( x + sqrt(x * x - 1.0) );
+    }
+
+    static V arctanh(V x)
+    {
+        return 0.5 * ln( (1.0 + x) / (1.0 - x) );
+    }
+};
+
+}
+
+#endif
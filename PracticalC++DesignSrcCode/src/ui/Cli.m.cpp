@@ -83,6 +83,9 @@ void Cli::execute(bool suppressStartupMessage, bool echo)
 
 void Cli::stackChanged()
 {
+    Trace::Span span{"Cli::stackChanged"};
+    Allocations::Scope scope{Allocations::Stage::Format};
+
     unsigned int nElements{4};
     auto v = Stack::Instance().getElements(nElements);
     string s{"\n"};
@@ -99,7 +102,7 @@ void Cli::stackChanged()
 
     for( auto j = v.size(); auto i : views::reverse(v) )
     {
-        std::format_to(bi, "{}:\t{:.12g}\n", j--, i);
+        std::format_to(bi, "{}:\t{:.{}g}\n", j--, i, Numeric::Precision);
     }
 
     postMessage(s);
@@ -37,6 +37,8 @@
 #include <iterator>
 #include <cassert>
 
+import pdCalc_utilities;
+
 using std::string_view;
 using std::vector;
 using std::string;
@@ -136,7 +138,7 @@ string Display::DisplayImpl::createLine(int lineNumber, double sv, int stackSize
 {
     assert(stackSize < 10); // if not, then the line padding will be wrong
 
-    string value = lineNumber < stackSize ? std::format("{:.12g}", sv) : "";
+    string value = lineNumber < stackSize ? std::format("{:.{}g}", sv, Numeric::Precision) : "";
     auto t = std::format("{}:{:>{}}", lineNumber + 1, value, nCharWide_ - 2);
 
     return t;
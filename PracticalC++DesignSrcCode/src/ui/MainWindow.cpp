@@ -32,6 +32,7 @@
 #include <any>
 
 import pdCalc_stack;
+import pdCalc_utilities;
 
 using std::cout;
 using std::endl;
@@ -104,8 +105,12 @@ void MainWindow::MainWindowImpl::showMessage(string_view m)
 
 void MainWindow::MainWindowImpl::stackChanged()
 {
+    Trace::Span span{"MainWindow::stackChanged"};
+    Allocations::Scope scope{Allocations::Stage::Format};
+
+    // the model holds doubles, which carry every digit the display shows
     auto v = Stack::Instance().getElements(nLinesStack_);
-    guiModel_->stackChanged(v);
+    guiModel_->stackChanged( std::vector<double>(v.begin(), v.end()) );
 
     return;
 }
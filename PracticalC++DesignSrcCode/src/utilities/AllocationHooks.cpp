@@ -0,0 +1,82 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// The replacements of the global operator new and delete that count allocations
+// for Allocations. They are only built, into pdCalcUtilities, with
+// PDCALC_ALLOC_STATS. The default array and nothrow forms call these, so they are
+// counted too. (Windows does not let a DLL replace operator new for the whole
+// program, so there, only the utilities library's own allocations are counted.)
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+import pdCalc_utilities;
+
+namespace {
+
+void* allocate(std::size_t n, std::size_t alignment)
+{
+    pdCalc::Allocations::Record(n);
+
+    if(n == 0) n = 1;
+
+    for(;;)
+    {
+        // aligned_alloc requires a multiple of the alignment
+        void* p = alignment <= alignof(std::max_align_t) ? std::malloc(n)
+            : std::aligned_alloc(alignment, (n + alignment - 1) / alignment * alignment);
+        if(p) return p;
+
+        auto handler = std::get_new_handler();
+        if(!handler) throw std::bad_alloc{};
+        handler();
+    }
+}
+
+}
+
+void* operator new(std::size_t n)
+{
+    return allocate(n, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t n, std::align_val_t alignment)
+{
+    return allocate( n, static_cast<std::size_t>(alignment) );
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,141 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Accounting of heap allocations by the stage of the command pipeline that makes
+// them, for checking work that reduces allocations. pdCalc only counts allocations
+// if built with PDCALC_ALLOC_STATS (the CMake option ENABLE_ALLOC_STATS), which
+// replaces operator new (in AllocationHooks.cpp) with one that calls Record;
+// otherwise, Scopes do nothing, and nothing is counted.
+//
+// Each thread counts allocations made within Scopes, under the innermost Scope's
+// stage, until the counts are taken. The interpreter takes them after each
+// command, and Stats reports them by command, so a command's counts include the
+// tokenizing of its token. Allocations made outside any Scope are not counted.
+module;
+#include <array>
+#include <cstddef>
+#include <cstdint>
+export module pdCalc_utilities:Allocations;
+
+namespace pdCalc {
+
+export class Allocations
+{
+public:
+    enum class Stage { None, Tokenize, Interpret, ParseNumber, Clone, Execute, Notify, Format };
+    static constexpr int NStages = 8;
+    static constexpr const char* StageNames[NStages] =
+        {"none", "tokenize", "interpret", "number", "clone", "execute", "notify", "format"};
+
+#ifdef PDCALC_ALLOC_STATS
+    static constexpr bool Enabled = true;
+#else
+    static constexpr bool Enabled = false;
+#endif
+
+    struct Counts
+    {
+        uint64_t allocations{0};
+        uint64_t bytes{0};
+    };
+
+    // counts by stage, indexed by Stage
+    using StageCounts = std::array<Counts, NStages>;
+
+    // counts an allocation of bytes under the calling thread's stage; it must not
+    // allocate, since operator new calls it
+    static void Record(size_t bytes);
+
+    // returns the calling thread's counts since it last took them, and resets them
+    static StageCounts Take();
+
+    static Stage Current();
+
+    // sets the calling thread's stage from its construction to its destruction
+    class Scope
+    {
+    public:
+        explicit Scope(Stage s)
+        {
+            if constexpr(Enabled) previous_ = Exchange(s);
+        }
+
+        ~Scope()
+        {
+            if constexpr(Enabled) Exchange(previous_);
+        }
+
+    private:
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        Stage previous_{Stage::None};
+    };
+
+private:
+    // sets the calling thread's stage, returning the stage it replaces
+    static Stage Exchange(Stage s);
+};
+
+namespace {
+
+struct ThreadAllocations
+{
+    Allocations::Stage stage{Allocations::Stage::None};
+    Allocations::StageCounts counts{};
+};
+
+// constant initialized, so that operator new may use it before anything else runs
+constinit thread_local ThreadAllocations threadAllocations;
+
+}
+
+void Allocations::Record(size_t bytes)
+{
+    auto& t = threadAllocations;
+    if(t.stage == Stage::None) return;
+
+    auto& c = t.counts[static_cast<int>(t.stage)];
+    ++c.allocations;
+    c.bytes += bytes;
+
+    return;
+}
+
+Allocations::StageCounts Allocations::Take()
+{
+    auto counts = threadAllocations.counts;
+    threadAllocations.counts = StageCounts{};
+
+    return counts;
+}
+
+Allocations::Stage Allocations::Current()
+{
+    return threadAllocations.stage;
+}
+
+Allocations::Stage Allocations::Exchange(Stage s)
+{
+    auto previous = threadAllocations.stage;
+    threadAllocations.stage = s;
+
+    return previous;
+}
+
+}
@@ -0,0 +1,81 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// The floating point type of pdCalc's stack and of its commands' arithmetic, chosen
+// when pdCalc is built (see PDCALC_NUMBER in the top level CMakeLists.txt). Each type's
+// policy gives the number of significant digits the user interfaces show, which
+// leaves a few digits of rounding error out of sight, and parses numbers the user
+// enters.
+//
+// float halves the memory the stack, the undo history, and sessions take, at about
+// seven digits; long double gives more digits than double where it is wider (e.g.,
+// x86), and is the same as double elsewhere. Plugins and their kernels always compute
+// in double, and their arguments and results are converted.
+//
+// This is a module of its own, re-exported by pdCalc_utilities, since plugins compile
+// the Command interface, which uses it, without the rest of the utilities.
+module;
+
+#include <string>
+#include <string_view>
+
+export module pdCalc_number;
+
+export namespace pdCalc {
+
+template<typename T>
+struct NumericPolicy;
+
+template<>
+struct NumericPolicy<float>
+{
+    using Type = float;
+    static constexpr int Precision = 6;
+    static constexpr std::string_view Name = "float";
+    static Type Parse(const std::string& s) { return std::stof(s); }
+};
+
+template<>
+struct NumericPolicy<double>
+{
+    using Type = double;
+    static constexpr int Precision = 12;
+    static constexpr std::string_view Name = "double";
+    static Type Parse(const std::string& s) { return std::stod(s); }
+};
+
+template<>
+struct NumericPolicy<long double>
+{
+    using Type = long double;
+    static constexpr int Precision = 15;
+    static constexpr std::string_view Name = "long double";
+    static Type Parse(const std::string& s) { return std::stold(s); }
+};
+
+#if defined(PDCALC_NUMBER_FLOAT)
+using Numeric = NumericPolicy<float>;
+#elif defined(PDCALC_NUMBER_LONG_DOUBLE)
+using Numeric = NumericPolicy<long double>;
+#else
+using Numeric = NumericPolicy<double>;
+#endif
+
+using Number = Numeric::Type;
+
+}
@@ -0,0 +1,421 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Hardware performance counters (cycles, instructions, cache misses, and branch
+// misses) sampled around each command's executeImpl, for deep tuning. pdCalc only
+// samples them if built with PDCALC_PERF_COUNTERS (the CMake option
+// ENABLE_PERF_COUNTERS, Linux only); otherwise, Samples do nothing.
+//
+// The counters are opened with perf_event_open, for user space only, on the thread
+// that takes the first Sample, which is the thread commands are executed on.
+// Containers and virtual machines often provide no counters, or only some: those
+// that cannot be opened are reported as unavailable, and everything else carries
+// on. Commands run by plugins in helper processes (--isolate-plugins) are not
+// counted, only the waiting for them.
+//
+// A Sample adds its counts under the command of the innermost Context (which the
+// CommandManager sets), under the command's kind, and under the stored procedure
+// the command runs in, if any. A stored procedure's own Sample includes those of
+// the commands it runs.
+module;
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+export module pdCalc_utilities:PerfCounters;
+
+using std::string;
+using std::string_view;
+
+namespace pdCalc {
+
+export class PerfCounters
+{
+public:
+    enum class Event { Cycles, Instructions, CacheMisses, BranchMisses };
+    static constexpr int NEvents = 4;
+
+    // counts by Event; events that are not counted stay 0
+    using Counts = std::array<uint64_t, NEvents>;
+
+    // samples are added up by command, by kind of command (core, plugin, procedure,
+    // or other), and by the stored procedure they are taken in
+    enum class Aggregate { Command, Kind, Procedure };
+    static constexpr int NAggregates = 3;
+
+#ifdef PDCALC_PERF_COUNTERS
+    static constexpr bool Enabled = true;
+#else
+    static constexpr bool Enabled = false;
+#endif
+
+    static PerfCounters& Instance();
+
+    // opens the counters for the calling thread, the first time it is called, and
+    // returns whether any event is counted
+    bool open();
+    bool counted(Event e) const { return slots_[static_cast<int>(e)] != -1; }
+
+    // why no events, or only some, are counted (empty if all are)
+    const string& unavailable() const { return unavailable_; }
+
+    // the counts of the thread the counters were opened for, so far
+    Counts read() const;
+
+    struct Totals
+    {
+        uint64_t samples{0};
+        Counts counts{};
+    };
+
+    void add(Aggregate a, string_view key, const Counts& c);
+
+    // the totals of the samples added under key, or nullptr if there are none
+    const Totals* totals(Aggregate a, string_view key) const;
+
+    // tables of the samples, with instructions per cycle and misses per thousand
+    // instructions, for the perfstats command
+    string report() const;
+
+    void clear();
+
+    // names the command, and its kind, whose Samples follow; both must outlive it
+    class Context
+    {
+    public:
+        Context(string_view command, string_view kind);
+        ~Context();
+
+    private:
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+
+        friend class PerfCounters;
+
+        string_view command_;
+        string_view kind_;
+        const Context* previous_;
+    };
+
+    // marks the Samples that follow as taken in the stored procedure name, which
+    // must outlive it
+    class Procedure
+    {
+    public:
+        explicit Procedure(string_view name)
+        {
+            if constexpr(Enabled) previous_ = Enter(name);
+        }
+
+        ~Procedure()
+        {
+            if constexpr(Enabled) Enter(previous_);
+        }
+
+    private:
+        Procedure(const Procedure&) = delete;
+        Procedure& operator=(const Procedure&) = delete;
+
+        string_view previous_;
+    };
+
+    // counts events from its construction to its destruction, if there is a Context
+    class Sample
+    {
+    public:
+        Sample()
+        {
+            if constexpr(Enabled) active_ = Start(start_);
+        }
+
+        ~Sample()
+        {
+            if constexpr(Enabled)
+            {
+                if(active_) Stop(start_);
+            }
+        }
+
+    private:
+        Sample(const Sample&) = delete;
+        Sample& operator=(const Sample&) = delete;
+
+        bool active_{false};
+        Counts start_;
+    };
+
+private:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters(PerfCounters&&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    PerfCounters& operator=(PerfCounters&&) = delete;
+
+    // sets the calling thread's stored procedure, returning the one it replaces
+    static string_view Enter(string_view procedure);
+
+    // begin and end a Sample; Start returns false if nothing is to be counted
+    static bool Start(Counts& start);
+    static void Stop(const Counts& start);
+
+    static constexpr const char* EventNames[NEvents] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+    static constexpr const char* AggregateNames[NAggregates] = {"command", "kind", "procedure"};
+
+    bool opened_{false};
+    std::thread::id owner_;
+    int leader_{-1};
+    std::array<int, NEvents> fds_;
+
+    // the position of each event's count in the group's reading, or -1
+    std::array<int, NEvents> slots_;
+    int nCounted_{0};
+    string unavailable_;
+
+    std::array<std::map<string, Totals, std::less<>>, NAggregates> totals_;
+};
+
+namespace {
+
+thread_local const PerfCounters::Context* currentContext = nullptr;
+thread_local string_view currentProcedure;
+
+}
+
+PerfCounters& PerfCounters::Instance()
+{
+    static PerfCounters instance;
+    return instance;
+}
+
+PerfCounters::PerfCounters()
+{
+    fds_.fill(-1);
+    slots_.fill(-1);
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for(int fd : fds_)
+        if(fd != -1) ::close(fd);
+#endif
+}
+
+bool PerfCounters::open()
+{
+    if(opened_) return nCounted_ > 0;
+
+    opened_ = true;
+    owner_ = std::this_thread::get_id();
+
+#ifdef __linux__
+    static constexpr uint64_t Configs[NEvents] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+    // the events are opened as a group, so that one read returns them all
+    string failed;
+    int error = 0;
+    for(int e = 0; e < NEvents; ++e)
+    {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = Configs[e];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        const int fd = static_cast<int>( ::syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0) );
+        if(fd == -1)
+        {
+            error = errno;
+            failed += std::format("{}{}", failed.empty() ? "" : ", ", EventNames[e]);
+            continue;
+        }
+
+        if(leader_ == -1) leader_ = fd;
+        fds_[e] = fd;
+        slots_[e] = nCounted_++;
+    }
+
+    if(nCounted_ == 0)
+    {
+        unavailable_ = std::format("perf_event_open failed: {}", std::strerror(error));
+        if(error == EACCES || error == EPERM)
+            unavailable_ += " (see /proc/sys/kernel/perf_event_paranoid)";
+        else if(error == ENOENT || error == ENODEV || error == EOPNOTSUPP)
+            unavailable_ += " (the processor's counters are not available here, as in many virtual machines)";
+        else if(error == ENOSYS)
+            unavailable_ += " (perf_event_open is not permitted here, as in many containers)";
+    }
+    else if( !failed.empty() )
+        unavailable_ = std::format("{} not counted: {}", failed, std::strerror(error));
+#else
+    unavailable_ = "hardware counters are only read on Linux";
+#endif
+
+    return nCounted_ > 0;
+}
+
+PerfCounters::Counts PerfCounters::read() const
+{
+    Counts c{};
+
+#ifdef __linux__
+    if(leader_ == -1) return c;
+
+    // the number of events, followed by their counts
+    uint64_t values[1 + NEvents];
+    if( ::read(leader_, values, sizeof(values)) < static_cast<ssize_t>( sizeof(uint64_t) ) ) return c;
+
+    for(int e = 0; e < NEvents; ++e)
+    {
+        if(slots_[e] != -1 && static_cast<uint64_t>(slots_[e]) < values[0])
+            c[e] = values[1 + slots_[e]];
+    }
+#endif
+
+    return c;
+}
+
+void PerfCounters::add(Aggregate a, string_view key, const Counts& c)
+{
+    auto& m = totals_[static_cast<int>(a)];
+    auto i = m.find(key);
+    if( i == m.end() ) i = m.emplace( string{key}, Totals{} ).first;
+
+    auto& t = i->second;
+    ++t.samples;
+    for(int e = 0; e < NEvents; ++e)
+        t.counts[e] += c[e];
+
+    return;
+}
+
+const PerfCounters::Totals* PerfCounters::totals(Aggregate a, string_view key) const
+{
+    const auto& m = totals_[static_cast<int>(a)];
+    auto i = m.find(key);
+
+    return i == m.end() ? nullptr : &i->second;
+}
+
+string PerfCounters::report() const
+{
+    if(!opened_) return "\nhardware counters have not been sampled\n";
+    if(nCounted_ == 0) return std::format("\nhardware counters are unavailable: {}\n", unavailable_);
+
+    string r = "\n";
+    if( !unavailable_.empty() ) r += unavailable_ + "\n";
+
+    auto ratio = [](bool counted, double n, double d, double scale) -> string
+    {
+        return counted && d > 0 ? std::format("{:.2f}", scale * n / d) : "n/a";
+    };
+
+    const bool cycles = counted(Event::Cycles);
+    const bool instructions = counted(Event::Instructions);
+    for(int a = 0; a < NAggregates; ++a)
+    {
+        if( totals_[a].empty() ) continue;
+
+        r += std::format("\n{:<16} {:>8} {:>14} {:>14} {:>6} {:>12} {:>12}\n", AggregateNames[a], "count",
+            "cycles", "instructions", "IPC", "cache MPKI", "branch MPKI");
+
+        for(const auto& [key, t] : totals_[a])
+        {
+            const auto& c = t.counts;
+            const double i = static_cast<double>( c[static_cast<int>(Event::Instructions)] );
+            r += std::format("{:<16} {:>8} {:>14} {:>14} {:>6} {:>12} {:>12}\n", key, t.samples,
+                cycles ? std::to_string( c[static_cast<int>(Event::Cycles)] ) : "n/a",
+                instructions ? std::to_string( c[static_cast<int>(Event::Instructions)] ) : "n/a",
+                ratio(cycles && instructions, i, c[static_cast<int>(Event::Cycles)], 1),
+                ratio(instructions && counted(Event::CacheMisses), c[static_cast<int>(Event::CacheMisses)], i, 1000),
+                ratio(instructions && counted(Event::BranchMisses), c[static_cast<int>(Event::BranchMisses)], i, 1000));
+        }
+    }
+
+    return r;
+}
+
+void PerfCounters::clear()
+{
+    for(auto& t : totals_) t.clear();
+
+    return;
+}
+
+PerfCounters::Context::Context(string_view command, string_view kind)
+: command_{command}
+, kind_{kind}
+, previous_{currentContext}
+{
+    currentContext = this;
+}
+
+PerfCounters::Context::~Context()
+{
+    currentContext = previous_;
+}
+
+string_view PerfCounters::Enter(string_view procedure)
+{
+    auto previous = currentProcedure;
+    currentProcedure = procedure;
+
+    return previous;
+}
+
+bool PerfCounters::Start(Counts& start)
+{
+    auto& p = Instance();
+    if( !currentContext || !p.open() || std::this_thread::get_id() != p.owner_ ) return false;
+
+    start = p.read();
+
+    return true;
+}
+
+void PerfCounters::Stop(const Counts& start)
+{
+    auto& p = Instance();
+
+    auto c = p.read();
+    for(int e = 0; e < NEvents; ++e)
+        c[e] -= start[e];
+
+    p.add(Aggregate::Command, currentContext->command_, c);
+    p.add(Aggregate::Kind, currentContext->kind_, c);
+    if( !currentProcedure.empty() ) p.add(Aggregate::Procedure, currentProcedure, c);
+
+    return;
+}
+
+}
@@ -29,8 +29,10 @@ module;
 
 export module pdCalc_utilities:Publisher;
 
+import :Allocations;
 import :Exception;
 import :Observer;
+import :Trace;
 
 using std::string;
 using std::vector;
@@ -131,6 +133,9 @@ void Publisher::raise(const string& eventName) const
 
 void Publisher::raise(const string& eventName, const std::any d) const
 {
+    Trace::Span span{"Publisher::raise", eventName};
+    Allocations::Scope scope{Allocations::Stage::Notify};
+
     const auto& obsList = findCheckedEvent(eventName)->second;
     ranges::for_each( views::values(obsList), [d](const auto& v){ v->notify(d);} );
 
@@ -0,0 +1,414 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Latency histograms and counters describing where a session's time goes. pdCalc
+// is instrumented to feed them only if built with PDCALC_STATS (the CMake option
+// ENABLE_STATS); otherwise, the instrumentation is compiled out, and Stats stays
+// empty. Built with PDCALC_ALLOC_STATS as well, Stats also reports the allocations
+// each command makes, by stage (see Allocations).
+//
+// A LatencyHistogram counts nanosecond latencies in buckets whose width grows with
+// the latency, as an HDR histogram does: below 2^SubBucketBits, every latency has
+// its own bucket, and above, each power of two is split into 2^SubBucketBits
+// buckets. A percentile is therefore within 1 / 2^SubBucketBits of the latency it
+// stands for, over the whole range, for a fixed size of under 8 kB.
+module;
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <algorithm>
+export module pdCalc_utilities:Stats;
+
+import :Allocations;
+
+using std::string;
+using std::string_view;
+
+namespace pdCalc {
+
+export class LatencyHistogram
+{
+public:
+    static constexpr int SubBucketBits = 4;
+
+    void record(uint64_t ns);
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? static_cast<double>(total_) / count_ : 0.0; }
+
+    // the latency below which the fraction p of the latencies fall, reported as
+    // the highest latency of its bucket (but no more than the maximum)
+    uint64_t percentile(double p) const;
+
+    // the bucket of ns, and the lowest and highest latency of bucket i
+    static size_t Bucket(uint64_t ns);
+    static uint64_t Lowest(size_t i);
+    static uint64_t Highest(size_t i);
+
+private:
+    static constexpr size_t SubBuckets = size_t{1} << SubBucketBits;
+    static constexpr size_t NBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+    std::array<uint64_t, NBuckets> counts_{};
+    uint64_t count_{0};
+    uint64_t total_{0};
+    uint64_t min_{UINT64_MAX};
+    uint64_t max_{0};
+};
+
+size_t LatencyHistogram::Bucket(uint64_t ns)
+{
+    if(ns < SubBuckets) return ns;
+
+    // the SubBucketBits bits after the leading one select the sub-bucket
+    const int e = std::bit_width(ns) - 1;
+    const size_t sub = (ns >> (e - SubBucketBits)) & (SubBuckets - 1);
+
+    return (e - SubBucketBits + 1) * SubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::Lowest(size_t i)
+{
+    if(i < SubBuckets) return i;
+
+    const size_t q = i / SubBuckets;
+
+    return (SubBuckets + i % SubBuckets) << (q - 1);
+}
+
+uint64_t LatencyHistogram::Highest(size_t i)
+{
+    if(i < SubBuckets) return i;
+
+    return Lowest(i) + ( (uint64_t{1} << (i / SubBuckets - 1)) - 1 );
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    ++counts_[ Bucket(ns) ];
+    ++count_;
+    total_ += ns;
+    min_ = std::min(min_, ns);
+    max_ = std::max(max_, ns);
+
+    return;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if(count_ == 0) return 0;
+
+    // the rank of the latency wanted, from 1 to count_
+    const auto rank = std::clamp( static_cast<uint64_t>(p * count_ + 0.5), uint64_t{1}, count_ );
+
+    uint64_t seen = 0;
+    for(size_t i = 0; i < NBuckets; ++i)
+    {
+        seen += counts_[i];
+        if(seen >= rank) return std::min( Highest(i), max_ );
+    }
+
+    return max_;
+}
+
+export class Stats
+{
+public:
+    // what is timed: a command as the interpreter handles it, and, beneath it, the
+    // CommandManager's execution, undo, and redo of the command
+    enum class Operation { Interpret, Execute, Undo, Redo };
+    static constexpr int NOperations = 4;
+
+    enum class Counter { Tokens, ParseFailures, PreconditionFailures };
+    static constexpr int NCounters = 3;
+
+    static Stats& Instance();
+
+    LatencyHistogram& latency(Operation op, string_view name);
+
+    void count(Counter c) { ++counters_[static_cast<int>(c)]; }
+    uint64_t counter(Counter c) const { return counters_[static_cast<int>(c)]; }
+
+    // the number of commands on the undo stack, of which the largest is kept
+    void undoDepth(size_t depth);
+    size_t undoDepth() const { return undoDepth_; }
+    size_t maxUndoDepth() const { return maxUndoDepth_; }
+
+    // the allocations made by the commands of a name, by stage
+    struct CommandAllocations
+    {
+        uint64_t commands{0};
+        Allocations::StageCounts stages{};
+    };
+
+    // adds the allocations of one command; the interpreter's Timer does so with
+    // PDCALC_ALLOC_STATS
+    void allocations(string_view name, const Allocations::StageCounts& counts);
+
+    // the allocations of the commands named name, or nullptr if there are none
+    const CommandAllocations* allocations(string_view name) const;
+
+    // a table of the counters and histograms, for the stats command, which ends
+    // with the allocationReport, a table of the allocations per command by stage
+    string report() const;
+    string allocationReport() const;
+
+    // the counters and histograms as JSON, written to filename by writeJson, which
+    // returns false if the file cannot be written
+    string json() const;
+    bool writeJson(const string& filename) const;
+
+    void clear();
+
+    // records the time from its construction to its destruction under the name it
+    // is given, if it is given one
+    class Timer
+    {
+    public:
+        explicit Timer(Operation op, string_view name = {});
+        ~Timer();
+
+        void name(string_view n) { name_ = n; }
+
+    private:
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        Operation op_;
+        string_view name_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+private:
+    Stats() = default;
+    ~Stats() = default;
+
+    Stats(const Stats&) = delete;
+    Stats(Stats&&) = delete;
+    Stats& operator=(const Stats&) = delete;
+    Stats& operator=(Stats&&) = delete;
+
+    static constexpr const char* OperationNames[NOperations] = {"interpret", "execute", "undo", "redo"};
+    static constexpr const char* CounterNames[NCounters] = {"tokens", "parse_failures", "precondition_failures"};
+
+    // histograms are looked up by string_view, so that no name is copied once its
+    // histogram exists
+    using Histograms = std::map<string, LatencyHistogram, std::less<>>;
+    std::array<Histograms, NOperations> histograms_;
+    std::array<uint64_t, NCounters> counters_{};
+    size_t undoDepth_{0};
+    size_t maxUndoDepth_{0};
+    std::map<string, CommandAllocations, std::less<>> allocations_;
+};
+
+Stats& Stats::Instance()
+{
+    static Stats instance;
+    return instance;
+}
+
+LatencyHistogram& Stats::latency(Operation op, string_view name)
+{
+    auto& h = histograms_[static_cast<int>(op)];
+    auto i = h.find(name);
+    if( i == h.end() ) i = h.emplace( string{name}, LatencyHistogram{} ).first;
+
+    return i->second;
+}
+
+void Stats::undoDepth(size_t depth)
+{
+    undoDepth_ = depth;
+    maxUndoDepth_ = std::max(maxUndoDepth_, depth);
+
+    return;
+}
+
+void Stats::allocations(string_view name, const Allocations::StageCounts& counts)
+{
+    auto i = allocations_.find(name);
+    if( i == allocations_.end() ) i = allocations_.emplace( string{name}, CommandAllocations{} ).first;
+
+    auto& a = i->second;
+    ++a.commands;
+    for(int s = 0; s < Allocations::NStages; ++s)
+    {
+        a.stages[s].allocations += counts[s].allocations;
+        a.stages[s].bytes += counts[s].bytes;
+    }
+
+    return;
+}
+
+const Stats::CommandAllocations* Stats::allocations(string_view name) const
+{
+    auto i = allocations_.find(name);
+
+    return i == allocations_.end() ? nullptr : &i->second;
+}
+
+string Stats::report() const
+{
+    string r = "\n";
+    for(int c = 0; c < NCounters; ++c)
+        r += std::format("{}: {}\n", CounterNames[c], counters_[c]);
+    r += std::format("undo_depth: {} (max {})\n", undoDepth_, maxUndoDepth_);
+
+    r += std::format("\n{:<10} {:<16} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+        "operation", "command", "count", "mean ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+    for(int op = 0; op < NOperations; ++op)
+    {
+        for(const auto& [name, h] : histograms_[op])
+            r += std::format("{:<10} {:<16} {:>8} {:>10.0f} {:>10} {:>10} {:>10} {:>10}\n", OperationNames[op], name,
+                h.count(), h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max());
+    }
+
+    return r + allocationReport();
+}
+
+string Stats::allocationReport() const
+{
+    if( allocations_.empty() ) return {};
+
+    // allocations per command, by stage; no allocation is counted under None
+    string r = std::format("\n{:<16} {:>8}", "command", "count");
+    for(int s = 1; s < Allocations::NStages; ++s)
+        r += std::format(" {:>9}", Allocations::StageNames[s]);
+    r += std::format(" {:>9}\n", "bytes");
+
+    for(const auto& [name, a] : allocations_)
+    {
+        uint64_t bytes = 0;
+        r += std::format("{:<16} {:>8}", name, a.commands);
+        for(int s = 1; s < Allocations::NStages; ++s)
+        {
+            r += std::format( " {:>9.1f}", static_cast<double>(a.stages[s].allocations) / a.commands );
+            bytes += a.stages[s].bytes;
+        }
+        r += std::format( " {:>9.0f}\n", static_cast<double>(bytes) / a.commands );
+    }
+
+    return r;
+}
+
+namespace {
+
+// command names are typed by users, so they are escaped
+string jsonString(string_view s)
+{
+    string r = "\"";
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\') r += {'\\', c};
+        else if(static_cast<unsigned char>(c) < 0x20) r += std::format("\\u{:04x}", c);
+        else r += c;
+    }
+
+    return r + '"';
+}
+
+}
+
+string Stats::json() const
+{
+    string r = "{\n  \"counters\": {";
+    for(int c = 0; c < NCounters; ++c)
+        r += std::format("\"{}\": {}, ", CounterNames[c], counters_[c]);
+    r += std::format("\"undo_depth\": {}, \"max_undo_depth\": {}}},\n  \"latencies\": [", undoDepth_, maxUndoDepth_);
+
+    bool first = true;
+    for(int op = 0; op < NOperations; ++op)
+    {
+        for(const auto& [name, h] : histograms_[op])
+        {
+            r += std::format("{}\n    {{\"operation\": \"{}\", \"command\": {}, \"count\": {}, \"min_ns\": {}, "
+                "\"mean_ns\": {:.1f}, \"p50_ns\": {}, \"p90_ns\": {}, \"p99_ns\": {}, \"max_ns\": {}}}",
+                first ? "" : ",", OperationNames[op], jsonString(name), h.count(), h.min(), h.mean(),
+                h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max());
+            first = false;
+        }
+    }
+
+    r += "\n  ],\n  \"allocations\": [";
+
+    first = true;
+    for(const auto& [name, a] : allocations_)
+    {
+        r += std::format("{}\n    {{\"command\": {}, \"count\": {}, \"stages\": {{",
+            first ? "" : ",", jsonString(name), a.commands);
+        for(int s = 1; s < Allocations::NStages; ++s)
+        {
+            r += std::format("{}\"{}\": {{\"allocations\": {}, \"bytes\": {}}}", s == 1 ? "" : ", ",
+                Allocations::StageNames[s], a.stages[s].allocations, a.stages[s].bytes);
+        }
+        r += "}}";
+        first = false;
+    }
+
+    return r + "\n  ]\n}\n";
+}
+
+bool Stats::writeJson(const string& filename) const
+{
+    std::ofstream ofs{filename};
+    ofs << json();
+
+    return static_cast<bool>(ofs);
+}
+
+void Stats::clear()
+{
+    for(auto& h : histograms_) h.clear();
+    counters_.fill(0);
+    undoDepth_ = 0;
+    maxUndoDepth_ = 0;
+    allocations_.clear();
+
+    return;
+}
+
+Stats::Timer::Timer(Operation op, string_view name)
+: op_{op}
+, name_{name}
+, start_{std::chrono::steady_clock::now()}
+{ }
+
+Stats::Timer::~Timer()
+{
+    // a command's allocations are taken even if it goes unrecorded, so that they are
+    // not added to the next command's
+    Allocations::StageCounts counts{};
+    if(Allocations::Enabled && op_ == Operation::Interpret) counts = Allocations::Take();
+
+    if( name_.empty() ) return;
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+    Stats::Instance().latency(op_, name_).record( static_cast<uint64_t>(ns) );
+
+    if(Allocations::Enabled && op_ == Operation::Interpret) Stats::Instance().allocations(name_, counts);
+}
+
+}
@@ -30,6 +30,9 @@ module;
 
 export module pdCalc_utilities:Tokenizer;
 
+import :Allocations;
+import :Trace;
+
 using std::string;
 using std::istream_iterator;
 using std::back_inserter;
@@ -111,10 +114,17 @@ LazyTokenizer::LazyTokenizer(istream& is)
 
 cppcoro::generator<string> LazyTokenizer::tokenize(istream& is) noexcept
 {
-    for(istream_iterator<string> i{is}; i != istream_iterator<string>{}; ++i)
+    for(string s; ; )
     {
+        // traced token by token, since the span must end before the token is yielded
         string t;
-        ranges::transform(*i, back_inserter<string>(t), ::tolower);
+        {
+            Trace::Span span{"LazyTokenizer::tokenize"};
+            Allocations::Scope scope{Allocations::Stage::Tokenize};
+            if( !(is >> s) ) break;
+            ranges::transform(s, back_inserter<string>(t), ::tolower);
+        }
+
         ++nTokens_;
         co_yield t;
     }
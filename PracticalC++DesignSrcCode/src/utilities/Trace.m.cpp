@@ -0,0 +1,359 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+// Tracing of where a command's time goes, written as Chrome trace-event JSON, which
+// chrome://tracing and Perfetto display. The stages a command passes through are
+// marked with Spans; while tracing, each Span records a complete event, which nests
+// under the Spans enclosing it on the same thread. While not tracing, a Span only
+// tests a flag.
+//
+// Events are kept in a ring per thread, so recording takes no lock and allocates
+// nothing, and are timed by the processor's time-stamp counter where there is one,
+// which is cheaper to read than the system's clocks. Once a ring is full, its oldest
+// events are overwritten; the number lost is reported with the trace. Start and
+// Stop must not be called while other threads record events.
+module;
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+export module pdCalc_utilities:Trace;
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace pdCalc {
+
+export class Trace
+{
+public:
+    // an event, timed in nanoseconds from the start of tracing
+    struct Event
+    {
+        const char* name;
+        char arg[40];
+        uint32_t thread;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    static constexpr size_t DefaultCapacity = size_t{1} << 16;
+
+    // starts tracing, discarding any events recorded before, with rings of
+    // capacity events (rounded up to a power of two)
+    static void Start(size_t capacity = DefaultCapacity);
+
+    // stops tracing, keeping the events recorded
+    static void Stop();
+
+    static bool Enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // the events kept, ordered by thread and then by the time they ended, and the
+    // number overwritten
+    static vector<Event> Events();
+    static uint64_t Dropped();
+
+    // writes the events kept as trace-event JSON; returns false if filename cannot
+    // be written
+    static void Write(std::ostream& os);
+    static bool Write(const string& filename);
+
+    // Records an event named name, with arg (shortened to fit) as its argument, from
+    // its construction to its destruction. name must outlive tracing, and arg the Span.
+    class Span
+    {
+    public:
+        explicit Span(const char* name, string_view arg = {})
+        {
+            if( Enabled() )
+            {
+                name_ = name;
+                arg_ = arg;
+                start_ = Now();
+            }
+        }
+
+        ~Span()
+        {
+            if(name_) Record(name_, arg_, start_);
+        }
+
+    private:
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        const char* name_{nullptr};
+        string_view arg_;
+        uint64_t start_{0};
+    };
+
+private:
+    // a cheap, steady count of ticks, which need not be nanoseconds
+    static uint64_t Now()
+    {
+#if defined(__x86_64__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    static void Record(const char* name, string_view arg, uint64_t start);
+
+    static inline std::atomic<bool> enabled_{false};
+};
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Events are timed in ticks of Trace::Now, which are converted to nanoseconds from
+// the start of tracing by comparing the ticks and the clock's time at the start and
+// at the end of tracing.
+struct Calibration
+{
+    uint64_t startTicks{0};
+    Clock::time_point startTime;
+    uint64_t stopTicks{0};
+    Clock::time_point stopTime;
+
+    double nsPerTick() const
+    {
+        const double ns = std::chrono::duration<double, std::nano>(stopTime - startTime).count();
+        return stopTicks > startTicks ? ns / (stopTicks - startTicks) : 1.0;
+    }
+};
+
+Calibration calibration;
+
+struct Ring
+{
+    uint32_t thread;
+
+    // a power of two in size, so that the oldest event is found with a mask
+    vector<Trace::Event> events;
+    uint64_t mask{0};
+
+    // the number of events ever recorded, of which the last events.size() are kept
+    uint64_t recorded{0};
+};
+
+// rings outlive their threads, so that a thread's events are written after it ends
+struct Rings
+{
+    std::mutex mutex;
+    vector<std::unique_ptr<Ring>> rings;
+    size_t capacity{Trace::DefaultCapacity};
+};
+
+Rings& rings()
+{
+    static Rings r;
+    return r;
+}
+
+// rings made before the last Start are reset on their next use
+std::atomic<uint64_t> generation{0};
+
+struct ThreadRing
+{
+    Ring* ring{nullptr};
+    uint64_t generation{0};
+};
+
+thread_local ThreadRing threadRing;
+
+Ring& resetThreadRing()
+{
+    std::lock_guard lock{rings().mutex};
+
+    auto& t = threadRing;
+    if(!t.ring)
+    {
+        rings().rings.push_back( std::make_unique<Ring>() );
+        t.ring = rings().rings.back().get();
+        t.ring->thread = static_cast<uint32_t>( rings().rings.size() );
+    }
+
+    t.ring->events.resize( std::bit_ceil( std::max(rings().capacity, size_t{1}) ) );
+    t.ring->mask = t.ring->events.size() - 1;
+    t.ring->recorded = 0;
+    t.generation = generation.load(std::memory_order_relaxed);
+
+    return *t.ring;
+}
+
+}
+
+void Trace::Record(const char* name, string_view arg, uint64_t start)
+{
+    const auto end = Now();
+
+    auto& t = threadRing;
+    auto& ring = t.ring && t.generation == generation.load(std::memory_order_relaxed) ? *t.ring : resetThreadRing();
+
+    auto& e = ring.events[ring.recorded++ & ring.mask];
+    e.name = name;
+    e.start = start;
+    e.duration = end - start;
+
+    const auto n = std::min( arg.size(), sizeof(e.arg) - 1 );
+    std::memcpy(e.arg, arg.data(), n);
+    e.arg[n] = '\0';
+
+    return;
+}
+
+void Trace::Start(size_t capacity)
+{
+    {
+        std::lock_guard lock{rings().mutex};
+        for(auto& r : rings().rings)
+        {
+            r->events.clear();
+            r->recorded = 0;
+        }
+
+        rings().capacity = capacity;
+        generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    calibration.startTime = Clock::now();
+    calibration.startTicks = Now();
+    enabled_.store(true, std::memory_order_relaxed);
+
+    return;
+}
+
+void Trace::Stop()
+{
+    enabled_.store(false, std::memory_order_relaxed);
+    calibration.stopTicks = Now();
+    calibration.stopTime = Clock::now();
+
+    return;
+}
+
+vector<Trace::Event> Trace::Events()
+{
+    std::lock_guard lock{rings().mutex};
+
+    auto c = calibration;
+    if( Enabled() )
+    {
+        c.stopTicks = Now();
+        c.stopTime = Clock::now();
+    }
+
+    const double scale = c.nsPerTick();
+
+    vector<Event> events;
+    for(const auto& r : rings().rings)
+    {
+        const auto kept = std::min<uint64_t>( r->recorded, r->events.size() );
+        for(auto i = r->recorded - kept; i < r->recorded; ++i)
+        {
+            auto e = r->events[i & r->mask];
+            e.thread = r->thread;
+
+            // events begun before tracing started are clipped
+            const auto start = std::max(e.start, c.startTicks);
+            e.duration = static_cast<uint64_t>( (e.start + e.duration - start) * scale );
+            e.start = static_cast<uint64_t>( (start - c.startTicks) * scale );
+            events.push_back(e);
+        }
+    }
+
+    return events;
+}
+
+uint64_t Trace::Dropped()
+{
+    std::lock_guard lock{rings().mutex};
+
+    uint64_t dropped = 0;
+    for(const auto& r : rings().rings)
+        dropped += r->recorded - std::min<uint64_t>(r->recorded, r->events.size());
+
+    return dropped;
+}
+
+namespace {
+
+// arguments are command names and file names, which are typed by users
+string escaped(string_view s)
+{
+    string r;
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\') r += {'\\', c};
+        else if(static_cast<unsigned char>(c) < 0x20) r += std::format("\\u{:04x}", c);
+        else r += c;
+    }
+
+    return r;
+}
+
+}
+
+void Trace::Write(std::ostream& os)
+{
+    const auto events = Events();
+
+    os << "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped\": " << Dropped() << "},\n"
+       << "\"traceEvents\": [\n";
+
+    bool first = true;
+    for(const auto& e : events)
+    {
+        os << (first ? "" : ",\n")
+           << std::format("{{\"name\": \"{}\", \"ph\": \"X\", \"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}",
+                  e.name, e.thread, e.start / 1e3, e.duration / 1e3);
+        if(e.arg[0] != '\0') os << ", \"args\": {\"arg\": \"" << escaped(e.arg) << "\"}";
+        os << '}';
+        first = false;
+    }
+
+    os << "\n]}\n";
+
+    return;
+}
+
+bool Trace::Write(const string& filename)
+{
+    std::ofstream ofs{filename};
+    Write(ofs);
+
+    return static_cast<bool>(ofs);
+}
+
+}
@@ -21,4 +21,9 @@ export import :Observer;
 export import :Exception;
 export import :Publisher;
 export import :Tokenizer;
+export import :Allocations;
+export import :Stats;
+export import :Trace;
+export import :PerfCounters;
+export import pdCalc_number;
 
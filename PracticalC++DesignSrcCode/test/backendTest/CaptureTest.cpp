@@ -0,0 +1,203 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "CaptureTest.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+
+import pdCalc_utilities;
+import pdCalc_stack;
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+
+using std::vector;
+using std::string;
+using std::string_view;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class TestInterface : public pdCalc::UserInterface
+{
+public:
+    TestInterface() { }
+    void postMessage(string_view) override { }
+    void stackChanged() override { }
+};
+
+string captureFile()
+{
+    return ( fs::temp_directory_path() / "pdCalcCaptureTest.pdc" ).string();
+}
+
+vector<string> texts(const pdCalc::Capture::Recording& r)
+{
+    vector<string> t;
+    for(const auto& token : r.tokens) t.push_back(token.text);
+
+    return t;
+}
+
+// procedures are found relative to the current directory, as pdCalc finds them
+class WorkingDirectory
+{
+public:
+    explicit WorkingDirectory(const fs::path& dir) : previous_{fs::current_path()} { fs::current_path(dir); }
+    ~WorkingDirectory() { fs::current_path(previous_); }
+
+private:
+    fs::path previous_;
+};
+
+}
+
+void CaptureTest::testRoundTrip()
+{
+    auto file = captureFile();
+    const vector<string> tokens{"3", "4", "+", "3", "+", "proc:norm3", "undo", "+", "undo"};
+
+    {
+        WorkingDirectory dir{BACKEND_TEST_DIR};
+        pdCalc::Capture capture{file, {"libPlugin.so", "lib/libPlugin.so"}};
+        for(const auto& t : tokens) capture.token(t);
+    }
+
+    auto r = pdCalc::Capture::Read(file);
+    QCOMPARE( texts(r), tokens );
+    QVERIFY( std::ranges::is_sorted(r.tokens, {}, &pdCalc::Capture::Token::time) );
+
+    // libraries found along the search path are left to it
+    QCOMPARE( r.plugins.size(), size_t{2} );
+    QCOMPARE( r.plugins[0], string{"libPlugin.so"} );
+    QVERIFY( fs::path{r.plugins[1]}.is_absolute() );
+
+    // norm3 runs hypotenuse, so both are captured, each once
+    QCOMPARE( r.procedures.size(), size_t{2} );
+    QCOMPARE( r.procedures[0].name, string{"norm3"} );
+    QCOMPARE( r.procedures[1].name, string{"hypotenuse"} );
+    std::ifstream ifs{ std::format("{}/hypotenuse", BACKEND_TEST_DIR) };
+    std::ostringstream hypotenuse;
+    hypotenuse << ifs.rdbuf();
+    QCOMPARE( r.procedures[1].contents, hypotenuse.str() );
+
+    // a repeated token is written once, and then as its index
+    {
+        pdCalc::Capture capture{file, {}};
+        for(int i = 0; i < 1000; ++i) capture.token("swap");
+    }
+    QCOMPARE( pdCalc::Capture::Read(file).tokens.size(), size_t{1000} );
+    QVERIFY( fs::file_size(file) < 4 * 1000 );
+
+    fs::remove(file);
+
+    return;
+}
+
+void CaptureTest::testCutShort()
+{
+    auto file = captureFile();
+
+    {
+        pdCalc::Capture capture{file, {}};
+        capture.token("1");
+        capture.token("2");
+        capture.token("swap");
+    }
+
+    // a crash in the middle of writing the last record
+    fs::resize_file(file, fs::file_size(file) - 2);
+    QCOMPARE( texts( pdCalc::Capture::Read(file) ), (vector<string>{"1", "2"}) );
+
+    fs::remove(file);
+
+    return;
+}
+
+void CaptureTest::testNotACapture()
+{
+    auto file = captureFile();
+    std::ofstream{file} << "1 2 +\n";
+
+    try
+    {
+        pdCalc::Capture::Read(file);
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("{} is not a capture", file) );
+    }
+
+    fs::remove(file);
+
+    return;
+}
+
+void CaptureTest::testReplay()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+    pdCalc::CommandInterpreter ci{ui};
+
+    using std::chrono::microseconds;
+    pdCalc::Capture::Recording recording{{}, {},
+        {{microseconds{0}, "3"}, {microseconds{10}, "4"}, {microseconds{20}, "proc:hypotenuse"},
+         {microseconds{30}, "2"}, {microseconds{40}, "*"}, {microseconds{50}, "undo"}, {microseconds{60}, "redo"}}};
+
+    pdCalc::Replay::Report report;
+    {
+        WorkingDirectory dir{BACKEND_TEST_DIR};
+        report = pdCalc::Replay{ci}.run(recording, pdCalc::Replay::Pacing::Original);
+    }
+
+    QCOMPARE( pdCalc::Stack::Instance().getElements(1).back(), 10.0 );
+
+    vector<string> names;
+    for(const auto& [name, s] : report) names.push_back(name);
+    QCOMPARE( names, (vector<string>{"*", "number", "proc", "redo", "undo"}) );
+    QCOMPARE( report["number"].count, size_t{3} );
+    QVERIFY( report["proc"].p50Us > 0 && report["proc"].p50Us <= report["proc"].p99Us );
+
+    // a report read back compares with itself as unchanged
+    auto file = captureFile();
+    {
+        std::ofstream ofs{file};
+        pdCalc::Replay::Write(ofs, report);
+    }
+    auto baseline = pdCalc::Replay::Read(file);
+    QCOMPARE( baseline.size(), report.size() );
+    QCOMPARE( baseline["number"].count, size_t{3} );
+
+    std::ostringstream oss;
+    pdCalc::Replay::Write(oss, report, &baseline);
+    QVERIFY( oss.str().find("baseline_p50_us") != string::npos );
+
+    fs::remove(file);
+    pdCalc::Stack::Instance().clear();
+
+    return;
+}
@@ -20,6 +20,7 @@
 #include <format>
 #include <set>
 #include <string_view>
+#include <vector>
 
 import pdCalc_command;
 import pdCalc_utilities;
@@ -180,3 +181,78 @@ void CommandFactoryTest::testAllocateCommand()
 
     return;
 }
+
+void CommandFactoryTest::testCoreCommands()
+{
+    pdCalc::CommandFactory& cf = pdCalc::CommandFactory::Instance();
+    pdCalc::Stack& stack = pdCalc::Stack::Instance();
+    cf.clearAllCommands();
+
+    cf.registerCommand( "dup", pdCalc::MakeCommandPtr<TestCommand>() );
+
+    auto conflicts = cf.registerCoreCommands();
+
+    QCOMPARE( conflicts, std::vector<string>{"dup"} );
+    QCOMPARE( cf.getNumberCommands(), pdCalc::CoreCommandTable.size() );
+    QVERIFY( cf.deregisterCommand("dup") != nullptr );
+    QVERIFY( cf.registerCoreCommands().empty() );
+    QVERIFY( cf.registerCoreCommands().empty() );
+    QCOMPARE( cf.getNumberCommands(), pdCalc::CoreCommandTable.size() );
+
+    for(const auto& core : pdCalc::CoreCommandTable)
+    {
+        string name{core.name};
+        QVERIFY( cf.hasKey(name) );
+        QVERIFY( cf.getAllCommandNames().contains(name) );
+
+        auto c = cf.allocateCommand(name);
+        QVERIFY( c != nullptr );
+        QCOMPARE( string_view{c->helpMessage()}, core.help );
+        QCOMPARE( cf.commandName(*c), name );
+        QCOMPARE( cf.helpMessage(name), std::format("{}: {}", name, core.help) );
+
+        // a command fails with fewer elements on the stack than its arity
+        stack.clear();
+        for(int i = 0; i < core.arity - 1; ++i) stack.push(0.5);
+        if(core.arity > 0)
+        {
+            try
+            {
+                c->execute();
+                QVERIFY( false );
+            }
+            catch(pdCalc::Exception&)
+            { }
+        }
+
+        stack.push(0.5);
+        c->execute();
+    }
+
+    auto neg = cf.deregisterCommand("neg");
+    QVERIFY( neg != nullptr );
+    QCOMPARE( cf.hasKey("neg"), false );
+    QCOMPARE( cf.getAllCommandNames().contains("neg"), false );
+    QCOMPARE( cf.getNumberCommands(), pdCalc::CoreCommandTable.size() - 1 );
+    QCOMPARE( cf.commandName(*neg), string{} );
+    QVERIFY( cf.allocateCommand("neg") == nullptr );
+
+    // the names cached by commandName follow the registered commands
+    cf.registerCommand( "negate", pdCalc::MakeCommandPtr( neg->clone() ) );
+    QCOMPARE( cf.commandName(*neg), string{"negate"} );
+    cf.deregisterCommand("negate");
+    QCOMPARE( cf.commandName(*neg), string{} );
+
+    // a core command may be replaced
+    cf.registerCommand( "neg", pdCalc::MakeCommandPtr<TestCommand>("neg") );
+    QCOMPARE( cf.registerCoreCommands(), std::vector<string>{"neg"} );
+    QVERIFY( dynamic_cast<TestCommand*>( cf.allocateCommand("neg").get() ) != nullptr );
+
+    cf.clearAllCommands();
+    stack.clear();
+    QCOMPARE( cf.getNumberCommands(), size_t{0} );
+    QVERIFY( cf.getAllCommandNames().empty() );
+    QVERIFY( cf.allocateCommand("+") == nullptr );
+
+    return;
+}
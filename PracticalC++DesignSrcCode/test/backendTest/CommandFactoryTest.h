@@ -30,6 +30,7 @@ private slots:
     void testDuplicateRegister();
     void testDeregister();
     void testAllocateCommand();
+    void testCoreCommands();
 };
 
 #endif
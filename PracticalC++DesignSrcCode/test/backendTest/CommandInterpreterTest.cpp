@@ -24,6 +24,7 @@ import pdCalc_userInterface;
 import pdCalc_commandDispatcher;
 
 #include <cmath>
+#include <format>
 #include <iostream>
 #include <string_view>
 
@@ -157,3 +158,215 @@ void CommandInterpreterTest::testCommandInterpreter()
     return;
 }
 
+void CommandInterpreterTest::testMultiStepUndoRedo()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::RegisterCoreCommands(ui);
+
+    for(auto i = 1; i <= 100; ++i)
+        ci.commandEntered( std::to_string(i) );
+
+    ci.commandEntered("goto:10");
+    QVERIFY( pdCalc::Stack::Instance().size() == 10 );
+    QCOMPARE( ui.top(), 10.0 );
+
+    ci.commandEntered("undo:3");
+    QCOMPARE( ui.top(), 7.0 );
+
+    ci.commandEntered("redo:50");
+    QCOMPARE( ui.top(), 57.0 );
+
+    ci.commandEntered("redo:500");
+    QCOMPARE( ui.top(), 100.0 );
+
+    ci.commandEntered("undo:x");
+    QCOMPARE( ui.getLastMessage(), string{"Command undo:x needs a nonnegative integer count"} );
+
+    ci.commandEntered("goto:-1");
+    QCOMPARE( ui.getLastMessage(), string{"Command goto:-1 needs a nonnegative integer count"} );
+    QCOMPARE( ui.top(), 100.0 );
+
+    ci.commandEntered("goto:0");
+    QVERIFY( pdCalc::Stack::Instance().size() == 0 );
+
+    ci.commandEntered("redo");
+    QCOMPARE( ui.top(), 1.0 );
+
+    pdCalc::Stack::Instance().clear();
+
+    return;
+}
+
+void CommandInterpreterTest::testStats()
+{
+#ifdef PDCALC_STATS
+    using pdCalc::Stats;
+
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::RegisterCoreCommands(ui);
+
+    auto& stats = Stats::Instance();
+    stats.clear();
+
+    ci.commandEntered("1");
+    ci.commandEntered("+");
+    ci.commandEntered("2");
+    ci.commandEntered("*");
+    ci.commandEntered("undo");
+    ci.commandEntered("redo");
+    ci.commandEntered("3");
+    ci.commandEntered("undo:x");
+    ci.commandEntered("nonsense");
+    ci.commandEntered("goto:1");
+
+    QCOMPARE( stats.counter(Stats::Counter::Tokens), uint64_t{10} );
+    QCOMPARE( stats.counter(Stats::Counter::ParseFailures), uint64_t{2} );
+    QCOMPARE( stats.counter(Stats::Counter::PreconditionFailures), uint64_t{1} );
+    QCOMPARE( stats.undoDepth(), size_t{1} );
+    QCOMPARE( stats.maxUndoDepth(), size_t{4} );
+
+    QCOMPARE( stats.latency(Stats::Operation::Interpret, "number").count(), uint64_t{3} );
+    QCOMPARE( stats.latency(Stats::Operation::Interpret, "+").count(), uint64_t{1} );
+    QCOMPARE( stats.latency(Stats::Operation::Interpret, "undo:n").count(), uint64_t{1} );
+    QCOMPARE( stats.latency(Stats::Operation::Interpret, "goto:k").count(), uint64_t{1} );
+    QCOMPARE( stats.latency(Stats::Operation::Interpret, "nonsense").count(), uint64_t{0} );
+
+    // the CommandManager names the commands it executes, undoes, and redoes
+    QCOMPARE( stats.latency(Stats::Operation::Execute, "number").count(), uint64_t{3} );
+    QCOMPARE( stats.latency(Stats::Operation::Execute, "*").count(), uint64_t{1} );
+    QCOMPARE( stats.latency(Stats::Operation::Redo, "*").count(), uint64_t{1} );
+
+    // goto may restore a checkpoint instead of undoing commands one by one
+    QVERIFY( stats.latency(Stats::Operation::Undo, "*").count() >= 1 );
+
+    ci.commandEntered("stats");
+    QVERIFY( ui.getLastMessage().find("precondition_failures: 1") != string::npos );
+
+    stats.clear();
+    pdCalc::Stack::Instance().clear();
+#else
+    QSKIP("pdCalc is built without statistics");
+#endif
+
+    return;
+}
+
+void CommandInterpreterTest::testAllocationBudgets()
+{
+#ifdef PDCALC_ALLOC_STATS
+    using pdCalc::Stats;
+    using pdCalc::Allocations;
+
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::RegisterCoreCommands(ui);
+
+    // the first commands make what later commands reuse, such as the expression
+    // numbers are matched with
+    ci.commandEntered("1");
+    ci.commandEntered("1");
+    ci.commandEntered("+");
+
+    auto& stats = Stats::Instance();
+    stats.clear();
+
+    const int n = 100;
+    for(int i = 0; i < n; ++i)
+    {
+        ci.commandEntered("1");
+        ci.commandEntered("+");
+    }
+
+    cout << stats.allocationReport() << endl;
+
+    // The budgets, in allocations per command, are what the commands make now (the
+    // interpreter's share includes the amortized growth of the undo stack): an
+    // EnterNumber is made, and matching a number allocates the regex's state; an Add
+    // is cloned from the factory's prototype. Lower them when allocations are
+    // removed.
+    struct Budget
+    {
+        const char* command;
+        Allocations::Stage stage;
+        double allocations;
+    };
+
+    const Budget budgets[] = {
+        {"number", Allocations::Stage::Interpret, 1.5},
+        {"number", Allocations::Stage::ParseNumber, 3},
+        {"number", Allocations::Stage::Clone, 0},
+        {"number", Allocations::Stage::Execute, 0},
+        {"number", Allocations::Stage::Notify, 0},
+        {"+", Allocations::Stage::Interpret, 0.5},
+        {"+", Allocations::Stage::ParseNumber, 0},
+        {"+", Allocations::Stage::Clone, 1},
+        {"+", Allocations::Stage::Execute, 0},
+        {"+", Allocations::Stage::Notify, 0}
+    };
+
+    for(const auto& b : budgets)
+    {
+        auto a = stats.allocations(b.command);
+        QVERIFY(a);
+        QCOMPARE( a->commands, uint64_t{n} );
+
+        const double perCommand = static_cast<double>( a->stages[static_cast<int>(b.stage)].allocations ) / n;
+        QVERIFY2( perCommand <= b.allocations, std::format("{} makes {} allocations per command in {}, over its budget of {}",
+            b.command, perCommand, Allocations::StageNames[static_cast<int>(b.stage)], b.allocations).c_str() );
+    }
+
+    stats.clear();
+    pdCalc::Stack::Instance().clear();
+#else
+    QSKIP("pdCalc is built without allocation statistics");
+#endif
+
+    return;
+}
+
+void CommandInterpreterTest::testMem()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::RegisterCoreCommands(ui);
+
+    for(auto i = 1; i <= 100; ++i)
+        ci.commandEntered( std::to_string(i) );
+    ci.commandEntered("clear");
+    ci.commandEntered("undo");
+
+    ci.addFootprint("extra", []{ return size_t{1000}; });
+    ci.commandEntered("mem");
+
+    const auto& m = ui.getLastMessage();
+    QVERIFY( m.find("stack: 100 elements") != string::npos );
+    QVERIFY( m.find("history: 100 undo, 1 redo") != string::npos );
+    QVERIFY( m.find("extra: 1000 bytes") != string::npos );
+    QVERIFY( m.find("total: ") != string::npos );
+    QVERIFY( m.find("history limit") == string::npos );
+
+    // the limit trims the oldest entries but leaves the stack alone
+    ci.setMemoryLimit(2048);
+    QVERIFY( ci.footprint() <= 2048 );
+    QVERIFY( pdCalc::Stack::Instance().size() == 100 );
+
+    ci.commandEntered("mem");
+    QVERIFY( ui.getLastMessage().find("history limit: 2048 bytes") != string::npos );
+
+    ci.commandEntered("redo");
+    QVERIFY( pdCalc::Stack::Instance().size() == 0 );
+
+    pdCalc::Stack::Instance().clear();
+
+    return;
+}
@@ -32,6 +32,10 @@ class CommandInterpreterTest : public QObject
 
 private slots:
     void testCommandInterpreter();
+    void testMultiStepUndoRedo();
+    void testStats();
+    void testAllocationBudgets();
+    void testMem();
 };
 
 #endif
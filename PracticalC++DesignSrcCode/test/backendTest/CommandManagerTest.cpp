@@ -20,15 +20,21 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <iostream>
+#include <any>
 
 import pdCalc_commandDispatcher;
 import pdCalc_command;
+import pdCalc_stack;
+import pdCalc_utilities;
 
 using namespace pdCalc;
 using std::cout;
 using std::endl;
 using std::string;
+using std::vector;
+using std::unique_ptr;
 
 namespace {
 
@@ -319,6 +325,183 @@ void ignoreError(CommandManager::UndoRedoStrategy st)
     return;
 }
 
+vector<double> stackContents()
+{
+    Stack& s = Stack::Instance();
+    return s.getElements( s.size() );
+}
+
+class ChangeCounter : public Observer
+{
+public:
+    ChangeCounter() : Observer{"ChangeCounter"}, count_{0} { }
+    unsigned int count() const { return count_; }
+    void reset() { count_ = 0; }
+
+private:
+    void notifyImpl(const std::any&) override { ++count_; }
+
+    unsigned int count_;
+};
+
+// pushes a counter that lives outside the stack, so the command cannot be replayed
+// from a stack checkpoint
+class TestOpaqueCommand : public Command
+{
+public:
+    explicit TestOpaqueCommand(int& counter) : counter_{counter} { }
+
+private:
+    void executeImpl() noexcept override { Stack::Instance().push(++counter_); }
+    void undoImpl() noexcept override { Stack::Instance().pop(); --counter_; }
+    Command* cloneImpl() const noexcept override { return nullptr; }
+    const char* helpMessageImpl() const noexcept override { return ""; }
+    bool replayableImpl() const noexcept override { return false; }
+
+    int& counter_;
+};
+
+void testJump(CommandManager::UndoRedoStrategy st)
+{
+    Stack::Instance().clear();
+    CommandManager cm(st, 8);
+
+    // long enough for several checkpoints
+    vector<vector<double>> states{ stackContents() };
+    for(auto i = 0; i < 300; ++i)
+    {
+        if(i % 3 == 2)
+            cm.executeCommand( MakeCommandPtr<Add>() );
+        else
+            cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+
+        states.push_back( stackContents() );
+    }
+
+    auto raw = new ChangeCounter;
+    Stack::Instance().attach( Stack::StackChanged(), unique_ptr<Observer>{raw} );
+
+    auto check = [&](size_t position)
+    {
+        QVERIFY( cm.getUndoSize() == position );
+        QVERIFY( cm.getUndoSize() + cm.getRedoSize() == states.size() - 1 );
+        QCOMPARE( stackContents(), states[position] );
+        QCOMPARE( raw->count(), 1u );
+        raw->reset();
+    };
+
+    cm.jumpTo(10);
+    check(10);
+
+    cm.jumpTo(299);
+    check(299);
+
+    cm.undo(100);
+    check(199);
+
+    cm.undo(3);
+    check(196);
+
+    cm.redo(50);
+    check(246);
+
+    cm.redo(1000);
+    check(300);
+
+    cm.undo(1000);
+    check(0);
+
+    cm.jumpTo(2000);
+    check(300);
+
+    // a jump to the current position changes nothing
+    cm.jumpTo(300);
+    QCOMPARE( raw->count(), 0u );
+
+    // single steps still work after a jump
+    cm.jumpTo(150);
+    check(150);
+    cm.undo();
+    QCOMPARE( stackContents(), states[149] );
+    cm.redo();
+    cm.redo();
+    QCOMPARE( stackContents(), states[151] );
+    raw->reset();
+
+    // branching discards checkpoints beyond the branch
+    cm.undo(51);
+    check(100);
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(-1.0) );
+    auto branched = stackContents();
+    cm.jumpTo(0);
+    QCOMPARE( stackContents(), states[0] );
+    cm.jumpTo(101);
+    QCOMPARE( stackContents(), branched );
+    cm.jumpTo(100);
+    QCOMPARE( stackContents(), states[100] );
+
+    Stack::Instance().detach(Stack::StackChanged(), "ChangeCounter");
+    Stack::Instance().clear();
+
+    return;
+}
+
+// runs core commands through cm and checks the stack after every undo and redo
+void testCoreCommands(CommandManager& cm)
+{
+    Stack::Instance().clear();
+
+    vector<vector<double>> states{ stackContents() };
+    auto execute = [&](CommandPtr c)
+    {
+        cm.executeCommand( std::move(c) );
+        states.push_back( stackContents() );
+    };
+
+    execute( MakeCommandPtr<EnterNumber>(3.0) );
+    execute( MakeCommandPtr<EnterNumber>(4.0) );
+    execute( MakeCommandPtr<Add>() );
+    execute( MakeCommandPtr<Duplicate>() );
+    execute( MakeCommandPtr<Sine>() );
+    execute( MakeCommandPtr<SwapTopOfStack>() );
+    execute( MakeCommandPtr<DropTopOfStack>() );
+    execute( MakeCommandPtr<EnterNumber>(-2.5) );
+    execute( MakeCommandPtr<ClearStack>() );
+    execute( MakeCommandPtr<EnterNumber>(8.0) );
+
+    QVERIFY( cm.getUndoSize() == states.size() - 1 );
+
+    for(auto i = states.size() - 1; i > 0; --i)
+    {
+        cm.undo();
+        QCOMPARE( stackContents(), states[i - 1] );
+    }
+
+    QVERIFY( cm.getUndoSize() == 0 );
+    QVERIFY( cm.getRedoSize() == states.size() - 1 );
+
+    for(auto i = 1u; i < states.size(); ++i)
+    {
+        cm.redo();
+        QCOMPARE( stackContents(), states[i] );
+    }
+
+    // branch from the middle of a spilled history
+    for(auto i = 0u; i < 6; ++i) cm.undo();
+    QCOMPARE( stackContents(), states[4] );
+
+    cm.executeCommand( MakeCommandPtr<Negate>() );
+    QVERIFY( cm.getUndoSize() == 5 );
+    QVERIFY( cm.getRedoSize() == 0 );
+
+    cm.undo();
+    QCOMPARE( stackContents(), states[4] );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
 }
 
 void CommandManagerTest::testExecuteStackStrategy()
@@ -410,3 +593,463 @@ void CommandManagerTest::ignoreErrorListStrategyVector()
 {
     ignoreError(CommandManager::UndoRedoStrategy::ListStrategyVector);
 }
+
+void CommandManagerTest::testExecuteSpillStrategy()
+{
+    testExecute(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testUndoSpillStrategy()
+{
+    testUndo(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testRedoSpillStrategy()
+{
+    testRedo(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testRedoStackFlushSpillStrategy()
+{
+    testRedoStackFlush(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testResourceCleanupSpillStrategy()
+{
+    testResourceCleanup(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::ignoreErrorSpillStrategy()
+{
+    ignoreError(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testSpilledCoreCommands()
+{
+    // a window of two forces nearly every entry through the log
+    CommandManager cm(CommandManager::UndoRedoStrategy::SpillStrategy, 2);
+    testCoreCommands(cm);
+
+    return;
+}
+
+void CommandManagerTest::testExecuteFlatStrategy()
+{
+    testExecute(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testUndoFlatStrategy()
+{
+    testUndo(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testRedoFlatStrategy()
+{
+    testRedo(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testRedoStackFlushFlatStrategy()
+{
+    testRedoStackFlush(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testResourceCleanupFlatStrategy()
+{
+    testResourceCleanup(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::ignoreErrorFlatStrategy()
+{
+    ignoreError(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testFlatCoreCommands()
+{
+    CommandManager cm(CommandManager::UndoRedoStrategy::FlatStrategy);
+    testCoreCommands(cm);
+
+    // records of resident commands interleaved with core commands must truncate together
+    CommandManager mixed(CommandManager::UndoRedoStrategy::FlatStrategy);
+    TestCommand* raw = new TestCommand;
+    bool deleted = false;
+    mixed.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+    mixed.executeCommand( MakeCommandPtr(raw) );
+    mixed.executeCommand( MakeCommandPtr<EnterNumber>(2.0) );
+    mixed.executeCommand( MakeCommandPtr<TestDeleteCommand>(deleted) );
+    mixed.executeCommand( MakeCommandPtr<EnterNumber>(3.0) );
+
+    mixed.undo();
+    mixed.undo();
+    mixed.undo();
+    QCOMPARE( stackContents(), vector<double>{1.0} );
+    QCOMPARE( raw->getUndoCount(), 0u );
+
+    mixed.executeCommand( MakeCommandPtr<EnterNumber>(4.0) );
+    QCOMPARE( deleted, true );
+    QVERIFY( mixed.getRedoSize() == 0 );
+    QCOMPARE( stackContents(), (vector<double>{4.0, 1.0}) );
+
+    mixed.undo();
+    mixed.undo();
+    QCOMPARE( raw->getUndoCount(), 1u );
+    mixed.redo();
+    mixed.redo();
+    QCOMPARE( raw->getExecuteCount(), 2u );
+    QCOMPARE( stackContents(), (vector<double>{4.0, 1.0}) );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+void CommandManagerTest::testSpilledResidentCommands()
+{
+    TestCommand* raw1 = new TestCommand;
+    TestCommand* raw2 = new TestCommand;
+    bool deleted = false;
+
+    // commands that cannot be serialized must stay in memory, in order
+    CommandManager* cm = new CommandManager(CommandManager::UndoRedoStrategy::SpillStrategy, 1);
+    cm->executeCommand( MakeCommandPtr(raw1) );
+    cm->executeCommand( MakeCommandPtr<TestDeleteCommand>(deleted) );
+    cm->executeCommand( MakeCommandPtr(raw2) );
+
+    cm->undo();
+    cm->undo();
+    cm->undo();
+    QCOMPARE( raw1->getUndoCount(), 1u );
+    QCOMPARE( raw2->getUndoCount(), 1u );
+
+    cm->redo();
+    cm->redo();
+    cm->redo();
+    QCOMPARE( raw1->getExecuteCount(), 2u );
+    QCOMPARE( raw2->getExecuteCount(), 2u );
+    QCOMPARE( deleted, false );
+
+    delete cm;
+
+    QCOMPARE( deleted, true );
+
+    return;
+}
+
+void CommandManagerTest::testJumpStackStrategy()
+{
+    testJump(CommandManager::UndoRedoStrategy::StackStrategy);
+}
+
+void CommandManagerTest::testJumpListStrategy()
+{
+    testJump(CommandManager::UndoRedoStrategy::ListStrategy);
+}
+
+void CommandManagerTest::testJumpListStrategyVector()
+{
+    testJump(CommandManager::UndoRedoStrategy::ListStrategyVector);
+}
+
+void CommandManagerTest::testJumpSpillStrategy()
+{
+    testJump(CommandManager::UndoRedoStrategy::SpillStrategy);
+}
+
+void CommandManagerTest::testJumpFlatStrategy()
+{
+    testJump(CommandManager::UndoRedoStrategy::FlatStrategy);
+}
+
+void CommandManagerTest::testJumpAcrossBarrier()
+{
+    Stack::Instance().clear();
+    CommandManager cm;
+    int counter = 0;
+
+    for(auto i = 0; i < 100; ++i)
+        cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+
+    cm.executeCommand( MakeCommandPtr<TestOpaqueCommand>(counter) );
+
+    for(auto i = 0; i < 100; ++i)
+        cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+
+    QCOMPARE( counter, 1 );
+    auto end = stackContents();
+
+    // jumps across the opaque command must undo and redo it
+    cm.jumpTo(50);
+    QCOMPARE( counter, 0 );
+    QVERIFY( Stack::Instance().size() == 50 );
+
+    cm.jumpTo(201);
+    QCOMPARE( counter, 1 );
+    QCOMPARE( stackContents(), end );
+
+    // jumps beyond the opaque command need not touch it
+    cm.jumpTo(110);
+    cm.jumpTo(190);
+    QCOMPARE( counter, 1 );
+    QVERIFY( Stack::Instance().size() == 190 );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+namespace {
+
+// rebinds every Add of the history to a Subtract with the same undo state
+void testRebind(CommandManager::UndoRedoStrategy st)
+{
+    Stack::Instance().clear();
+    CommandManager cm(st, 1);
+
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(3.0) );
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(4.0) );
+    cm.executeCommand( MakeCommandPtr<Add>() );
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(5.0) );
+    cm.executeCommand( MakeCommandPtr<Add>() );
+    cm.undo(2);
+
+    size_t rebound = 0;
+    cm.rebindHistory([&](const Command& c)
+    {
+        vector<double> operands;
+        if( !dynamic_cast<const Add*>(&c) || !c.serialize(operands) ) return MakeCommandPtr(nullptr);
+
+        auto s = MakeCommandPtr<Subtract>();
+        s->deserialize(operands);
+        ++rebound;
+
+        return s;
+    });
+
+    QVERIFY(rebound > 0);
+    QVERIFY( cm.getUndoSize() == 3 && cm.getRedoSize() == 2 );
+    QCOMPARE( stackContents(), (vector<double>{7.0}) );
+
+    // undo restores what the Add took, and redo now subtracts
+    cm.undo();
+    QCOMPARE( stackContents(), (vector<double>{4.0, 3.0}) );
+    cm.redo(4);
+    QCOMPARE( stackContents(), (vector<double>{-6.0}) );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+}
+
+void CommandManagerTest::testRebindHistory()
+{
+    testRebind(CommandManager::UndoRedoStrategy::StackStrategy);
+    testRebind(CommandManager::UndoRedoStrategy::ListStrategy);
+    testRebind(CommandManager::UndoRedoStrategy::ListStrategyVector);
+    testRebind(CommandManager::UndoRedoStrategy::SpillStrategy);
+    testRebind(CommandManager::UndoRedoStrategy::FlatStrategy);
+
+    return;
+}
+
+void CommandManagerTest::testFootprint()
+{
+    Stack::Instance().clear();
+    CommandManager cm;
+
+    for(auto i = 0; i < 1000; ++i)
+        cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+
+    QVERIFY( Stack::Instance().footprint() >= 1000 * sizeof(double) );
+
+    // the commands alone, without the checkpoints taken along the way
+    auto commands = [&]{ return cm.footprint() - cm.checkpointFootprint(); };
+
+    // a clear holds the cleared stack
+    auto before = commands();
+    auto clear = MakeCommandPtr<ClearStack>();
+    auto empty = clear->footprint();
+    cm.executeCommand( std::move(clear) );
+    QVERIFY( commands() >= before + empty + 1000 * sizeof(double) );
+
+    // flushing the redo stack releases it
+    cm.undo();
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+    QVERIFY( commands() < before + empty + 1000 * sizeof(double) );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+namespace {
+
+// trims a history mixing core commands with resident ones, from the middle of it
+void testTrim(CommandManager::UndoRedoStrategy st)
+{
+    Stack::Instance().clear();
+    CommandManager cm(st, 4);
+
+    bool deleted1 = false;
+    bool deleted2 = false;
+    vector<vector<double>> states{ stackContents() };
+    for(auto i = 0; i < 100; ++i)
+    {
+        if(i == 20)
+            cm.executeCommand( MakeCommandPtr<TestDeleteCommand>(deleted1) );
+        else if(i == 60)
+            cm.executeCommand( MakeCommandPtr<TestDeleteCommand>(deleted2) );
+        else if(i % 3 == 2)
+            cm.executeCommand( MakeCommandPtr<Add>() );
+        else
+            cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+
+        states.push_back( stackContents() );
+    }
+
+    cm.undo(10);
+    cm.trimHistory(30);
+    QVERIFY( cm.getUndoSize() == 60 );
+    QVERIFY( cm.getRedoSize() == 10 );
+    QCOMPARE( stackContents(), states[90] );
+    QCOMPARE( deleted1, true );
+    QCOMPARE( deleted2, false );
+
+    // positions now count from the oldest entry kept
+    cm.jumpTo(0);
+    QCOMPARE( stackContents(), states[30] );
+    cm.jumpTo(35);
+    QCOMPARE( stackContents(), states[65] );
+    cm.redo(1000);
+    QCOMPARE( stackContents(), states[100] );
+
+    for(auto i = 70; i > 0; --i)
+    {
+        cm.undo();
+        QCOMPARE( stackContents(), states[i + 29] );
+    }
+
+    // trimming every undo entry leaves the redo stack
+    cm.redo(20);
+    cm.trimHistory(1000);
+    QVERIFY( cm.getUndoSize() == 0 );
+    QVERIFY( cm.getRedoSize() == 50 );
+    QCOMPARE( deleted2, false );
+    cm.redo(50);
+    QCOMPARE( stackContents(), states[100] );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+// keeps a history of additions, whose stack stays small, under a limit
+void testLimit(CommandManager::UndoRedoStrategy st)
+{
+    constexpr size_t Limit = 64 * 1024;
+    constexpr auto N = 10000u;
+
+    Stack::Instance().clear();
+    CommandManager cm(st);
+    cm.setMemoryLimit(Limit);
+
+    vector<vector<double>> states{ stackContents() };
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(0.0) );
+    states.push_back( stackContents() );
+    for(auto i = 1u; i < N / 2; ++i)
+    {
+        cm.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+        states.push_back( stackContents() );
+        cm.executeCommand( MakeCommandPtr<Add>() );
+        states.push_back( stackContents() );
+    }
+
+    const auto undoSize = cm.getUndoSize();
+    QVERIFY( undoSize > 0 && undoSize < N - 1 );
+    QCOMPARE( stackContents(), (vector<double>{N / 2 - 1.0}) );
+
+    // the limit is soft, but measuring the history again trims it under the limit
+    cm.setMemoryLimit(Limit);
+    QVERIFY( cm.footprint() <= Limit );
+
+    const auto oldest = N - 1 - cm.getUndoSize();
+    cm.jumpTo(0);
+    QCOMPARE( stackContents(), states[oldest] );
+    cm.redo(N);
+    QCOMPARE( stackContents(), states[N - 1] );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+}
+
+void CommandManagerTest::testTrimHistory()
+{
+    testTrim(CommandManager::UndoRedoStrategy::StackStrategy);
+    testTrim(CommandManager::UndoRedoStrategy::ListStrategy);
+    testTrim(CommandManager::UndoRedoStrategy::ListStrategyVector);
+    testTrim(CommandManager::UndoRedoStrategy::SpillStrategy);
+    testTrim(CommandManager::UndoRedoStrategy::FlatStrategy);
+
+    return;
+}
+
+// trims the spilled history, whose log keeps the entries left where they were, and
+// then grows it past the space it had, which moves them down
+void CommandManagerTest::testTrimSpilledLog()
+{
+    constexpr auto N = 60000u;
+
+    // the stack after m commands: 0, then alternately 1 and +
+    auto state = [](size_t m)
+    {
+        const double k = static_cast<double>(m / 2);
+        return m % 2 == 1 ? vector<double>{k} : vector<double>{1.0, k - 1};
+    };
+
+    Stack::Instance().clear();
+    CommandManager cm(CommandManager::UndoRedoStrategy::SpillStrategy, 16);
+    auto execute = [&](size_t m)
+    {
+        if(m == 0)
+            cm.executeCommand( MakeCommandPtr<EnterNumber>(0.0) );
+        else if(m % 2 == 1)
+            cm.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+        else
+            cm.executeCommand( MakeCommandPtr<Add>() );
+    };
+
+    for(auto m = 0u; m < N; ++m) execute(m);
+    cm.trimHistory(N / 2);
+    QVERIFY( cm.getUndoSize() == N / 2 );
+    cm.jumpTo(0);
+    QCOMPARE( stackContents(), state(N / 2) );
+    cm.redo(N);
+    QCOMPARE( stackContents(), state(N) );
+
+    for(auto m = N; m < 2 * N; ++m) execute(m);
+    QVERIFY( cm.getUndoSize() == N + N / 2 );
+    cm.jumpTo(0);
+    QCOMPARE( stackContents(), state(N / 2) );
+    cm.jumpTo(N);
+    QCOMPARE( stackContents(), state(N + N / 2) );
+    cm.redo(N);
+    QCOMPARE( stackContents(), state(2 * N) );
+
+    Stack::Instance().clear();
+
+    return;
+}
+
+void CommandManagerTest::testMemoryLimit()
+{
+    testLimit(CommandManager::UndoRedoStrategy::StackStrategy);
+    testLimit(CommandManager::UndoRedoStrategy::ListStrategy);
+    testLimit(CommandManager::UndoRedoStrategy::ListStrategyVector);
+    testLimit(CommandManager::UndoRedoStrategy::SpillStrategy);
+    testLimit(CommandManager::UndoRedoStrategy::FlatStrategy);
+
+    return;
+}
@@ -45,6 +45,37 @@ private slots:
     void testRedoStackFlushListStrategyVector();
     void testResourceCleanupListStrategyVector();
     void ignoreErrorListStrategyVector();
+
+    void testExecuteSpillStrategy();
+    void testUndoSpillStrategy();
+    void testRedoSpillStrategy();
+    void testRedoStackFlushSpillStrategy();
+    void testResourceCleanupSpillStrategy();
+    void ignoreErrorSpillStrategy();
+    void testSpilledCoreCommands();
+    void testSpilledResidentCommands();
+
+    void testExecuteFlatStrategy();
+    void testUndoFlatStrategy();
+    void testRedoFlatStrategy();
+    void testRedoStackFlushFlatStrategy();
+    void testResourceCleanupFlatStrategy();
+    void ignoreErrorFlatStrategy();
+    void testFlatCoreCommands();
+
+    void testJumpStackStrategy();
+    void testJumpListStrategy();
+    void testJumpListStrategyVector();
+    void testJumpSpillStrategy();
+    void testJumpFlatStrategy();
+    void testJumpAcrossBarrier();
+
+    void testRebindHistory();
+
+    void testFootprint();
+    void testTrimHistory();
+    void testMemoryLimit();
+    void testTrimSpilledLog();
 };
 
 #endif
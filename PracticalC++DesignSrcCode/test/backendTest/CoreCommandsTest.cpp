@@ -23,6 +23,7 @@
 #include <memory>
 
 import pdCalc_commandDispatcher;
+import pdCalc_command;
 import pdCalc_utilities;
 import pdCalc_stack;
 
@@ -1137,3 +1138,161 @@ void CoreCommandsTest::testDuplicate()
     QCOMPARE(v[0], num);
     QCOMPARE(v[1], num);
 }
+
+namespace {
+
+void square(const double* in[], double* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = in[0][i] * in[0][i];
+}
+
+void difference(const double* in[], double* out, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) out[i] = in[0][i] - in[1][i];
+}
+
+}
+
+void CoreCommandsTest::testKernelCommandPreconditions()
+{
+    pdCalc::Stack& stack = getCheckedStack();
+    pdCalc::KernelCommand k{"difference", difference, 2, nullptr};
+    pdCalc::Command& c = k;
+
+    try
+    {
+        c.execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception&)
+    {
+        QVERIFY(true);
+    }
+
+    stack.push(1.);
+    stack.push(2.);
+    stack.push(3.);
+    try
+    {
+        c.execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception&)
+    {
+        QVERIFY(true);
+    }
+
+    stack.push(4.);
+    try
+    {
+        c.execute();
+        QVERIFY(true);
+    }
+    catch(pdCalc::Exception&)
+    {
+        QVERIFY(false);
+    }
+
+    return;
+}
+
+void CoreCommandsTest::testKernelCommand()
+{
+    pdCalc::Stack& stack = getCheckedStack();
+    for(double d : {1., 2., 3.}) stack.push(d);
+
+    pdCalc::KernelCommand sq{"square", square, 1, nullptr};
+    QCOMPARE( string{sq.helpMessage()}, string{"square"} );
+
+    pdCalc::Command& c = sq;
+    c.execute();
+    QCOMPARE( stack.contents(), (vector<double>{1., 4., 9.}) );
+
+    c.undo();
+    QCOMPARE( stack.contents(), (vector<double>{1., 2., 3.}) );
+
+    // the bottom half less the top half
+    stack.push(1.);
+    pdCalc::KernelCommand diff{"difference", difference, 2, nullptr};
+    diff.execute();
+    QCOMPARE( stack.contents(), (vector<double>{-2., 1.}) );
+
+    // the undo state survives serialization into a clone
+    vector<double> operands;
+    QVERIFY( diff.serialize(operands) );
+    auto clone = pdCalc::MakeCommandPtr( diff.clone() );
+    clone->deserialize(operands);
+    clone->undo();
+    QCOMPARE( stack.contents(), (vector<double>{1., 2., 3., 1.}) );
+
+    return;
+}
+
+namespace {
+
+double half(double top) { return top / 2.; }
+const char* positive(double top) { return top > 0. ? nullptr : "Not positive"; }
+
+double hypotenuse(double next, double top) { return std::hypot(next, top); }
+const char* nonnegative(double next, double top) { return next >= 0. && top >= 0. ? nullptr : "Negative operand"; }
+
+}
+
+void CoreCommandsTest::testUnaryFunctionCommand()
+{
+    pdCalc::UnaryFunctionCommand h{"half", half, positive};
+    testUnaryCommand(h, 3., 1.5);
+    pdCalc::Stack& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    testUnaryCommandPreconditions(h);
+    QCOMPARE( string{h.helpMessage()}, string{"half"} );
+
+    // the precondition is checked after the stack size
+    stack.clear();
+    stack.push(-1.);
+    try
+    {
+        h.execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), string{"Not positive"} );
+    }
+
+    // without a precondition, only the stack size is checked
+    pdCalc::UnaryFunctionCommand unchecked{"half", half, nullptr};
+    auto clone = pdCalc::MakeCommandPtr( unchecked.clone() );
+    clone->execute();
+    QCOMPARE( stackTop(), -0.5 );
+
+    return;
+}
+
+void CoreCommandsTest::testBinaryFunctionCommand()
+{
+    pdCalc::BinaryFunctionCommand h{"hypotenuse", hypotenuse, nonnegative};
+    testBinaryCommand(h, 3., 4., 5.);
+    pdCalc::Stack& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    testBinaryCommandPreconditions(h);
+
+    // the operands are passed as next and top
+    stack.clear();
+    stack.push(-2.);
+    stack.push(2.);
+    try
+    {
+        h.execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), string{"Negative operand"} );
+    }
+
+    auto clone = pdCalc::MakeCommandPtr( h.clone() );
+    QCOMPARE( string{clone->helpMessage()}, string{"hypotenuse"} );
+
+    return;
+}
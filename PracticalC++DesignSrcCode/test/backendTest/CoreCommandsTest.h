@@ -83,6 +83,10 @@ private slots:
     void testDuplicatePreconditions();
     void testDuplicateClone();
     void testDuplicate();
+    void testKernelCommandPreconditions();
+    void testKernelCommand();
+    void testUnaryFunctionCommand();
+    void testBinaryFunctionCommand();
 
 private:
     pdCalc::Stack& getCheckedStack();
@@ -0,0 +1,351 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "JournalTest.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <format>
+#include <cstddef>
+#include <span>
+
+import pdCalc_utilities;
+import pdCalc_stack;
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+
+using std::vector;
+using std::string;
+using std::string_view;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class TestInterface : public pdCalc::UserInterface
+{
+public:
+    TestInterface() { }
+    void postMessage(string_view) override { }
+    void stackChanged() override { }
+};
+
+string journalFile()
+{
+    return ( fs::temp_directory_path() / "pdCalcJournalTest.pdj" ).string();
+}
+
+vector<string> recover(const string& file)
+{
+    vector<string> commands;
+    pdCalc::Journal::Recover(file, [&commands](const string& c){ commands.push_back(c); },
+        [&commands](std::span<const std::byte> s){ commands.push_back( std::format("session of {} bytes", s.size()) ); });
+
+    return commands;
+}
+
+}
+
+void JournalTest::testRoundTrip()
+{
+    auto file = journalFile();
+
+    {
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        journal.command("+");
+        journal.number(0.1);
+        journal.number(-1.0 / 3.0);
+        journal.undo(1);
+        journal.undo(3);
+        journal.redo(1);
+        journal.redo(2);
+        journal.jumpTo(5);
+        journal.command("proc:hypotenuse");
+        const std::byte session[24] = {};
+        journal.session(session);
+    }
+
+    vector<string> expected{"+", "0.1", "-0.3333333333333333", "undo", "undo:3", "redo", "redo:2",
+        "goto:5", "proc:hypotenuse", "session of 24 bytes"};
+    QCOMPARE( recover(file), expected );
+
+    // appending continues the journal, and every sync policy writes the records
+    for(auto policy : {pdCalc::Journal::SyncPolicy::None, pdCalc::Journal::SyncPolicy::Always})
+    {
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Append, policy};
+        journal.command("swap");
+        journal.flush();
+        expected.push_back("swap");
+        QCOMPARE( recover(file), expected );
+    }
+
+    fs::remove(file);
+
+    return;
+}
+
+void JournalTest::testTornTail()
+{
+    auto file = journalFile();
+
+    {
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        journal.number(1.0);
+        journal.number(2.0);
+        journal.command("+");
+    }
+
+    // a crash in the middle of writing the last record
+    const auto size = fs::file_size(file);
+    fs::resize_file(file, size - 3);
+
+    QCOMPARE( recover(file), (vector<string>{"1", "2"}) );
+    QVERIFY( fs::file_size(file) < size - 3 );
+
+    {
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Append};
+        journal.command("-");
+    }
+
+    QCOMPARE( recover(file), (vector<string>{"1", "2", "-"}) );
+
+    // a corrupted record ends the journal
+    {
+        std::fstream fs{file, std::ios::in | std::ios::out | std::ios::binary};
+        fs.seekp(-2, std::ios::end);
+        fs.put('x');
+    }
+
+    QCOMPARE( recover(file), (vector<string>{"1", "2"}) );
+
+    fs::remove(file);
+
+    return;
+}
+
+void JournalTest::testNotAJournal()
+{
+    auto file = journalFile();
+
+    {
+        std::ofstream ofs{file};
+        ofs << "1 2 +";
+    }
+
+    try
+    {
+        recover(file);
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("{} is not a journal", file) );
+    }
+
+    fs::remove(file);
+
+    return;
+}
+
+void JournalTest::testInterpreterRecovery()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+
+    auto file = journalFile();
+    vector<double> expected;
+
+    {
+        pdCalc::CommandInterpreter ci{ui};
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        ci.setJournal(&journal);
+
+        for( string c : {"0.1", "2", "+", "3", "unknown", "sin", "undo", "1e-300", "swap", "-", "drop",
+            "drop", "drop", "7", "undo:2", "redo", "8", "9", "goto:6"} )
+        {
+            ci.commandEntered(c);
+        }
+
+        expected = pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() );
+    }
+
+    pdCalc::Stack::Instance().clear();
+
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::Journal::Recover(file, [&ci](const string& c){ ci.commandEntered(c); },
+        [&ci](std::span<const std::byte> s){ ci.loadSession(s); });
+
+    QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), expected );
+
+    // the recovered history can be undone past the point of recovery
+    ci.commandEntered("goto:0");
+    QVERIFY( pdCalc::Stack::Instance().size() == 0 );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void JournalTest::testTrimmedRecovery()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+
+    auto file = journalFile();
+    vector<double> expected;
+
+    {
+        // the limit trims the oldest entries, so positions in this history are not
+        // those of the recovered one, which has no limit
+        pdCalc::CommandInterpreter ci{ui};
+        ci.setMemoryLimit(2048);
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        ci.setJournal(&journal);
+
+        for(int i = 0; i < 1000; ++i)
+            ci.commandEntered( std::to_string(i) );
+
+        for( string c : {"goto:10", "redo:3", "undo:1000", "undo", "redo", "goto:5", "+"} )
+            ci.commandEntered(c);
+
+        // goto:5 was counted from the oldest entry kept, well after the fifth number
+        QVERIFY( pdCalc::Stack::Instance().size() > 10 );
+        expected = pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() );
+    }
+
+    pdCalc::Stack::Instance().clear();
+
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::Journal::Recover(file, [&ci](const string& c){ ci.commandEntered(c); },
+        [&ci](std::span<const std::byte> s){ ci.loadSession(s); });
+
+    QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), expected );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void JournalTest::testSessionRecovery()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+
+    auto file = journalFile();
+    auto session = ( fs::temp_directory_path() / "pdCalcJournalTest.pds" ).string();
+    vector<double> expected;
+
+    {
+        pdCalc::CommandInterpreter ci{ui};
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        ci.setJournal(&journal);
+
+        // the session is saved again after it is loaded, as a snapshot would, so
+        // recovery must load the session as it was
+        for( const string& c : vector<string>{"1", "2", "save-session:" + session, "9", "load-session:" + session,
+            "3", "+", "save-session:" + session, "7"} )
+        {
+            ci.commandEntered(c);
+        }
+
+        expected = pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() );
+        QCOMPARE( expected, (vector<double>{7.0, 5.0, 1.0}) );
+    }
+
+    pdCalc::Stack::Instance().clear();
+
+    pdCalc::CommandInterpreter ci{ui};
+    pdCalc::Journal::Recover(file, [&ci](const string& c){ ci.commandEntered(c); },
+        [&ci](std::span<const std::byte> s){ ci.loadSession(s); });
+
+    QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), expected );
+
+    // the loaded history came with the session
+    ci.commandEntered("undo:3");
+    QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), (vector<double>{2.0, 1.0}) );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove(file);
+    fs::remove(session);
+
+    return;
+}
+
+void JournalTest::testProcedureRecovery()
+{
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+
+    auto file = journalFile();
+    // procedures' tokens are lowercased, so the nested procedure's path must be
+    auto dir = fs::temp_directory_path() / "pdcalc-journal-procedures";
+    fs::create_directories(dir);
+    const auto outer = ( dir / "outer" ).string();
+    const auto inner = ( dir / "inner" ).string();
+    std::ofstream{outer} << "2 proc:" << inner << " *\n";
+    std::ofstream{inner} << "3 +\n";
+
+    {
+        pdCalc::CommandInterpreter ci{ui};
+        pdCalc::Journal journal{file, pdCalc::Journal::Mode::Create};
+        ci.setJournal(&journal);
+
+        for( const string& c : vector<string>{"1", "proc:" + outer, "profile", "proc:" + inner} )
+            ci.commandEntered(c);
+
+        QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), (vector<double>{8.0}) );
+    }
+
+    // recovery runs the procedures that ran, however they were edited since
+    std::ofstream{outer} << "100\n";
+    std::ofstream{inner} << "200\n";
+    pdCalc::Stack::Instance().clear();
+
+    {
+        pdCalc::CommandInterpreter ci{ui};
+        QCOMPARE( pdCalc::Journal::Recover(file, [&ci](const string& c){ ci.commandEntered(c); },
+            [&ci](std::span<const std::byte> s){ ci.loadSession(s); }), size_t{3} );
+
+        QCOMPARE( pdCalc::Stack::Instance().getElements( pdCalc::Stack::Instance().size() ), (vector<double>{8.0}) );
+    }
+
+    // the files are read again outside recovery
+    pdCalc::Stack::Instance().clear();
+    pdCalc::CommandInterpreter ci{ui};
+    ci.commandEntered("proc:" + outer);
+    QCOMPARE( pdCalc::Stack::Instance().getElements(1), (vector<double>{100.0}) );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove(file);
+    fs::remove_all(dir);
+
+    return;
+}
@@ -0,0 +1,299 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "PluginHostTest.h"
+#include <string>
+#include <vector>
+#include <format>
+#include <string_view>
+#include <cmath>
+#include <csignal>
+#include <filesystem>
+
+import pdCalc_pluginManagement;
+import pdCalc_utilities;
+import pdCalc_userInterface;
+import pdCalc_command;
+import pdCalc_commandDispatcher;
+import pdCalc_stack;
+
+using std::vector;
+using std::string;
+using std::string_view;
+
+class TestInterface : public pdCalc::UserInterface
+{
+public:
+    TestInterface() { }
+    void postMessage(string_view) override {  }
+    void stackChanged() override { }
+};
+
+void PluginHostTest::testLoading()
+{
+#ifdef POSIX
+    TestInterface ui;
+    pdCalc::PluginLoader loader;
+
+    auto pluginFile = std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE);
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Eager,
+        pdCalc::PluginLoader::Isolation::Process);
+
+    // the plugin is described by its helper, but never loaded into this process
+    QVERIFY( loader.getPlugins().size() == 0 );
+    QVERIFY( loader.getPluginManifest().size() == 1 );
+    QVERIFY( loader.getPluginManifest()[0].commands.size() == 8 );
+    QCOMPARE( loader.getPluginManifest()[0].commands[0].name, string{"sinh"} );
+
+    auto host = loader.getHost(0);
+    QVERIFY(host);
+    QVERIFY( host->processId() > 0 );
+    QVERIFY( host->index("sinh") < host->names().size() );
+    QVERIFY( host->index("notACommand") == host->names().size() );
+#endif
+
+    return;
+}
+
+void PluginHostTest::testCommands()
+{
+#ifdef POSIX
+    TestInterface ui;
+    pdCalc::PluginLoader loader;
+
+    auto pluginFile = std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE);
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Eager,
+        pdCalc::PluginLoader::Isolation::Process);
+    QVERIFY( loader.getPluginManifest().size() == 1 );
+
+    QVERIFY( !loader.makeCommand(0, "notACommand") );
+
+    auto& factory = pdCalc::CommandFactory::Instance();
+    factory.clearAllCommands();
+    factory.registerCommand( "sinh", loader.makeCommand(0, "sinh") );
+    factory.registerCommand( "ln", loader.makeCommand(0, "ln") );
+
+    auto& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    stack.push(2.0);
+    stack.push(0.5);
+
+    pdCalc::CommandManager manager;
+    manager.executeCommand( factory.allocateCommand("sinh") );
+
+    auto contents = stack.contents();
+    QVERIFY( contents.size() == 2 );
+    QCOMPARE( contents[0], 2.0 );
+    QVERIFY( std::abs(contents[1] - std::sinh(0.5)) < 1e-10 );
+
+    manager.undo();
+    contents = stack.contents();
+    QVERIFY( contents.size() == 2 );
+    QCOMPARE( contents[1], 0.5 );
+
+    // the command keeps only the part of the stack it replaced
+    for(int i = 0; i < 100; ++i) stack.push(i);
+    auto sinh = factory.allocateCommand("sinh");
+    sinh->execute();
+    vector<double> operands;
+    QVERIFY( sinh->serialize(operands) );
+    QVERIFY( operands.size() == 4 );
+    QCOMPARE( operands[0], 101.0 );
+    QCOMPARE( operands[1], 1.0 );
+    QCOMPARE( operands[2], 99.0 );
+    sinh->undo();
+    contents = stack.contents();
+    QVERIFY( contents.size() == 102 );
+    QCOMPARE( contents[101], 99.0 );
+    stack.clear();
+    stack.push(2.0);
+    stack.push(0.5);
+
+    // a failing precondition in the helper is reported as in the plugin
+    stack.push(-1.0);
+    auto ln = factory.allocateCommand("ln");
+    try
+    {
+        ln->execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), string{"Imaginary result"} );
+    }
+    QVERIFY( stack.size() == 3 );
+
+    factory.clearAllCommands();
+    stack.clear();
+#endif
+
+    return;
+}
+
+void PluginHostTest::testRun()
+{
+#ifdef POSIX
+    TestInterface ui;
+    pdCalc::PluginLoader loader;
+
+    auto pluginFile = std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE);
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Eager,
+        pdCalc::PluginLoader::Isolation::Process);
+    auto host = loader.getHost(0);
+    QVERIFY(host);
+
+    const size_t sinh = host->index("sinh");
+    const size_t arcsinh = host->index("arcsinh");
+    const size_t ln = host->index("ln");
+
+    // a run of commands in one request
+    vector<double> s{3.0, 0.5};
+    string error;
+    const vector<size_t> roundTrip{sinh, arcsinh, sinh, arcsinh};
+    QVERIFY( host->run(roundTrip, s, error) == 4 );
+    QVERIFY( error.empty() );
+    QVERIFY( s.size() == 2 );
+    QCOMPARE( s[0], 3.0 );
+    QVERIFY( std::abs(s[1] - 0.5) < 1e-10 );
+
+    // the stack below the top has changed since the last request
+    s = {7.0, 1.0};
+    const vector<size_t> one{ln};
+    QVERIFY( host->run(one, s, error) == 1 );
+    QVERIFY( s.size() == 2 );
+    QCOMPARE( s[0], 7.0 );
+    QCOMPARE( s[1], 0.0 );
+
+    // a run stops at the first failure, leaving the result of those that ran
+    s = {-1.0};
+    const vector<size_t> failing{sinh, ln, sinh};
+    QVERIFY( host->run(failing, s, error) == 1 );
+    QCOMPARE( error, string{"Imaginary result"} );
+    QVERIFY( s.size() == 1 );
+    QVERIFY( std::abs(s[0] - std::sinh(-1.0)) < 1e-10 );
+
+    // a command the helper does not have
+    s = {1.0};
+    const vector<size_t> missing{host->names().size()};
+    QVERIFY( host->run(missing, s, error) == 0 );
+    QVERIFY( !error.empty() );
+    QVERIFY( s.size() == 1 );
+    QCOMPARE( s[0], 1.0 );
+#endif
+
+    return;
+}
+
+void PluginHostTest::testRestart()
+{
+#ifdef POSIX
+    TestInterface ui;
+    pdCalc::PluginLoader loader;
+
+    auto pluginFile = std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE);
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Eager,
+        pdCalc::PluginLoader::Isolation::Process);
+    auto host = loader.getHost(0);
+    QVERIFY(host);
+    QVERIFY( host->restarts() == 0 );
+
+    const vector<size_t> sinh{host->index("sinh")};
+    vector<double> s{0.5};
+    string error;
+    QVERIFY( host->run(sinh, s, error) == 1 );
+
+    // a helper that dies fails the request it was serving and is restarted
+    const int crashed = host->processId();
+    kill(crashed, SIGKILL);
+
+    s = {0.5};
+    try
+    {
+        host->run(sinh, s, error);
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception&)
+    { }
+    QVERIFY( s.size() == 1 );
+    QCOMPARE( s[0], 0.5 );
+    QVERIFY( host->restarts() == 1 );
+    QVERIFY( host->processId() != crashed );
+
+    QVERIFY( host->run(sinh, s, error) == 1 );
+    QVERIFY( std::abs(s[0] - std::sinh(0.5)) < 1e-10 );
+
+    // reloading an isolated plugin restarts its helper
+    QVERIFY( loader.reload(0) );
+    QVERIFY( host->restarts() == 2 );
+    QVERIFY( loader.getPluginManifest()[0].commands.size() == 8 );
+#endif
+
+    return;
+}
+
+void PluginHostTest::testSession()
+{
+#ifdef POSIX
+    TestInterface ui;
+    pdCalc::PluginLoader loader;
+
+    auto pluginFile = std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE);
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Eager,
+        pdCalc::PluginLoader::Isolation::Process);
+
+    auto& factory = pdCalc::CommandFactory::Instance();
+    factory.clearAllCommands();
+    factory.registerCommand( "sinh", loader.makeCommand(0, "sinh") );
+
+    auto& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    stack.push(2.0);
+    stack.push(0.5);
+
+    // the command is saved on the redo stack, so loading must restore what it redoes
+    auto file = ( std::filesystem::temp_directory_path() / "pdCalcPluginHostTest.pds" ).string();
+    {
+        pdCalc::CommandManager manager;
+        manager.executeCommand( factory.allocateCommand("sinh") );
+        manager.undo();
+        pdCalc::Session::Save(file, manager);
+    }
+
+    stack.clear();
+    pdCalc::CommandManager manager;
+    pdCalc::Session::Load(file, manager);
+    QVERIFY( manager.getRedoSize() == 1 );
+
+    manager.redo();
+    auto contents = stack.contents();
+    QVERIFY( contents.size() == 2 );
+    QCOMPARE( contents[0], 2.0 );
+    QVERIFY( std::abs(contents[1] - std::sinh(0.5)) < 1e-10 );
+
+    manager.undo();
+    contents = stack.contents();
+    QVERIFY( contents.size() == 2 );
+    QCOMPARE( contents[1], 0.5 );
+
+    std::filesystem::remove(file);
+    factory.clearAllCommands();
+    stack.clear();
+#endif
+
+    return;
+}
@@ -22,11 +22,18 @@
 #include <iostream>
 #include <format>
 #include <string_view>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cmath>
 
 import pdCalc_pluginManagement;
 import pdCalc_plugin;
 import pdCalc_utilities;
 import pdCalc_userInterface;
+import pdCalc_command;
+import pdCalc_commandDispatcher;
+import pdCalc_stack;
 
 using std::cout;
 using std::endl;
@@ -34,6 +41,8 @@ using std::vector;
 using std::string;
 using std::string_view;
 
+namespace fs = std::filesystem;
+
 class TestInterface : public pdCalc::UserInterface
 {
 public:
@@ -69,3 +78,410 @@ void PluginLoaderTest::testNoPluginFile()
 
     return;
 }
+
+void PluginLoaderTest::testLazyLoading()
+{
+    TestInterface ui;
+
+    // the manifest is written next to the plugin file, so the plugin file is copied
+    // to a temporary directory with the path to the plugin made absolute
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+    library = fs::absolute(library).string();
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginLoaderTest.pdp" ).string();
+    std::ofstream{pluginFile} << library << "\n";
+    auto manifest = pdCalc::PluginLoader::ManifestName(pluginFile);
+    fs::remove(manifest);
+
+    // without a manifest, the plugin is loaded, and the manifest is written
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+        QVERIFY( loader.getPlugins().size() == 1 );
+        QVERIFY( fs::exists(manifest) );
+        QVERIFY( loader.getPluginManifest().size() == 1 );
+        QVERIFY( loader.getPluginManifest()[0].commands.size() == 8 );
+        QCOMPARE( loader.getPluginManifest()[0].commands[0].name, string{"sinh"} );
+    }
+
+    // with it, the plugin is only loaded once a command is cloned
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+        QVERIFY( loader.getPlugins().size() == 0 );
+        QVERIFY( loader.getPluginManifest().size() == 1 );
+        QCOMPARE( loader.getPluginManifest()[0].library, library );
+
+        QVERIFY( !loader.makeCommand(0, "notACommand") );
+
+        auto& factory = pdCalc::CommandFactory::Instance();
+        factory.clearAllCommands();
+        factory.registerCommand( "sinh", loader.makeCommand(0, "sinh") );
+        QCOMPARE( factory.helpMessage("sinh"), string{"sinh: Replace the first element, x, on the stack with sinh(x)"} );
+        QVERIFY( loader.getPlugins().size() == 0 );
+
+        auto c = factory.allocateCommand("sinh");
+        QVERIFY( c != nullptr );
+        QVERIFY( loader.getPlugins().size() == 1 );
+
+        auto& stack = pdCalc::Stack::Instance();
+        stack.clear();
+        stack.push(0.5);
+        c->execute();
+        QCOMPARE( stack.getElements(1)[0], std::sinh(0.5) );
+        stack.clear();
+
+        // clones of the stub are recognized as the registered command
+        QCOMPARE( factory.commandName(*c), string{"sinh"} );
+
+        c.reset();
+        factory.clearAllCommands();
+    }
+
+    // a changed library is loaded again
+    {
+        const auto modified = fs::last_write_time(library);
+        fs::last_write_time(library, modified - std::chrono::seconds{10});
+
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+        QVERIFY( loader.getPlugins().size() == 1 );
+
+        fs::last_write_time(library, modified);
+    }
+
+    // a library named without a directory is never cached, and does not make the
+    // manifest stale
+    std::ofstream{pluginFile} << library << "\n" << fs::path{library}.filename().string() << "\n";
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    }
+    const auto written = fs::last_write_time(manifest) - std::chrono::seconds{10};
+    fs::last_write_time(manifest, written);
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+        QVERIFY( loader.getPluginManifest().size() >= 1 );
+        QCOMPARE( loader.getPluginManifest()[0].library, library );
+        QVERIFY( fs::last_write_time(manifest) == written );
+    }
+
+    fs::remove(pluginFile);
+    fs::remove(manifest);
+
+    return;
+}
+
+void PluginLoaderTest::testPluginDirectory()
+{
+    TestInterface ui;
+
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+    library = fs::absolute(library).string();
+
+    // copies of the plugin are distinct libraries, and other files are ignored
+    auto dir = fs::temp_directory_path() / "pdCalcPluginLoaderTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    for(auto name : {"c", "a", "b"})
+        fs::copy_file( library, dir / std::format("{}{}", name, pdCalc::PluginLoader::LibraryExtension) );
+    std::ofstream{dir / "readme.txt"} << "not a plugin\n";
+
+    pdCalc::PluginLoader loader;
+    loader.loadPlugins(ui, dir.string());
+    QVERIFY( loader.getPlugins().size() == 3 );
+
+    // plugins are ordered by name, however they were loaded
+    const auto& manifest = loader.getPluginManifest();
+    QVERIFY( manifest.size() == 3 );
+    QCOMPARE( fs::path{manifest[0].library}.stem().string(), string{"a"} );
+    QCOMPARE( fs::path{manifest[1].library}.stem().string(), string{"b"} );
+    QCOMPARE( fs::path{manifest[2].library}.stem().string(), string{"c"} );
+
+    auto c = loader.makeCommand(2, "sinh");
+    QVERIFY( c != nullptr );
+    QCOMPARE( string{c->helpMessage()}, manifest[2].commands[0].help );
+    c.reset();
+
+    fs::remove_all(dir);
+
+    return;
+}
+
+void PluginLoaderTest::testReload()
+{
+    TestInterface ui;
+
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+
+    auto dir = fs::temp_directory_path() / "pdCalcPluginReloadTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto copy = ( dir / fs::path{library}.filename() ).string();
+    fs::copy_file(library, copy);
+    auto pluginFile = ( dir / "plugins.pdp" ).string();
+    std::ofstream{pluginFile} << copy << "\n";
+
+    pdCalc::PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile);
+    QVERIFY( loader.getPlugins().size() == 1 );
+
+    pdCalc::PluginWatcher watcher;
+    watcher.watch(copy);
+    QVERIFY( watcher.changed().empty() );
+
+    auto& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    pdCalc::CommandManager cm;
+    cm.executeCommand( pdCalc::MakeCommandPtr<pdCalc::EnterNumber>(0.5) );
+    cm.executeCommand( loader.makeCommand(0, "sinh") );
+
+    // a new version is moved into place
+    fs::copy_file(library, copy + ".new");
+    fs::rename(copy + ".new", copy);
+    auto changed = watcher.changed();
+    QVERIFY( changed.size() == 1 );
+    QCOMPARE( changed[0], copy );
+    QVERIFY( watcher.changed().empty() );
+
+    QVERIFY( loader.reload(0) );
+    QVERIFY( loader.getPlugins().size() == 1 );
+    QVERIFY( loader.retainedVersions() == 1 );
+    QVERIFY( loader.retainedBytes() > 0 );
+
+    // the old version is kept while the history uses it
+    auto visit = [&](const auto& f){ cm.visitHistory(f); };
+    loader.releaseRetired(visit);
+    QVERIFY( loader.retainedVersions() == 1 );
+
+    cm.rebindHistory([&](const pdCalc::Command& c){ return loader.upgrade(0, c); });
+    loader.releaseRetired(visit);
+    QVERIFY( loader.retainedVersions() == 0 );
+
+    // the upgraded command kept its state
+    cm.undo();
+    QCOMPARE( stack.getElements(1)[0], 0.5 );
+    cm.redo();
+    QCOMPARE( stack.getElements(1)[0], std::sinh(0.5) );
+    stack.clear();
+
+    fs::remove_all(dir);
+
+    return;
+}
+
+void PluginLoaderTest::testReloadMismatch()
+{
+    TestInterface ui;
+
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+
+    auto dir = fs::temp_directory_path() / "pdCalcPluginReloadMismatchTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    auto copy = ( dir / fs::path{library}.filename() ).string();
+    fs::copy_file(library, copy);
+    auto pluginFile = ( dir / "plugins.pdp" ).string();
+    std::ofstream{pluginFile} << copy << "\n";
+
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    }
+
+    // the manifest describes a later API version than the library's
+    auto manifest = pdCalc::PluginLoader::ManifestName(pluginFile);
+    vector<string> lines;
+    {
+        std::ifstream ifs{manifest};
+        for(string line; std::getline(ifs, line); ) lines.push_back(line);
+    }
+    {
+        std::ofstream ofs{manifest};
+        for(auto line : lines)
+        {
+            if( line.starts_with("plugin\t") )
+            {
+                auto tab = line.rfind('\t');
+                line = std::format( "{}{}", line.substr(0, tab + 1), std::stoi( line.substr(tab + 1) ) + 1 );
+            }
+            ofs << line << "\n";
+        }
+    }
+
+    pdCalc::PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    QVERIFY( loader.getPlugins().size() == 0 );
+    const auto open = loader.openLibraries();
+
+    // a rejected version is unloaded again
+    QVERIFY( !loader.reload(0) );
+    QVERIFY( loader.getPlugins().size() == 0 );
+    QCOMPARE( loader.openLibraries(), open );
+
+    fs::remove_all(dir);
+
+    return;
+}
+
+void PluginLoaderTest::testKernels()
+{
+    TestInterface ui;
+
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+    library = fs::absolute(library).string();
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginKernelTest.pdp" ).string();
+    std::ofstream{pluginFile} << library << "\n";
+    auto manifest = pdCalc::PluginLoader::ManifestName(pluginFile);
+    fs::remove(manifest);
+
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+        QVERIFY( loader.getPlugins().size() == 1 );
+        QVERIFY( loader.getPlugins()[0]->getKernels() != nullptr );
+    }
+
+    // the manifest records the kernels, so their commands need no library either
+    pdCalc::PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    QVERIFY( loader.getPlugins().size() == 0 );
+
+    const auto& kernels = loader.getPluginManifest()[0].kernels;
+    QVERIFY( kernels.size() == 8 );
+    QCOMPARE( kernels[0].name, string{"sinh"} );
+    QCOMPARE( kernels[0].arity, 1 );
+
+    const auto name = pdCalc::PluginLoader::KernelCommandName("sinh");
+    QCOMPARE( name, string{"map:sinh"} );
+    QVERIFY( !loader.makeCommand(0, "map:notAKernel") );
+
+    auto& factory = pdCalc::CommandFactory::Instance();
+    factory.clearAllCommands();
+    factory.registerCommand( name, loader.makeCommand(0, name) );
+    QVERIFY( loader.getPlugins().size() == 0 );
+
+    auto c = factory.allocateCommand(name);
+    QVERIFY( c != nullptr );
+    QVERIFY( loader.getPlugins().size() == 1 );
+
+    auto& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    for(double d : {0.5, -1.0, 2.0}) stack.push(d);
+    c->execute();
+    auto result = stack.contents();
+    QVERIFY( result.size() == 3 );
+    QVERIFY( std::abs(result[0] - std::sinh(0.5)) < 1e-10 );
+    QVERIFY( std::abs(result[1] - std::sinh(-1.0)) < 1e-10 );
+    QVERIFY( std::abs(result[2] - std::sinh(2.0)) < 1e-10 );
+
+    c->undo();
+    QCOMPARE( stack.contents(), (vector<double>{0.5, -1.0, 2.0}) );
+    stack.clear();
+
+    // a kernel refuses a stack with any element outside its domain, as its command
+    // refuses the top of the stack
+    const auto ln = pdCalc::PluginLoader::KernelCommandName("ln");
+    factory.registerCommand( ln, loader.makeCommand(0, ln) );
+    for(auto [d, message] : {std::pair{0.0, "Infinite result"}, std::pair{-1.0, "Imaginary result"}})
+    {
+        for(double e : {2.0, d, 3.0}) stack.push(e);
+        auto l = factory.allocateCommand(ln);
+        try
+        {
+            l->execute();
+            QVERIFY(false);
+        }
+        catch(pdCalc::Exception& e)
+        {
+            QCOMPARE( e.what(), string{message} );
+        }
+        QCOMPARE( stack.contents(), (vector<double>{2.0, d, 3.0}) );
+        stack.clear();
+    }
+
+    c.reset();
+    factory.clearAllCommands();
+
+    fs::remove(pluginFile);
+    fs::remove(manifest);
+
+    return;
+}
+
+void PluginLoaderTest::testFunctions()
+{
+    TestInterface ui;
+
+    string library;
+    std::ifstream{ std::format("{}/{}", BACKEND_TEST_DIR, PLUGIN_TEST_FILE) } >> library;
+    library = fs::absolute(library).string();
+
+    auto pluginFile = ( fs::temp_directory_path() / "pdCalcPluginFunctionTest.pdp" ).string();
+    std::ofstream{pluginFile} << library << "\n";
+    auto manifest = pdCalc::PluginLoader::ManifestName(pluginFile);
+    fs::remove(manifest);
+
+    {
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    }
+
+    // the manifest records the functions with their help messages
+    pdCalc::PluginLoader loader;
+    loader.loadPlugins(ui, pluginFile, pdCalc::PluginLoader::Activation::Lazy);
+    QVERIFY( loader.getPlugins().size() == 0 );
+
+    const auto& functions = loader.getPluginManifest()[0].functions;
+    QVERIFY( functions.size() == 8 );
+    QCOMPARE( functions[7].name, string{"ln"} );
+    QCOMPARE( functions[7].arity, 1 );
+    QCOMPARE( functions[7].help, string{"Replace the first element, x, on the stack with ln(x)"} );
+
+    // a function takes the place of the command of the same name
+    auto& factory = pdCalc::CommandFactory::Instance();
+    factory.clearAllCommands();
+    factory.registerCommand( "ln", loader.makeCommand(0, "ln") );
+
+    auto c = factory.allocateCommand("ln");
+    QVERIFY( c != nullptr );
+    QVERIFY( loader.getPlugins().size() == 1 );
+    QVERIFY( dynamic_cast<pdCalc::UnaryFunctionCommand*>( c.get() ) != nullptr );
+    QCOMPARE( factory.commandName(*c), string{"ln"} );
+
+    auto& stack = pdCalc::Stack::Instance();
+    stack.clear();
+    stack.push(-1.0);
+    try
+    {
+        c->execute();
+        QVERIFY(false);
+    }
+    catch(pdCalc::Exception& e)
+    {
+        QCOMPARE( e.what(), string{"Imaginary result"} );
+    }
+
+    stack.clear();
+    stack.push(2.0);
+    c->execute();
+    QVERIFY( std::abs(stack.getElements(1)[0] - std::log(2.0)) < 1e-10 );
+    c->undo();
+    QCOMPARE( stack.getElements(1)[0], 2.0 );
+    stack.clear();
+
+    c.reset();
+    factory.clearAllCommands();
+
+    fs::remove(pluginFile);
+    fs::remove(manifest);
+
+    return;
+}
@@ -27,6 +27,12 @@ class PluginLoaderTest : public QObject
 private slots:
     void testLoading();
     void testNoPluginFile();
+    void testLazyLoading();
+    void testPluginDirectory();
+    void testReload();
+    void testReloadMismatch();
+    void testKernels();
+    void testFunctions();
 };
 
 #endif
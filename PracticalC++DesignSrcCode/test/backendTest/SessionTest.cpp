@@ -0,0 +1,384 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "SessionTest.h"
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <filesystem>
+#include <format>
+
+import pdCalc_utilities;
+import pdCalc_stack;
+import pdCalc_command;
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+
+using namespace pdCalc;
+using std::vector;
+using std::string;
+using std::string_view;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class TestInterface : public UserInterface
+{
+public:
+    TestInterface() { }
+    void postMessage(string_view m) override { lastMessage_ = m; }
+    void stackChanged() override { }
+    const string& lastMessage() const { return lastMessage_; }
+
+private:
+    string lastMessage_;
+};
+
+// a command that is not registered, and so cannot be saved
+class TestUnregisteredCommand : public Command
+{
+private:
+    void executeImpl() noexcept override { Stack::Instance().push(0.0); }
+    void undoImpl() noexcept override { Stack::Instance().pop(); }
+    Command* cloneImpl() const noexcept override { return new TestUnregisteredCommand; }
+    const char* helpMessageImpl() const noexcept override { return "unregistered"; }
+    bool serializeImpl(vector<double>&) const override { return true; }
+};
+
+string sessionFile()
+{
+    return ( fs::temp_directory_path() / "pdCalcSessionTest.pds" ).string();
+}
+
+vector<double> stackContents()
+{
+    return Stack::Instance().contents();
+}
+
+CommandPtr command(const string& name)
+{
+    return CommandFactory::Instance().allocateCommand(name);
+}
+
+const vector<CommandManager::UndoRedoStrategy> Strategies{
+    CommandManager::UndoRedoStrategy::StackStrategy,
+    CommandManager::UndoRedoStrategy::ListStrategy,
+    CommandManager::UndoRedoStrategy::ListStrategyVector,
+    CommandManager::UndoRedoStrategy::SpillStrategy,
+    CommandManager::UndoRedoStrategy::FlatStrategy
+};
+
+}
+
+void SessionTest::testSaveLoad()
+{
+    CommandFactory::Instance().clearAllCommands();
+    TestInterface ui;
+    RegisterCoreCommands(ui);
+    auto file = sessionFile();
+
+    for(auto st : Strategies)
+    {
+        Stack::Instance().clear();
+
+        // a hot window of two puts most of a spilled history on disk
+        CommandManager cm{st, 2};
+        vector<vector<double>> states{ stackContents() };
+        auto execute = [&](CommandPtr c)
+        {
+            cm.executeCommand( std::move(c) );
+            states.push_back( stackContents() );
+        };
+
+        execute( MakeCommandPtr<EnterNumber>(3.0) );
+        execute( MakeCommandPtr<EnterNumber>(4.0) );
+        execute( command("+") );
+        execute( command("dup") );
+        execute( command("*") );
+        execute( command("sin") );
+        execute( MakeCommandPtr<EnterNumber>(0.1) );
+        execute( command("swap") );
+        execute( command("clear") );
+        execute( MakeCommandPtr<EnterNumber>(8.0) );
+        cm.undo();
+        cm.undo();
+        cm.undo();
+
+        Session::Save(file, cm);
+        Stack::Instance().clear();
+
+        CommandManager restored{st, 2};
+        Session::Load(file, restored);
+        QCOMPARE( stackContents(), states[7] );
+        QVERIFY( restored.getUndoSize() == 7 );
+        QVERIFY( restored.getRedoSize() == 3 );
+
+        for(auto i = 7u; i > 0; --i)
+        {
+            restored.undo();
+            QCOMPARE( stackContents(), states[i - 1] );
+        }
+
+        restored.jumpTo(10);
+        QCOMPARE( stackContents(), states[10] );
+        restored.jumpTo(5);
+        QCOMPARE( stackContents(), states[5] );
+    }
+
+    Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void SessionTest::testUnsavedCommands()
+{
+    CommandFactory::Instance().clearAllCommands();
+    TestInterface ui;
+    RegisterCoreCommands(ui);
+    Stack::Instance().clear();
+    auto file = sessionFile();
+
+    CommandManager cm;
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+    cm.executeCommand( MakeCommandPtr<TestUnregisteredCommand>() );
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(2.0) );
+    cm.executeCommand( command("+") );
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(3.0) );
+    cm.executeCommand( MakeCommandPtr<TestUnregisteredCommand>() );
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(4.0) );
+    cm.undo();
+    cm.undo();
+    cm.undo();
+    auto expected = stackContents();
+
+    // the undo stack starts after the unregistered command, and the redo stack ends
+    // before the next one
+    Session::Save(file, cm);
+    Stack::Instance().clear();
+
+    CommandManager restored;
+    Session::Load(file, restored);
+    QCOMPARE( stackContents(), expected );
+    QVERIFY( restored.getUndoSize() == 2 );
+    QVERIFY( restored.getRedoSize() == 1 );
+
+    restored.undo(2);
+    QCOMPARE( stackContents(), (vector<double>{1.0, 0.0}) );
+    restored.redo(5);
+    QCOMPARE( stackContents(), (vector<double>{1.0, 2.0, 3.0}) );
+
+    Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void SessionTest::testLoadErrors()
+{
+    CommandFactory::Instance().clearAllCommands();
+    TestInterface ui;
+    RegisterCoreCommands(ui);
+    Stack::Instance().clear();
+    auto file = sessionFile();
+
+    {
+        std::ofstream ofs{file};
+        ofs << "1 2 +";
+    }
+
+    CommandManager cm;
+    cm.executeCommand( MakeCommandPtr<EnterNumber>(5.0) );
+
+    try
+    {
+        Session::Load(file, cm);
+        QVERIFY(false);
+    }
+    catch(Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("{} is not a session", file) );
+    }
+
+    cm.executeCommand( command("neg") );
+    Session::Save(file, cm);
+
+    // a session cannot be loaded without its commands, and a failed load changes nothing
+    CommandFactory::Instance().deregisterCommand("neg");
+    Stack::Instance().clear();
+    Stack::Instance().push(7.0);
+
+    try
+    {
+        Session::Load(file, cm);
+        QVERIFY(false);
+    }
+    catch(Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("Session {} uses unknown command neg", file) );
+    }
+
+    QCOMPARE( stackContents(), vector<double>{7.0} );
+    QVERIFY( cm.getUndoSize() == 2 );
+
+    // a truncated session is not loaded
+    fs::resize_file(file, fs::file_size(file) - 1);
+    RegisterCoreCommands(ui);
+    try
+    {
+        Session::Load(file, cm);
+        QVERIFY(false);
+    }
+    catch(Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("{} is not a session", file) );
+    }
+
+    // nor is one whose records split the operands other than as their commands need:
+    // of 1, 2, +, the second number claims one of the addition's two operands
+    {
+        CommandManager saved;
+        Stack::Instance().clear();
+        saved.executeCommand( MakeCommandPtr<EnterNumber>(1.0) );
+        saved.executeCommand( MakeCommandPtr<EnterNumber>(2.0) );
+        saved.executeCommand( command("+") );
+        Session::Save(file, saved);
+    }
+
+    // the records follow a 48 byte header, the stack of 1, and 4 operands, and each
+    // record holds its name and then its operand count
+    constexpr std::streamoff Records = 48 + 5 * sizeof(double);
+    {
+        std::fstream fs{file, std::ios::in | std::ios::out | std::ios::binary};
+        const uint32_t two = 2;
+        const uint32_t one = 1;
+        fs.seekp(Records + 8 + 4);
+        fs.write( reinterpret_cast<const char*>(&two), sizeof(two) );
+        fs.seekp(Records + 16 + 4);
+        fs.write( reinterpret_cast<const char*>(&one), sizeof(one) );
+    }
+
+    Stack::Instance().clear();
+    Stack::Instance().push(7.0);
+    try
+    {
+        Session::Load(file, cm);
+        QVERIFY(false);
+    }
+    catch(Exception& e)
+    {
+        QCOMPARE( e.what(), std::format("{} is not a session", file) );
+    }
+    QCOMPARE( stackContents(), vector<double>{7.0} );
+
+    Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void SessionTest::testBackgroundSnapshot()
+{
+    CommandFactory::Instance().clearAllCommands();
+    TestInterface ui;
+    RegisterCoreCommands(ui);
+    Stack::Instance().clear();
+    auto file = sessionFile();
+
+    CommandManager cm;
+    for(auto i = 0; i < 1000; ++i)
+        cm.executeCommand( MakeCommandPtr<EnterNumber>( static_cast<double>(i) ) );
+    auto expected = stackContents();
+
+    {
+        Session session{file};
+        QCOMPARE( session.filename(), file );
+        QVERIFY( session.snapshot(cm) );
+
+        // changes after the snapshot started are not in it
+        cm.executeCommand( command("+") );
+        session.wait();
+    }
+
+    Stack::Instance().clear();
+
+    CommandManager restored;
+    Session::Load(file, restored);
+    QCOMPARE( stackContents(), expected );
+    QVERIFY( restored.getUndoSize() == 1000 );
+
+    Stack::Instance().clear();
+    fs::remove(file);
+
+    return;
+}
+
+void SessionTest::testInterpreterSession()
+{
+    CommandFactory::Instance().clearAllCommands();
+    TestInterface ui;
+    RegisterCoreCommands(ui);
+    Stack::Instance().clear();
+    auto file = sessionFile();
+    fs::remove(file);
+
+    vector<double> expected;
+    {
+        CommandInterpreter ci{ui};
+
+        ci.commandEntered("save-session");
+        QCOMPARE( ui.lastMessage(), string{"Command save-session needs a file: no session is set"} );
+
+        ci.setSession(file, std::chrono::seconds{0});
+        for( string c : {"2", "3", "pow", "1.5", "undo"} )
+            ci.commandEntered(c);
+
+        expected = stackContents();
+        ci.commandEntered("save-session");
+    }
+
+    Stack::Instance().clear();
+
+    CommandInterpreter ci{ui};
+    ci.setSession(file, std::chrono::seconds{0});
+    QCOMPARE( stackContents(), expected );
+
+    ci.commandEntered("redo");
+    QCOMPARE( stackContents(), (vector<double>{8.0, 1.5}) );
+
+    // an explicit file does not change the session file
+    auto other = ( fs::temp_directory_path() / "pdCalcSessionTestOther.pds" ).string();
+    ci.commandEntered( std::format("save-session:{}", other) );
+    ci.commandEntered("goto:0");
+    QVERIFY( Stack::Instance().size() == 0 );
+    ci.commandEntered( std::format("load-session:{}", other) );
+    QCOMPARE( stackContents(), (vector<double>{8.0, 1.5}) );
+    ci.commandEntered("load-session");
+    QCOMPARE( stackContents(), expected );
+
+    ci.commandEntered("save-sessions");
+    QCOMPARE( ui.lastMessage(), string{"Command save-sessions is not a known command"} );
+
+    Stack::Instance().clear();
+    fs::remove(file);
+    fs::remove(other);
+
+    return;
+}
@@ -226,3 +226,45 @@ void StackTest::testErrors()
     stack.detach(pdCalc::Stack::StackError(), "StackErrorObserver");
 }
 
+void StackTest::testBatchAndRestore()
+{
+    pdCalc::Stack& stack = pdCalc::Stack::Instance();
+    stack.clear();
+
+    auto raw = new StackChangedObserver{"StackChangedObserver"};
+    stack.attach( pdCalc::Stack::StackChanged(), unique_ptr<pdCalc::Observer>{raw} );
+
+    // nested batches raise one event at the outermost end
+    stack.beginBatch();
+    stack.push(1.0);
+    stack.push(2.0);
+    stack.beginBatch();
+    stack.push(3.0);
+    stack.endBatch();
+    QCOMPARE( raw->changeCount(), 0u );
+    stack.endBatch();
+    QCOMPARE( raw->changeCount(), 1u );
+
+    // a batch without changes raises nothing
+    {
+        pdCalc::StackChangeBatch batch;
+    }
+    QCOMPARE( raw->changeCount(), 1u );
+
+    QCOMPARE( stack.contents(), (vector<double>{1.0, 2.0, 3.0}) );
+
+    stack.restore( vector<double>{4.0, 5.0} );
+    QCOMPARE( raw->changeCount(), 2u );
+    QVERIFY( stack.size() == 2 );
+    QCOMPARE( stack.pop(true), 5.0 );
+    QCOMPARE( stack.pop(true), 4.0 );
+
+    stack.restore( vector<double>{6.0}, true );
+    QCOMPARE( raw->changeCount(), 2u );
+    QCOMPARE( stack.contents(), vector<double>{6.0} );
+
+    stack.detach(pdCalc::Stack::StackChanged(), "StackChangedObserver");
+    stack.clear();
+
+    return;
+}
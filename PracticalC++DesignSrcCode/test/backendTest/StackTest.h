@@ -28,6 +28,7 @@ private slots:
     void testPushPop();
     void testSwapTop();
     void testErrors();
+    void testBatchAndRestore();
 };
 
 #endif
@@ -20,6 +20,12 @@
 #include <vector>
 #include <format>
 #include <string_view>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <map>
 
 import pdCalc_utilities;
 import pdCalc_stack;
@@ -30,14 +36,20 @@ using std::vector;
 using std::string;
 using std::string_view;
 
+namespace fs = std::filesystem;
+
 namespace {
 
 class TestInterface : public pdCalc::UserInterface
 {
 public:
     TestInterface() { }
-    void postMessage(string_view) override {  }
+    void postMessage(string_view m) override { lastMessage_ = m; }
     void stackChanged() override { }
+    const string& getLastMessage() const { return lastMessage_; }
+
+private:
+    string lastMessage_;
 };
 
 }
@@ -103,3 +115,123 @@ void StoredProcedureTest::testStoredProcedure()
 
     return;
 }
+
+void StoredProcedureTest::testNestedTrace()
+{
+    // the tokenizer lowers the case of the inner procedure's name
+    auto dir = fs::temp_directory_path() / "pdcalcstoredproceduretest";
+    string lower = dir.string();
+    std::ranges::transform(lower, lower.begin(), [](unsigned char c){ return std::tolower(c); });
+    if(lower != dir.string()) QSKIP("the temporary directory's path is not in lower case");
+
+    fs::create_directories(dir);
+    fs::copy_file(std::format("{}/hypotenuse", BACKEND_TEST_DIR), dir / "inner", fs::copy_options::overwrite_existing);
+    std::ofstream{dir / "outer"} << "3 4 proc:" << (dir / "inner").string() << " 2 *\n";
+
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+    pdCalc::CommandInterpreter ci{ui};
+
+    pdCalc::Trace::Start();
+    ci.commandEntered( std::format("proc:{}", (dir / "outer").string()) );
+    pdCalc::Trace::Stop();
+
+    QCOMPARE( pdCalc::Stack::Instance().getElements(1)[0], 10.0 );
+
+    auto events = pdCalc::Trace::Events();
+    auto within = [](const auto& inner, const auto& outer)
+        { return inner.start >= outer.start && inner.start + inner.duration <= outer.start + outer.duration; };
+    auto find = [&](string_view name, string_view arg)
+    {
+        return std::ranges::find_if(events, [&](const auto& e){ return e.name == name && e.arg == arg; });
+    };
+
+    auto outer = find( "StoredProcedure::executeImpl", (dir / "outer").string().substr(0, 39) );
+    auto inner = find( "StoredProcedure::executeImpl", (dir / "inner").string().substr(0, 39) );
+    auto root = find( "CommandInterpreter::executeCommand", "root" );
+    auto times = find( "CommandInterpreter::executeCommand", "*" );
+    for(auto i : {outer, inner, root, times})
+        QVERIFY( i != events.end() );
+
+    QVERIFY( within(*inner, *outer) );
+    QVERIFY( within(*root, *inner) );
+    QVERIFY( within(*times, *outer) );
+    QVERIFY( !within(*times, *inner) );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove_all(dir);
+
+    return;
+}
+
+void StoredProcedureTest::testProfile()
+{
+    // the tokenizer lowers the case of the procedures' names
+    auto dir = fs::temp_directory_path() / "pdcalcprofiletest";
+    string lower = dir.string();
+    std::ranges::transform(lower, lower.begin(), [](unsigned char c){ return std::tolower(c); });
+    if(lower != dir.string()) QSKIP("the temporary directory's path is not in lower case");
+
+    const auto inner = (dir / "inner").string();
+    const auto outer = (dir / "outer").string();
+    fs::create_directories(dir);
+    fs::copy_file(std::format("{}/hypotenuse", BACKEND_TEST_DIR), inner, fs::copy_options::overwrite_existing);
+    std::ofstream{outer} << "3 4 proc:" << inner << " 2 * 1 -\n";
+
+    pdCalc::CommandFactory::Instance().clearAllCommands();
+    pdCalc::Stack::Instance().clear();
+    TestInterface ui;
+    pdCalc::RegisterCoreCommands(ui);
+    pdCalc::CommandInterpreter ci{ui};
+
+    ci.commandEntered("profile");
+    ci.commandEntered("proc:" + outer);
+    QCOMPARE( pdCalc::Stack::Instance().getElements(1)[0], 9.0 );
+
+    // each line is the time, its percentage, the calls, the depths, and the token,
+    // indented by its procedure's depth
+    struct Line { size_t calls; string depth; size_t indent; };
+    std::map<string, Line> lines;
+    std::istringstream report{ ui.getLastMessage() };
+    for(string line; std::getline(report, line); )
+    {
+        std::istringstream is{line};
+        double ms, percent;
+        Line l;
+        string token;
+        if( !(is >> ms >> percent >> l.calls >> l.depth) ) continue;
+
+        is.get();
+        is.get();
+        std::getline(is, token);
+        l.indent = token.find_first_not_of(' ');
+        lines.emplace( token.substr(l.indent), l );
+    }
+
+    QVERIFY( lines.contains("proc:" + outer) );
+    QCOMPARE( lines["proc:" + outer].indent, size_t{0} );
+    QCOMPARE( lines["proc:" + inner].indent, size_t{2} );
+    QCOMPARE( lines["pow"].indent, size_t{4} );
+    QCOMPARE( lines["pow"].calls, size_t{2} );
+    QCOMPARE( lines["pow"].depth, string{"2"} );
+    QCOMPARE( lines["-"].calls, size_t{1} );
+    QCOMPARE( lines["-"].indent, size_t{2} );
+    QCOMPARE( lines["*"].depth, string{"1"} );
+
+    // the profiled procedure is undone as any other
+    ci.commandEntered("undo");
+    QVERIFY( pdCalc::Stack::Instance().size() == 0 );
+
+    // profile only applies to a procedure
+    ci.commandEntered("profile");
+    ci.commandEntered("1");
+    QCOMPARE( ui.getLastMessage(), string{"Command profile must be followed by proc:<file>"} );
+    QVERIFY( pdCalc::Stack::Instance().size() == 1 );
+
+    pdCalc::Stack::Instance().clear();
+    fs::remove_all(dir);
+
+    return;
+}
@@ -28,6 +28,8 @@ class StoredProcedureTest : public QObject
 private slots:
     void testMissingProcedure();
     void testStoredProcedure();
+    void testNestedTrace();
+    void testProfile();
 };
 
 #endif
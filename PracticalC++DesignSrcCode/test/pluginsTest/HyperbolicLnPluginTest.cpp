@@ -17,7 +17,12 @@
 // along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
 
 #include "HyperbolicLnPluginTest.h"
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <map>
 #include <vector>
@@ -52,6 +57,48 @@ void testStack()
     QVERIFY( pdCalc::Stack::Instance().size() == 0 );
 }
 
+// the number of doubles between a and b, where NaNs are only equal to each other
+uint64_t ulps(double a, double b)
+{
+    if( std::isnan(a) || std::isnan(b) )
+        return std::isnan(a) && std::isnan(b) ? 0 : std::numeric_limits<uint64_t>::max();
+    if(a == b) return 0;
+
+    // doubles ordered as integers
+    auto ordered = [](double d)
+    {
+        int64_t i;
+        std::memcpy(&i, &d, sizeof(i));
+        return i < 0 ? std::numeric_limits<int64_t>::min() - i : i;
+    };
+
+    const int64_t ia = ordered(a);
+    const int64_t ib = ordered(b);
+
+    return ia > ib ? static_cast<uint64_t>(ia) - ib : static_cast<uint64_t>(ib) - ia;
+}
+
+// the largest error of each vectorized kernel, as documented in VectorKernels.h
+uint64_t maxUlps(const string& kernel)
+{
+    if(kernel == "sinh") return 3;
+    else if(kernel == "cosh") return 2;
+    else if(kernel == "tanh") return 4;
+    else return 1;
+}
+
+void setSimd(const char* isa)
+{
+#ifdef _WIN32
+    _putenv_s("PDCALC_SIMD", isa ? isa : "");
+#else
+    if(isa) setenv("PDCALC_SIMD", isa, 1);
+    else unsetenv("PDCALC_SIMD");
+#endif
+
+    return;
+}
+
 }
 
 pdCalc::Stack& HyperbolicLnPluginTest::getCheckedStack()
@@ -207,5 +254,137 @@ void HyperbolicLnPluginTest::testHyperbolicLnPlugin()
 
     top = 1.34;
     testCommand( commands.find("ln")->second, top, std::log(top) );
+
+    // each kernel agrees with its command, element by element, within the error of
+    // the vectorized kernels
+    auto kernels = p->getKernels();
+    QVERIFY(kernels != nullptr);
+    QCOMPARE(kernels->nKernels, 8);
+
+    const vector<double> x{0.1, 0.5, 0.9};
+    for(int i = 0; i < kernels->nKernels; ++i)
+    {
+        QCOMPARE(kernels->arities[i], 1);
+        auto command = commands.find(kernels->kernelNames[i]);
+        QVERIFY( command != commands.end() );
+
+        // arccosh is only real from 1
+        auto in = x;
+        if( string{kernels->kernelNames[i]} == "arccosh" )
+            for(auto& d : in) d += 1.0;
+
+        vector<double> out(in.size());
+        const double* args[] = {in.data()};
+        kernels->kernels[i](args, out.data(), in.size());
+
+        for(size_t j = 0; j < in.size(); ++j)
+        {
+            pdCalc::Stack& stack = getCheckedStack();
+            stack.push(in[j]);
+            command->second->execute();
+            QVERIFY( ulps(out[j], stack.getElements(1)[0]) <= maxUlps(kernels->kernelNames[i]) );
+        }
+    }
+    getCheckedStack();
+
+    // each function has the name, help message, and result of a command, and rejects
+    // what the command rejects
+    auto functions = p->getFunctions();
+    QVERIFY(functions != nullptr);
+    QCOMPARE(functions->nUnary, 8);
+    QCOMPARE(functions->nBinary, 0);
+
+    for(int i = 0; i < functions->nUnary; ++i)
+    {
+        auto command = commands.find(functions->unaryNames[i]);
+        QVERIFY( command != commands.end() );
+        QCOMPARE( string{functions->unaryHelp[i]}, string{command->second->helpMessage()} );
+
+        for(double x : {-2.0, 0.0, 0.5, 2.0})
+        {
+            pdCalc::Stack& stack = getCheckedStack();
+            stack.push(x);
+
+            auto precondition = functions->unaryPreconditions[i];
+            const bool accepted = !precondition || !precondition(x);
+            try
+            {
+                command->second->execute();
+                QVERIFY(accepted);
+                QCOMPARE( functions->unaryFunctions[i](x), stack.getElements(1)[0] );
+            }
+            catch(pdCalc::Exception&)
+            {
+                QVERIFY(!accepted);
+            }
+
+            pdCalc::Stack::Instance().clear();
+        }
+    }
+
+    return;
+}
+
+void HyperbolicLnPluginTest::testVectorKernels()
+{
+    // magnitudes from 1e-12 to past where exp overflows, of either sign, a finer grid
+    // around the inverse functions' domains, and the edges of every range
+    vector<double> x;
+    const int n = 20000;
+    for(int i = 0; i <= n; ++i)
+    {
+        const double magnitude = std::pow(10.0, -12.0 + 15.2 * i / n);
+        x.push_back(magnitude);
+        x.push_back(-magnitude);
+        x.push_back(-1.5 + 3.0 * i / n);
+    }
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    for(double d : {0.0, -0.0, 1.0, -1.0, infinity, -infinity, std::numeric_limits<double>::quiet_NaN(),
+        std::numeric_limits<double>::denorm_min(), 1e-310, -1e-310, 22.0, 709.78, 709.79, 710.4, 710.5,
+        -708.4, -745.1, -745.2, 1e154, 1.4e154, 1e308, -1e308})
+        x.push_back(d);
+
+    TestInterface ui;
+    string pluginFile{PLUGIN_TEST_DIR};
+    pluginFile += "/../backendTest/";
+    pluginFile += PLUGIN_TEST_FILE;
+
+    // each instruction set's kernels, as far as the CPU supports them; the scalar
+    // kernels are the functions themselves
+    for(const char* isa : {"none", "baseline", "avx2", "avx512"})
+    {
+        setSimd(isa);
+
+        pdCalc::PluginLoader loader;
+        loader.loadPlugins(ui, pluginFile);
+        QVERIFY( loader.getPlugins().size() == 1 );
+
+        const Plugin* p = loader.getPlugins()[0];
+        auto kernels = p->getKernels();
+        auto functions = p->getFunctions();
+        QVERIFY(kernels != nullptr);
+        QVERIFY(functions != nullptr);
+
+        for(int i = 0; i < kernels->nKernels; ++i)
+        {
+            const string name{kernels->kernelNames[i]};
+            const string function{functions->unaryNames[i]};
+            QCOMPARE(name, function);
+
+            vector<double> out(x.size());
+            const double* args[] = {x.data()};
+            kernels->kernels[i](args, out.data(), x.size());
+
+            uint64_t worst = 0;
+            for(size_t j = 0; j < x.size(); ++j)
+                worst = std::max( worst, ulps(out[j], functions->unaryFunctions[i](x[j])) );
+
+            QVERIFY( worst <= (string{isa} == "none" ? 0 : maxUlps(name)) );
+        }
+    }
+
+    setSimd(nullptr);
+
     return;
 }
@@ -31,6 +31,7 @@ class HyperbolicLnPluginTest : public QObject
     Q_OBJECT
 private slots:
     void testHyperbolicLnPlugin();
+    void testVectorKernels();
 
 private:
     pdCalc::Stack& getCheckedStack();
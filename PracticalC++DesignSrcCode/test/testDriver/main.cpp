@@ -19,14 +19,22 @@
 #include <QtTest/QtTest>
 #include "../utilitiesTest/PublisherObserverTest.h"
 #include "../utilitiesTest/TokenizerTest.h"
+#include "../utilitiesTest/StatsTest.h"
+#include "../utilitiesTest/TraceTest.h"
+#include "../utilitiesTest/PerfCountersTest.h"
 #include "../pluginsTest/HyperbolicLnPluginTest.h"
 #include "../uiTest/DisplayTest.h"
 #include "../uiTest/CliTest.h"
+#include "../uiTest/PerformanceTest.h"
+#include "../backendTest/CaptureTest.h"
 #include "../backendTest/CommandInterpreterTest.h"
 #include "../backendTest/CommandManagerTest.h"
 #include "../backendTest/CommandFactoryTest.h"
 #include "../backendTest/CoreCommandsTest.h"
+#include "../backendTest/JournalTest.h"
+#include "../backendTest/PluginHostTest.h"
 #include "../backendTest/PluginLoaderTest.h"
+#include "../backendTest/SessionTest.h"
 #include "../backendTest/StackTest.h"
 #include "../backendTest/StoredProcedureTest.h"
 
@@ -47,6 +55,11 @@ int main(int argc, char* argv[])
     for(int i = 0; i < argc; ++i)
         args.append( QString{argv[i]} );
 
+    // the performance tests only run when asked for, since their timings need a
+    // quiet machine; --perf-update records their baseline instead of checking it
+    const bool perfUpdate = args.removeAll("--perf-update") > 0;
+    const bool perf = args.removeAll("--perf") > 0 || perfUpdate;
+
     std::unordered_map<std::string, int> passFail;
 
     PublisherObserverTest pot;
@@ -55,6 +68,15 @@ int main(int argc, char* argv[])
     TokenizerTest tt;
     passFail["TokenizerTest"] = QTest::qExec(&tt, args);
 
+    StatsTest stt;
+    passFail["StatsTest"] = QTest::qExec(&stt, args);
+
+    TraceTest trt;
+    passFail["TraceTest"] = QTest::qExec(&trt, args);
+
+    PerfCountersTest pct;
+    passFail["PerfCountersTest"] = QTest::qExec(&pct, args);
+
     HyperbolicLnPluginTest hpt;
     passFail["HyperbolicPluginTest"] = QTest::qExec(&hpt, args);
 
@@ -64,6 +86,9 @@ int main(int argc, char* argv[])
     CliTest ct;
     passFail["CliTest"] = QTest::qExec(&ct, args);
 
+    CaptureTest cat;
+    passFail["CaptureTest"] = QTest::qExec(&cat, args);
+
     CommandInterpreterTest cet;
     passFail["CommandInterpreterTest"] = QTest::qExec(&cet, args);
 
@@ -76,15 +101,30 @@ int main(int argc, char* argv[])
     CoreCommandsTest cct;
     passFail["CoreCommandsTest"] = QTest::qExec(&cct, args);
 
+    JournalTest jt;
+    passFail["JournalTest"] = QTest::qExec(&jt, args);
+
+    PluginHostTest pht;
+    passFail["PluginHostTest"] = QTest::qExec(&pht, args);
+
     PluginLoaderTest plt;
     passFail["PluginLoaderTest"] = QTest::qExec(&plt, args);
 
+    SessionTest sst;
+    passFail["SessionTest"] = QTest::qExec(&sst, args);
+
     StackTest st;
     passFail["StackTest"] = QTest::qExec(&st, args);
 
     StoredProcedureTest spt;
     passFail["StoredProcedureTest"] = QTest::qExec(&spt, args);
 
+    if(perf)
+    {
+        PerformanceTest pft{perfUpdate};
+        passFail["PerformanceTest"] = QTest::qExec(&pft, args);
+    }
+
     cout << endl;
     int errors = 0;
     for(const auto& [key, val] : passFail)
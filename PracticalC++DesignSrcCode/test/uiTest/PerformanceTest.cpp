@@ -0,0 +1,362 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "PerformanceTest.h"
+#include "src/ui/GuiModel.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+import pdCalc_utilities;
+import pdCalc_stack;
+import pdCalc_commandDispatcher;
+import pdCalc_userInterface;
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::string_view;
+using std::vector;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int Runs = 7;
+
+// the tolerance of workloads without one in the baseline
+constexpr double DefaultTolerance = 2.0;
+
+class PerfInterface : public pdCalc::UserInterface
+{
+public:
+    explicit PerfInterface(std::function<void()> onStackChanged = {}) : onStackChanged_{std::move(onStackChanged)} { }
+    void postMessage(string_view) override { }
+    void stackChanged() override { if(onStackChanged_) onStackChanged_(); }
+
+private:
+    std::function<void()> onStackChanged_;
+};
+
+// the best of Runs runs of f, in seconds
+double best(const std::function<void()>& f)
+{
+    double t = std::numeric_limits<double>::max();
+    for(int run = 0; run < Runs; ++run)
+    {
+        auto start = Clock::now();
+        f();
+        t = std::min( t, std::chrono::duration<double>(Clock::now() - start).count() );
+    }
+
+    return t;
+}
+
+volatile double sink;
+
+// The build options that change the workloads' times relative to the reference loop,
+// which is mostly library code: optimization above all, and then the number type and
+// the instrumentation compiled into every command. A baseline only holds for the
+// build it was recorded with.
+string buildConfiguration()
+{
+#if defined(__OPTIMIZE__) || defined(RELEASE)
+    constexpr bool optimized = true;
+#else
+    constexpr bool optimized = false;
+#endif
+
+#ifdef PDCALC_STATS
+    constexpr bool stats = true;
+#else
+    constexpr bool stats = false;
+#endif
+
+#ifdef PDCALC_ALLOC_STATS
+    constexpr bool allocStats = true;
+#else
+    constexpr bool allocStats = false;
+#endif
+
+#ifdef PDCALC_PERF_COUNTERS
+    constexpr bool perfCounters = true;
+#else
+    constexpr bool perfCounters = false;
+#endif
+
+    return std::format("optimized={} number={} stats={} allocStats={} perfCounters={}", optimized,
+        pdCalc::Numeric::Name, stats, allocStats, perfCounters);
+}
+
+// A fixed mix of what pdCalc spends its time on (formatting and parsing numbers,
+// arithmetic, and small allocations), with which the workloads' times are
+// normalized. Running about as much of each as the workloads do, it slows down
+// with them on a slower machine, but not when pdCalc itself regresses.
+void referenceLoop()
+{
+    double sum = 0;
+    for(int i = 0; i < 20000; ++i)
+    {
+        auto s = std::format("{:.12g}", i * 1.25 + sum);
+        auto d = std::make_unique<double>( std::stod(s) );
+        sum = std::sqrt(*d + sum);
+    }
+
+    sink = sum;
+
+    return;
+}
+
+// registers the core commands, and attaches a command interpreter to ui as pdCalc does
+class Calculator
+{
+public:
+    explicit Calculator(pdCalc::UserInterface& ui)
+    : ui_{ui}
+    , ci_{ui}
+    {
+        pdCalc::CommandFactory::Instance().clearAllCommands();
+        pdCalc::RegisterCoreCommands(ui);
+        ui.attach( pdCalc::UserInterface::CommandEntered(), std::make_unique<pdCalc::CommandIssuedObserver>(ci_) );
+        pdCalc::Stack::Instance().attach( pdCalc::Stack::StackChanged(), std::make_unique<pdCalc::StackUpdatedObserver>(ui) );
+    }
+
+    ~Calculator()
+    {
+        pdCalc::Stack::Instance().detach(pdCalc::Stack::StackChanged(), "StackUpdated");
+        ui_.detach(pdCalc::UserInterface::CommandEntered(), "CommandIssued");
+        pdCalc::CommandFactory::Instance().clearAllCommands();
+        pdCalc::Stack::Instance().clear();
+    }
+
+    pdCalc::CommandInterpreter& interpreter() { return ci_; }
+
+private:
+    pdCalc::UserInterface& ui_;
+    pdCalc::CommandInterpreter ci_;
+};
+
+}
+
+PerformanceTest::PerformanceTest(bool updateBaseline)
+: updateBaseline_{updateBaseline}
+, reference_{0}
+{ }
+
+void PerformanceTest::initTestCase()
+{
+    reference_ = best(referenceLoop);
+
+    // each line is a workload, its time in reference units, and its tolerance, the
+    // factor by which it may be slower, or the build the baseline was recorded with;
+    // # starts a comment
+    std::ifstream ifs{PERF_BASELINE};
+    for(string line; std::getline(ifs, line); )
+    {
+        if( line.starts_with("build ") )
+        {
+            build_ = line.substr(6);
+            continue;
+        }
+
+        std::istringstream iss{ line.substr( 0, line.find('#') ) };
+        string name;
+        Baseline b{0, DefaultTolerance};
+        if(iss >> name >> b.units)
+        {
+            iss >> b.tolerance;
+            baseline_[name] = b;
+        }
+    }
+
+    cout << std::format("reference loop: {:.3f} ms", reference_ * 1e3) << endl;
+
+    if( !updateBaseline_ && build_ != buildConfiguration() )
+    {
+        cout << std::format("baseline build: {}\nthis build: {}", build_.empty() ? "unknown" : build_,
+            buildConfiguration()) << endl;
+        QSKIP("The baseline was recorded with a different build; record one with --perf-update");
+    }
+
+    return;
+}
+
+void PerformanceTest::cleanupTestCase()
+{
+    if(!updateBaseline_) return;
+
+    std::ofstream ofs{PERF_BASELINE};
+    ofs << "# workload, time in reference loops, and the factor by which it may be slower\n"
+        << "# recorded with testPdCalc --perf-update\n"
+        << "build " << buildConfiguration() << '\n';
+    for(const auto& [name, units] : measured_)
+    {
+        auto i = baseline_.find(name);
+        ofs << std::format("{} {:.3f} {}\n", name, units, i == baseline_.end() ? DefaultTolerance : i->second.tolerance);
+    }
+
+    QVERIFY( static_cast<bool>(ofs) );
+
+    return;
+}
+
+void PerformanceTest::init()
+{
+    pdCalc::Stack::Instance().clear();
+
+    return;
+}
+
+void PerformanceTest::cleanup()
+{
+    pdCalc::Stack::Instance().clear();
+
+    return;
+}
+
+void PerformanceTest::check(const string& name, const std::function<void()>& f)
+{
+    // the reference loop is timed again next to each workload, so that both are
+    // timed under the same load
+    const double seconds = best(f);
+    reference_ = std::min( reference_, best(referenceLoop) );
+    const double units = seconds / reference_;
+    measured_[name] = units;
+
+    auto i = baseline_.find(name);
+    if( updateBaseline_ || i == baseline_.end() )
+    {
+        cout << std::format("{}: {:.3f} reference loops", name, units) << endl;
+        if(!updateBaseline_)
+            QSKIP("No baseline for this workload; record one with --perf-update");
+        return;
+    }
+
+    const auto [baseline, tolerance] = i->second;
+    cout << std::format("{}: {:.3f} reference loops (baseline {:.3f}, {:+.0f}%)", name, units, baseline,
+        (units / baseline - 1) * 100) << endl;
+
+    // a workload much faster than its baseline is not a failure, but the baseline
+    // should be recorded again to catch its regression
+    if(units < baseline / tolerance)
+        cout << std::format("{} is more than {}x faster than its baseline", name, tolerance) << endl;
+
+    QVERIFY2( units <= baseline * tolerance,
+        std::format("{} is more than {}x slower than its baseline", name, tolerance).c_str() );
+
+    return;
+}
+
+void PerformanceTest::testBatchScript()
+{
+    std::ostringstream out;
+    check("batchScript", [&]
+    {
+        std::ifstream in{ std::format("{}/workload.arith", BACKEND_TEST_DIR) };
+        out.str({});
+
+        pdCalc::Cli cli{in, out};
+        Calculator calculator{cli};
+        cli.execute(true, true);
+    });
+
+    QVERIFY( out.str().size() > 0 );
+
+    return;
+}
+
+void PerformanceTest::testStoredProcedure()
+{
+    PerfInterface ui;
+    Calculator calculator{ui};
+    const auto hypotenuse = std::format("{}/hypotenuse", BACKEND_TEST_DIR);
+
+    auto& stack = pdCalc::Stack::Instance();
+    check("storedProcedure", [&]
+    {
+        for(int i = 0; i < 2000; ++i)
+        {
+            stack.push(3.0);
+            stack.push(4.0);
+            pdCalc::StoredProcedure sp{ui, hypotenuse};
+            sp.execute();
+            stack.pop();
+        }
+    });
+
+    QCOMPARE( stack.size(), size_t{0} );
+
+    return;
+}
+
+void PerformanceTest::testDeepUndo()
+{
+    PerfInterface ui;
+    Calculator calculator{ui};
+    auto& ci = calculator.interpreter();
+
+    constexpr int Depth = 5000;
+    check("deepUndo", [&]
+    {
+        ci.commandEntered("1");
+        for(int i = 1; i < Depth; ++i)
+        {
+            ci.commandEntered( std::format("{}", i) );
+            ci.commandEntered("+");
+        }
+
+        for(int i = 0; i < 2 * Depth - 1; ++i) ci.commandEntered("undo");
+        for(int i = 0; i < 2 * Depth - 1; ++i) ci.commandEntered("redo");
+        ci.commandEntered("clear");
+    });
+
+    return;
+}
+
+void PerformanceTest::testGuiModel()
+{
+    // as the main window does, the model is given the top of the stack whenever it
+    // changes, and enters what is typed into it
+    pdCalc::GuiModel model;
+    PerfInterface ui{ [&]{ model.stackChanged( pdCalc::Stack::Instance().getElements(6) ); } };
+    Calculator calculator{ui};
+    QObject::connect(&model, &pdCalc::GuiModel::commandEntered, [&](string s){ calculator.interpreter().commandEntered(s); });
+
+    check("guiModel", [&]
+    {
+        for(int i = 0; i < 2000; ++i)
+        {
+            for(char c : std::format("{}.25", i)) model.onCharacterEntered(c);
+            model.onEnter();
+            if(i % 2 == 1) model.onCommandEntered("+", "-");
+        }
+        calculator.interpreter().commandEntered("clear");
+    });
+
+    QVERIFY( model.inputEmpty() );
+
+    return;
+}
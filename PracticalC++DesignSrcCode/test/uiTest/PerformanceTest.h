@@ -0,0 +1,69 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PERFORMANCE_TEST_H
+#define PERFORMANCE_TEST_H
+
+#include <QtTest/QtTest>
+#include <functional>
+#include <map>
+#include <string>
+
+// Opt-in performance tests, run by the test driver with --perf. Each workload is
+// timed (the best of several runs) in units of a reference loop timed alongside it,
+// so that a baseline recorded on one machine can be checked on another, and fails if
+// it is slower than its baseline by more than the baseline's tolerance. With
+// --perf-update, the baseline is rewritten with the timings measured instead. The
+// baseline records the build configuration it was measured with, and the workloads
+// are skipped in any other, since the reference loop does not cancel out, e.g.,
+// optimization.
+class PerformanceTest : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PerformanceTest(bool updateBaseline = false);
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void testBatchScript();
+    void testStoredProcedure();
+    void testDeepUndo();
+    void testGuiModel();
+
+private:
+    struct Baseline
+    {
+        double units;
+        double tolerance;
+    };
+
+    // times f, and checks the time against the baseline for name
+    void check(const std::string& name, const std::function<void()>& f);
+
+    bool updateBaseline_;
+    double reference_;
+    std::string build_;
+    std::map<std::string, Baseline> baseline_;
+    std::map<std::string, double> measured_;
+};
+
+#endif
@@ -0,0 +1,103 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "PerfCountersTest.h"
+#include <cstdint>
+#include <string>
+
+import pdCalc_utilities;
+
+using std::string;
+using pdCalc::PerfCounters;
+
+void PerfCountersTest::testAggregation()
+{
+    auto& p = PerfCounters::Instance();
+    p.clear();
+
+    QVERIFY( !p.totals(PerfCounters::Aggregate::Command, "+") );
+
+    p.add(PerfCounters::Aggregate::Command, "+", {100, 200, 1, 2});
+    p.add(PerfCounters::Aggregate::Command, "+", {300, 400, 3, 4});
+    p.add(PerfCounters::Aggregate::Kind, "core", {1, 2, 3, 4});
+
+    auto t = p.totals(PerfCounters::Aggregate::Command, "+");
+    QVERIFY(t);
+    QCOMPARE( t->samples, uint64_t{2} );
+    QCOMPARE( t->counts[static_cast<int>(PerfCounters::Event::Cycles)], uint64_t{400} );
+    QCOMPARE( t->counts[static_cast<int>(PerfCounters::Event::Instructions)], uint64_t{600} );
+    QCOMPARE( t->counts[static_cast<int>(PerfCounters::Event::BranchMisses)], uint64_t{6} );
+
+    // aggregates are kept apart
+    QVERIFY( !p.totals(PerfCounters::Aggregate::Kind, "+") );
+    QCOMPARE( p.totals(PerfCounters::Aggregate::Kind, "core")->samples, uint64_t{1} );
+
+    p.clear();
+    QVERIFY( !p.totals(PerfCounters::Aggregate::Command, "+") );
+
+    return;
+}
+
+void PerfCountersTest::testCounters()
+{
+    auto& p = PerfCounters::Instance();
+    p.clear();
+
+    // without counters, as in most containers, only the reason is reported
+    if( !p.open() )
+    {
+        QVERIFY( !p.unavailable().empty() );
+        QVERIFY( p.report().find("unavailable") != string::npos );
+        QSKIP("hardware counters are unavailable");
+    }
+
+    QVERIFY( p.counted(PerfCounters::Event::Instructions) || p.counted(PerfCounters::Event::Cycles) );
+
+    volatile double x = 1;
+    {
+        PerfCounters::Context context{"loop", "core"};
+        PerfCounters::Procedure procedure{"procedure"};
+        PerfCounters::Sample sample;
+        for(int i = 0; i < 100000; ++i) x = x * 1.0000001;
+    }
+
+    // a Sample counts nothing outside a Context
+    {
+        PerfCounters::Sample sample;
+        for(int i = 0; i < 100000; ++i) x = x * 1.0000001;
+    }
+
+    if(PerfCounters::Enabled)
+    {
+        auto t = p.totals(PerfCounters::Aggregate::Command, "loop");
+        QVERIFY(t);
+        QCOMPARE( t->samples, uint64_t{1} );
+        if( p.counted(PerfCounters::Event::Instructions) )
+            QVERIFY( t->counts[static_cast<int>(PerfCounters::Event::Instructions)] >= 100000 );
+
+        QCOMPARE( p.totals(PerfCounters::Aggregate::Kind, "core")->samples, uint64_t{1} );
+        QCOMPARE( p.totals(PerfCounters::Aggregate::Procedure, "procedure")->samples, uint64_t{1} );
+        QVERIFY( p.report().find("IPC") != string::npos );
+    }
+    else
+        QVERIFY( !p.totals(PerfCounters::Aggregate::Command, "loop") );
+
+    p.clear();
+
+    return;
+}
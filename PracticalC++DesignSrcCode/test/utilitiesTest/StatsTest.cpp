@@ -0,0 +1,129 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "StatsTest.h"
+#include <cstdint>
+#include <string>
+
+import pdCalc_utilities;
+
+using std::string;
+using pdCalc::LatencyHistogram;
+using pdCalc::Stats;
+
+void StatsTest::testBuckets()
+{
+    constexpr uint64_t SubBuckets = uint64_t{1} << LatencyHistogram::SubBucketBits;
+
+    // small latencies have buckets of their own
+    for(uint64_t ns = 0; ns < 2 * SubBuckets; ++ns)
+    {
+        QCOMPARE( LatencyHistogram::Bucket(ns), ns );
+        QCOMPARE( LatencyHistogram::Lowest(ns), ns );
+        QCOMPARE( LatencyHistogram::Highest(ns), ns );
+    }
+
+    // every latency falls between the bounds of its bucket, which is no wider than
+    // 1 / SubBuckets of the latency, and buckets are consecutive
+    for(uint64_t ns : {uint64_t{32}, uint64_t{33}, uint64_t{1000}, uint64_t{123456789}, uint64_t{1} << 40,
+        (uint64_t{1} << 40) - 1, UINT64_MAX})
+    {
+        auto i = LatencyHistogram::Bucket(ns);
+        QVERIFY( LatencyHistogram::Lowest(i) <= ns );
+        QVERIFY( ns <= LatencyHistogram::Highest(i) );
+        QVERIFY( (LatencyHistogram::Highest(i) - LatencyHistogram::Lowest(i)) <= ns / SubBuckets );
+        QCOMPARE( LatencyHistogram::Bucket( LatencyHistogram::Highest(i) + 1 ), ns == UINT64_MAX ? 0 : i + 1 );
+    }
+
+    return;
+}
+
+void StatsTest::testPercentiles()
+{
+    LatencyHistogram h;
+
+    QCOMPARE( h.count(), uint64_t{0} );
+    QCOMPARE( h.percentile(0.5), uint64_t{0} );
+
+    for(uint64_t ns = 1; ns <= 10000; ++ns)
+        h.record(ns);
+
+    QCOMPARE( h.count(), uint64_t{10000} );
+    QCOMPARE( h.min(), uint64_t{1} );
+    QCOMPARE( h.max(), uint64_t{10000} );
+    QCOMPARE( h.mean(), 5000.5 );
+
+    // percentiles are within a bucket of the exact ones
+    for(double p : {0.01, 0.5, 0.9, 0.99})
+    {
+        const auto exact = static_cast<uint64_t>(p * 10000);
+        const auto reported = h.percentile(p);
+        QVERIFY( reported >= exact );
+        QVERIFY( reported - exact <= exact / (1 << LatencyHistogram::SubBucketBits) );
+    }
+
+    QCOMPARE( h.percentile(1.0), uint64_t{10000} );
+    QCOMPARE( h.percentile(0.0), uint64_t{1} );
+
+    return;
+}
+
+void StatsTest::testStats()
+{
+    auto& stats = Stats::Instance();
+    stats.clear();
+
+    stats.count(Stats::Counter::Tokens);
+    stats.count(Stats::Counter::Tokens);
+    stats.count(Stats::Counter::ParseFailures);
+    stats.undoDepth(3);
+    stats.undoDepth(1);
+    stats.latency(Stats::Operation::Execute, "+").record(100);
+    stats.latency(Stats::Operation::Execute, "+").record(300);
+    stats.latency(Stats::Operation::Undo, "a \"quoted\" name").record(5);
+
+    {
+        Stats::Timer unnamed{Stats::Operation::Redo};
+        Stats::Timer named{Stats::Operation::Redo, "swap"};
+    }
+
+    QCOMPARE( stats.counter(Stats::Counter::Tokens), uint64_t{2} );
+    QCOMPARE( stats.counter(Stats::Counter::ParseFailures), uint64_t{1} );
+    QCOMPARE( stats.counter(Stats::Counter::PreconditionFailures), uint64_t{0} );
+    QCOMPARE( stats.undoDepth(), size_t{1} );
+    QCOMPARE( stats.maxUndoDepth(), size_t{3} );
+    QCOMPARE( stats.latency(Stats::Operation::Execute, "+").count(), uint64_t{2} );
+    QCOMPARE( stats.latency(Stats::Operation::Redo, "swap").count(), uint64_t{1} );
+
+    const string json = stats.json();
+    QVERIFY( json.find("\"tokens\": 2") != string::npos );
+    QVERIFY( json.find("\"max_undo_depth\": 3") != string::npos );
+    QVERIFY( json.find("{\"operation\": \"execute\", \"command\": \"+\", \"count\": 2, \"min_ns\": 100, \"mean_ns\": 200.0")
+        != string::npos );
+    QVERIFY( json.find("\"command\": \"a \\\"quoted\\\" name\"") != string::npos );
+
+    const string report = stats.report();
+    QVERIFY( report.find("parse_failures: 1") != string::npos );
+    QVERIFY( report.find("swap") != string::npos );
+
+    stats.clear();
+    QCOMPARE( stats.counter(Stats::Counter::Tokens), uint64_t{0} );
+    QVERIFY( stats.json().find("\"operation\"") == string::npos );
+
+    return;
+}
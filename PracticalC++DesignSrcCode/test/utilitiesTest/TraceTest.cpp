@@ -0,0 +1,126 @@
+// Copyright 2016 Adam B. Singer
+// Contact: PracticalDesignBook@gmail.com
+//
+// This file is part of pdCalc.
+//
+// pdCalc is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// pdCalc is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with pdCalc; if not, see <http://www.gnu.org/licenses/>.
+
+#include "TraceTest.h"
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+import pdCalc_utilities;
+
+using std::string;
+using std::string_view;
+using pdCalc::Trace;
+
+void TraceTest::testSpans()
+{
+    {
+        Trace::Span untraced{"untraced"};
+    }
+
+    Trace::Start();
+    QVERIFY( Trace::Enabled() );
+    {
+        Trace::Span outer{"outer", "an argument longer than an event can hold"};
+        Trace::Span inner{"inner"};
+    }
+    Trace::Stop();
+
+    {
+        Trace::Span untraced{"untraced"};
+    }
+
+    QVERIFY( !Trace::Enabled() );
+
+    // events are kept in the order they ended
+    auto events = Trace::Events();
+    QCOMPARE( events.size(), size_t{2} );
+    QCOMPARE( string_view{events[0].name}, string_view{"inner"} );
+    QCOMPARE( string_view{events[0].arg}, string_view{} );
+    QCOMPARE( string_view{events[1].name}, string_view{"outer"} );
+    QCOMPARE( string_view{events[1].arg}, string_view{"an argument longer than an event can ho"} );
+    QCOMPARE( events[0].thread, events[1].thread );
+
+    QVERIFY( events[0].start >= events[1].start );
+    QVERIFY( events[0].start + events[0].duration <= events[1].start + events[1].duration );
+    QCOMPARE( Trace::Dropped(), uint64_t{0} );
+
+    // starting again discards the events
+    Trace::Start();
+    Trace::Stop();
+    QVERIFY( Trace::Events().empty() );
+
+    return;
+}
+
+void TraceTest::testRing()
+{
+    Trace::Start(4);
+    for(const char* name : {"1", "2", "3", "4", "5", "6"})
+        Trace::Span span{name};
+    Trace::Stop();
+
+    // the oldest events are overwritten
+    auto events = Trace::Events();
+    QCOMPARE( events.size(), size_t{4} );
+    QCOMPARE( string_view{events.front().name}, string_view{"3"} );
+    QCOMPARE( string_view{events.back().name}, string_view{"6"} );
+    QCOMPARE( Trace::Dropped(), uint64_t{2} );
+
+    return;
+}
+
+void TraceTest::testThreads()
+{
+    Trace::Start();
+    {
+        Trace::Span span{"main"};
+        std::thread t{[]{ Trace::Span span{"worker"}; }};
+        t.join();
+    }
+    Trace::Stop();
+
+    // each thread has its own ring, which outlives it
+    auto events = Trace::Events();
+    QCOMPARE( events.size(), size_t{2} );
+    QVERIFY( events[0].thread != events[1].thread );
+
+    return;
+}
+
+void TraceTest::testWrite()
+{
+    Trace::Start();
+    {
+        Trace::Span span{"span", "a \"quoted\" argument"};
+    }
+    Trace::Stop();
+
+    std::ostringstream oss;
+    Trace::Write(oss);
+    const string json = oss.str();
+
+    QVERIFY( json.starts_with("{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped\": 0},") );
+    QVERIFY( json.find("\"traceEvents\": [") != string::npos );
+    QVERIFY( json.find("{\"name\": \"span\", \"ph\": \"X\", \"pid\": 1, \"tid\": ") != string::npos );
+    QVERIFY( json.find("\"args\": {\"arg\": \"a \\\"quoted\\\" argument\"}}") != string::npos );
+    QVERIFY( json.ends_with("\n]}\n") );
+
+    return;
+}